@@ -144,6 +144,21 @@ standard names. */
 
 /* USER CODE BEGIN Defines */
 /* Section where parameter definitions can be added (for instance, to override default ones in FreeRTOS.h) */
+/* Run time stats for the CPU load reports, see lib/cpu_load. The run time
+   counter is the free running 1Mhz TIM2. */
+#define configUSE_TRACE_FACILITY                 1
+#define configGENERATE_RUN_TIME_STATS            1
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+  void cpu_load_configure_timers(void);
+  uint32_t cpu_load_run_time_counter(void);
+#endif
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() cpu_load_configure_timers()
+#define portGET_RUN_TIME_COUNTER_VALUE() cpu_load_run_time_counter()
+/* Task switches for the event trace, see lib/event_trace. */
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+  void event_trace_task_switched_in(uint32_t task_number);
+#endif
+#define traceTASK_SWITCHED_IN() event_trace_task_switched_in(pxCurrentTCB->uxTCBNumber)
 /* USER CODE END Defines */
 
 #endif /* FREERTOS_CONFIG_H */
@@ -24,6 +24,7 @@
 #include "task.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "cpu_load_isr.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -201,11 +202,11 @@ void SysTick_Handler(void)
 void DMA1_Stream0_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream0_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END DMA1_Stream0_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_spi1_tx);
   /* USER CODE BEGIN DMA1_Stream0_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_SPI1, isr_start_cycles);
   /* USER CODE END DMA1_Stream0_IRQn 1 */
 }
 
@@ -215,11 +216,11 @@ void DMA1_Stream0_IRQHandler(void)
 void DMA1_Stream1_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream1_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END DMA1_Stream1_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_spi1_rx);
   /* USER CODE BEGIN DMA1_Stream1_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_SPI1, isr_start_cycles);
   /* USER CODE END DMA1_Stream1_IRQn 1 */
 }
 
@@ -229,11 +230,11 @@ void DMA1_Stream1_IRQHandler(void)
 void DMA1_Stream2_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream2_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END DMA1_Stream2_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_usart1_rx);
   /* USER CODE BEGIN DMA1_Stream2_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_UART, isr_start_cycles);
   /* USER CODE END DMA1_Stream2_IRQn 1 */
 }
 
@@ -243,11 +244,11 @@ void DMA1_Stream2_IRQHandler(void)
 void DMA1_Stream3_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream3_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END DMA1_Stream3_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_usart2_rx);
   /* USER CODE BEGIN DMA1_Stream3_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_UART, isr_start_cycles);
   /* USER CODE END DMA1_Stream3_IRQn 1 */
 }
 
@@ -257,11 +258,11 @@ void DMA1_Stream3_IRQHandler(void)
 void DMA1_Stream4_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream4_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END DMA1_Stream4_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_usart2_tx);
   /* USER CODE BEGIN DMA1_Stream4_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_UART, isr_start_cycles);
   /* USER CODE END DMA1_Stream4_IRQn 1 */
 }
 
@@ -271,11 +272,11 @@ void DMA1_Stream4_IRQHandler(void)
 void DMA1_Stream5_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream5_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END DMA1_Stream5_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_usart1_tx);
   /* USER CODE BEGIN DMA1_Stream5_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_UART, isr_start_cycles);
   /* USER CODE END DMA1_Stream5_IRQn 1 */
 }
 
@@ -285,11 +286,11 @@ void DMA1_Stream5_IRQHandler(void)
 void DMA1_Stream6_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream6_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END DMA1_Stream6_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_i2c1_tx);
   /* USER CODE BEGIN DMA1_Stream6_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_I2C1, isr_start_cycles);
   /* USER CODE END DMA1_Stream6_IRQn 1 */
 }
 
@@ -299,11 +300,11 @@ void DMA1_Stream6_IRQHandler(void)
 void I2C1_EV_IRQHandler(void)
 {
   /* USER CODE BEGIN I2C1_EV_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END I2C1_EV_IRQn 0 */
   HAL_I2C_EV_IRQHandler(&hi2c1);
   /* USER CODE BEGIN I2C1_EV_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_I2C1, isr_start_cycles);
   /* USER CODE END I2C1_EV_IRQn 1 */
 }
 
@@ -313,11 +314,11 @@ void I2C1_EV_IRQHandler(void)
 void I2C1_ER_IRQHandler(void)
 {
   /* USER CODE BEGIN I2C1_ER_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END I2C1_ER_IRQn 0 */
   HAL_I2C_ER_IRQHandler(&hi2c1);
   /* USER CODE BEGIN I2C1_ER_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_I2C1, isr_start_cycles);
   /* USER CODE END I2C1_ER_IRQn 1 */
 }
 
@@ -327,11 +328,11 @@ void I2C1_ER_IRQHandler(void)
 void SPI1_IRQHandler(void)
 {
   /* USER CODE BEGIN SPI1_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END SPI1_IRQn 0 */
   HAL_SPI_IRQHandler(&hspi1);
   /* USER CODE BEGIN SPI1_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_SPI1, isr_start_cycles);
   /* USER CODE END SPI1_IRQn 1 */
 }
 
@@ -341,11 +342,11 @@ void SPI1_IRQHandler(void)
 void USART1_IRQHandler(void)
 {
   /* USER CODE BEGIN USART1_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END USART1_IRQn 0 */
   HAL_UART_IRQHandler(&huart1);
   /* USER CODE BEGIN USART1_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_UART, isr_start_cycles);
   /* USER CODE END USART1_IRQn 1 */
 }
 
@@ -355,11 +356,11 @@ void USART1_IRQHandler(void)
 void USART2_IRQHandler(void)
 {
   /* USER CODE BEGIN USART2_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END USART2_IRQn 0 */
   HAL_UART_IRQHandler(&huart2);
   /* USER CODE BEGIN USART2_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_UART, isr_start_cycles);
   /* USER CODE END USART2_IRQn 1 */
 }
 
@@ -369,11 +370,11 @@ void USART2_IRQHandler(void)
 void DMA1_Stream7_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream7_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END DMA1_Stream7_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_i2c1_rx);
   /* USER CODE BEGIN DMA1_Stream7_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_I2C1, isr_start_cycles);
   /* USER CODE END DMA1_Stream7_IRQn 1 */
 }
 
@@ -383,11 +384,11 @@ void DMA1_Stream7_IRQHandler(void)
 void SDMMC1_IRQHandler(void)
 {
   /* USER CODE BEGIN SDMMC1_IRQn 0 */
-
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
   /* USER CODE END SDMMC1_IRQn 0 */
   HAL_SD_IRQHandler(&hsd1);
   /* USER CODE BEGIN SDMMC1_IRQn 1 */
-
+  cpu_load_isr_exit(CPU_LOAD_ISR_SDMMC, isr_start_cycles);
   /* USER CODE END SDMMC1_IRQn 1 */
 }
 
@@ -108,6 +108,13 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+// Called from the USB ISR when a CDC_Transmit_FS() transfer completed.
+// Weak, the application can override it.
+void CDC_TransmitCpltCallback_FS(void);
+// Called from the USB ISR when the CDC class is deinitialized, on a USB
+// reset or disconnect. A transfer in progress is aborted without a
+// completion callback. Weak, the application can override it.
+void CDC_DeInitCallback_FS(void);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
@@ -30,3 +30,20 @@ if "test" in build_type:
 else:
     print(f"** (extra_script.py): Not adding a post upload delay.")
     
+
+# Estimates the worst case stack usage of the tasks from the .su files
+# of -fstack-usage and the call graph of the firmware. Informative, see
+# tools/stack_usage.py.
+if "test" not in build_type:
+    def report_stack_usage(source, target, env):
+        objdump = env.subst("$OBJCOPY").replace("objcopy", "objdump")
+        env.Execute(
+            env.VerboseAction(
+                f'"$PYTHONEXE" "$PROJECT_DIR/tools/stack_usage.py" --project_dir "$PROJECT_DIR" '
+                f'--build_dir "$BUILD_DIR" --elf "{target[0].get_abspath()}" '
+                f'--objdump "{objdump}"',
+                "Estimating the task stacks usage",
+            )
+        )
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report_stack_usage)
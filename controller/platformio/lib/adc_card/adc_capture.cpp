@@ -0,0 +1,271 @@
+#include "adc_capture.h"
+
+#include <string.h>
+
+namespace adc_capture {
+
+const char* trigger_source_name(TriggerSource source) {
+  switch (source) {
+    case TriggerSource::LEVEL:
+      return "level";
+    case TriggerSource::SLOPE:
+      return "slope";
+    case TriggerSource::MARKER:
+      return "marker";
+    case TriggerSource::HOST:
+      return "host";
+    default:
+      return "none";
+  }
+}
+
+// Decodes a 3 bytes big endian signed value. Unlike adc_dsp, doesn't
+// read past the 3 bytes, since the sample may be at the end of the ring.
+static inline int32_t decode_int24(const uint8_t* bfr3) {
+  return ((int32_t)(((uint32_t)bfr3[0] << 24) | ((uint32_t)bfr3[1] << 16) |
+                    ((uint32_t)bfr3[2] << 8))) >>
+         8;
+}
+
+Capture::Capture(uint8_t* buffer, uint32_t buffer_size,
+                 uint32_t interval_usecs)
+    : _buffer(buffer),
+      _capacity(buffer_size / kBytesPerSample),
+      _interval_usecs(interval_usecs) {}
+
+void Capture::reset() {
+  _next_index = 0;
+  _next_slot = 0;
+  _oldest_index = 0;
+  _first_run = 0;
+  _num_runs = 0;
+  _was_outside_level = false;
+  _was_over_slope = false;
+  _state = IDLE;
+  _source = TriggerSource::NONE;
+}
+
+bool Capture::set_window(uint32_t pre_samples, uint32_t post_samples) {
+  // Leaves room for the samples that are captured while dumping.
+  if (pre_samples >= _capacity / 2 || post_samples >= _capacity / 2) {
+    return false;
+  }
+  _pre_samples = pre_samples;
+  _post_samples = post_samples;
+  return true;
+}
+
+void Capture::set_triggers(const Triggers& triggers) {
+  _triggers = triggers;
+  if (_triggers.slope_span == 0) {
+    _triggers.slope_span = 1;
+  }
+  _was_outside_level = false;
+  _was_over_slope = false;
+}
+
+uint32_t Capture::slot_of(uint32_t index) const {
+  const uint32_t back = _next_index - index;
+  return (_next_slot >= back) ? _next_slot - back
+                              : _next_slot + _capacity - back;
+}
+
+int32_t Capture::sample_at(uint32_t index) const {
+  return decode_int24(&_buffer[slot_of(index) * kBytesPerSample]);
+}
+
+void Capture::add_run(uint32_t first_index, uint32_t first_micros) {
+  if (_num_runs >= kMaxRuns) {
+    // Drops the samples of the oldest run.
+    drop_until(run(1).first_index);
+  }
+  Run& r = _runs[(_first_run + _num_runs) % kMaxRuns];
+  r.first_index = first_index;
+  r.first_micros = first_micros;
+  _num_runs++;
+}
+
+void Capture::drop_until(uint32_t index) {
+  if ((int32_t)(index - _oldest_index) <= 0) {
+    return;
+  }
+  _oldest_index = index;
+  // Keeps the run of the oldest sample.
+  while (_num_runs > 1 && (int32_t)(run(1).first_index - index) <= 0) {
+    _first_run = (_first_run + 1) % kMaxRuns;
+    _num_runs--;
+  }
+  // Skips dump samples that were overwritten.
+  if (_state != IDLE && (int32_t)(_dump_next - index) < 0) {
+    const uint32_t lost_end =
+        (int32_t)(_dump_end - index) < 0 ? _dump_end : index;
+    _lost_samples_count += lost_end - _dump_next;
+    _dump_next = lost_end;
+  }
+}
+
+void Capture::check_triggers(uint32_t index, int32_t value) {
+  if (_triggers.level_low <= _triggers.level_high) {
+    const bool is_outside =
+        value < _triggers.level_low || value > _triggers.level_high;
+    if (is_outside && !_was_outside_level) {
+      trigger(index, TriggerSource::LEVEL);
+    }
+    _was_outside_level = is_outside;
+  }
+
+  // The slope is checked within the current run only.
+  if (_triggers.slope_delta > 0 &&
+      index - last_run().first_index >= _triggers.slope_span) {
+    const int32_t delta = value - sample_at(index - _triggers.slope_span);
+    const bool is_over =
+        delta > _triggers.slope_delta || delta < -_triggers.slope_delta;
+    if (is_over && !_was_over_slope) {
+      trigger(index, TriggerSource::SLOPE);
+    }
+    _was_over_slope = is_over;
+  }
+}
+
+void Capture::append(const uint8_t* first, uint32_t stride, uint32_t n,
+                     uint32_t first_micros) {
+  if (n == 0 || _capacity == 0) {
+    return;
+  }
+
+  // Starts a new run unless the samples continue the last one within
+  // half an interval.
+  bool is_contiguous = false;
+  if (_num_runs > 0) {
+    const Run& r = last_run();
+    const uint32_t expected_micros =
+        r.first_micros + (_next_index - r.first_index) * _interval_usecs;
+    const int32_t diff = (int32_t)(first_micros - expected_micros);
+    is_contiguous = diff <= (int32_t)(_interval_usecs / 2) &&
+                    diff >= -(int32_t)(_interval_usecs / 2);
+  }
+  if (!is_contiguous) {
+    add_run(_next_index, first_micros);
+    _was_over_slope = false;
+  }
+
+  const bool check = _state == IDLE &&
+                     (_triggers.level_low <= _triggers.level_high ||
+                      _triggers.slope_delta > 0);
+  const uint8_t* p = first;
+  for (uint32_t i = 0; i < n; i++, p += stride) {
+    // Makes room for the sample.
+    if (_next_index - _oldest_index >= _capacity) {
+      drop_until(_next_index - _capacity + 1);
+    }
+    uint8_t* const dst = &_buffer[_next_slot * kBytesPerSample];
+    dst[0] = p[0];
+    dst[1] = p[1];
+    dst[2] = p[2];
+    const uint32_t index = _next_index;
+    _next_index++;
+    if (++_next_slot >= _capacity) {
+      _next_slot = 0;
+    }
+    if (check && _state == IDLE) {
+      check_triggers(index, decode_int24(p));
+    }
+  }
+
+  if (_state == TRIGGERED && (int32_t)(_next_index - _dump_end) >= 0) {
+    _state = DUMPING;
+  }
+}
+
+bool Capture::trigger(uint32_t index, TriggerSource source) {
+  if (_state != IDLE) {
+    _ignored_triggers_count++;
+    return false;
+  }
+  _triggers_count++;
+  _state = TRIGGERED;
+  _source = source;
+  _trigger_index = index;
+  // Clamps the start of the window to the oldest sample.
+  const uint32_t available = index - _oldest_index;
+  const uint32_t pre =
+      ((int32_t)available < 0)   ? 0
+      : (available < _pre_samples) ? available
+                                   : _pre_samples;
+  _dump_next = ((int32_t)available < 0) ? _oldest_index : index - pre;
+  _dump_end = index + _post_samples + 1;
+  _dump_started = false;
+  if ((int32_t)(_next_index - _dump_end) >= 0) {
+    _state = DUMPING;
+  }
+  return true;
+}
+
+uint32_t Capture::index_at_micros(uint32_t t_micros) const {
+  if (_num_runs == 0 || _interval_usecs == 0) {
+    return _next_index;
+  }
+  // The last run that started before the given time.
+  for (int i = _num_runs - 1; i >= 0; i--) {
+    const Run& r = run(i);
+    const int32_t dt = (int32_t)(t_micros - r.first_micros);
+    if (dt >= 0) {
+      return r.first_index +
+             ((uint32_t)dt + _interval_usecs / 2) / _interval_usecs;
+    }
+  }
+  return run(0).first_index;
+}
+
+bool Capture::next_dump_chunk(uint32_t max_samples, DumpChunk* chunk,
+                              uint8_t* out) {
+  if (_state != DUMPING || max_samples == 0) {
+    return false;
+  }
+  if ((int32_t)(_dump_next - _dump_end) >= 0) {
+    // The rest of the window was overwritten.
+    _state = IDLE;
+    return false;
+  }
+
+  // The run of the next sample and where it ends.
+  uint8_t i = _num_runs - 1;
+  while (i > 0 && (int32_t)(_dump_next - run(i).first_index) < 0) {
+    i--;
+  }
+  const Run& r = run(i);
+  const uint32_t run_end =
+      (i + 1 < _num_runs) ? run(i + 1).first_index : _next_index;
+
+  uint32_t n = _dump_end - _dump_next;
+  if (run_end - _dump_next < n) {
+    n = run_end - _dump_next;
+  }
+  if (max_samples < n) {
+    n = max_samples;
+  }
+
+  // Copies the samples, in up to two parts due to the ring wrap around.
+  const uint32_t slot = slot_of(_dump_next);
+  const uint32_t n1 = (_capacity - slot < n) ? _capacity - slot : n;
+  memcpy(out, &_buffer[slot * kBytesPerSample], n1 * kBytesPerSample);
+  memcpy(out + n1 * kBytesPerSample, _buffer, (n - n1) * kBytesPerSample);
+
+  chunk->first_index = _dump_next;
+  chunk->num_samples = n;
+  chunk->first_micros =
+      r.first_micros + (_dump_next - r.first_index) * _interval_usecs;
+  chunk->trigger_index = _trigger_index;
+  chunk->source = _source;
+  chunk->is_first = !_dump_started;
+
+  _dump_started = true;
+  _dump_next += n;
+  if (_dump_next == _dump_end) {
+    _state = IDLE;
+    _dumps_count++;
+  }
+  return true;
+}
+
+}  // namespace adc_capture
@@ -0,0 +1,191 @@
+// A pre trigger capture of the full rate samples of an adc card channel.
+//
+// The samples are kept in a large RAM ring, as the 3 bytes big endian
+// ADC readings, while the channel itself is streamed decimated. When a
+// trigger fires, the samples of the window around it, from pre_samples
+// before the trigger to post_samples after it, are dumped at full
+// resolution once the post trigger samples were captured.
+//
+// Triggers:
+// * Level - a sample outside [level_low, level_high], on the transition
+//   from inside the range.
+// * Slope - a change of more than slope_delta within slope_span samples.
+// * External - at a given sample index, e.g. of a marker from the
+//   printer or a host command.
+// While a window is pending or being dumped, new triggers are ignored.
+//
+// The samples are evenly spaced, except for gaps, e.g. for bursts of
+// other channels. The capture tracks the runs of contiguous samples and
+// the dump chunks don't cross runs, so each chunk has a first sample
+// time and a fixed interval.
+//
+// Sample indexes count from the last reset() and wrap around after 2^32
+// samples. That's more than 6 days at 8000 samples/sec.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace adc_capture {
+
+// Bytes per sample in the ring and in the dumps.
+constexpr uint32_t kBytesPerSample = 3;
+
+// Max number of runs of contiguous samples in the ring. When exceeded,
+// the samples of the oldest run are dropped.
+constexpr uint8_t kMaxRuns = 32;
+
+enum class TriggerSource : uint8_t {
+  NONE,
+  LEVEL,
+  SLOPE,
+  MARKER,
+  HOST,
+};
+
+// A short name of the source, for reports.
+const char* trigger_source_name(TriggerSource source);
+
+struct Triggers {
+  // A sample outside [level_low, level_high] triggers. Disabled if
+  // level_low > level_high.
+  int32_t level_low = 1;
+  int32_t level_high = 0;
+  // A change of more than slope_delta within slope_span samples
+  // triggers. Disabled if slope_delta is 0.
+  int32_t slope_delta = 0;
+  uint16_t slope_span = 1;
+};
+
+// A chunk of a dump, of contiguous samples.
+struct DumpChunk {
+  // The index of the first sample.
+  uint32_t first_index;
+  uint32_t num_samples;
+  // The time of the first sample, in usecs.
+  uint32_t first_micros;
+  // The trigger of the dump.
+  uint32_t trigger_index;
+  TriggerSource source;
+  // True for the first chunk of a dump.
+  bool is_first;
+};
+
+class Capture {
+ public:
+  // buffer holds buffer_size / kBytesPerSample samples. interval_usecs
+  // is the nominal time between samples.
+  Capture(uint8_t* buffer, uint32_t buffer_size, uint32_t interval_usecs);
+
+  // Prevent copy and assignment.
+  Capture(const Capture& other) = delete;
+  Capture& operator=(const Capture& other) = delete;
+
+  // Drops the samples and any pending dump. Should be called on a gap
+  // in the sample indexes, e.g. a lost DMA half.
+  void reset();
+
+  // Sets the samples before and after the trigger that are dumped.
+  // Returns false if the window doesn't fit in the ring.
+  bool set_window(uint32_t pre_samples, uint32_t post_samples);
+
+  void set_triggers(const Triggers& triggers);
+  const Triggers& triggers() const { return _triggers; }
+
+  // Appends n samples whose data is 'stride' bytes apart. first_micros
+  // is the time of the first sample. Checks the level and slope
+  // triggers.
+  void append(const uint8_t* first, uint32_t stride, uint32_t n,
+              uint32_t first_micros);
+
+  // Triggers a dump around the sample at the given index. Indexes of
+  // samples that were not captured yet are allowed. Returns false if
+  // ignored since a dump is pending.
+  bool trigger(uint32_t index, TriggerSource source);
+
+  // The index of the sample at the given time, per the runs of samples.
+  // May be an index of a future sample.
+  uint32_t index_at_micros(uint32_t t_micros) const;
+
+  // The index of the next appended sample.
+  uint32_t next_index() const { return _next_index; }
+
+  // True if a trigger fired and its window was not dumped yet.
+  bool is_triggered() const { return _state != IDLE; }
+
+  // If the window of a trigger was captured, copies up to max_samples of
+  // its next samples to 'out' and returns true. Returns false if there
+  // is nothing to dump.
+  bool next_dump_chunk(uint32_t max_samples, DumpChunk* chunk, uint8_t* out);
+
+  // Stats.
+  uint32_t triggers_count() const { return _triggers_count; }
+  uint32_t ignored_triggers_count() const { return _ignored_triggers_count; }
+  uint32_t dumps_count() const { return _dumps_count; }
+  // Samples of windows that were overwritten before they were dumped.
+  uint32_t lost_samples_count() const { return _lost_samples_count; }
+
+ private:
+  enum State {
+    IDLE,
+    // Waiting for the post trigger samples.
+    TRIGGERED,
+    // Dumping the window.
+    DUMPING,
+  };
+
+  // A run of contiguous samples.
+  struct Run {
+    uint32_t first_index;
+    uint32_t first_micros;
+  };
+
+  uint8_t* const _buffer;
+  const uint32_t _capacity;
+  const uint32_t _interval_usecs;
+
+  uint32_t _pre_samples = 0;
+  uint32_t _post_samples = 0;
+  Triggers _triggers;
+
+  uint32_t _next_index = 0;
+  // The ring slot of the next sample.
+  uint32_t _next_slot = 0;
+  // The first sample that is still in the ring.
+  uint32_t _oldest_index = 0;
+
+  // A ring of the runs, by their first index. The first run may start
+  // before the oldest sample.
+  Run _runs[kMaxRuns];
+  uint8_t _first_run = 0;
+  uint8_t _num_runs = 0;
+
+  // For triggering on the transitions only.
+  bool _was_outside_level = false;
+  bool _was_over_slope = false;
+
+  State _state = IDLE;
+  TriggerSource _source = TriggerSource::NONE;
+  uint32_t _trigger_index = 0;
+  // The window of the pending dump, [_dump_next, _dump_end).
+  uint32_t _dump_next = 0;
+  uint32_t _dump_end = 0;
+  bool _dump_started = false;
+
+  uint32_t _triggers_count = 0;
+  uint32_t _ignored_triggers_count = 0;
+  uint32_t _dumps_count = 0;
+  uint32_t _lost_samples_count = 0;
+
+  const Run& run(uint8_t i) const { return _runs[(_first_run + i) % kMaxRuns]; }
+  const Run& last_run() const { return run(_num_runs - 1); }
+  void add_run(uint32_t first_index, uint32_t first_micros);
+  // Drops samples from the oldest up to the given index.
+  void drop_until(uint32_t index);
+  // The ring slot of a sample that is in the ring.
+  uint32_t slot_of(uint32_t index) const;
+  int32_t sample_at(uint32_t index) const;
+  void check_triggers(uint32_t index, int32_t value);
+};
+
+}  // namespace adc_capture
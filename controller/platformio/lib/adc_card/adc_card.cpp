@@ -4,19 +4,30 @@
 #include <portmacro.h>
 #include <queue.h>
 
+#include <cstdio>
 #include <cstring>
 
+#include "adc_capture.h"
+#include "adc_card_config.h"
+#include "adc_dsp.h"
+#include "adc_sequence.h"
+#include "alarms.h"
 #include "common.h"
 #include "data_queue.h"
 #include "data_recorder.h"
 #include "dma.h"
+#include "dma_buffers.h"
+#include "sample_clock.h"
 #include "host_link.h"
 #include "serial_packets_client.h"
 #include "session.h"
 #include "spi.h"
+#include "static_notify_channel.h"
 #include "static_queue.h"
+#include "static_string.h"
 #include "stm32h7xx_hal_spi.h"
 #include "stm32h7xx_hal_spi_ex.h"
+#include "tcm.h"
 #include "tim.h"
 #include "time_util.h"
 
@@ -26,118 +37,273 @@ using host_link::HostPorts;
 
 namespace adc_card {
 
+// For logging from the sampling path.
+static const DeferredLogger<CONFIG_LOG_LEVEL_ADC_CARD> deferred_logger;
+
 // Our DMA Terminology
-// * Buffer - the entire dma tx or rx buffer (must be same size).
-// * Half (buffer) - half of a DMA tx or rx buffer. We use double buffering,
-//   transfering one half while processing the results in the other
-//   half.
-// * Point - A single ADC conversion.
-// * Slot - A consecutive group of points where we read the load cell
-//   channel N times and the next temperature channel one time. We read the
-//   load cell N times and use only the last value as a workaround for noise
-//   that is injected by switching the ADC between input channels.
-// * Cycle - A group of slots in which we read each of the temperaute channels
-//   once.
+// * Half - a DMA transfer of kDmaBytesPerHalf bytes, one of the two
+//   memories of the double buffer mode of the RX and TX DMA streams. The
+//   name is from the earlier circular DMA over two halves.
+// * Segment - an RX buffer of a half. The segments form a ring of
+//   kNumDmaRxSegments entries. The DMA writes a half to a segment and the
+//   adc task reads it in place, so the task can fall behind by
+//   kNumDmaSegments halves without losing data.
+// * Point, slot, cycle - See adc_sequence.h.
 //
 // Hierarchy:
-// DMA Buffer (1)
-//   Half DMA buffer (2, double buffering)
-//     Cycle (40)
-//       Slot (3, one per temp channel x)
-//          LC1 data point (ignored)
-//          LC1 data point (ignored)
-//          LC1 data Point (used)
-//          TMx data point (used)
+// Half (a DMA memory, double buffering)
+//   Cycle (kMode.cycles_per_half)
+//     Slot (per the channels rate dividers)
+//       Points (per the channels conversions)
+//
+// On the completion of a half, the ISR passes its segment to the task
+// and points the DMA memory that completed to a free segment, for the
+// half after the next one. It doesn't touch the data. Each half gets a
+// sequence number by the ISR, which derives the halves that completed
+// from the time since the previous completion, so missed interrupts
+// show as a gap. The task verifies that the segments it processes have
+// consecutive sequence numbers and reports the gaps, so a lost half is
+// never silent.
 //
-// Examples of cycle points when reading the load cell three times. The
-// '*' indicates the values we actually use.
-// (LC, LC, *Lc, *T1), (LC, LC, *LC, *T2), (LC, LC, *LC, *T3)
-
-constexpr uint32_t kDmaBytesPerPoint = 16;
-constexpr uint32_t kDmaNumTemperatureChans = 3;
-// We read the load cell N times and use only the last value.
-constexpr uint32_t kDmaConsecutiveLcPoints = 3;
-
-constexpr uint32_t kDmaPointsPerSlot = kDmaConsecutiveLcPoints + 1;
-constexpr uint32_t kDmaBytesPerSlot = kDmaPointsPerSlot * kDmaBytesPerPoint;
-constexpr uint32_t kDmaSlotsPerCycle = kDmaNumTemperatureChans;
-constexpr uint32_t kDmaPointsPerCycle = kDmaSlotsPerCycle * kDmaPointsPerSlot;
+// The channels and their sampling rates are defined in adc_card_config.h
+// and compiled here to the TX command image and the RX extraction plan.
+// In modes with bursts, some of the halves end with a cycle of the
+// burst plan instead.
+
+using adc_card_config::kBurstChannels;
+using adc_card_config::kChannels;
+using adc_card_config::kMode;
+using adc_card_config::kNumDmaSegments;
+using adc_sequence::ChannelSpec;
+using adc_sequence::ConversionMode;
+constexpr uint8_t kNumChannels = sizeof(kChannels) / sizeof(kChannels[0]);
+constexpr uint8_t kNumBurstChannels =
+    sizeof(kBurstChannels) / sizeof(kBurstChannels[0]);
+
+constexpr adc_sequence::Plan kPlan = adc_sequence::compile(kChannels);
+static_assert(kPlan.is_valid());
+
+constexpr bool kHasBursts = kMode.halves_per_burst > 0;
+constexpr uint16_t kHalvesPerBurst = kHasBursts ? kMode.halves_per_burst : 1;
+constexpr adc_sequence::Plan kBurstPlan =
+    adc_sequence::compile(kBurstChannels);
+static_assert(!kHasBursts ||
+              adc_sequence::is_valid_burst(kPlan, kBurstPlan,
+                                           kMode.cycles_per_half));
+
+constexpr uint32_t kDmaBytesPerPoint = adc_sequence::kBytesPerPoint;
+constexpr uint32_t kDmaPointsPerCycle = kPlan.points_per_cycle;
 constexpr uint32_t kDmaBytesPerCycle = kDmaPointsPerCycle * kDmaBytesPerPoint;
-constexpr uint32_t kDmaCyclesPerHalf = 40;
-constexpr uint32_t kDmaSlotsPerHalf = kDmaSlotsPerCycle * kDmaCyclesPerHalf;
+constexpr uint32_t kDmaCyclesPerHalf = kMode.cycles_per_half;
 constexpr uint32_t kDmaPointsPerHalf = kDmaPointsPerCycle * kDmaCyclesPerHalf;
 constexpr uint32_t kDmaBytesPerHalf = kDmaPointsPerHalf * kDmaBytesPerPoint;
 
-// We have an integer number of cycles, slots, and data points in a second.
-static_assert(kDmaPointsPerCycle % kDmaPointsPerCycle == 0);
-static_assert(kDmaPointsPerCycle % kDmaPointsPerSlot == 0);
+constexpr uint32_t kDmaRxDataOffsetInPoint = adc_sequence::kRxDataOffsetInPoint;
+constexpr uint32_t kDmaRegValOffsetInPoint = adc_sequence::kRegValOffsetInPoint;
+
+// The task reads the points of a segment in place, through a pointer
+// to the data bytes of its first point.
+constexpr uint32_t kSegmentBytesPerPoint = kDmaBytesPerPoint;
+static_assert(kDmaRegValOffsetInPoint > kDmaRxDataOffsetInPoint);
+constexpr uint32_t kSegmentRegValOffsetInPoint =
+    kDmaRegValOffsetInPoint - kDmaRxDataOffsetInPoint;
+
+// Two segments are always owned by the DMA, the one it writes and the
+// next one.
+constexpr uint32_t kNumDmaRxSegments = kNumDmaSegments + 2;
+
+// This is the frequency of TIM12 which generates the points time
+// base. TIM12 ticks at 1Mhz.
+constexpr uint32_t kDmaPointsPerSec = kMode.points_per_sec;
+static_assert(1000000 % kDmaPointsPerSec == 0);
+constexpr uint32_t kUsecsPerPoint =
+    adc_sequence::usecs_per_point(kDmaPointsPerSec);
+static_assert(kUsecsPerPoint > kMode.cs_high_usecs);
+
+// The log packet format requires whole ms halves.
+static_assert((1000 * kDmaPointsPerHalf) % kDmaPointsPerSec == 0);
 
-// The offset of the 3 bytes conversion data within the
-// kBytesPerPoint bytes of a single point SPI transfer.
-constexpr uint32_t kDmaRxDataOffsetInPoint = 2;
+// The time between the completions of the halves.
+constexpr uint32_t kUsecsPerHalf = kDmaPointsPerHalf * kUsecsPerPoint;
+
+// SPI1 clock. The kernel clock is PLL2P (25Mhz / 25 * 256 / 4).
+constexpr uint32_t kSpiKernelClockHz = 64000000;
+constexpr uint32_t kSpiClockHz = kSpiKernelClockHz / kMode.spi_clock_divider;
+
+// The ADS1261 max SCLK is 10Mhz.
+static_assert(kSpiClockHz <= 10000000);
+
+// The SPI transfer time of a point, rounded up.
+constexpr uint32_t kDmaTransferUsecsPerPoint =
+    (kDmaBytesPerPoint * 8 * 1000000 + kSpiClockHz - 1) / kSpiClockHz;
+
+// The transfer of a point should end while CS is low.
+static_assert(kDmaTransferUsecsPerPoint < kUsecsPerPoint - kMode.cs_high_usecs);
+
+// Maps the divider to the HAL value.
+constexpr uint32_t spi_baud_rate_prescaler(uint16_t divider) {
+  switch (divider) {
+    case 2:
+      return SPI_BAUDRATEPRESCALER_2;
+    case 4:
+      return SPI_BAUDRATEPRESCALER_4;
+    case 8:
+      return SPI_BAUDRATEPRESCALER_8;
+    case 16:
+      return SPI_BAUDRATEPRESCALER_16;
+    case 32:
+      return SPI_BAUDRATEPRESCALER_32;
+    case 64:
+      return SPI_BAUDRATEPRESCALER_64;
+    case 128:
+      return SPI_BAUDRATEPRESCALER_128;
+    case 256:
+      return SPI_BAUDRATEPRESCALER_256;
+  }
+  return 0xffffffff;
+}
 
-// The byte offset of the register reading value in each point.
-constexpr uint32_t kDmaRegValOffsetInPoint = 7;
+constexpr uint32_t kSpiBaudRatePrescaler =
+    spi_baud_rate_prescaler(kMode.spi_clock_divider);
+static_assert(kSpiBaudRatePrescaler != 0xffffffff);
+
+// Max length of an 'ext' report of the DMA counters, the sample clock
+// or the settings, e.g. "adc_clk_ppb:-2147483648".
+constexpr uint32_t kMaxExtReportLen = 24;
+
+// Max number of 'ext' reports in a log packet.
+constexpr uint32_t kMaxExtReportsPerPacket = 4;
+
+// Size of the log packet of a half. Each channel has a 3 chars id,
+// a 10 bytes header and 3 bytes per value. The packet may also have
+// 'ext' reports of the DMA counters and the sample clock.
+constexpr uint32_t log_packet_len() {
+  uint32_t result =
+      1 + 4 + 4 + kMaxExtReportsPerPacket * (4 + 6 + 1 + kMaxExtReportLen);
+  for (uint8_t c = 0; c < kNumChannels; c++) {
+    result += 4 + 10 + 3 * kPlan.channels[c].samples_per_cycle *
+                           kDmaCyclesPerHalf /
+                           kChannels[c].filter.decimation;
+  }
+  if (kHasBursts) {
+    for (uint8_t c = 0; c < kNumBurstChannels; c++) {
+      result += 4 + 10 + 3 * kBurstPlan.channels[c].samples_per_cycle;
+    }
+  }
+  return result;
+}
+static_assert(log_packet_len() <= MAX_PACKET_DATA_LEN);
+
+// The pre trigger capture of a main channel, see adc_card_config.h.
+using adc_card_config::kCapture;
+static_assert(kCapture.chan_index < kNumChannels);
+constexpr uint32_t kCaptureBytes = CONFIG_ADC_CAPTURE_KBYTES * 1024;
+// Fits in the D2 SRAM.
+static_assert(kCaptureBytes <= 288 * 1024);
+// The interval of the captured samples. The bursts leave gaps.
+constexpr uint32_t kCaptureIntervalUsecs = adc_sequence::sample_interval_usecs(
+    kPlan, kCapture.chan_index, kDmaPointsPerSec);
+
+// Limits of the dump packets of a capture. They are sent after the log
+// packet of a half, so the dump of a window takes a few halves.
+constexpr uint32_t kMaxDumpSamplesPerPacket = 300;
+constexpr uint32_t kMaxDumpPacketsPerHalf = 2;
+
+// Size of a dump packet, a single channel and the report of the trigger.
+constexpr uint32_t kDumpPacketLen = 1 + 4 + 4 +
+                                    (4 + 10 + 3 * kMaxDumpSamplesPerPacket) +
+                                    (4 + 6 + 1 + kMaxExtReportLen);
+static_assert(kDumpPacketLen <= MAX_PACKET_DATA_LEN);
+
+// The decimated values should be aligned with the halves, with and
+// without a burst, so their times can be reported per packet.
+constexpr bool are_filters_aligned() {
+  const uint32_t burst_cycles =
+      kHasBursts ? adc_sequence::cycles_before_burst(kPlan, kBurstPlan,
+                                                     kDmaCyclesPerHalf)
+                 : kDmaCyclesPerHalf;
+  for (uint8_t c = 0; c < kNumChannels; c++) {
+    const uint32_t samples_per_cycle = kPlan.channels[c].samples_per_cycle;
+    const uint32_t decimation = kChannels[c].filter.decimation;
+    if ((samples_per_cycle * kDmaCyclesPerHalf) % decimation != 0 ||
+        (samples_per_cycle * burst_cycles) % decimation != 0) {
+      return false;
+    }
+  }
+  // Burst channels have a single sample per burst.
+  for (uint8_t c = 0; c < kNumBurstChannels; c++) {
+    if (kHasBursts && kBurstChannels[c].filter.decimation != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(are_filters_aligned());
 
-// This is the frequency of TIM2 which generates the points time
-// base. The effective sampling rate of the load cell is this
-// value divided by 3, and for each temp channel, this value
-// divided by 9.
-constexpr uint16_t kDmaPointsPerSec = 2000;
+// In modes with bursts, the size of the TX images of a half with and
+// without a burst.
+constexpr uint32_t kTxImageSize = kHasBursts ? kDmaBytesPerHalf : 1;
 
-// Time in ms per a half, cycle and slot. Values should divide evently.
-static_assert((1000 * kDmaPointsPerHalf) % kDmaPointsPerSec == 0);
-static_assert((1000 * kDmaPointsPerCycle) % kDmaPointsPerSec == 0);
-static_assert((1000 * kDmaPointsPerSlot) % kDmaPointsPerSec == 0);
+// Halves per update of the sample clock model.
+constexpr uint16_t kHalvesPerClockUpdate = 32;
 
-constexpr uint32_t kMsPerHalf = (1000 * kDmaPointsPerHalf) / kDmaPointsPerSec;
-constexpr uint32_t kMsPerCycle = (1000 * kDmaPointsPerCycle) / kDmaPointsPerSec;
-constexpr uint32_t kMsPerSlot = (1000 * kDmaPointsPerSlot) / kDmaPointsPerSec;
+// The info of a half whose RX segment was passed to the adc task. The
+// data is in the segment.
+struct Segment {
+  // The sequence number of the DMA half.
+  uint32_t seq;
+  // The time the half was completed, in millis and in usecs.
+  uint32_t isr_millis;
+  uint32_t isr_micros;
+  bool has_burst;
+};
 
-// Each of tx/rx buffer contains two halves that are used
-// as dual buffers with the DMA circular mode.
-static uint8_t tx_buffer[2 * kDmaBytesPerHalf] = {};
-static uint8_t rx_buffer[2 * kDmaBytesPerHalf] = {};
+// The buffers that the SPI DMA of a card reads and writes. In the non
+// cacheable DMA memory, see dma_buffers.h.
+struct AdcDmaBuffers {
+  // The ring of RX segments.
+  uint8_t rx[kNumDmaRxSegments][kDmaBytesPerHalf];
+  // The TX images of a half without and, in modes with bursts, with a
+  // burst. The two memories of the TX DMA point to one of them.
+  uint8_t plain_tx[kDmaBytesPerHalf];
+  uint8_t burst_tx[kTxImageSize];
+  // The TX data of a one shot transfer. The commands are copied here
+  // since they are on the stack or in the flash.
+  uint8_t one_shot_tx[kDmaBytesPerPoint];
+};
 
 // Represent the type of an event that is passed from the ISR handlers to the
 // worker thread.
 enum IrqEventId {
-  EVENT_HALF_COMPLETE = 1,
-  EVENT_FULL_COMPLETE = 2,
+  // A one shot transfer is completed.
+  EVENT_ONE_SHOT_COMPLETE = 1,
+  // A DMA half was completed in a segment.
+  EVENT_SEGMENT_READY = 2,
 };
 
 // The event itself.
 struct IrqEvent {
   IrqEventId id;
-  uint32_t isr_millis;
+  // The sequence number of the half and the index of its segment. For
+  // EVENT_SEGMENT_READY.
+  uint32_t seq;
+  uint32_t segment;
 };
 
-// The completion ISRs pass event to the worker thread using
-// this queue.
-static StaticQueue<IrqEvent, 5> irq_event_queue;
-
 // The state of the DMA operation.
 enum DmaState {
   // DMA not active.
   DMA_STATE_IDLE,
   // DMA active. Completion IRQ will abort it on first invocation..
   DMA_STATE_ONE_SHOT,
-  // DMA is active and half and full completion IRQs are invoked
-  // to report completion of respective halves.
+  // DMA is active in double buffer mode and the completion IRQs of
+  // its two memories report the completion of the halves.
   DMA_STATE_CONTINUOS,
 };
 
-static volatile DmaState state = DMA_STATE_IDLE;
-
-// We detect in setup() of the card exists and fall gracefully if not.
-static bool adc_card_hardware_found = false;
-
-// General stats.
-static volatile uint32_t irq_half_count = 0;
-static volatile uint32_t irq_full_count = 0;
-static volatile uint32_t irq_error_count = 0;
-static volatile uint32_t event_half_count = 0;
-static volatile uint32_t event_full_count = 0;
+// ADS1261 MODE1 register value.
+constexpr uint8_t kRegMode1 =
+    (kMode.conversion_mode == ConversionMode::ONE_SHOT) ? 0x11 : 0x01;
 
 // A static register is an ADS1261 register that is initialized
 // once and doesn't change value through the execution of the
@@ -154,8 +320,8 @@ struct RegisterInfo {
 static const RegisterInfo regs_info[] = {
     {.idx = 0x00, .type = INFO},
     {.idx = 0x01, .type = INFO},
-    {.idx = 0x02, .type = STAT, .val = 0x6C},  // 14400 SPS, (Sinc5)
-    {.idx = 0x03, .type = STAT, .val = 0x11},  // One shot, 50us delay
+    {.idx = 0x02, .type = STAT, .val = kMode.reg_mode0},  // Data rate, filter
+    {.idx = 0x03, .type = STAT, .val = kRegMode1},  // Conv mode, 50us delay
     {.idx = 0x04, .type = STAT, .val = 0x00},  // GPIO 0-3 disconnected
     {.idx = 0x05, .type = STAT, .val = 0x00},  // Disable CRC and status.
     {.idx = 0x06, .type = DYNM},
@@ -175,144 +341,599 @@ static const RegisterInfo regs_info[] = {
 
 static constexpr size_t kNumRegsInfo = sizeof(regs_info) / sizeof(regs_info[0]);
 
-// For diagnostics. Used to verify that the static registers
-// in the ADC where not mutated, e.g. due to noise on the bus.
-static uint8_t regs_values[kNumRegsInfo] = {};
+// The static register that can be changed at run time.
+constexpr uint8_t kRegMode0Index = 0x02;
 
-// Called when the first half of rx_buffer is ready for processing.
-void spi_TxRxHalfCpltCallbackIsr(SPI_HandleTypeDef *hspi) {
-  // error_handler::Panic(322);
+// The conversion start delay that kRegMode1 selects.
+constexpr uint32_t kConversionStartDelayUsecs = 50;
+
+// The min conversions of the channels that the sequence switches to.
+// Zero if it never switches channels.
+constexpr uint8_t min_switch_conversions() {
+  uint8_t result = 0;
+  for (uint8_t c = 0; c < kNumChannels && kNumChannels > 1; c++) {
+    if (result == 0 || kChannels[c].conversions < result) {
+      result = kChannels[c].conversions;
+    }
+  }
+  for (uint8_t c = 0; c < kNumBurstChannels && kHasBursts; c++) {
+    if (result == 0 || kBurstChannels[c].conversions < result) {
+      result = kBurstChannels[c].conversions;
+    }
+  }
+  return result;
+}
 
-  irq_half_count++;
+// For validating the data rates that are set at run time.
+constexpr adc_sequence::PointTiming kPointTiming = {
+    .conversion_mode = kMode.conversion_mode,
+    .usecs_per_point = kUsecsPerPoint,
+    .transfer_usecs = kDmaTransferUsecsPerPoint,
+    .start_delay_usecs = kConversionStartDelayUsecs,
+    .min_switch_conversions = min_switch_conversions()};
+static_assert(adc_sequence::validate_data_rate(kMode.reg_mode0,
+                                               kPointTiming) == nullptr);
+
+// Valid values of the reference (0x06) and PGA (0x10) registers.
+constexpr bool is_valid_reg_ref(uint8_t val) { return (val & 0xe0) == 0; }
+constexpr bool is_valid_reg_pga(uint8_t val) { return (val & 0x78) == 0; }
+
+// A request to change the settings of a card and restart its
+// acquisition. Passed by value from the host link rx task to the card's
+// task.
+struct ConfigRequest {
+  uint32_t cmd_id;
+  uint8_t reg_mode0;
+  // The channels to change. Others keep their settings.
+  uint8_t num_channels;
+  struct {
+    char chan_id[4];
+    uint8_t ref;
+    uint8_t pga;
+  } channels[kNumChannels + kNumBurstChannels];
+};
 
-  // In one time transfer we ignore the half complete since
-  // we want to transfer the entire buffer before we stop
-  // the DMA.
-  if (state != DMA_STATE_ONE_SHOT) {
-    BaseType_t task_woken = pdFALSE;
-    IrqEvent event = {.id = EVENT_HALF_COMPLETE,
-                      .isr_millis = time_util::millis_from_isr()};
-    if (!irq_event_queue.add_from_isr(event, &task_woken)) {
-      // Comment this out for debugging with breakpoints
-      error_handler::Panic(52);
+// The hardware of a card.
+struct AdcCardHardware {
+  SPI_HandleTypeDef *const hspi;
+  // The SPI TX DMA. Its DMAMUX request generator is synchronized with
+  // the CS timer.
+  DMA_HandleTypeDef *const hdma_tx;
+  // A 1Mhz timer whose PWM output acts as the ADC CS.
+  TIM_HandleTypeDef *const htim_cs;
+  const uint32_t tim_cs_channel;
+};
+
+// A single ADS1261 card. Each card has its own SPI, DMA and CS timer,
+// its own task and its own stream of log packets. All the cards use
+// the acquisition sequence of adc_card_config.h.
+class AdcCard : public TaskBody {
+ public:
+  // The card's channel ids are the ids of adc_card_config.h with their
+  // trailing digit advanced by chan_id_offset. E.g. with offset 3, lc1
+  // and tm1 become lc4 and tm4. capture is the pre trigger capture of
+  // the card, or null for none. dma_buffers should be in the DMA memory.
+  AdcCard(const char *name, const AdcCardHardware &hardware,
+          uint8_t chan_id_offset, adc_capture::Capture *capture,
+          AdcDmaBuffers *dma_buffers);
+
+  // Prevent copy and assignment.
+  AdcCard(const AdcCard &other) = delete;
+  AdcCard &operator=(const AdcCard &other) = delete;
+
+  void dump_state();
+  void verify_static_registers_values();
+
+  // Called from the host link rx task with a validated request. Returns
+  // PENDING if the request was passed to the card's task which will send
+  // the response.
+  PacketStatus request_configuration(const ConfigRequest &request);
+
+  // True if the card has a reported channel with this id.
+  bool has_channel(const char *chan_id) const;
+
+  // Called from other tasks to trigger a dump of the capture around the
+  // given time, or to change the capture triggers. Applied by the
+  // card's task on the next half. Return false if the card has no
+  // capture.
+  bool request_capture_trigger(uint32_t t_micros,
+                               adc_capture::TriggerSource source);
+  bool request_capture_triggers(const adc_capture::Triggers &triggers);
+
+ private:
+  // Max number of cards, for the ISR dispatch table.
+  static constexpr uint8_t kMaxCards = 4;
+
+  const char *const _name;
+  const AdcCardHardware _hw;
+
+  // The ids of the channels of this card. Null for the burst settling
+  // entries.
+  char _chan_ids[kNumChannels][4] = {};
+  char _burst_chan_ids[kNumBurstChannels][4] = {};
+
+  // The current settings. Initialized from adc_card_config.h and
+  // changed by configuration requests. Accessed by the card's task only.
+  uint8_t _reg_mode0 = kMode.reg_mode0;
+  ChannelSpec _channels[kNumChannels];
+  ChannelSpec _burst_channels[kNumBurstChannels];
+
+  // Pending configuration requests. The rx task also wakes up the
+  // card's task through the irq events channel.
+  StaticQueue<ConfigRequest, 1> _config_requests_queue;
+
+  // For the configuration responses. Accessed by the card's task only.
+  SerialPacketsData _response_data;
+
+  // The number of settings reports that were written to the log stream
+  // since the acquisition was (re)started. Accessed by the card's task
+  // only.
+  uint8_t _settings_reports_written = 0;
+
+  // The DMA buffers of the card, in its AdcDmaBuffers.
+  uint8_t (&_rx_segments)[kNumDmaRxSegments][kDmaBytesPerHalf];
+  uint8_t (&_plain_tx_half)[kDmaBytesPerHalf];
+  uint8_t (&_burst_tx_half)[kTxImageSize];
+  uint8_t (&_one_shot_tx_buffer)[kDmaBytesPerPoint];
+
+  // The filter states of the channels. Accessed by the adc task only.
+  adc_dsp::FilterState _filter_states[kNumChannels];
+  adc_dsp::FilterState _burst_filter_states[kNumBurstChannels];
+
+  // The time model of the DMA halves. Fits the points rate of the CS
+  // timer against the usecs time base and smooths the interrupt latency
+  // out of the packet times. Accessed by the adc task only.
+  SampleClock _sample_clock;
+
+  // For the filtered values of a channel in a half.
+  int32_t _filtered_values[kDmaPointsPerHalf];
+
+  // The pre trigger capture. Null if none. Accessed by the card's task
+  // only.
+  adc_capture::Capture *const _capture;
+
+  // For the values of a dump packet.
+  uint8_t _dump_values[kMaxDumpSamplesPerPacket *
+                       adc_capture::kBytesPerSample];
+
+  // Capture requests from other tasks. Protected by a critical section.
+  adc_capture::TriggerSource _pending_trigger_source =
+      adc_capture::TriggerSource::NONE;
+  uint32_t _pending_trigger_micros = 0;
+  bool _has_pending_triggers = false;
+  adc_capture::Triggers _pending_triggers;
+
+  // Tells if the TX memory 0, 1 points to the burst image. Accessed by
+  // the ISR only, once the DMA is continuous.
+  bool _tx_half_has_burst[2] = {};
+
+  // The info of the halves in the RX segments, by segment index.
+  Segment _segments[kNumDmaRxSegments];
+  // The segments that were passed to the task and not yet released.
+  // Set by the ISR and cleared by the task.
+  volatile bool _segment_with_task[kNumDmaRxSegments] = {};
+  // The segments of the RX memory 0, 1. Accessed by the ISR only, once
+  // the DMA is continuous.
+  uint32_t _dma_segment[2] = {};
+  // Where the ISR starts searching for a free segment. Accessed by the
+  // ISR only.
+  uint32_t _next_free_segment = 0;
+  volatile uint32_t _segments_written = 0;
+  volatile uint32_t _segments_released = 0;
+
+  // The sequence number of the next DMA half and the completion time of
+  // the previous one. Accessed by the ISR only.
+  uint32_t _next_dma_seq = 0;
+  uint32_t _last_half_end_micros = 0;
+
+  // The sequence number the task expects in the next segment. Accessed
+  // by the adc task only.
+  uint32_t _next_expected_seq = 0;
+
+  // The completion ISRs pass event to the worker thread using
+  // this channel. There is at most one pending event per segment, plus
+  // the one shot event.
+  StaticNotifyChannel<IrqEvent, kNumDmaSegments + 1> _irq_event_queue;
+
+  volatile DmaState _state = DMA_STATE_IDLE;
+
+  // We detect in setup() of the card exists and fall gracefully if not.
+  bool _hardware_found = false;
+
+  // General stats.
+  volatile uint32_t _bursts_count = 0;
+  volatile uint32_t _irq_half_count = 0;
+  volatile uint32_t _irq_full_count = 0;
+  volatile uint32_t _irq_dma_count = 0;
+  volatile uint32_t _irq_error_count = 0;
+  volatile uint32_t _event_segment_count = 0;
+  // Halves that were not delivered to the task since all the segments
+  // were in use.
+  volatile uint32_t _dropped_halves_count = 0;
+  // Gaps of halves whose completion interrupts were missed, e.g. due to
+  // a long interrupt latency. Their data was overwritten.
+  volatile uint32_t _overruns_count = 0;
+  // Max number of segments in use.
+  volatile uint32_t _max_segments_in_use = 0;
+
+  // The counters values that were reported in the log stream. Accessed
+  // by the adc task only.
+  uint32_t _reported_dropped_halves_count = 0;
+  uint32_t _reported_overruns_count = 0;
+  uint32_t _reported_clock_windows_count = 0;
+
+  // For diagnostics. Used to verify that the static registers
+  // in the ADC where not mutated, e.g. due to noise on the bus.
+  uint8_t _regs_values[kNumRegsInfo] = {};
+
+  // The ISR dispatch table. Cards are added in setup().
+  static AdcCard *_isr_cards[kMaxCards];
+  static uint8_t _num_isr_cards;
+
+  // ISR handlers that are shared by all cards.
+  static void spi_TxRxHalfCpltCallbackIsr(SPI_HandleTypeDef *hspi);
+  static void spi_TxRxCpltCallbackIsr(SPI_HandleTypeDef *hspi);
+  static void spi_ErrorCallbackIsr(SPI_HandleTypeDef *hspi);
+  static void dma_rx_m0_complete_isr(DMA_HandleTypeDef *hdma);
+  static void dma_rx_m1_complete_isr(DMA_HandleTypeDef *hdma);
+  static void dma_error_isr(DMA_HandleTypeDef *hdma);
+
+  // Maps hspi to a card. Panic if not found.
+  static inline AdcCard *isr_hspi_to_card(const SPI_HandleTypeDef *hspi);
+
+  // Card specific ISR handlers.
+  void on_half_complete_isr();
+  void on_full_complete_isr();
+  void update_tx_half_from_isr(uint32_t memory, uint32_t seq);
+  void on_rx_half_from_isr(uint32_t memory);
+
+  void set_dma_request_generator(uint32_t num_transfers_per_sync);
+  void spi_send_one_shot(const uint8_t *cmd, uint16_t num_bytes);
+  void cmd_reset();
+  uint8_t one_shot_cmd_read_register(uint8_t reg_index);
+  void one_shot_cmd_write_register(uint8_t reg_index, uint8_t val);
+  void start_double_buffer_dma();
+  void start_continuos_DMA();
+  void stop_continuos_DMA();
+  void configure(const ConfigRequest &request);
+  uint8_t static_reg_value(const RegisterInfo &reg_info) const;
+  bool write_settings_report(SerialPacketsData *packet_data);
+  void configure_timing();
+  void setup();
+  void write_channel_values(SerialPacketsData *packet_data,
+                            const char *chan_id, const ChannelSpec &chan_spec,
+                            adc_dsp::FilterState *filter_state,
+                            uint32_t base_usecs, uint32_t first_point,
+                            uint32_t points_stride, uint32_t num_samples,
+                            const uint8_t *segment_points);
+  void process_channel_alarms(const char *chan_id, const uint8_t *points,
+                              uint32_t first_point_micros,
+                              uint32_t first_point, uint32_t points_stride,
+                              uint32_t num_samples);
+  void update_capture(const uint8_t *points, uint32_t first_point_micros,
+                      uint32_t main_cycles);
+  void write_dump_packets(uint32_t ref_millis);
+  void process_segment(const Segment &segment, const uint8_t *points);
+
+  // Implementation of TaskBody parent
+  void task_body();
+};
+
+AdcCard *AdcCard::_isr_cards[kMaxCards] = {};
+uint8_t AdcCard::_num_isr_cards = 0;
+
+// Advances the trailing digit of a channel id.
+static void offset_chan_id(const char *chan_id, uint8_t offset,
+                           char result[4]) {
+  if (strlen(chan_id) != 3) {
+    error_handler::Panic(168);
+  }
+  memcpy(result, chan_id, 4);
+  const int digit = (chan_id[2] - '0') + offset;
+  // Channel ids are [a-z0-9]{3}.
+  if (chan_id[2] < '0' || chan_id[2] > '9' || digit > 9) {
+    error_handler::Panic(169);
+  }
+  result[2] = (char)('0' + digit);
+}
+
+AdcCard::AdcCard(const char *name, const AdcCardHardware &hardware,
+                 uint8_t chan_id_offset, adc_capture::Capture *capture,
+                 AdcDmaBuffers *dma_buffers)
+    : _name(name),
+      _hw(hardware),
+      _rx_segments(dma_buffers->rx),
+      _plain_tx_half(dma_buffers->plain_tx),
+      _burst_tx_half(dma_buffers->burst_tx),
+      _one_shot_tx_buffer(dma_buffers->one_shot_tx),
+      _sample_clock(kDmaPointsPerHalf * kUsecsPerPoint,
+                    kHalvesPerClockUpdate),
+      _capture(capture) {
+  for (uint8_t c = 0; c < kNumChannels; c++) {
+    offset_chan_id(kChannels[c].chan_id, chan_id_offset, _chan_ids[c]);
+    _channels[c] = kChannels[c];
+  }
+  for (uint8_t c = 0; c < kNumBurstChannels; c++) {
+    _burst_channels[c] = kBurstChannels[c];
+    if (kHasBursts && kBurstChannels[c].chan_id) {
+      offset_chan_id(kBurstChannels[c].chan_id, chan_id_offset,
+                     _burst_chan_ids[c]);
+    }
+  }
+}
+
+// Called from ISR to map the hspi to a card.
+inline AdcCard *AdcCard::isr_hspi_to_card(const SPI_HandleTypeDef *hspi) {
+  for (uint8_t i = 0; i < _num_isr_cards; i++) {
+    if (_isr_cards[i]->_hw.hspi == hspi) {
+      return _isr_cards[i];
     }
-    portYIELD_FROM_ISR(task_woken)
   }
+  error_handler::Panic(171);
 }
 
-// Called when the second half of rx_buffer is ready for processing.
-void spi_TxRxCpltCallbackIsr(SPI_HandleTypeDef *hspi) {
+// Dispatch the shared ISRs to the specific card.
+ITCM_CODE void AdcCard::spi_TxRxHalfCpltCallbackIsr(
+    SPI_HandleTypeDef *hspi) {
+  isr_hspi_to_card(hspi)->on_half_complete_isr();
+}
+
+ITCM_CODE void AdcCard::spi_TxRxCpltCallbackIsr(
+    SPI_HandleTypeDef *hspi) {
+  isr_hspi_to_card(hspi)->on_full_complete_isr();
+}
+
+void AdcCard::spi_ErrorCallbackIsr(SPI_HandleTypeDef *hspi) {
   // trap();
 
-  irq_full_count++;
+  isr_hspi_to_card(hspi)->_irq_error_count++;
+}
 
-  // If trasfering a one time transaction, we shut off the
-  // DMA transfer once the first transfer is completed.
-  if (state == DMA_STATE_ONE_SHOT) {
-    HAL_SPI_Abort(&hspi1);
-    state = DMA_STATE_IDLE;
+// The DMA callbacks of the continuous mode. The DMA handle's parent
+// is the SPI handle.
+ITCM_CODE void AdcCard::dma_rx_m0_complete_isr(DMA_HandleTypeDef *hdma) {
+  isr_hspi_to_card((SPI_HandleTypeDef *)hdma->Parent)->on_rx_half_from_isr(0);
+}
+
+ITCM_CODE void AdcCard::dma_rx_m1_complete_isr(DMA_HandleTypeDef *hdma) {
+  isr_hspi_to_card((SPI_HandleTypeDef *)hdma->Parent)->on_rx_half_from_isr(1);
+}
+
+void AdcCard::dma_error_isr(DMA_HandleTypeDef *hdma) {
+  isr_hspi_to_card((SPI_HandleTypeDef *)hdma->Parent)->_irq_error_count++;
+}
+
+// Called from the ISR after the DMA completed the half of the TX memory
+// 0, 1 and before it gets back to it. Points the memory to the TX image
+// of its next half, two halves from now.
+void AdcCard::update_tx_half_from_isr(uint32_t memory, uint32_t seq) {
+  const bool needs_burst = ((seq + 2) % kHalvesPerBurst) == 0;
+  if (needs_burst == _tx_half_has_burst[memory]) {
+    return;
   }
+  HAL_DMAEx_ChangeMemory(
+      _hw.hdma_tx, (uint32_t)(needs_burst ? _burst_tx_half : _plain_tx_half),
+      memory ? MEMORY1 : MEMORY0);
+  _tx_half_has_burst[memory] = needs_burst;
+  if (needs_burst) {
+    _bursts_count++;
+  }
+}
+
+// Called in continuous mode when the half of the RX memory 0, 1 is
+// completed. Passes its segment to the adc task and points the memory
+// to a free segment. The DMA continues with the other memory meanwhile.
+ITCM_CODE void AdcCard::on_rx_half_from_isr(uint32_t memory) {
+  _irq_dma_count++;
+  const uint32_t isr_micros = time_util::micros();
+
+  // The completion time of the half, from the progress of the DMA in
+  // the next one. Unlike the ISR time, it doesn't depend on the
+  // interrupt latency.
+  const uint32_t next_half_points =
+      (kDmaBytesPerHalf - __HAL_DMA_GET_COUNTER(_hw.hspi->hdmarx)) /
+      kDmaBytesPerPoint;
+  const uint32_t half_end_micros =
+      isr_micros - next_half_points * kUsecsPerPoint;
+
+  // The number of halves that completed since the previous interrupt is
+  // more than one if interrupts were missed. The memories were reused
+  // meanwhile so the segment has the last of them. The count from the
+  // completion times is confirmed by the memory that completed, since
+  // memory 0 completes the even halves and memory 1 the odd ones.
+  uint32_t seq = _next_dma_seq;
+  if (seq > 0) {
+    uint32_t halves =
+        (half_end_micros - _last_half_end_micros + kUsecsPerHalf / 2) /
+        kUsecsPerHalf;
+    if (halves < 1) {
+      halves = 1;
+    }
+    if (((seq + halves - 1) & 1) != memory) {
+      // Off by one. A late interrupt is not a missed half.
+      halves = (halves == 1) ? 2 : halves - 1;
+    }
+    if (halves > 1) {
+      _overruns_count++;
+      seq += halves - 1;
+    }
+  }
+  _next_dma_seq = seq + 1;
+  _last_half_end_micros = half_end_micros;
+
+  const bool has_burst = _tx_half_has_burst[memory];
+  if (kHasBursts) {
+    update_tx_half_from_isr(memory, seq);
+  }
+
+  // Find a free segment for the memory. The segment of the other memory
+  // is in use by the DMA.
+  const uint32_t segment_index = _dma_segment[memory];
+  uint32_t free_segment = kNumDmaRxSegments;
+  for (uint32_t i = 0; i < kNumDmaRxSegments; i++) {
+    const uint32_t candidate = (_next_free_segment + i) % kNumDmaRxSegments;
+    if (candidate != segment_index && candidate != _dma_segment[1 - memory] &&
+        !_segment_with_task[candidate]) {
+      free_segment = candidate;
+      break;
+    }
+  }
+  if (free_segment >= kNumDmaRxSegments) {
+    // The task is behind. The memory keeps its segment and the half is
+    // overwritten. The sequence gap tells the task about it.
+    _dropped_halves_count++;
+    return;
+  }
+  HAL_DMAEx_ChangeMemory(_hw.hspi->hdmarx,
+                         (uint32_t)_rx_segments[free_segment],
+                         memory ? MEMORY1 : MEMORY0);
+  _dma_segment[memory] = free_segment;
+  _next_free_segment = (free_segment + 1) % kNumDmaRxSegments;
+
+  const uint32_t in_use = _segments_written - _segments_released;
+  if (in_use >= _max_segments_in_use) {
+    _max_segments_in_use = in_use + 1;
+  }
+
+  Segment &segment = _segments[segment_index];
+  segment.seq = seq;
+  segment.isr_millis = time_util::millis_from_isr();
+  segment.isr_micros = isr_micros;
+  segment.has_burst = has_burst;
+  _segment_with_task[segment_index] = true;
+  _segments_written++;
 
   BaseType_t task_woken = pdFALSE;
-  IrqEvent event = {.id = EVENT_FULL_COMPLETE,
-                    .isr_millis = time_util::millis_from_isr()};
-  if (!irq_event_queue.add_from_isr(event, &task_woken)) {
+  IrqEvent event = {
+      .id = EVENT_SEGMENT_READY, .seq = seq, .segment = segment_index};
+  if (!_irq_event_queue.add_from_isr(event, &task_woken)) {
     // Comment this out for debugging with breakpoints
-    error_handler::Panic(53);
+    error_handler::Panic(52);
   }
   portYIELD_FROM_ISR(task_woken)
 }
 
-void spi_ErrorCallbackIsr(SPI_HandleTypeDef *hspi) {
+// Called by the SPI in one shot transfers.
+ITCM_CODE void AdcCard::on_half_complete_isr() {
+  // error_handler::Panic(322);
+
+  // In one time transfer we ignore the half complete since
+  // we want to transfer the entire buffer before we stop
+  // the DMA.
+  _irq_half_count++;
+}
+
+// Called by the SPI when a one shot transfer is completed.
+ITCM_CODE void AdcCard::on_full_complete_isr() {
   // trap();
 
-  irq_error_count++;
+  _irq_full_count++;
+
+  BaseType_t task_woken = pdFALSE;
+
+  // If trasfering a one time transaction, we shut off the
+  // DMA transfer once the first transfer is completed.
+  if (_state == DMA_STATE_ONE_SHOT) {
+    HAL_SPI_Abort(_hw.hspi);
+    _state = DMA_STATE_IDLE;
+  }
+
+  IrqEvent event = {.id = EVENT_ONE_SHOT_COMPLETE, .seq = 0, .segment = 0};
+  if (!_irq_event_queue.add_from_isr(event, &task_woken)) {
+    // Comment this out for debugging with breakpoints
+    error_handler::Panic(53);
+  }
+  portYIELD_FROM_ISR(task_woken)
 }
 
 // Set up the DMA MUX request generator which controls how many
-// transfers (bytes in out case) are done on each TIM12 PWM
+// transfers (bytes in out case) are done on each CS timer PWM
 // sync which we use as a repeating ADC CS.
-static void set_dma_request_generator(uint32_t num_transfers_per_sync) {
-  if (state != DMA_STATE_IDLE) {
+void AdcCard::set_dma_request_generator(uint32_t num_transfers_per_sync) {
+  if (_state != DMA_STATE_IDLE) {
     error_handler::Panic(31);
   }
 
   // Set tx DMA request generator.
 
   // A workaround to reset the request generator.
-  CLEAR_BIT(hdma_spi1_tx.DMAmuxChannel->CCR, (DMAMUX_CxCR_SE));
+  CLEAR_BIT(_hw.hdma_tx->DMAmuxChannel->CCR, (DMAMUX_CxCR_SE));
 
   const uint32_t mask = DMAMUX_CxCR_NBREQ_Msk;
-  MODIFY_REG(hdma_spi1_tx.DMAmuxChannel->CCR, mask,
+  MODIFY_REG(_hw.hdma_tx->DMAmuxChannel->CCR, mask,
              (num_transfers_per_sync - 1U) << DMAMUX_CxCR_NBREQ_Pos);
 
-  SET_BIT(hdma_spi1_tx.DMAmuxChannel->CCR, (DMAMUX_CxCR_SE));
+  SET_BIT(_hw.hdma_tx->DMAmuxChannel->CCR, (DMAMUX_CxCR_SE));
 }
 
 // Blocks the calling task until completion. Recieved bytes are returned
-// in rx_buffer.
-static void spi_send_one_shot(const uint8_t *cmd, uint16_t num_bytes) {
-  if (state != DMA_STATE_IDLE) {
+// in the first RX segment.
+void AdcCard::spi_send_one_shot(const uint8_t *cmd, uint16_t num_bytes) {
+  if (_state != DMA_STATE_IDLE) {
     error_handler::Panic(32);
   }
 
   // logger.info("ADC: Sending SPI one shot (%hu bytes)", num_bytes);
-  if (num_bytes > sizeof(rx_buffer)) {
+  if (num_bytes > sizeof(_rx_segments[0])) {
     error_handler::Panic(33);
   }
+  if (num_bytes > sizeof(_one_shot_tx_buffer)) {
+    error_handler::Panic(188);
+  }
+  memcpy(_one_shot_tx_buffer, cmd, num_bytes);
 
   // For determinism.
-  memset(rx_buffer, 0, num_bytes);
-
-  // irq_event_queue.reset();
+  memset(_rx_segments[0], 0, num_bytes);
 
   set_dma_request_generator(num_bytes);
-  // continious_DMA = false;
-  irq_event_queue.reset();
+  _irq_event_queue.reset();
 
-  state = DMA_STATE_ONE_SHOT;
+  _state = DMA_STATE_ONE_SHOT;
   const HAL_StatusTypeDef status =
-      HAL_SPI_TransmitReceive_DMA(&hspi1, cmd, rx_buffer, num_bytes);
+      HAL_SPI_TransmitReceive_DMA(_hw.hspi, _one_shot_tx_buffer,
+                                  _rx_segments[0], num_bytes);
   if (status != HAL_StatusTypeDef::HAL_OK) {
     error_handler::Panic(34);
   }
 
+  // Configuration wake ups are absorbed by the channel. The pending
+  // requests are processed once the task is idle anyway.
   IrqEvent event;
-  if (!irq_event_queue.consume_from_task(&event, 300)) {
+  if (!_irq_event_queue.consume_from_task(&event, 300)) {
     error_handler::Panic(35);
   }
 
   // We expect the IRQ handler that aborted the DMA to also
   // set the state to IDLE.
-  if (state != DMA_STATE_IDLE) {
+  if (_state != DMA_STATE_IDLE) {
     error_handler::Panic(36);
   }
 
   // logger.info("IRQ event: %d", event.id);
-  if (event.id != IrqEventId::EVENT_FULL_COMPLETE) {
+  if (event.id != IrqEventId::EVENT_ONE_SHOT_COMPLETE) {
     error_handler::Panic(37);
   }
 }
 
-void cmd_reset() {
+void AdcCard::cmd_reset() {
   static const uint8_t cmd[] = {0x06, 0x00};
   spi_send_one_shot(cmd, sizeof(cmd));
 
-  // Since commands are done at a TIM12 intervals, we don't
+  // Since commands are done at a CS timer intervals, we don't
   // need to insert a ~50us delay here as called by the datasheet.
 }
 
-uint8_t one_shot_cmd_read_register(uint8_t reg_index) {
+uint8_t AdcCard::one_shot_cmd_read_register(uint8_t reg_index) {
   if (reg_index > 18) {
     error_handler::Panic(38);
   }
   const uint8_t cmd_code = (uint8_t)0x20 | reg_index;
   const uint8_t cmd[] = {cmd_code, 0x0, 0x0};
   spi_send_one_shot(cmd, sizeof(cmd));
-  return rx_buffer[2];
+  return _rx_segments[0][2];
 }
 
-void one_shot_cmd_write_register(uint8_t reg_index, uint8_t val) {
+void AdcCard::one_shot_cmd_write_register(uint8_t reg_index, uint8_t val) {
   if (reg_index > 18) {
     error_handler::Panic(39);
   }
@@ -321,150 +942,341 @@ void one_shot_cmd_write_register(uint8_t reg_index, uint8_t val) {
   spi_send_one_shot(cmd, sizeof(cmd));
 }
 
-// Bfr3 points to three bytes with ADC value.
-int32_t decode_int24(const uint8_t *bfr3) {
-  const uint32_t sign_extension = (bfr3[0] & 0x80) ? 0xff000000 : 0x00000000;
-  const uint32_t value = sign_extension | ((uint32_t)bfr3[0]) << 16 |
-                         ((uint32_t)bfr3[1]) << 8 | ((uint32_t)bfr3[2]) << 0;
-  return (int32_t)value;
+// Starts the SPI transfer of the continuous mode, same as
+// HAL_SPI_TransmitReceive_DMA() but with the RX and TX DMA streams in
+// double buffer mode. The ISR switches the memories between the
+// segments and the TX images. The SPI transfer is endless (TSIZE = 0).
+// Stopped with HAL_SPI_Abort().
+void AdcCard::start_double_buffer_dma() {
+  SPI_HandleTypeDef *const hspi = _hw.hspi;
+  if (hspi->State != HAL_SPI_STATE_READY) {
+    error_handler::Panic(189);
+  }
+  hspi->State = HAL_SPI_STATE_BUSY_TX_RX;
+  hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+  SPI_2LINES(hspi);
+  CLEAR_BIT(hspi->Instance->CFG1, SPI_CFG1_TXDMAEN | SPI_CFG1_RXDMAEN);
+
+  DMA_HandleTypeDef *const hdmarx = hspi->hdmarx;
+  hdmarx->XferHalfCpltCallback = nullptr;
+  hdmarx->XferM1HalfCpltCallback = nullptr;
+  hdmarx->XferCpltCallback = dma_rx_m0_complete_isr;
+  hdmarx->XferM1CpltCallback = dma_rx_m1_complete_isr;
+  hdmarx->XferErrorCallback = dma_error_isr;
+  hdmarx->XferAbortCallback = nullptr;
+  if (HAL_OK != HAL_DMAEx_MultiBufferStart_IT(
+                    hdmarx, (uint32_t)&hspi->Instance->RXDR,
+                    (uint32_t)_rx_segments[_dma_segment[0]],
+                    (uint32_t)_rx_segments[_dma_segment[1]],
+                    kDmaBytesPerHalf)) {
+    error_handler::Panic(43);
+  }
+  SET_BIT(hspi->Instance->CFG1, SPI_CFG1_RXDMAEN);
+
+  // The TX completions are tracked by the RX ones.
+  DMA_HandleTypeDef *const hdmatx = hspi->hdmatx;
+  hdmatx->XferHalfCpltCallback = nullptr;
+  hdmatx->XferM1HalfCpltCallback = nullptr;
+  hdmatx->XferCpltCallback = nullptr;
+  hdmatx->XferM1CpltCallback = nullptr;
+  hdmatx->XferErrorCallback = dma_error_isr;
+  hdmatx->XferAbortCallback = nullptr;
+  if (HAL_OK != HAL_DMAEx_MultiBufferStart_IT(
+                    hdmatx, (uint32_t)_plain_tx_half,
+                    (uint32_t)&hspi->Instance->TXDR,
+                    (uint32_t)_plain_tx_half, kDmaBytesPerHalf)) {
+    error_handler::Panic(190);
+  }
+  MODIFY_REG(hspi->Instance->CR2, SPI_CR2_TSIZE, 0UL);
+  SET_BIT(hspi->Instance->CFG1, SPI_CFG1_TXDMAEN);
+
+  __HAL_SPI_ENABLE_IT(hspi,
+                      (SPI_IT_OVR | SPI_IT_UDR | SPI_IT_FRE | SPI_IT_MODF));
+  __HAL_SPI_ENABLE(hspi);
+  if (hspi->Init.Mode == SPI_MODE_MASTER) {
+    SET_BIT(hspi->Instance->CR1, SPI_CR1_CSTART);
+  }
 }
 
 // Assuming cs is pulsing.
-void start_continuos_DMA() {
-  if (state != DMA_STATE_IDLE) {
+void AdcCard::start_continuos_DMA() {
+  if (_state != DMA_STATE_IDLE) {
     error_handler::Panic(41);
   }
 
-  // Confirm the assumptions used the code below.
-  static_assert(kDmaNumTemperatureChans == 3);
-  static_assert(kDmaBytesPerPoint == 16);
-  static_assert(kDmaRxDataOffsetInPoint == 2);
-  static_assert(kDmaRegValOffsetInPoint == 7);
-  static_assert(kDmaCyclesPerHalf * kDmaPointsPerCycle * kDmaBytesPerPoint ==
-                kDmaBytesPerHalf);
-  static_assert(2 * kDmaBytesPerHalf == sizeof(tx_buffer));
-  static_assert(sizeof(tx_buffer) == sizeof(rx_buffer));
-
-  uint8_t *p = tx_buffer;
-  // Populate the first half of the TX buffer.
-  for (uint32_t cycle = 0; cycle < kDmaCyclesPerHalf; cycle++) {
-    for (uint32_t slot = 0; slot < kDmaSlotsPerCycle; slot++) {
-      for (uint32_t pt = 0; pt < kDmaPointsPerSlot; pt++) {
-        // On each point, we also read the next register. For diagnostic.
-        const uint32_t pt_global_index =
-            (cycle * kDmaPointsPerCycle) + (slot * kDmaPointsPerSlot) + pt;
-        const uint8_t reg_index = pt_global_index % kNumRegsInfo;
-
-        // Determine if next point is a load cell or temp.
-        const bool next_point_is_loadcell = pt != (kDmaPointsPerSlot - 2);
-
-        // Reference selection.
-        // Load cell: (ain0 - ain1)
-        // Temperature: (avdd - avss)
-        const uint8_t reg_0x06_val = next_point_is_loadcell ? 0x0a : 0x05;
-
-        // PGA selection.
-        // Load cell: x128 gain.
-        // Temperature: disabled.
-        const uint8_t reg_0x10_val = next_point_is_loadcell ? 0x07 : 0x00;
-
-        // Input selection.
-        // Load cell: (ain1 - ain0)
-        // Temperature 1: (ain4 - ain5)
-        // Temperature 2: (ain6 - ain7)
-        // Temperature 3: (ain8 - ain9)
-
-        const uint8_t reg_0x11_val = next_point_is_loadcell ? 0x34
-                                     : (slot == 0)          ? 0x56
-                                     : (slot == 1)          ? 0x78
-                                                            : 0x9a;
-
-        // RDATA: Read data of previous conversion.
-        *p++ = 0x12;
-        *p++ = 0x00;  // Dummy.
-        *p++ = 0x00;  // Read data byte 1 (MSB) (kRxDataOffsetInPoint)
-        *p++ = 0x00;  // Read data byte 2
-        *p++ = 0x00;  // Read data byte 3 (LSB)
-
-        // Read the next static register, for diagnostic.
-        *p++ = (uint8_t)0x20 | reg_index;
-        *p++ = 0x00;  // Dummy byte
-        *p++ = 0x00;  // Read value
-
-        // Set and start next converstion.
-        // WREG: Write to reg 0x06 (reference selection)
-        *p++ = (uint8_t)0x40 | 0x06;
-        *p++ = reg_0x06_val;
-        // WREG:  Write to reg 0x10 (gain selection)
-        *p++ = (uint8_t)0x40 | 0x10;
-        *p++ = reg_0x10_val;  //
-        // WREG: Write to reg 0x11 (input selection)
-        *p++ = (uint8_t)0x40 | 0x11;
-        *p++ = reg_0x11_val;
-        // START: Start next conversion.
-        *p++ = 0x08;
-        *p++ = 0x00;  // Dummy byte.
-      }
-    }
-  }
+  // Populate the TX image of a half. On each point, we also read the
+  // next register, for diagnostic.
+  const uint32_t tx_bytes =
+      adc_sequence::build_tx_half(kPlan, _channels, kDmaCyclesPerHalf,
+                                  kNumRegsInfo, _plain_tx_half,
+                                  kMode.conversion_mode);
 
-  // We expect to be here exactly past the first half.
-  if (p != (&tx_buffer[kDmaBytesPerHalf])) {
+  // We expect to fill exactly a half.
+  if (tx_bytes != kDmaBytesPerHalf) {
     error_handler::Panic(42);
   }
 
-  // Copy the first half to second half.
-  memcpy(&tx_buffer[kDmaBytesPerHalf], tx_buffer, kDmaBytesPerHalf);
-
-  // Issue the last command in the TX buffer to start
-  // the first conversion.
-  spi_send_one_shot(&tx_buffer[sizeof(tx_buffer) - kDmaBytesPerPoint],
-                    kDmaBytesPerPoint);
+  if (kHasBursts) {
+    const uint32_t n = adc_sequence::build_tx_burst_half(
+        kPlan, _channels, kBurstPlan, _burst_channels, kDmaCyclesPerHalf,
+        kNumRegsInfo, _burst_tx_half, kMode.conversion_mode);
+    if (n != kDmaBytesPerHalf) {
+      error_handler::Panic(164);
+    }
+  }
+  for (auto &filter_state : _filter_states) {
+    filter_state.reset();
+  }
+  for (auto &filter_state : _burst_filter_states) {
+    filter_state.reset();
+  }
+  _sample_clock.reset();
+  // The captured samples of the previous settings are dropped.
+  if (_capture) {
+    _capture->reset();
+  }
+  // The first two halves are without a burst, in the first two
+  // segments.
+  _tx_half_has_burst[0] = false;
+  _tx_half_has_burst[1] = false;
+  _bursts_count = 0;
+  for (auto &with_task : _segment_with_task) {
+    with_task = false;
+  }
+  _dma_segment[0] = 0;
+  _dma_segment[1] = 1;
+  _next_free_segment = 2;
+
+  _next_dma_seq = 0;
+  _last_half_end_micros = 0;
+  _next_expected_seq = 0;
+  _segments_written = 0;
+  _segments_released = 0;
+  _dropped_halves_count = 0;
+  _overruns_count = 0;
+  _max_segments_in_use = 0;
+  _reported_dropped_halves_count = 0;
+  _reported_overruns_count = 0;
+  _reported_clock_windows_count = 0;
+  _settings_reports_written = 0;
+
+  // Configure and start the conversion of the first point.
+  uint8_t start_cmd[kDmaBytesPerPoint];
+  adc_sequence::write_tx_point(_channels[kPlan.point_channel[0]], true, 0,
+                               start_cmd);
+  spi_send_one_shot(start_cmd, sizeof(start_cmd));
 
   set_dma_request_generator(kDmaBytesPerPoint);
 
-  irq_event_queue.reset();
-  irq_error_count = 0;
-  irq_half_count = 0;
-  irq_full_count = 0;
+  _irq_event_queue.reset();
+  _irq_error_count = 0;
+  _irq_half_count = 0;
+  _irq_full_count = 0;
+  _irq_dma_count = 0;
 
-  state = DMA_STATE_CONTINUOS;
+  _state = DMA_STATE_CONTINUOS;
 
-  // Reset RX buffer for determinism.
-  memset(rx_buffer, 0, sizeof(rx_buffer));
+  // Reset the RX segments for determinism.
+  memset(_rx_segments, 0, sizeof(_rx_segments));
 
   // Start the continusons DMA. It is set to transfer kDmaBytesPerPoint
-  // bytes to the ADC SPI, on each high to low transition of TIM12 output
-  // which acts as SPI CS.
-  static_assert(sizeof(rx_buffer) == sizeof(tx_buffer));
-  const auto status = HAL_SPI_TransmitReceive_DMA(&hspi1, tx_buffer, rx_buffer,
-                                                  sizeof(tx_buffer));
-  if (HAL_OK != status) {
-    // dma_active = false;
-    error_handler::Panic(43);
+  // bytes to the ADC SPI, on each high to low transition of the CS
+  // timer output.
+  start_double_buffer_dma();
+
+  logger.info("%s: continuos DMA started.", _name);
+}
+
+// Stops the continuous DMA. The ADC keeps converting.
+void AdcCard::stop_continuos_DMA() {
+  if (_state != DMA_STATE_CONTINUOS) {
+    error_handler::Panic(174);
+  }
+  if (HAL_OK != HAL_SPI_Abort(_hw.hspi)) {
+    error_handler::Panic(175);
   }
+  // The ISR may have completed a last half meanwhile. Its segment and
+  // event are discarded by start_continuos_DMA(). The next one shot
+  // transfer restores the SPI callbacks of the DMA streams.
+  _state = DMA_STATE_IDLE;
+}
 
-  logger.info("ADC: continuos DMA started.");
+// Applies a validated configuration request, restarts the acquisition
+// and sends the response. The acquisition gap is a few points, mostly
+// waiting for the one shot commands.
+void AdcCard::configure(const ConfigRequest &request) {
+  const uint32_t start_micros = time_util::micros();
+  stop_continuos_DMA();
+
+  _reg_mode0 = request.reg_mode0;
+  for (uint8_t i = 0; i < request.num_channels; i++) {
+    const auto &chan = request.channels[i];
+    for (uint8_t c = 0; c < kNumChannels; c++) {
+      if (strcmp(_chan_ids[c], chan.chan_id) == 0) {
+        _channels[c].ref = chan.ref;
+        _channels[c].pga = chan.pga;
+      }
+    }
+    for (uint8_t c = 0; c < kNumBurstChannels; c++) {
+      if (strcmp(_burst_chan_ids[c], chan.chan_id) == 0) {
+        _burst_channels[c].ref = chan.ref;
+        _burst_channels[c].pga = chan.pga;
+      }
+    }
+  }
+  // The burst settling points follow the main channel with the same
+  // input.
+  for (uint8_t c = 0; c < kNumBurstChannels && kHasBursts; c++) {
+    if (_burst_chan_ids[c][0]) {
+      continue;
+    }
+    for (const ChannelSpec &main_channel : _channels) {
+      if (main_channel.inpmux == _burst_channels[c].inpmux) {
+        _burst_channels[c].ref = main_channel.ref;
+        _burst_channels[c].pga = main_channel.pga;
+      }
+    }
+  }
+
+  // The reference, PGA and input registers are set by the first point
+  // and by the TX images.
+  one_shot_cmd_write_register(kRegMode0Index, _reg_mode0);
+  start_continuos_DMA();
+
+  const uint32_t gap_usecs = time_util::micros() - start_micros;
+  logger.info("%s: configured MODE0 0x%02hx, restarted in %lu us.", _name,
+              _reg_mode0, gap_usecs);
+
+  _response_data.clear();
+  _response_data.write_uint32(gap_usecs);
+  host_link::client.sendResponse(request.cmd_id, PacketStatus::OK,
+                                 _response_data);
 }
 
-static void setup() {
-  if (!state == DMA_STATE_IDLE) {
+PacketStatus AdcCard::request_configuration(const ConfigRequest &request) {
+  if (!_hardware_found || _state != DMA_STATE_CONTINUOS) {
+    logger.error("%s: not running, ignoring configuration.", _name);
+    return PacketStatus::GENERAL_ERROR;
+  }
+  if (!_config_requests_queue.add_from_task(request, 0)) {
+    logger.error("%s: busy, dropping configuration.", _name);
+    return PacketStatus::TOO_MANY_COMMANDS;
+  }
+  // Wake up the card's task. It checks the requests queue whenever it
+  // runs out of segments.
+  _irq_event_queue.wake_up_from_task();
+  return PacketStatus::PENDING;
+}
+
+bool AdcCard::has_channel(const char *chan_id) const {
+  for (const auto &id : _chan_ids) {
+    if (strcmp(id, chan_id) == 0) {
+      return true;
+    }
+  }
+  for (const auto &id : _burst_chan_ids) {
+    if (id[0] && strcmp(id, chan_id) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AdcCard::request_capture_trigger(uint32_t t_micros,
+                                      adc_capture::TriggerSource source) {
+  if (!_capture) {
+    return false;
+  }
+  taskENTER_CRITICAL();
+  {
+    _pending_trigger_micros = t_micros;
+    _pending_trigger_source = source;
+  }
+  taskEXIT_CRITICAL();
+  return true;
+}
+
+bool AdcCard::request_capture_triggers(const adc_capture::Triggers &triggers) {
+  if (!_capture) {
+    return false;
+  }
+  taskENTER_CRITICAL();
+  {
+    _pending_triggers = triggers;
+    _has_pending_triggers = true;
+  }
+  taskEXIT_CRITICAL();
+  return true;
+}
+
+// The value of a static register, per the current settings.
+uint8_t AdcCard::static_reg_value(const RegisterInfo &reg_info) const {
+  return reg_info.idx == kRegMode0Index ? _reg_mode0 : reg_info.val;
+}
+
+// Sets the points rate and the SPI clock of the mode. Should be called
+// before the first SPI transfer.
+void AdcCard::configure_timing() {
+  // The CS timer PWM acts as the ADC CS. The new period takes effect on
+  // the next update event.
+  __HAL_TIM_SET_AUTORELOAD(_hw.htim_cs, kUsecsPerPoint - 1);
+  __HAL_TIM_SET_COMPARE(_hw.htim_cs, _hw.tim_cs_channel, kMode.cs_high_usecs);
+
+  // The SPI is disabled between transfers so we can change its clock.
+  _hw.hspi->Init.BaudRatePrescaler = kSpiBaudRatePrescaler;
+  MODIFY_REG(_hw.hspi->Instance->CFG1, SPI_CFG1_MBR, kSpiBaudRatePrescaler);
+}
+
+void AdcCard::setup() {
+  if (_state != DMA_STATE_IDLE) {
     error_handler::Panic(44);
   }
 
+  configure_timing();
+
+  // The capture ring is in the D2 SRAM.
+  if (_capture) {
+    __HAL_RCC_D2SRAM1_CLK_ENABLE();
+    __HAL_RCC_D2SRAM2_CLK_ENABLE();
+    __HAL_RCC_D2SRAM3_CLK_ENABLE();
+    const bool window_ok = _capture->set_window(
+        (kCapture.pre_trigger_millis * 1000) / kCaptureIntervalUsecs,
+        (kCapture.post_trigger_millis * 1000) / kCaptureIntervalUsecs);
+    if (!window_ok) {
+      error_handler::Panic(177);
+    }
+  }
+
+  // Add to the ISR dispatch table. The cards are set up by their own
+  // tasks so we add atomically.
+  taskENTER_CRITICAL();
+  {
+    if (_num_isr_cards >= kMaxCards) {
+      error_handler::Panic(172);
+    }
+    for (uint8_t i = 0; i < _num_isr_cards; i++) {
+      if (_isr_cards[i]->_hw.hspi == _hw.hspi) {
+        error_handler::Panic(173);
+      }
+    }
+    _isr_cards[_num_isr_cards++] = this;
+  }
+  taskEXIT_CRITICAL();
+
   // Register interrupt handler. These handler are marked in
   // cube ide for registration rather than overriding a weak
   // global handler.
-  if (HAL_OK != HAL_SPI_RegisterCallback(&hspi1,
+  if (HAL_OK != HAL_SPI_RegisterCallback(_hw.hspi,
                                          HAL_SPI_TX_RX_HALF_COMPLETE_CB_ID,
                                          spi_TxRxHalfCpltCallbackIsr)) {
     error_handler::Panic(45);
   }
-  if (HAL_OK != HAL_SPI_RegisterCallback(&hspi1, HAL_SPI_TX_RX_COMPLETE_CB_ID,
+  if (HAL_OK != HAL_SPI_RegisterCallback(_hw.hspi,
+                                         HAL_SPI_TX_RX_COMPLETE_CB_ID,
                                          spi_TxRxCpltCallbackIsr)) {
     error_handler::Panic(46);
   }
-  if (HAL_OK != HAL_SPI_RegisterCallback(&hspi1, HAL_SPI_ERROR_CB_ID,
+  if (HAL_OK != HAL_SPI_RegisterCallback(_hw.hspi, HAL_SPI_ERROR_CB_ID,
                                          spi_ErrorCallbackIsr)) {
     error_handler::Panic(47);
   }
@@ -479,9 +1291,9 @@ static void setup() {
   // TODO: Is this a strong enough way to detect no card? E.g. by writing and
   // reading back.
   const uint8_t device_id = one_shot_cmd_read_register(0);
-  logger.info("ADC device id: 0x%02hx", device_id);
-  adc_card_hardware_found = (device_id != 0x00);
-  if (!adc_card_hardware_found) {
+  logger.info("%s device id: 0x%02hx", _name, device_id);
+  _hardware_found = (device_id != 0x00);
+  if (!_hardware_found) {
     return;
   }
 
@@ -497,7 +1309,7 @@ static void setup() {
       error_handler::Panic(48);
     }
     if (reg_info.type == STAT) {
-      one_shot_cmd_write_register(reg_info.idx, reg_info.val);
+      one_shot_cmd_write_register(reg_info.idx, static_reg_value(reg_info));
     }
   }
 
@@ -510,123 +1322,381 @@ static void setup() {
   start_continuos_DMA();
 }
 
-void dump_state() {
-  uint32_t _irq_half_count;
-  uint32_t _irq_full_count;
-  uint32_t _irq_error_count;
-  uint32_t _event_half_count;
-  uint32_t _event_full_count;
+void AdcCard::dump_state() {
+  uint32_t _irq_half_count_;
+  uint32_t _irq_full_count_;
+  uint32_t _irq_dma_count_;
+  uint32_t _irq_error_count_;
+  uint32_t _event_segment_count_;
+  uint32_t _bursts_count_;
+  uint32_t _dropped_halves_count_;
+  uint32_t _overruns_count_;
+  uint32_t _max_segments_in_use_;
 
   __disable_irq();
   {
-    _irq_half_count = irq_half_count;
-    _irq_full_count = irq_full_count;
-    _irq_error_count = irq_error_count;
-    _event_half_count = event_half_count;
-    _event_full_count = event_full_count;
+    _irq_half_count_ = _irq_half_count;
+    _irq_full_count_ = _irq_full_count;
+    _irq_dma_count_ = _irq_dma_count;
+    _irq_error_count_ = _irq_error_count;
+    _event_segment_count_ = _event_segment_count;
+    _bursts_count_ = _bursts_count;
+    _dropped_halves_count_ = _dropped_halves_count;
+    _overruns_count_ = _overruns_count;
+    _max_segments_in_use_ = _max_segments_in_use;
   }
   __enable_irq();
 
-  // TODO: Print something else if there is no hardware.
-  logger.info("ADC DMA counters: half: %lu (%lu), full: %lu (%lu), err: %lu",
-              _irq_half_count, _event_half_count, _irq_full_count,
-              _event_full_count, _irq_error_count);
+  if (!_hardware_found) {
+    logger.info("%s: no hardware.", _name);
+    return;
+  }
+  logger.info(
+      "%s DMA counters: half: %lu, full: %lu, dma: %lu, err: %lu, "
+      "segments: %lu, bursts: %lu",
+      _name, _irq_half_count_, _irq_full_count_, _irq_dma_count_,
+      _irq_error_count_, _event_segment_count_, _bursts_count_);
+  logger.info("%s DMA segments: max %lu/%lu, dropped: %lu, overruns: %lu",
+              _name, _max_segments_in_use_, kNumDmaSegments,
+              _dropped_halves_count_, _overruns_count_);
+  // Not synchronized with the adc task but good enough for diagnostics.
+  logger.info("%s clock: rate %ld ppb, latency %ld us, resets: %lu", _name,
+              _sample_clock.rate_error_ppb(),
+              _sample_clock.last_window_error_usecs(),
+              _sample_clock.resets_count());
+  if (_capture) {
+    logger.info(
+        "%s capture: triggers %lu, ignored: %lu, dumps: %lu, lost: %lu",
+        _name, _capture->triggers_count(), _capture->ignored_triggers_count(),
+        _capture->dumps_count(), _capture->lost_samples_count());
+  }
+}
+
+// Writes the values of a channel to the log packet. Times are in usecs.
+// base_usecs is the time of the first point relative to the packet base
+// time. The values are filtered per the channel's filter spec. A
+// decimated value is reported at the time of the last sample it covers.
+void AdcCard::write_channel_values(SerialPacketsData *packet_data,
+                                   const char *chan_id,
+                                   const ChannelSpec &chan_spec,
+                                   adc_dsp::FilterState *filter_state,
+                                   uint32_t base_usecs, uint32_t first_point,
+                                   uint32_t points_stride,
+                                   uint32_t num_samples,
+                                   const uint8_t *segment_points) {
+  const adc_dsp::FilterSpec &filter = chan_spec.filter;
+  const uint32_t decimation = filter.decimation;
+  const uint32_t num_values = num_samples / decimation;
+
+  packet_data->write_str(chan_id);
+
+  // Channel start time in usecs relative to the packet start time.
+  packet_data->write_uint32(
+      base_usecs +
+      (first_point + (decimation - 1) * points_stride) * kUsecsPerPoint);
+
+  // Number of values in this channel report.
+  packet_data->write_uint16(num_values);
+
+  // Usecs between values.
+  packet_data->write_uint32(decimation * points_stride * kUsecsPerPoint);
+
+  const uint8_t *first_value =
+      &segment_points[first_point * kSegmentBytesPerPoint];
+  const uint32_t byte_stride = points_stride * kSegmentBytesPerPoint;
+
+  // Write the values. They are already in big endian order.
+  if (filter.is_pass_through()) {
+    const uint8_t *p = first_value;
+    for (uint32_t i = 0; i < num_values; i++) {
+      packet_data->write_bytes(p, 3);
+      p += byte_stride;
+    }
+    return;
+  }
+
+  // Filter and write.
+  adc_dsp::reduce(filter, first_value, byte_stride, kSegmentBytesPerPoint,
+                  num_samples, _filtered_values);
+  const uint32_t n =
+      adc_dsp::decimate(filter, filter_state, _filtered_values, num_samples);
+  adc_dsp::iir_lowpass(filter, filter_state, _filtered_values, n);
+  if (n != num_values) {
+    // Should not happen since the decimation is aligned with the halves.
+    error_handler::Panic(165);
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    uint8_t bfr3[3];
+    adc_dsp::encode_int24(_filtered_values[i], bfr3);
+    packet_data->write_bytes(bfr3, 3);
+  }
+}
+
+// Writes an 'ext' report to the log packet.
+static void write_ext_report(SerialPacketsData *packet_data,
+                             const char *report) {
+  packet_data->write_str("ext");
+  packet_data->write_uint32(0);  // Relative time offset
+  packet_data->write_uint16(1);  // Num data points
+  packet_data->write_str(report);
+}
+
+// Writes an 'ext' report with a named value to the log packet.
+static void write_ext_report(SerialPacketsData *packet_data, const char *name,
+                             int32_t value) {
+  char report[kMaxExtReportLen + 1];
+  snprintf(report, sizeof(report), "%s:%ld", name, value);
+  write_ext_report(packet_data, report);
+}
+
+// Writes the next report of the current settings, one per reported
+// channel, "<chan id>_cfg:<mode0>/<ref>/<pga>" with the register values
+// in hex. Lets the host rescale the values. Returns false if all were
+// written since the acquisition was (re)started.
+bool AdcCard::write_settings_report(SerialPacketsData *packet_data) {
+  constexpr uint8_t kNumReports =
+      kNumChannels + (kHasBursts ? kNumBurstChannels : 0);
+  while (_settings_reports_written < kNumReports) {
+    const uint8_t i = _settings_reports_written++;
+    const bool is_main = i < kNumChannels;
+    const char *chan_id =
+        is_main ? _chan_ids[i] : _burst_chan_ids[i - kNumChannels];
+    // Skip the burst settling points.
+    if (!chan_id[0]) {
+      continue;
+    }
+    const ChannelSpec &spec =
+        is_main ? _channels[i] : _burst_channels[i - kNumChannels];
+    char report[kMaxExtReportLen + 1];
+    snprintf(report, sizeof(report), "%s_cfg:%02hx/%02hx/%02hx", chan_id,
+             _reg_mode0, spec.ref, spec.pga);
+    write_ext_report(packet_data, report);
+    return true;
+  }
+  return false;
 }
 
-void process_rx_dma_half_buffer(int id, uint32_t isr_millis, uint8_t *half_buffer) {
+// Passes the raw, unfiltered, samples of a channel in a half to the
+// alarm rules, if any rule applies to it. Called before the half is
+// packetized, so a match is detected with a delay of at most a half.
+void AdcCard::process_channel_alarms(const char *chan_id,
+                                     const uint8_t *points,
+                                     uint32_t first_point_micros,
+                                     uint32_t first_point,
+                                     uint32_t points_stride,
+                                     uint32_t num_samples) {
+  if (!alarms::has_rules(chan_id)) {
+    return;
+  }
+  adc_dsp::reduce({}, &points[first_point * kSegmentBytesPerPoint],
+                  points_stride * kSegmentBytesPerPoint, kSegmentBytesPerPoint,
+                  num_samples, _filtered_values);
+  alarms::process(chan_id, 0, _filtered_values, num_samples,
+                  first_point_micros + first_point * kUsecsPerPoint,
+                  points_stride * kUsecsPerPoint);
+}
+
+// Appends the raw samples of the captured channel in a half and applies
+// the pending capture requests.
+void AdcCard::update_capture(const uint8_t *points,
+                             uint32_t first_point_micros,
+                             uint32_t main_cycles) {
+  const adc_sequence::ChannelPlan &chan_plan =
+      kPlan.channels[kCapture.chan_index];
+  _capture->append(&points[chan_plan.first_point * kSegmentBytesPerPoint],
+                   chan_plan.points_stride * kSegmentBytesPerPoint,
+                   chan_plan.samples_per_cycle * main_cycles,
+                   first_point_micros + chan_plan.first_point * kUsecsPerPoint);
+
+  adc_capture::TriggerSource source;
+  uint32_t t_micros;
+  bool has_triggers;
+  adc_capture::Triggers triggers;
+  taskENTER_CRITICAL();
+  {
+    source = _pending_trigger_source;
+    t_micros = _pending_trigger_micros;
+    _pending_trigger_source = adc_capture::TriggerSource::NONE;
+    has_triggers = _has_pending_triggers;
+    triggers = _pending_triggers;
+    _has_pending_triggers = false;
+  }
+  taskEXIT_CRITICAL();
+
+  if (has_triggers) {
+    _capture->set_triggers(triggers);
+  }
+  if (source != adc_capture::TriggerSource::NONE &&
+      !_capture->trigger(_capture->index_at_micros(t_micros), source)) {
+    deferred_logger.warning("%s: capture busy, ignoring a %s trigger", _name,
+                            adc_capture::trigger_source_name(source));
+  }
+}
+
+// Sends the next chunks of a triggered capture window as log packets of
+// the dump channel, so they are also recorded. The first one also has an
+// 'ext' report "cap_trg:<source>" at the time of the trigger.
+void AdcCard::write_dump_packets(uint32_t ref_millis) {
+  for (uint32_t i = 0; i < kMaxDumpPacketsPerHalf; i++) {
+    adc_capture::DumpChunk chunk;
+    if (!_capture->next_dump_chunk(kMaxDumpSamplesPerPacket, &chunk,
+                                   _dump_values)) {
+      return;
+    }
+
+    // Non blocking. Guaranteed to be non null.
+    data_queue::DataBuffer *data_buffer = data_queue::grab_buffer();
+    SerialPacketsData *packet_data = &data_buffer->packet_data();
+
+    uint32_t base_millis;
+    uint32_t base_usecs;
+    time_util::split_micros(chunk.first_micros, ref_millis, &base_millis,
+                            &base_usecs);
+    packet_data->clear();
+    packet_data->write_uint8(2);
+    packet_data->write_uint32(session::id());
+    packet_data->write_uint32(base_millis);
+
+    packet_data->write_str(kCapture.dump_chan_id);
+    packet_data->write_uint32(base_usecs);
+    packet_data->write_uint16(chunk.num_samples);
+    packet_data->write_uint32(kCaptureIntervalUsecs);
+    packet_data->write_bytes(_dump_values,
+                             chunk.num_samples * adc_capture::kBytesPerSample);
+
+    if (chunk.is_first) {
+      char report[kMaxExtReportLen + 1];
+      snprintf(report, sizeof(report), "cap_trg:%s",
+               adc_capture::trigger_source_name(chunk.source));
+      packet_data->write_str("ext");
+      packet_data->write_uint32(
+          base_usecs +
+          (chunk.trigger_index - chunk.first_index) * kCaptureIntervalUsecs);
+      packet_data->write_uint16(1);
+      packet_data->write_str(report);
+    }
+
+    if (packet_data->had_write_errors()) {
+      error_handler::Panic(178);
+    }
+
+    // Do not use 'buffer' beyond this point.
+    data_queue::queue_buffer(data_buffer);
+  }
+}
+
+// points is the data of the first point of the half, in its RX segment.
+void AdcCard::process_segment(const Segment &segment, const uint8_t *points) {
+  const bool has_burst = segment.has_burst;
+
   // Allocate a data buffer. Non blocking. Guaranteed to be non null.
   data_queue::DataBuffer *data_buffer = data_queue::grab_buffer();
   SerialPacketsData *packet_data = &data_buffer->packet_data();
 
   // const bool reports_enabled = controller::is_adc_report_enabled();
   packet_data->clear();
-  packet_data->write_uint8(1);               // packet version
+  // Packet version. In version 2 the channel times are in usecs.
+  packet_data->write_uint8(2);
   packet_data->write_uint32(session::id());  // Device session id.
+  // The packet base time is the millis of the first point and the
+  // channel offsets include its sub millis part. The times are from the
+  // sample clock model, so consecutive packets are contiguous.
   // NOTE: In case of a millis wrap around, it's ok if this wraps back. All
   // timestamps are mod 2^32.
-  const uint32_t packet_base_millis =
-      isr_millis - ((1000 * (kDmaPointsPerHalf - 1)) / kDmaPointsPerSec);
+  const uint32_t last_point_micros =
+      _sample_clock.update(segment.seq, segment.isr_micros);
+  const uint32_t first_point_micros =
+      last_point_micros - (kDmaPointsPerHalf - 1) * kUsecsPerPoint;
+  uint32_t packet_base_millis;
+  uint32_t base_usecs;
+  time_util::split_micros(first_point_micros, segment.isr_millis,
+                          &packet_base_millis, &base_usecs);
   packet_data->write_uint32(packet_base_millis);
-  // Write the load cell channel data.
-  // logger.info("dt = %lu", time_util::millis() - packet_base_millis);
-  {
-    // Chan id. Load cell 1.
-    packet_data->write_str("lc1");
-
-    // Offset of first value relative to packet start time.
-    // packet_data->write_uint16(0);
-
-    // Channel start time in ms relative to the packet start time.
-    // Here we do allow truncation.
-    static constexpr uint32_t kLcFirstDataPointIndex =
-        kDmaConsecutiveLcPoints - 1;
-    packet_data->write_uint16((1000 * kLcFirstDataPointIndex) /
-                              kDmaPointsPerSec);
-
-    // Num of load cell points in this packet. One per slot.
-    packet_data->write_uint16(kDmaSlotsPerHalf);
-
-    // Millis between load cell values. We don't allow truncation.
-    // static_assert(kDmaPointsPerSec % kDmaPointsPerSlot == 0);
-    // static_assert((kDmaPointsPerSlot * 1000) % kDmaPointsPerSec == 0);
-    // Channel data points interval in ms. One lcx reading per slot.
-    // packet_data->write_uint16((kDmaPointsPerSlot * 1000) / kDmaPointsPerSec);
-
-    // static constexpr uint16_t xxxx = (kDmaPointsPerSlot * 1000) /
-    // kDmaPointsPerSec;
-    //     packet_data->write_uint16(xxxx);
-
-    // Millis between LC data points is the same as slot interval.
-    packet_data->write_uint16(kMsPerSlot);
-    // Write the values. They are already in big endian order.
-    // We collect last load cell point of each slot.
-    uint32_t byte_index =
-        (kLcFirstDataPointIndex * kDmaBytesPerPoint) + kDmaRxDataOffsetInPoint;
-    for (uint32_t slot = 0 ; slot < kDmaSlotsPerHalf; slot++) {
-      packet_data->write_bytes(&half_buffer[byte_index], 3);
-      byte_index += kDmaBytesPerSlot;
-    }
-  }
-
-  // Output each of the temperature channels. Each channel has a single slot
-  // in each cycle.
-  for (uint32_t i = 0; i < kDmaNumTemperatureChans; i++) {
-    // Temperature channel id.
-    char ch_id[] = "tm?";
-    ch_id[2] = '1' + i;
-    packet_data->write_str(ch_id);
-    // First item offset in ms from packet base time. Truncation of
-    // a fraction of a ms is ok.
-    const uint32_t first_datapoint_index =
-        kDmaConsecutiveLcPoints + i * kDmaPointsPerSlot;
-
-    // Channel start time in ms relative to the packet start time.
-    // Here we do allow truncation.
-    packet_data->write_uint16((1000 * first_datapoint_index) / kDmaPointsPerSec);
-
-    // Number of values in this channel report. Each temperature channel
-    // has a single slot in each cycle.
-    packet_data->write_uint16(kDmaCyclesPerHalf);
-
-    // Millis between values. We don't allow truncation.
-    // static_assert(kDmaCyclesPerHalf > 1);
-    // static_assert((1000 * kDmaPointsPerCycle) % kDmaPointsPerSec == 0);
-    // // Channel data points interval in ms. One tmx reading per cycle.
-    // packet_data->write_uint16((1000 * kDmaPointsPerCycle) /
-    // kDmaPointsPerSec);
-
-    // Millis between TMx data points is the same as cycle interval.
-    packet_data->write_uint16(kMsPerCycle);
-
-    // Write the values. They are already in big endian order.
-    uint32_t byte_index =
-        (first_datapoint_index * kDmaBytesPerPoint) + kDmaRxDataOffsetInPoint;
-    for (uint32_t cycle = 0; cycle < kDmaCyclesPerHalf; cycle++) {
-      packet_data->write_bytes(&half_buffer[byte_index], 3);
-      byte_index += kDmaBytesPerCycle;
+
+  // A burst replaces the last cycles of the main plan.
+  const uint32_t main_cycles =
+      has_burst ? adc_sequence::cycles_before_burst(kPlan, kBurstPlan,
+                                                    kDmaCyclesPerHalf)
+                : kDmaCyclesPerHalf;
+  const uint32_t burst_first_point = main_cycles * kDmaPointsPerCycle;
+
+  // Evaluate the alarm rules first, for a lower latency.
+  for (uint8_t c = 0; c < kNumChannels; c++) {
+    const adc_sequence::ChannelPlan &chan_plan = kPlan.channels[c];
+    process_channel_alarms(_chan_ids[c], points, first_point_micros,
+                           chan_plan.first_point, chan_plan.points_stride,
+                           chan_plan.samples_per_cycle * main_cycles);
+  }
+  if (has_burst) {
+    for (uint8_t c = 0; c < kNumBurstChannels; c++) {
+      if (!kBurstChannels[c].chan_id) {
+        continue;
+      }
+      const adc_sequence::ChannelPlan &chan_plan = kBurstPlan.channels[c];
+      process_channel_alarms(_burst_chan_ids[c], points, first_point_micros,
+                             burst_first_point + chan_plan.first_point,
+                             chan_plan.points_stride,
+                             chan_plan.samples_per_cycle);
     }
   }
 
+  // Write the channels data per the extraction plan.
+  for (uint8_t c = 0; c < kNumChannels; c++) {
+    const adc_sequence::ChannelPlan &chan_plan = kPlan.channels[c];
+    write_channel_values(packet_data, _chan_ids[c], kChannels[c],
+                         &_filter_states[c], base_usecs, chan_plan.first_point,
+                         chan_plan.points_stride,
+                         chan_plan.samples_per_cycle * main_cycles, points);
+  }
+  if (_capture) {
+    update_capture(points, first_point_micros, main_cycles);
+  }
+  if (has_burst) {
+    for (uint8_t c = 0; c < kNumBurstChannels; c++) {
+      // Skip the settling points.
+      if (!kBurstChannels[c].chan_id) {
+        continue;
+      }
+      const adc_sequence::ChannelPlan &chan_plan = kBurstPlan.channels[c];
+      write_channel_values(packet_data, _burst_chan_ids[c], kBurstChannels[c],
+                           &_burst_filter_states[c], base_usecs,
+                           burst_first_point + chan_plan.first_point,
+                           chan_plan.points_stride, chan_plan.samples_per_cycle,
+                           points);
+    }
+  }
+
+  // Report changes of the DMA counters in the log stream, so the gaps
+  // in the data are explained in the recordings.
+  uint32_t num_ext_reports = 0;
+  const uint32_t dropped = _dropped_halves_count;
+  const uint32_t overruns = _overruns_count;
+  if (dropped != _reported_dropped_halves_count) {
+    write_ext_report(packet_data, "adc_dropped", dropped);
+    _reported_dropped_halves_count = dropped;
+    num_ext_reports++;
+  }
+  if (overruns != _reported_overruns_count) {
+    write_ext_report(packet_data, "adc_overruns", overruns);
+    _reported_overruns_count = overruns;
+    num_ext_reports++;
+  }
+  // The sample clock model, on each update.
+  if (_sample_clock.windows_count() != _reported_clock_windows_count) {
+    write_ext_report(packet_data, "adc_clk_ppb",
+                     _sample_clock.rate_error_ppb());
+    write_ext_report(packet_data, "adc_clk_err",
+                     _sample_clock.last_window_error_usecs());
+    _reported_clock_windows_count = _sample_clock.windows_count();
+    num_ext_reports += 2;
+  }
+  // The current settings, after each (re)start of the acquisition. In
+  // the remaining reports budget of the packet.
+  while (num_ext_reports < kMaxExtReportsPerPacket &&
+         write_settings_report(packet_data)) {
+    num_ext_reports++;
+  }
+
   // Verify writing was OK.
   if (packet_data->had_write_errors()) {
     error_handler::Panic(49);
@@ -636,16 +1706,8 @@ void process_rx_dma_half_buffer(int id, uint32_t isr_millis, uint8_t *half_buffe
   // we read as part of the continious DMA (one static reg value per
   // point)
   for (uint32_t i = 0; i < kNumRegsInfo; i++) {
-    regs_values[i] = half_buffer[i * kDmaBytesPerPoint + kDmaRegValOffsetInPoint];
-  }
-
-  // Debugging info.
-  if (true) {
-    logger.info(
-        "ADC [%d] %ld, %ld, %ld", id,
-        decode_int24(&half_buffer[kDmaRxDataOffsetInPoint]),
-        decode_int24(&half_buffer[kDmaRxDataOffsetInPoint + 2 * kDmaBytesPerPoint]),
-        decode_int24(&half_buffer[kDmaRxDataOffsetInPoint + 4 * kDmaBytesPerPoint]));
+    _regs_values[i] =
+        points[i * kSegmentBytesPerPoint + kSegmentRegValOffsetInPoint];
   }
 
   // Send to monitor and maybe to SD.
@@ -654,8 +1716,9 @@ void process_rx_dma_half_buffer(int id, uint32_t isr_millis, uint8_t *half_buffe
   data_buffer = nullptr;
   packet_data = nullptr;
 
-  if (false) {
-    logger.info("ADC processed in %lu ms", time_util::millis() - isr_millis);
+  // The full resolution window of a capture trigger, if any.
+  if (_capture) {
+    write_dump_packets(segment.isr_millis);
   }
 }
 
@@ -663,68 +1726,260 @@ void process_rx_dma_half_buffer(int id, uint32_t isr_millis, uint8_t *half_buffe
 // shacking the ADC card), change the static regs reads to writes to restore
 // the desired values.
 // Used to detect SPI bus error or ADC reset mid operation.
-void verify_static_registers_values() {
+void AdcCard::verify_static_registers_values() {
   // If ADC card was not detected do nothing.
-  if (!adc_card_hardware_found) {
+  if (!_hardware_found) {
     return;
   }
 
   // Report.
-  logger.info("ADC id reg: 0x%02hx", regs_values[0x00]);
-  logger.info("ADC status reg: 0x%02hx", regs_values[0x01]);
+  logger.info("%s id reg: 0x%02hx", _name, _regs_values[0x00]);
+  logger.info("%s status reg: 0x%02hx", _name, _regs_values[0x01]);
   for (uint32_t i = 0; i < kNumRegsInfo; i++) {
     const RegisterInfo &reg_info = regs_info[i];
-    if (reg_info.type == STAT && regs_values[i] != reg_info.val) {
-      logger.error("ADC Reg %02hx: %02hx -> %02hx", reg_info.idx, reg_info.val,
-                   regs_values[i]);
+    const uint8_t expected_value = static_reg_value(reg_info);
+    if (reg_info.type == STAT && _regs_values[i] != expected_value) {
+      logger.error("%s Reg %02hx: %02hx -> %02hx", _name, reg_info.idx,
+                   expected_value, _regs_values[i]);
     }
   }
 }
 
-static void adc_card_task_body_impl(void *ignored_argument) {
+void AdcCard::task_body() {
   setup();
 
   // If no hardware, stay in a do nothing loop.
-  if (!adc_card_hardware_found) {
+  if (!_hardware_found) {
     for (;;) {
-      logger.warning(
-          "ADC card not found. Ignoring channels lc1, tm1, tm2, tm3");
+      logger.warning("%s not found. Ignoring its %hu channels", _name,
+                     kNumChannels);
       time_util::delay_millis(5000);
     }
   }
 
   // Here when hardware found. Report data rates.
-  logger.info("lc1 data point interval %lu ms", kMsPerSlot);
-  for (int i = 1; i <= 3; i++) {
-     logger.info("tm%d data point interval %lu ms", i,  kMsPerCycle);
+  logger.info("%s: %lu points/sec, SCLK %lu Khz, %s conversions.", _name,
+              kDmaPointsPerSec, kSpiClockHz / 1000,
+              kMode.conversion_mode == ConversionMode::ONE_SHOT ? "one shot"
+                                                                : "continuous");
+  for (uint8_t c = 0; c < kNumChannels; c++) {
+    logger.info(
+        "%s data point interval %lu us", _chan_ids[c],
+        adc_sequence::sample_interval_usecs(kPlan, c, kDmaPointsPerSec));
+  }
+  if (kHasBursts) {
+    logger.info("%s: a burst every %hu halves (%lu ms).", _name,
+                kHalvesPerBurst,
+                (kHalvesPerBurst * 1000 * kDmaPointsPerHalf) /
+                    kDmaPointsPerSec);
   }
 
   // Infite service loop of recieving completed half DMAs from the ISR
   // and processing their data.
   for (;;) {
     IrqEvent event;
-    if (!irq_event_queue.consume_from_task(&event, 300)) {
-      logger.error("Timeout fetching ADC event.");
-      time_util::delay_millis(200);
+    if (!_irq_event_queue.try_consume(&event)) {
+      // Caught up with the ISR. Apply the pending configuration
+      // requests, including ones whose wake ups were absorbed during a
+      // previous configuration, and wait for the next half.
+      ConfigRequest request;
+      while (_config_requests_queue.consume_from_task(&request, 0)) {
+        configure(request);
+      }
+      if (!_irq_event_queue.wait_from_task(300)) {
+        logger.error("%s: timeout fetching ADC event.", _name);
+        time_util::delay_millis(200);
+      }
       continue;
     }
     // logger.info("Event %d", event);
-    if (event.id == EVENT_HALF_COMPLETE) {
-      event_half_count++;
-      // Process first half.
-      process_rx_dma_half_buffer(0, event.isr_millis, &rx_buffer[0]);
-    } else if (event.id == EVENT_FULL_COMPLETE) {
-      event_full_count++;
-      // Process second half.
-      process_rx_dma_half_buffer(1, event.isr_millis,
-                                 &rx_buffer[kDmaBytesPerHalf]);
-    } else {
+    if (event.id != EVENT_SEGMENT_READY) {
       error_handler::Panic(51);
     }
+    _event_segment_count++;
+
+    // The ISR doesn't touch the segment until we release it.
+    if (event.segment >= kNumDmaRxSegments ||
+        !_segment_with_task[event.segment]) {
+      error_handler::Panic(191);
+    }
+    const Segment &segment = _segments[event.segment];
+    if (segment.seq != event.seq) {
+      error_handler::Panic(166);
+    }
+    if (segment.seq != _next_expected_seq) {
+      deferred_logger.warning("%s: missing halves %lu to %lu", _name,
+                              _next_expected_seq, segment.seq - 1);
+    }
+    _next_expected_seq = segment.seq + 1;
+
+    process_segment(segment,
+                    &_rx_segments[event.segment][kDmaRxDataOffsetInPoint]);
+
+    // Make sure we are done with the segment before the ISR can reuse it.
+    __DMB();
+    _segment_with_task[event.segment] = false;
+    _segments_released++;
+  }
+}
+
+// The cards. To add a card, configure its SPI, the DMA of the SPI and a
+// 1Mhz CS timer that synchronizes the DMAMUX request generator of the
+// SPI TX DMA, similar to SPI1 and TIM12, then add it here with its DMA
+// buffers and give it a task in app_main.cpp.
+//
+// Card 1 has the pre trigger capture. Its ring is in the D2 SRAM and is
+// not initialized by the startup code. The ring is written by the CPU
+// only, so it can be cached.
+static uint8_t capture1_buffer[kCaptureBytes]
+    __attribute__((section(".ram_d2")));
+
+static adc_capture::Capture capture1(capture1_buffer, sizeof(capture1_buffer),
+                                     kCaptureIntervalUsecs);
+
+DMA_BUFFER static AdcDmaBuffers adc_card1_dma_buffers;
+
+static AdcCard adc_card1("ADC1",
+                         {.hspi = &hspi1,
+                          .hdma_tx = &hdma_spi1_tx,
+                          .htim_cs = &htim12,
+                          .tim_cs_channel = TIM_CHANNEL_1},
+                         0, &capture1, &adc_card1_dma_buffers);
+
+static AdcCard *const cards[] = {&adc_card1};
+
+TaskBody &adc_card1_task_body = adc_card1;
+
+void dump_state() {
+  for (AdcCard *card : cards) {
+    card->dump_state();
+  }
+}
+
+void verify_static_registers_values() {
+  for (AdcCard *card : cards) {
+    card->verify_static_registers_values();
+  }
+}
+
+void trigger_capture(uint32_t t_micros) {
+  for (AdcCard *card : cards) {
+    card->request_capture_trigger(t_micros,
+                                  adc_capture::TriggerSource::MARKER);
   }
 }
 
-// The exported task body.
-TaskBodyFunction adc_card_task_body(adc_card_task_body_impl, nullptr);
+// Returns the card of the card index in the command data, or null if
+// invalid.
+static AdcCard *read_card(const SerialPacketsData &command_data) {
+  const uint8_t card_index = command_data.read_uint8();
+  if (command_data.had_read_errors() ||
+      card_index >= sizeof(cards) / sizeof(cards[0])) {
+    return nullptr;
+  }
+  return cards[card_index];
+}
+
+static PacketStatus handle_capture_trigger_command(
+    const SerialPacketsData &command_data) {
+  const uint32_t t_micros = time_util::micros();
+  AdcCard *const card = read_card(command_data);
+  if (!card || !command_data.all_read_ok()) {
+    logger.error("Capture trigger: invalid command data.");
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  if (!card->request_capture_trigger(t_micros,
+                                     adc_capture::TriggerSource::HOST)) {
+    logger.error("Capture trigger: the card has no capture.");
+    return PacketStatus::GENERAL_ERROR;
+  }
+  return PacketStatus::OK;
+}
+
+static PacketStatus handle_capture_triggers_command(
+    const SerialPacketsData &command_data) {
+  AdcCard *const card = read_card(command_data);
+  adc_capture::Triggers triggers;
+  triggers.level_low = (int32_t)command_data.read_uint32();
+  triggers.level_high = (int32_t)command_data.read_uint32();
+  triggers.slope_delta = (int32_t)command_data.read_uint32();
+  triggers.slope_span = command_data.read_uint16();
+  if (!card || !command_data.all_read_ok() || triggers.slope_delta < 0 ||
+      triggers.slope_span == 0) {
+    logger.error("Capture triggers: invalid command data.");
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  if (!card->request_capture_triggers(triggers)) {
+    logger.error("Capture triggers: the card has no capture.");
+    return PacketStatus::GENERAL_ERROR;
+  }
+  return PacketStatus::OK;
+}
+
+PacketStatus handle_command(uint32_t cmd_id, uint8_t op_code,
+                            const SerialPacketsData &command_data) {
+  // Used by the rx task only.
+  static ConfigRequest request;
+  static StaticString<3> chan_id;
+
+  if (op_code == CAPTURE_TRIGGER) {
+    return handle_capture_trigger_command(command_data);
+  }
+  if (op_code == CAPTURE_TRIGGERS) {
+    return handle_capture_triggers_command(command_data);
+  }
+  if (op_code != CONFIGURE) {
+    logger.error("Unexpected adc card command code %hx", op_code);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  memset(&request, 0, sizeof(request));
+  request.cmd_id = cmd_id;
+  const uint8_t card_index = command_data.read_uint8();
+  const uint8_t data_rate_code = command_data.read_uint8();
+  const uint8_t filter_code = command_data.read_uint8();
+  request.num_channels = command_data.read_uint8();
+  constexpr uint8_t kMaxChannels =
+      sizeof(request.channels) / sizeof(request.channels[0]);
+  if (command_data.had_read_errors() ||
+      card_index >= sizeof(cards) / sizeof(cards[0]) ||
+      data_rate_code > adc_sequence::kMaxDataRateCode ||
+      filter_code > adc_sequence::kFilterFir ||
+      request.num_channels > kMaxChannels) {
+    logger.error("ADC configuration: invalid command data.");
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  AdcCard *const card = cards[card_index];
+
+  request.reg_mode0 = adc_sequence::reg_mode0(data_rate_code, filter_code);
+  const char *error =
+      adc_sequence::validate_data_rate(request.reg_mode0, kPointTiming);
+  if (error) {
+    logger.error("ADC configuration: MODE0 0x%02hx: %s.", request.reg_mode0,
+                 error);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  for (uint8_t i = 0; i < request.num_channels; i++) {
+    auto &chan = request.channels[i];
+    command_data.read_str(&chan_id);
+    chan.ref = command_data.read_uint8();
+    chan.pga = command_data.read_uint8();
+    if (command_data.had_read_errors() || !card->has_channel(chan_id.c_str()) ||
+        !is_valid_reg_ref(chan.ref) || !is_valid_reg_pga(chan.pga)) {
+      logger.error("ADC configuration: invalid channel [%s].",
+                   chan_id.c_str());
+      return PacketStatus::INVALID_ARGUMENT;
+    }
+    strcpy(chan.chan_id, chan_id.c_str());
+  }
+
+  if (!command_data.all_read_ok()) {
+    logger.error("ADC configuration: invalid command data.");
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  return card->request_configuration(request);
+}
 
-}  // namespace adc_card
\ No newline at end of file
+}  // namespace adc_card
@@ -5,13 +5,58 @@
 
 #pragma once
 
+#include "serial_packets_consts.h"
+#include "serial_packets_data.h"
 #include "static_task.h"
 
 namespace adc_card {
 
-// Caller should provide a task for this task body.
-extern TaskBodyFunction adc_card_task_body;
+// Caller should provide a task for each card's task body.
+extern TaskBody& adc_card1_task_body;
 
+// Control command codes that are handled here.
+enum OpCodes {
+  // Change the data rate and filter of a card and the reference and PGA
+  // of some of its channels, and restart its acquisition. Channels that
+  // are not listed keep their settings. Data rates whose conversions
+  // don't settle within the compiled points timing are rejected. The new
+  // settings are reported in the card's log stream as 'ext' reports
+  // "<chan id>_cfg:<mode0>/<ref>/<pga>" with the register values in hex.
+  // Command: [uint8 card index][uint8 data rate code][uint8 filter code]
+  //          [uint8 n] n x [str chan id][uint8 ref reg][uint8 pga reg]
+  // Response: [uint32 acquisition gap usecs]
+  CONFIGURE = 0x08,
+  // Trigger a dump of the pre trigger capture of a card around the time
+  // the command was received. The window is sent at full resolution in
+  // the card's log stream, see adc_card_config.h.
+  // Command: [uint8 card index]
+  // Response: none
+  CAPTURE_TRIGGER = 0x09,
+  // Set the level and slope triggers of the capture of a card, in raw
+  // ADC units. A value outside [low, high] triggers, disabled if low >
+  // high. A change of more than delta within span samples triggers,
+  // disabled if delta is 0.
+  // Command: [uint8 card index][int32 level low][int32 level high]
+  //          [int32 slope delta][uint16 slope span]
+  // Response: none
+  CAPTURE_TRIGGERS = 0x0a,
+};
+
+inline bool is_adc_card_op_code(uint8_t op_code) {
+  return op_code >= CONFIGURE && op_code <= CAPTURE_TRIGGERS;
+}
+
+// Called from the host link rx task with a command whose op code was
+// already read. Returns PENDING if the command was passed to the card's
+// task.
+PacketStatus handle_command(uint32_t cmd_id, uint8_t op_code,
+                            const SerialPacketsData& command_data);
+
+// Triggers a dump of the captures of the cards around the given time,
+// e.g. of a marker report from the printer. Can be called from any task.
+void trigger_capture(uint32_t t_micros);
+
+// Of all the cards.
 void dump_state();
 
 // For diagnostics.
@@ -0,0 +1,177 @@
+// The acquisition sequence of the adc card. Change this to modify the
+// channel mix and sampling rates. See adc_sequence.h for details.
+//
+// The active mode is selected at build time with the
+// CONFIG_ADC_HIGH_RATE_MODE build flag.
+
+#pragma once
+
+#include "adc_sequence.h"
+
+#ifndef CONFIG_ADC_HIGH_RATE_MODE
+#define CONFIG_ADC_HIGH_RATE_MODE 0
+#endif
+
+// The number of DMA segments, see kNumDmaSegments below.
+#ifndef CONFIG_ADC_DMA_SEGMENTS
+#define CONFIG_ADC_DMA_SEGMENTS 4
+#endif
+
+// The size of the pre trigger capture ring, see kCapture below. It's in
+// the D2 SRAM (288KB) which is otherwise unused.
+#ifndef CONFIG_ADC_CAPTURE_KBYTES
+#define CONFIG_ADC_CAPTURE_KBYTES 256
+#endif
+
+namespace adc_card_config {
+
+using adc_sequence::ChannelSpec;
+using adc_sequence::ConversionMode;
+
+// The timing and clocking of an acquisition mode.
+struct ModeConfig {
+  // Points per sec. TIM12 ticks at 1Mhz so this should divide 1,000,000.
+  uint32_t points_per_sec;
+  // TIM12 PWM high time at the start of each point, in usecs. The DMA
+  // transfer of a point starts at the falling edge and should end before
+  // the next rising edge.
+  uint16_t cs_high_usecs;
+  // Divides the 64Mhz SPI1 kernel clock. A power of 2 in [2, 256].
+  uint16_t spi_clock_divider;
+  ConversionMode conversion_mode;
+  // ADS1261 MODE0 register value (data rate and filter).
+  uint8_t reg_mode0;
+  // Number of cycles in each DMA half buffer. Determines the packets
+  // rate.
+  uint32_t cycles_per_half;
+  // If non zero, every this number of halves the last points of the
+  // half are replaced by a single cycle of kBurstChannels.
+  uint16_t halves_per_burst;
+};
+
+// The pre trigger capture of the full rate samples of a main channel.
+// The samples are captured before the channel's filter so the channel
+// can be streamed decimated while the window around a trigger is dumped
+// at full resolution. See adc_capture.h.
+struct CaptureConfig {
+  // The index of the captured channel in kChannels.
+  uint8_t chan_index;
+  // The channel id of the dumped samples. Should not be used by other
+  // channels.
+  const char* dump_chan_id;
+  // The dumped window around a trigger.
+  uint16_t pre_trigger_millis;
+  uint16_t post_trigger_millis;
+};
+
+namespace standard_mode {
+
+// Load cell: (ain1 - ain0), ref (ain0 - ain1), PGA x128.
+// Temperature: (ain4 - ain5), (ain6 - ain7), (ain8 - ain9), ref
+// (avdd - avss), PGA disabled.
+//
+// The load cell is read three times per sample to let it settle
+// after a temperature reading.
+//
+// Resulting cycle points. The '*' indicates the values we actually use.
+// (LC, LC, *Lc, *T1), (LC, LC, *LC, *T2), (LC, LC, *LC, *T3)
+//
+// To also use the other load cell conversions, set a filter, e.g.
+// .filter = {.reduce = adc_dsp::Reduce::MEAN, .reduce_count = 2}.
+// See adc_dsp.h.
+constexpr ChannelSpec kChannels[] = {
+    {.chan_id = "lc1", .ref = 0x0a, .pga = 0x07, .inpmux = 0x34,
+     .conversions = 3, .rate_divider = 1},
+    {.chan_id = "tm1", .ref = 0x05, .pga = 0x00, .inpmux = 0x56,
+     .conversions = 1, .rate_divider = 3},
+    {.chan_id = "tm2", .ref = 0x05, .pga = 0x00, .inpmux = 0x78,
+     .conversions = 1, .rate_divider = 3},
+    {.chan_id = "tm3", .ref = 0x05, .pga = 0x00, .inpmux = 0x9a,
+     .conversions = 1, .rate_divider = 3},
+};
+
+// No bursts in this mode. Not used.
+constexpr const ChannelSpec (&kBurstChannels)[4] = kChannels;
+
+// 2000 points per sec at 2Mhz SCLK. Each point is a one shot
+// conversion.
+constexpr ModeConfig kMode = {.points_per_sec = 2000,
+                              .cs_high_usecs = 200,
+                              .spi_clock_divider = 32,
+                              .conversion_mode = ConversionMode::ONE_SHOT,
+                              .reg_mode0 = 0x6C,  // 14400 SPS, (Sinc5)
+                              .cycles_per_half = 40,
+                              .halves_per_burst = 0};
+
+// lc1 has 500 samples/sec, so the ring holds about 170 secs.
+constexpr CaptureConfig kCapture = {.chan_index = 0,
+                                    .dump_chan_id = "lcf",
+                                    .pre_trigger_millis = 2000,
+                                    .post_trigger_millis = 1000};
+
+}  // namespace standard_mode
+
+namespace high_rate_mode {
+
+// Load cell only, for impact and vibration tests. The ADC converts
+// continuously at 14400 SPS and each point reads the latest conversion,
+// without switching inputs. lc1 is streamed decimated to 2000 values/sec
+// and the full rate samples around a trigger are dumped from the capture
+// ring, see kCapture below.
+constexpr ChannelSpec kChannels[] = {
+    {.chan_id = "lc1", .ref = 0x0a, .pga = 0x07, .inpmux = 0x34,
+     .conversions = 1, .rate_divider = 1,
+     .filter = {.reduce = adc_dsp::Reduce::LAST,
+                .reduce_count = 1,
+                .decimation = 4,
+                .cic_order = 2}},
+};
+
+// The temperatures are sampled in a burst about once a second. Each
+// temperature is read four times to let the conversion that was restarted
+// by the input switch complete (latency + 50us delay < 500us). The
+// unnamed load cell points at the end let it settle before the main
+// sequence resumes. The load cell data has a 2ms gap at each burst.
+constexpr ChannelSpec kBurstChannels[] = {
+    {.chan_id = "tm1", .ref = 0x05, .pga = 0x00, .inpmux = 0x56,
+     .conversions = 4, .rate_divider = 1},
+    {.chan_id = "tm2", .ref = 0x05, .pga = 0x00, .inpmux = 0x78,
+     .conversions = 4, .rate_divider = 1},
+    {.chan_id = "tm3", .ref = 0x05, .pga = 0x00, .inpmux = 0x9a,
+     .conversions = 4, .rate_divider = 1},
+    {.chan_id = nullptr, .ref = 0x0a, .pga = 0x07, .inpmux = 0x34,
+     .conversions = 4, .rate_divider = 1},
+};
+
+// 8000 points per sec at 8Mhz SCLK (the ADS1261 max is 10Mhz). A half
+// is 30ms and its 240 load cell values fit in a single log packet.
+constexpr ModeConfig kMode = {.points_per_sec = 8000,
+                              .cs_high_usecs = 25,
+                              .spi_clock_divider = 8,
+                              .conversion_mode = ConversionMode::CONTINUOUS,
+                              .reg_mode0 = 0x6C,  // 14400 SPS, (Sinc5)
+                              .cycles_per_half = 240,
+                              .halves_per_burst = 32};
+
+// lc1 has 8000 samples/sec, so the ring holds about 10 secs.
+constexpr CaptureConfig kCapture = {.chan_index = 0,
+                                    .dump_chan_id = "lcf",
+                                    .pre_trigger_millis = 1000,
+                                    .post_trigger_millis = 500};
+
+}  // namespace high_rate_mode
+
+// The number of DMA halves that are buffered for the adc task. This is
+// how many halves the task can fall behind before halves are dropped.
+// The task reads the halves in place, in a ring of kNumDmaSegments + 2
+// RX segments in the DMA memory, each of 16 bytes per point.
+constexpr uint32_t kNumDmaSegments = CONFIG_ADC_DMA_SEGMENTS;
+static_assert(kNumDmaSegments >= 2);
+
+#if CONFIG_ADC_HIGH_RATE_MODE
+using namespace high_rate_mode;
+#else
+using namespace standard_mode;
+#endif
+
+}  // namespace adc_card_config
@@ -0,0 +1,196 @@
+#include "adc_dsp.h"
+
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP)
+#include <cmsis_compiler.h>
+#endif
+
+namespace adc_dsp {
+
+void FilterState::reset() {
+  memset(integrators, 0, sizeof(integrators));
+  memset(combs, 0, sizeof(combs));
+  decimation_phase = 0;
+  iir_acc = 0;
+  iir_primed = false;
+}
+
+// Clamps to the 24 bits range.
+static inline int32_t saturate24(int32_t v) {
+#if defined(__ARM_FEATURE_DSP)
+  return __SSAT(v, 24);
+#else
+  return v < kMinValue ? kMinValue : v > kMaxValue ? kMaxValue : v;
+#endif
+}
+
+int32_t decode_int24(const uint8_t* bfr3) {
+#if defined(__ARM_FEATURE_DSP)
+  // Unaligned load, byte reverse and sign extending shift. The 4th byte
+  // is dropped by the shift.
+  uint32_t word;
+  memcpy(&word, bfr3, sizeof(word));
+  return ((int32_t)__REV(word)) >> 8;
+#else
+  const uint32_t sign_extension = (bfr3[0] & 0x80) ? 0xff000000 : 0x00000000;
+  return (int32_t)(sign_extension | ((uint32_t)bfr3[0]) << 16 |
+                   ((uint32_t)bfr3[1]) << 8 | ((uint32_t)bfr3[2]) << 0);
+#endif
+}
+
+void encode_int24(int32_t value, uint8_t* bfr3) {
+  bfr3[0] = value >> 16;
+  bfr3[1] = value >> 8;
+  bfr3[2] = value >> 0;
+}
+
+// Median of three without branches.
+static inline int32_t median3(int32_t a, int32_t b, int32_t c) {
+  const int32_t lo = a < b ? a : b;
+  const int32_t hi = a < b ? b : a;
+  const int32_t hi_c = hi < c ? hi : c;
+  return lo > hi_c ? lo : hi_c;
+}
+
+// Median by insertion sort, for the less common sizes. The input is
+// in reversed order, which doesn't matter.
+static int32_t median_n(const int32_t* v, uint32_t n) {
+  int32_t sorted[kMaxReduceCount];
+  for (uint32_t i = 0; i < n; i++) {
+    int32_t x = v[i];
+    uint32_t j = i;
+    for (; j > 0 && sorted[j - 1] > x; j--) {
+      sorted[j] = sorted[j - 1];
+    }
+    sorted[j] = x;
+  }
+  // For even n, the mean of the two middle values.
+  if (n & 1) {
+    return sorted[n / 2];
+  }
+  return (sorted[n / 2 - 1] + sorted[n / 2] + 1) >> 1;
+}
+
+void reduce(const FilterSpec& spec, const uint8_t* first, uint32_t stride,
+            uint32_t point_size, uint32_t n, int32_t* out) {
+  const uint8_t* p = first;
+  const uint32_t count = spec.reduce_count;
+
+  switch (spec.reduce) {
+    case Reduce::LAST:
+      for (uint32_t i = 0; i < n; i++, p += stride) {
+        out[i] = decode_int24(p);
+      }
+      return;
+
+    case Reduce::MEAN:
+      for (uint32_t i = 0; i < n; i++, p += stride) {
+        int32_t sum = 0;
+        const uint8_t* q = p;
+        for (uint32_t k = 0; k < count; k++, q -= point_size) {
+          sum += decode_int24(q);
+        }
+        // Rounded division. The hardware divider takes a few cycles.
+        out[i] = (sum >= 0) ? (sum + (int32_t)(count / 2)) / (int32_t)count
+                            : (sum - (int32_t)(count / 2)) / (int32_t)count;
+      }
+      return;
+
+    case Reduce::MEDIAN:
+      if (count == 3) {
+        for (uint32_t i = 0; i < n; i++, p += stride) {
+          out[i] = median3(decode_int24(p), decode_int24(p - point_size),
+                           decode_int24(p - 2 * point_size));
+        }
+        return;
+      }
+      for (uint32_t i = 0; i < n; i++, p += stride) {
+        int32_t v[kMaxReduceCount];
+        const uint8_t* q = p;
+        for (uint32_t k = 0; k < count; k++, q -= point_size) {
+          v[k] = decode_int24(q);
+        }
+        out[i] = median_n(v, count);
+      }
+      return;
+  }
+}
+
+uint32_t decimate(const FilterSpec& spec, FilterState* state, int32_t* values,
+                  uint32_t n) {
+  const uint32_t r = spec.decimation;
+  if (r == 1) {
+    return n;
+  }
+  const uint32_t order = spec.cic_order;
+
+  // CIC gain, verified by validate() to fit in 7 bits.
+  uint32_t gain = 1;
+  for (uint32_t i = 0; i < order; i++) {
+    gain *= r;
+  }
+  // The log2 of the gain, if it's a power of 2.
+  const int32_t gain_shift =
+      ((gain & (gain - 1)) == 0) ? __builtin_ctz(gain) : -1;
+
+  // The integrators and combs rely on two's complement wrap around, so
+  // we do the math as unsigned.
+  uint32_t* integrators = (uint32_t*)state->integrators;
+  uint32_t* combs = (uint32_t*)state->combs;
+  uint32_t phase = state->decimation_phase;
+  uint32_t out_count = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t acc = (uint32_t)values[i];
+    for (uint32_t k = 0; k < order; k++) {
+      integrators[k] += acc;
+      acc = integrators[k];
+    }
+    if (++phase < r) {
+      continue;
+    }
+    phase = 0;
+    for (uint32_t k = 0; k < order; k++) {
+      const uint32_t prev = combs[k];
+      combs[k] = acc;
+      acc -= prev;
+    }
+    const int32_t sum = (int32_t)acc;
+    // Rounded division by the gain.
+    const int32_t v = (gain_shift >= 0)
+                          ? (sum + (int32_t)(gain / 2)) >> gain_shift
+                          : (sum >= 0 ? sum + (int32_t)(gain / 2)
+                                      : sum - (int32_t)(gain / 2)) /
+                                (int32_t)gain;
+    values[out_count++] = saturate24(v);
+  }
+  state->decimation_phase = phase;
+  return out_count;
+}
+
+void iir_lowpass(const FilterSpec& spec, FilterState* state, int32_t* values,
+                 uint32_t n) {
+  const uint32_t shift = spec.iir_shift;
+  if (shift == 0 || n == 0) {
+    return;
+  }
+  // Accumulator with fraction bits, to avoid a dead band when the
+  // input is close to the output. 24 + 6 bits leave room for the
+  // difference term.
+  constexpr uint32_t kFractionBits = 6;
+  constexpr int32_t kOne = 1 << kFractionBits;
+  int32_t acc = state->iir_acc;
+  if (!state->iir_primed) {
+    acc = values[0] * kOne;
+    state->iir_primed = true;
+  }
+  // Rounding the step avoids a bias of the output.
+  const int32_t step_rounding = 1 << (shift - 1);
+  for (uint32_t i = 0; i < n; i++) {
+    acc += ((values[i] * kOne) - acc + step_rounding) >> shift;
+    values[i] = saturate24((acc + kOne / 2) >> kFractionBits);
+  }
+  state->iir_acc = acc;
+}
+
+}  // namespace adc_dsp
@@ -0,0 +1,121 @@
+// A per channel DSP stage of the adc card, between the DMA half buffer
+// and the log packets.
+//
+// The samples of a channel go through three optional steps:
+// 1. Reduce - the consecutive conversions of each sample are reduced
+//    to a single value. Either the last one (the default), the mean
+//    or the median of the last reduce_count conversions. The first
+//    conversions after an input switch are noisy so reduce_count should
+//    typically be less than the number of conversions.
+// 2. Decimate - a CIC decimator of order cic_order that outputs one
+//    value every 'decimation' samples. Order 1 is a boxcar average.
+// 3. IIR - a single pole low pass y += (x - y) / 2^iir_shift.
+//
+// The kernels work on int32 values of the 24 bits ADC readings. On the
+// Cortex-M7 they use the REV and SSAT instructions. The 16 bits SIMD
+// lanes of the M7 are too narrow for the 24 bits readings. See
+// adc_dsp_reference.h for a plain reference implementation.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace adc_dsp {
+
+// Limits.
+constexpr uint8_t kMaxReduceCount = 8;
+constexpr uint8_t kMaxCicOrder = 4;
+
+// The range of the 24 bits ADC readings.
+constexpr int32_t kMinValue = -(1 << 23);
+constexpr int32_t kMaxValue = (1 << 23) - 1;
+
+enum class Reduce : uint8_t {
+  // Use the last conversion only.
+  LAST,
+  // The mean of the last reduce_count conversions. Rounded.
+  MEAN,
+  // The median of the last reduce_count conversions. Rejects spikes.
+  MEDIAN,
+};
+
+struct FilterSpec {
+  Reduce reduce = Reduce::LAST;
+  // Number of last conversions used by MEAN and MEDIAN.
+  uint8_t reduce_count = 1;
+  // Output a value every this number of samples. 1 to disable.
+  uint8_t decimation = 1;
+  // CIC decimator order. 1 is a boxcar.
+  uint8_t cic_order = 1;
+  // IIR low pass coefficient is 2^-iir_shift. 0 to disable.
+  uint8_t iir_shift = 0;
+
+  // True if the filter doesn't modify the last conversion values.
+  constexpr bool is_pass_through() const {
+    return reduce == Reduce::LAST && decimation == 1 && iir_shift == 0;
+  }
+};
+
+// Verifies a filter spec of a channel with the given conversions per
+// sample. Returns null if OK, or a description of the problem.
+constexpr const char* validate(const FilterSpec& spec, uint8_t conversions) {
+  if (spec.reduce != Reduce::LAST &&
+      (spec.reduce_count < 1 || spec.reduce_count > kMaxReduceCount ||
+       spec.reduce_count > conversions)) {
+    return "Invalid reduce count";
+  }
+  if (spec.decimation < 1) {
+    return "Invalid decimation";
+  }
+  if (spec.cic_order < 1 || spec.cic_order > kMaxCicOrder) {
+    return "Invalid cic order";
+  }
+  // The CIC gain is decimation^order and the output should not
+  // overflow when 24 bits values are multiplied by it.
+  uint32_t gain = 1;
+  for (uint8_t i = 0; i < spec.cic_order; i++) {
+    gain *= spec.decimation;
+    if (gain > 128) {
+      return "CIC gain is above 2^7";
+    }
+  }
+  if (spec.iir_shift > 16) {
+    return "Invalid iir shift";
+  }
+  return nullptr;
+}
+
+// The filter state of a channel, persists across DMA halves.
+struct FilterState {
+  int32_t integrators[kMaxCicOrder];
+  int32_t combs[kMaxCicOrder];
+  // Number of samples since the last decimator output.
+  uint8_t decimation_phase;
+  // IIR output in fixed point with 6 fraction bits.
+  int32_t iir_acc;
+  bool iir_primed;
+
+  void reset();
+};
+
+// Decodes a big endian 24 bits ADC reading. May read a 4th byte.
+int32_t decode_int24(const uint8_t* bfr3);
+
+// Encodes a 24 bits value in big endian.
+void encode_int24(int32_t value, uint8_t* bfr3);
+
+// Reduces the conversions of n samples. The data of the last conversion
+// of the first sample is at 'first'. The samples are 'stride' bytes
+// apart and the conversions of each sample are 'point_size' bytes apart.
+void reduce(const FilterSpec& spec, const uint8_t* first, uint32_t stride,
+            uint32_t point_size, uint32_t n, int32_t* out);
+
+// Decimates n values in place. Returns the number of output values.
+uint32_t decimate(const FilterSpec& spec, FilterState* state, int32_t* values,
+                  uint32_t n);
+
+// Filters n values in place.
+void iir_lowpass(const FilterSpec& spec, FilterState* state, int32_t* values,
+                 uint32_t n);
+
+}  // namespace adc_dsp
@@ -0,0 +1,138 @@
+// A plain reference implementation of the adc_dsp kernels, for testing.
+// Favors clarity over speed. Processes an entire sequence at once and
+// computes the CIC as its equivalent FIR filter and the IIR in floating
+// point.
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "adc_dsp.h"
+
+namespace adc_dsp_reference {
+
+using adc_dsp::FilterSpec;
+using adc_dsp::Reduce;
+
+inline int32_t clamp24(int64_t v) {
+  return v < adc_dsp::kMinValue   ? adc_dsp::kMinValue
+         : v > adc_dsp::kMaxValue ? adc_dsp::kMaxValue
+                                  : (int32_t)v;
+}
+
+inline int32_t decode_int24(const uint8_t* bfr3) {
+  int32_t v = (bfr3[0] << 16) | (bfr3[1] << 8) | bfr3[2];
+  return (v & 0x800000) ? v - 0x1000000 : v;
+}
+
+// Division rounded half away from zero.
+inline int64_t div_round(int64_t a, int64_t b) {
+  return (int64_t)llround((double)a / (double)b);
+}
+
+// Division rounded half up.
+inline int64_t div_round_up(int64_t a, int64_t b) {
+  return (int64_t)floor((double)a / (double)b + 0.5);
+}
+
+// Same contract as adc_dsp::reduce().
+inline void reduce(const FilterSpec& spec, const uint8_t* first,
+                   uint32_t stride, uint32_t point_size, uint32_t n,
+                   int32_t* out) {
+  for (uint32_t i = 0; i < n; i++) {
+    const uint8_t* p = first + i * stride;
+    if (spec.reduce == Reduce::LAST) {
+      out[i] = decode_int24(p);
+      continue;
+    }
+    const uint32_t count = spec.reduce_count;
+    int32_t v[adc_dsp::kMaxReduceCount];
+    for (uint32_t k = 0; k < count; k++) {
+      v[k] = decode_int24(p - k * point_size);
+    }
+    if (spec.reduce == Reduce::MEAN) {
+      int64_t sum = 0;
+      for (uint32_t k = 0; k < count; k++) {
+        sum += v[k];
+      }
+      out[i] = div_round(sum, count);
+      continue;
+    }
+    // Median. Bubble sort.
+    for (uint32_t a = 0; a < count; a++) {
+      for (uint32_t b = 0; b + 1 < count - a; b++) {
+        if (v[b] > v[b + 1]) {
+          const int32_t t = v[b];
+          v[b] = v[b + 1];
+          v[b + 1] = t;
+        }
+      }
+    }
+    out[i] = (count & 1) ? v[count / 2]
+                         : div_round_up((int64_t)v[count / 2 - 1] + v[count / 2], 2);
+  }
+}
+
+// Decimates an entire sequence that starts with zero history. Output m
+// is the FIR of the inputs up to (m + 1) * decimation - 1, with the
+// coefficients of cic_order cascaded boxcars. Returns the output count.
+inline uint32_t decimate(const FilterSpec& spec, const int32_t* in, uint32_t n,
+                         int32_t* out) {
+  const uint32_t r = spec.decimation;
+  if (r == 1) {
+    for (uint32_t i = 0; i < n; i++) {
+      out[i] = in[i];
+    }
+    return n;
+  }
+  // Coefficients by repeated convolution with a boxcar.
+  constexpr uint32_t kMaxTaps = 128;
+  int64_t h[kMaxTaps] = {1};
+  uint32_t taps = 1;
+  int64_t gain = 1;
+  for (uint32_t k = 0; k < spec.cic_order; k++) {
+    int64_t next[kMaxTaps] = {};
+    for (uint32_t i = 0; i < taps; i++) {
+      for (uint32_t j = 0; j < r; j++) {
+        next[i + j] += h[i];
+      }
+    }
+    taps += r - 1;
+    for (uint32_t i = 0; i < taps; i++) {
+      h[i] = next[i];
+    }
+    gain *= r;
+  }
+  const bool gain_is_power_of_2 = (gain & (gain - 1)) == 0;
+  uint32_t count = 0;
+  for (uint32_t t = r - 1; t < n; t += r) {
+    int64_t y = 0;
+    for (uint32_t k = 0; k < taps && k <= t; k++) {
+      y += h[k] * in[t - k];
+    }
+    out[count++] = clamp24(gain_is_power_of_2 ? div_round_up(y, gain)
+                                              : div_round(y, gain));
+  }
+  return count;
+}
+
+// A floating point IIR of an entire sequence. The output starts at the
+// first input.
+inline void iir_lowpass(const FilterSpec& spec, const int32_t* in, uint32_t n,
+                        double* out) {
+  if (spec.iir_shift == 0) {
+    for (uint32_t i = 0; i < n; i++) {
+      out[i] = in[i];
+    }
+    return;
+  }
+  const double alpha = 1.0 / (1 << spec.iir_shift);
+  double y = n ? in[0] : 0;
+  for (uint32_t i = 0; i < n; i++) {
+    y += (in[i] - y) * alpha;
+    out[i] = y;
+  }
+}
+
+}  // namespace adc_dsp_reference
@@ -0,0 +1,457 @@
+// A declarative description of the ADS1261 acquisition sequence of the
+// adc card, and a compile time compiler that turns it into the DMA TX
+// command image and the matching RX extraction plan.
+//
+// Terminology (see also adc_card.cpp)
+// * Point - A single ADC conversion, and its kBytesPerPoint SPI transfer.
+// * Slot - A group of consecutive points. In each slot we sample the
+//   channels whose rate divider selects this slot.
+// * Cycle - A group of slots after which the sequence repeats. Its
+//   length is the max rate divider.
+//
+// Each sample of a channel is acquired with 'conversions' consecutive
+// points of that channel and only the last one is used, as a workaround
+// for noise that is injected by switching the ADC input.
+//
+// The SPI transfer of each point reads the conversion that was started
+// in the previous point, reads a register for diagnostics and then
+// configures and starts the next conversion. The RX data of point i
+// thus belongs to the channel that point i - 1 configured.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "adc_dsp.h"
+
+namespace adc_sequence {
+
+// SPI transfer layout of a single point.
+constexpr uint32_t kBytesPerPoint = 16;
+// The offset of the 3 bytes conversion data within a point.
+constexpr uint32_t kRxDataOffsetInPoint = 2;
+// The offset of the diagnostic register value within a point.
+constexpr uint32_t kRegValOffsetInPoint = 7;
+
+// Limits of the compiled plan.
+constexpr uint8_t kMaxChannels = 8;
+constexpr uint16_t kMaxPointsPerCycle = 64;
+
+// The description of a single channel.
+struct ChannelSpec {
+  // Three chars channel id, as used in the log packets.
+  const char* chan_id;
+  // ADS1261 register values for this channel.
+  uint8_t ref;     // Register 0x06, reference selection.
+  uint8_t pga;     // Register 0x10, PGA.
+  uint8_t inpmux;  // Register 0x11, input selection.
+  // Number of consecutive conversions per sample. Only the last one is
+  // used.
+  uint8_t conversions;
+  // The channel is sampled once every rate_divider slots. Channels with
+  // the same divider are assigned to consecutive slots.
+  uint8_t rate_divider;
+  // Optional filtering of the channel samples. See adc_dsp.h.
+  adc_dsp::FilterSpec filter = {};
+};
+
+// Where to find the samples of a channel in a DMA half buffer.
+struct ChannelPlan {
+  // Index of the point with the first sample, within a half.
+  uint16_t first_point;
+  // Points between consecutive samples. Samples are evenly spaced.
+  uint16_t points_stride;
+  // Number of samples per cycle.
+  uint16_t samples_per_cycle;
+};
+
+// The compiled sequence. Use is_valid() to verify it.
+struct Plan {
+  // Null if valid. Otherwise describes the problem.
+  const char* error = nullptr;
+
+  uint8_t num_channels = 0;
+  uint16_t slots_per_cycle = 0;
+  uint16_t points_per_cycle = 0;
+  // The channel whose conversion data is read at each point of the cycle.
+  uint8_t point_channel[kMaxPointsPerCycle] = {};
+  ChannelPlan channels[kMaxChannels] = {};
+
+  constexpr bool is_valid() const { return error == nullptr; }
+
+  // The channel that a point of the cycle configures. That is, the
+  // channel of the next point.
+  constexpr uint8_t configured_channel(uint32_t point_in_cycle) const {
+    return point_channel[(point_in_cycle + 1) % points_per_cycle];
+  }
+};
+
+// Compiles the channel specs. Intended to be evaluated at compile time
+// and verified with a static_assert on is_valid().
+template <uint8_t N>
+constexpr Plan compile(const ChannelSpec (&specs)[N]) {
+  Plan plan;
+  if (N == 0 || N > kMaxChannels) {
+    plan.error = "Invalid number of channels";
+    return plan;
+  }
+  plan.num_channels = N;
+
+  // The cycle length is the max divider. All the dividers should
+  // divide it.
+  uint16_t slots_per_cycle = 1;
+  for (uint8_t c = 0; c < N; c++) {
+    if (specs[c].rate_divider == 0 || specs[c].conversions == 0) {
+      plan.error = "Zero rate divider or conversions";
+      return plan;
+    }
+    const char* filter_error =
+        adc_dsp::validate(specs[c].filter, specs[c].conversions);
+    if (filter_error) {
+      plan.error = filter_error;
+      return plan;
+    }
+    if (specs[c].rate_divider > slots_per_cycle) {
+      slots_per_cycle = specs[c].rate_divider;
+    }
+  }
+  for (uint8_t c = 0; c < N; c++) {
+    if (slots_per_cycle % specs[c].rate_divider != 0) {
+      plan.error = "Rate dividers should divide the max divider";
+      return plan;
+    }
+  }
+  plan.slots_per_cycle = slots_per_cycle;
+
+  // The slot phase of each channel. The i'th channel with divider d is
+  // sampled in slots i (mod d).
+  uint8_t phase[kMaxChannels] = {};
+  for (uint8_t c = 0; c < N; c++) {
+    uint8_t same_divider_before = 0;
+    for (uint8_t j = 0; j < c; j++) {
+      if (specs[j].rate_divider == specs[c].rate_divider) {
+        same_divider_before++;
+      }
+    }
+    phase[c] = same_divider_before % specs[c].rate_divider;
+  }
+
+  // Lay out the points of the cycle. Marks the last point of each
+  // sample, which is the one we use.
+  bool is_sample_end[kMaxPointsPerCycle] = {};
+  uint16_t num_points = 0;
+  for (uint16_t slot = 0; slot < slots_per_cycle; slot++) {
+    for (uint8_t c = 0; c < N; c++) {
+      if (slot % specs[c].rate_divider != phase[c]) {
+        continue;
+      }
+      for (uint8_t k = 0; k < specs[c].conversions; k++) {
+        if (num_points >= kMaxPointsPerCycle) {
+          plan.error = "Too many points per cycle";
+          return plan;
+        }
+        is_sample_end[num_points] = (k + 1 == specs[c].conversions);
+        plan.point_channel[num_points++] = c;
+      }
+    }
+  }
+  plan.points_per_cycle = num_points;
+
+  // Extract the used (last) point of each sample.
+  for (uint8_t c = 0; c < N; c++) {
+    ChannelPlan& ch = plan.channels[c];
+    uint16_t count = 0;
+    uint16_t first = 0;
+    uint16_t prev = 0;
+    uint16_t stride = 0;
+    for (uint16_t p = 0; p < num_points; p++) {
+      if (plan.point_channel[p] != c || !is_sample_end[p]) {
+        continue;
+      }
+      if (count == 0) {
+        first = p;
+      } else if (count == 1) {
+        stride = p - prev;
+      } else if (p - prev != stride) {
+        plan.error = "Samples of a channel are not evenly spaced";
+        return plan;
+      }
+      prev = p;
+      count++;
+    }
+    if (count == 0) {
+      plan.error = "Channel has no samples";
+      return plan;
+    }
+    // The spacing should be even also across the cycle boundary.
+    const uint16_t wrap_stride = num_points - prev + first;
+    if (count == 1) {
+      stride = wrap_stride;
+    } else if (wrap_stride != stride) {
+      plan.error = "Samples of a channel are not evenly spaced";
+      return plan;
+    }
+    ch.first_point = first;
+    ch.points_stride = stride;
+    ch.samples_per_cycle = count;
+  }
+
+  return plan;
+}
+
+// The time between points, in usecs. Sample times are reported with
+// usec resolution so points_per_sec should divide 1,000,000.
+constexpr uint32_t usecs_per_point(uint32_t points_per_sec) {
+  return 1000000 / points_per_sec;
+}
+
+// The interval between samples of a channel, in usecs.
+constexpr uint32_t sample_interval_usecs(const Plan& plan, uint8_t c,
+                                         uint32_t points_per_sec) {
+  return plan.channels[c].points_stride * usecs_per_point(points_per_sec);
+}
+
+// The time of the first sample of a channel in a half, in usecs relative
+// to the time of the first point of the half.
+constexpr uint32_t first_sample_offset_usecs(const Plan& plan, uint8_t c,
+                                             uint32_t points_per_sec) {
+  return plan.channels[c].first_point * usecs_per_point(points_per_sec);
+}
+
+// How the ADC converts.
+enum class ConversionMode {
+  // Each point starts a single conversion with a START command.
+  ONE_SHOT,
+  // The ADC converts continuously and the points just read the latest
+  // conversion. Points that don't switch channels send NOPs instead of
+  // the configuration and START commands since those restart the
+  // conversion.
+  CONTINUOUS,
+};
+
+// The ADS1261 MODE0 register is the data rate code in bits 7:3 and the
+// digital filter code in bits 2:0.
+constexpr uint8_t kNumDataRates = 17;
+constexpr uint8_t kMaxDataRateCode = kNumDataRates - 1;
+constexpr uint8_t kFilterSinc1 = 0;
+constexpr uint8_t kFilterSinc4 = 3;
+constexpr uint8_t kFilterFir = 4;
+
+constexpr uint8_t reg_mode0(uint8_t data_rate_code, uint8_t filter_code) {
+  return (uint8_t)((data_rate_code << 3) | filter_code);
+}
+
+// The data rates in SPS x 10, by data rate code. E.g. 166 is 16.6 SPS.
+constexpr uint32_t kDataRatesX10[kNumDataRates] = {
+    25,    50,    100,   166,    200,    500,    600,    1000,  4000,
+    12000, 24000, 48000, 72000, 144000, 192000, 256000, 400000};
+
+// The data rate codes of 20 SPS and 14400 SPS. The FIR filter is
+// available up to 20 SPS and from 14400 SPS the ADC uses the sinc5
+// filter, regardless of the filter code.
+constexpr uint8_t kMaxFirDataRateCode = 4;
+constexpr uint8_t kMinSinc5DataRateCode = 13;
+
+// An estimate of the time from the start of a conversion to its settled
+// result, in usecs, excluding the start delay of the MODE1 register.
+// Returns 0 if the MODE0 value is invalid. The sincN filters settle
+// within N data periods. For sinc5 we allow two periods. The FIR is
+// much slower than the points anyway so it's modeled loosely.
+constexpr uint32_t conversion_latency_usecs(uint8_t reg_mode0) {
+  const uint8_t data_rate_code = reg_mode0 >> 3;
+  const uint8_t filter_code = reg_mode0 & 0x07;
+  if (data_rate_code > kMaxDataRateCode || filter_code > kFilterFir) {
+    return 0;
+  }
+  uint32_t periods = 0;
+  if (data_rate_code >= kMinSinc5DataRateCode) {
+    periods = 2;
+  } else if (filter_code <= kFilterSinc4) {
+    periods = filter_code + 1;
+  } else if (filter_code == kFilterFir &&
+             data_rate_code <= kMaxFirDataRateCode) {
+    periods = 5;
+  } else {
+    return 0;
+  }
+  // Rounded up.
+  const uint32_t rate_x10 = kDataRatesX10[data_rate_code];
+  return (periods * 10000000 + rate_x10 - 1) / rate_x10;
+}
+
+// The timing of the points, for validating a data rate.
+struct PointTiming {
+  ConversionMode conversion_mode;
+  uint32_t usecs_per_point;
+  // The SPI transfer time of a point. The conversion starts at its end.
+  uint32_t transfer_usecs;
+  // The conversion start delay, per the MODE1 register.
+  uint32_t start_delay_usecs;
+  // In continuous mode, the min conversions of the channels that the
+  // sequence switches to. 0 if the sequence never switches channels.
+  uint8_t min_switch_conversions;
+};
+
+// Checks that the conversions of a MODE0 value settle before the points
+// that read them. Returns null if OK, or a description of the problem.
+constexpr const char* validate_data_rate(uint8_t reg_mode0,
+                                         const PointTiming& timing) {
+  const uint32_t latency = conversion_latency_usecs(reg_mode0);
+  if (latency == 0) {
+    return "Invalid data rate or filter";
+  }
+  const uint32_t needed = timing.start_delay_usecs + latency;
+  if (timing.conversion_mode == ConversionMode::ONE_SHOT) {
+    // A conversion is read by the next point.
+    if (needed + timing.transfer_usecs > timing.usecs_per_point) {
+      return "Conversion is slower than the points";
+    }
+    return nullptr;
+  }
+  // Each point should read a new conversion.
+  const uint32_t rate_x10 = kDataRatesX10[reg_mode0 >> 3];
+  if (10000000 > timing.usecs_per_point * rate_x10) {
+    return "Data rate is lower than the points rate";
+  }
+  // A channel switch restarts the conversion, which should settle by
+  // the last conversion point of the channel.
+  if (timing.min_switch_conversions > 0 &&
+      needed + timing.transfer_usecs >
+          timing.min_switch_conversions * timing.usecs_per_point) {
+    return "Conversion doesn't settle after a channel switch";
+  }
+  return nullptr;
+}
+
+// True if switching from channel a to channel b requires reconfiguring
+// the ADC.
+constexpr bool is_channel_switch(const ChannelSpec& a, const ChannelSpec& b) {
+  return a.ref != b.ref || a.pga != b.pga || a.inpmux != b.inpmux;
+}
+
+// Writes the TX command of a single point and returns a pointer past it.
+// 'next' is the channel of the next point and 'reconfigure' tells if
+// the point should configure and start its conversion.
+constexpr uint8_t* write_tx_point(const ChannelSpec& next, bool reconfigure,
+                                  uint8_t reg_index, uint8_t* p) {
+  // RDATA: Read data of previous conversion.
+  *p++ = 0x12;
+  *p++ = 0x00;  // Dummy.
+  *p++ = 0x00;  // Read data byte 1 (MSB) (kRxDataOffsetInPoint)
+  *p++ = 0x00;  // Read data byte 2
+  *p++ = 0x00;  // Read data byte 3 (LSB)
+
+  // Read the next static register, for diagnostic.
+  *p++ = (uint8_t)0x20 | reg_index;
+  *p++ = 0x00;  // Dummy byte
+  *p++ = 0x00;  // Read value (kRegValOffsetInPoint)
+
+  if (!reconfigure) {
+    // NOP: Keep the current conversion running.
+    for (int i = 0; i < 8; i++) {
+      *p++ = 0x00;
+    }
+    return p;
+  }
+
+  // Set and start next converstion.
+  // WREG: Write to reg 0x06 (reference selection)
+  *p++ = (uint8_t)0x40 | 0x06;
+  *p++ = next.ref;
+  // WREG:  Write to reg 0x10 (gain selection)
+  *p++ = (uint8_t)0x40 | 0x10;
+  *p++ = next.pga;
+  // WREG: Write to reg 0x11 (input selection)
+  *p++ = (uint8_t)0x40 | 0x11;
+  *p++ = next.inpmux;
+  // START: Start next conversion.
+  *p++ = 0x08;
+  *p++ = 0x00;  // Dummy byte.
+  return p;
+}
+
+// Writes the TX command image of a DMA half buffer with the given number
+// of cycles. On each point we also read the next of num_diag_regs
+// registers, for diagnostics. Returns the number of bytes written.
+template <uint8_t N>
+constexpr uint32_t build_tx_half(
+    const Plan& plan, const ChannelSpec (&specs)[N], uint32_t cycles_per_half,
+    uint8_t num_diag_regs, uint8_t* buffer,
+    ConversionMode mode = ConversionMode::ONE_SHOT) {
+  uint8_t* p = buffer;
+  const uint32_t num_points = cycles_per_half * plan.points_per_cycle;
+  for (uint32_t i = 0; i < num_points; i++) {
+    const uint32_t point_in_cycle = i % plan.points_per_cycle;
+    const ChannelSpec& current = specs[plan.point_channel[point_in_cycle]];
+    const ChannelSpec& next = specs[plan.configured_channel(point_in_cycle)];
+    const bool reconfigure = mode == ConversionMode::ONE_SHOT ||
+                             is_channel_switch(current, next);
+    p = write_tx_point(next, reconfigure, i % num_diag_regs, p);
+  }
+  return p - buffer;
+}
+
+// A burst is a short sequence of points, described by its own plan, that
+// replaces the last points of some of the halves. It allows to sample
+// slow channels occasionally without slowing down the sampling of the
+// main channels. The burst plan is compiled with compile() and its
+// specs may contain channels with a null chan_id. Those are not
+// reported and are used to let the main channel settle before the main
+// sequence resumes.
+//
+// Checks that a burst fits in a half of the main plan and that it
+// doesn't break the main cycles.
+constexpr bool is_valid_burst(const Plan& plan, const Plan& burst_plan,
+                              uint32_t cycles_per_half) {
+  return plan.is_valid() && burst_plan.is_valid() &&
+         burst_plan.points_per_cycle % plan.points_per_cycle == 0 &&
+         burst_plan.points_per_cycle < cycles_per_half * plan.points_per_cycle;
+}
+
+// The number of main plan cycles in a half with a burst.
+constexpr uint32_t cycles_before_burst(const Plan& plan,
+                                       const Plan& burst_plan,
+                                       uint32_t cycles_per_half) {
+  return cycles_per_half - burst_plan.points_per_cycle / plan.points_per_cycle;
+}
+
+// Like build_tx_half() but the last points of the half are replaced by
+// a single cycle of the burst plan. To let the main sequence resume
+// with settled values, the burst should end with conversions of the
+// first channel of the main plan.
+template <uint8_t N, uint8_t M>
+constexpr uint32_t build_tx_burst_half(
+    const Plan& plan, const ChannelSpec (&specs)[N], const Plan& burst_plan,
+    const ChannelSpec (&burst_specs)[M], uint32_t cycles_per_half,
+    uint8_t num_diag_regs, uint8_t* buffer,
+    ConversionMode mode = ConversionMode::ONE_SHOT) {
+  uint8_t* p = buffer;
+  const uint32_t main_points =
+      cycles_before_burst(plan, burst_plan, cycles_per_half) *
+      plan.points_per_cycle;
+  const uint32_t num_points = cycles_per_half * plan.points_per_cycle;
+  for (uint32_t i = 0; i < num_points; i++) {
+    // The channel of this point and of the next one.
+    const ChannelSpec* current;
+    const ChannelSpec* next;
+    if (i < main_points) {
+      const uint32_t point_in_cycle = i % plan.points_per_cycle;
+      current = &specs[plan.point_channel[point_in_cycle]];
+      next = (i + 1 < main_points)
+                 ? &specs[plan.configured_channel(point_in_cycle)]
+                 : &burst_specs[burst_plan.point_channel[0]];
+    } else {
+      const uint32_t point_in_burst = i - main_points;
+      current = &burst_specs[burst_plan.point_channel[point_in_burst]];
+      next = (i + 1 < num_points)
+                 ? &burst_specs[burst_plan.point_channel[point_in_burst + 1]]
+                 : &specs[plan.point_channel[0]];
+    }
+    const bool reconfigure =
+        mode == ConversionMode::ONE_SHOT || is_channel_switch(*current, *next);
+    p = write_tx_point(*next, reconfigure, i % num_diag_regs, p);
+  }
+  return p - buffer;
+}
+
+}  // namespace adc_sequence
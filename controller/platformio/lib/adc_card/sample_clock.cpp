@@ -0,0 +1,64 @@
+#include "sample_clock.h"
+
+void SampleClock::reset() {
+  _started = false;
+  _last_index = 0;
+  _last_time_q16 = 0;
+  _rate_q16 = _nominal_period_q16;
+  _slew_q16 = 0;
+  _window_events = 0;
+  _window_min_error = INT32_MAX;
+}
+
+uint32_t SampleClock::model_time(uint32_t index) const {
+  const uint32_t steps = index - _last_index;
+  const uint64_t period_q16 = _rate_q16 + _slew_q16;
+  return (uint32_t)((_last_time_q16 + steps * period_q16) >> 16);
+}
+
+uint32_t SampleClock::update(uint32_t index, uint32_t observed_usecs) {
+  if (!_started) {
+    _started = true;
+    _last_index = index;
+    _last_time_q16 = (uint64_t)observed_usecs << 16;
+    return observed_usecs;
+  }
+
+  // Advance the model to this event. We keep the time bits above 32
+  // since they carry across the usecs wrap around.
+  const uint32_t steps = index - _last_index;
+  _last_time_q16 += steps * (_rate_q16 + _slew_q16);
+  _last_index = index;
+  const uint32_t model_usecs = (uint32_t)(_last_time_q16 >> 16);
+
+  const int32_t error = (int32_t)(observed_usecs - model_usecs);
+  if (error > kMaxErrorUsecs || error < -kMaxErrorUsecs) {
+    // Lost track, e.g. the stream was stopped. Restart from this event.
+    _resets_count++;
+    reset();
+    return update(index, observed_usecs);
+  }
+
+  if (error < _window_min_error) {
+    _window_min_error = error;
+  }
+  if (++_window_events < _window) {
+    return model_usecs;
+  }
+
+  // End of window. A proportional correction of the offset over the
+  // next window and an integral correction of the rate.
+  const int64_t error_q16 = (int64_t)_window_min_error * 65536;
+  _slew_q16 = error_q16 / _window;
+  _rate_q16 += error_q16 / (4 * _window);
+  _last_window_error = _window_min_error;
+  _windows_count++;
+  _window_events = 0;
+  _window_min_error = INT32_MAX;
+  return model_usecs;
+}
+
+int32_t SampleClock::rate_error_ppb() const {
+  const int64_t diff_q16 = (int64_t)_rate_q16 - (int64_t)_nominal_period_q16;
+  return (int32_t)((diff_q16 * 1000000000) / (int64_t)_nominal_period_q16);
+}
@@ -0,0 +1,79 @@
+// A time model of a periodic event stream, such as the adc card DMA
+// halves. The events are timed by a hardware counter but their
+// observed times include the interrupt latency. The model fits the
+// rate and offset of the stream and provides event times that are
+// exactly periodic, except for slow and continuous corrections.
+//
+// The model is a second order tracking loop. It follows the lower
+// envelope of the observed times, since the latency only delays them.
+// Every 'window' events it takes the min error of the window and
+// adjusts the rate and the offset. The offset correction is spread
+// over the next window so the model times never jump.
+//
+// Times are in usecs mod 2^32.
+
+#pragma once
+
+#include <stdint.h>
+
+class SampleClock {
+ public:
+  // Usecs between events, nominal, and events per model update.
+  SampleClock(uint32_t nominal_period_usecs, uint16_t window)
+      : _nominal_period_q16((uint64_t)nominal_period_usecs << 16),
+        _window(window) {
+    reset();
+  }
+
+  // Prevent copy and assignment.
+  SampleClock(const SampleClock& other) = delete;
+  SampleClock& operator=(const SampleClock& other) = delete;
+
+  // Restarts the model on the next event.
+  void reset();
+
+  // Adds the observed time of the event with the given index. Indexes
+  // may skip missing events. Returns the model time of the event.
+  uint32_t update(uint32_t index, uint32_t observed_usecs);
+
+  // The model time of an event with the given index, which is not older
+  // than the last event.
+  uint32_t model_time(uint32_t index) const;
+
+  // The fitted period relative to the nominal one, in parts per billion.
+  int32_t rate_error_ppb() const;
+
+  // The min error of the last window, in usecs. This is the min latency
+  // of the events beyond the one the model settled on.
+  int32_t last_window_error_usecs() const { return _last_window_error; }
+
+  // Number of completed windows. Changes when the model is updated.
+  uint32_t windows_count() const { return _windows_count; }
+
+  // Number of times the model lost track and restarted.
+  uint32_t resets_count() const { return _resets_count; }
+
+ private:
+  // Above this error the model restarts.
+  static constexpr int32_t kMaxErrorUsecs = 2000;
+
+  const uint64_t _nominal_period_q16;
+  const uint16_t _window;
+
+  bool _started;
+  // The index and model time of the last event. The time is in usecs
+  // with 16 fraction bits.
+  uint32_t _last_index;
+  uint64_t _last_time_q16;
+  // The fitted period and the offset correction that is spread over the
+  // current window, in usecs with 16 fraction bits per event.
+  uint64_t _rate_q16;
+  int64_t _slew_q16;
+  // State of the current window.
+  uint16_t _window_events;
+  int32_t _window_min_error;
+
+  int32_t _last_window_error = 0;
+  uint32_t _windows_count = 0;
+  uint32_t _resets_count = 0;
+};
@@ -0,0 +1,156 @@
+#include "alarm_rules.h"
+
+#include <string.h>
+
+namespace alarm_rules {
+
+const char* validate(const Rule& rule) {
+  if (strnlen(rule.chan_id, sizeof(rule.chan_id)) != 3) {
+    return "invalid channel id";
+  }
+  switch (rule.type) {
+    case RuleType::ABOVE:
+    case RuleType::BELOW:
+      return nullptr;
+    case RuleType::RATE:
+    case RuleType::SPREAD:
+      if (rule.span < 1 || rule.span > kMaxSpan) {
+        return "span out of range";
+      }
+      if (rule.limit < 0) {
+        return "negative limit";
+      }
+      return nullptr;
+    default:
+      return "invalid rule type";
+  }
+}
+
+const char* RuleEngine::set_rules(const Rule* rules, uint8_t num_rules) {
+  if (num_rules > kMaxRules) {
+    return "too many rules";
+  }
+  for (uint8_t i = 0; i < num_rules; i++) {
+    const char* error = validate(rules[i]);
+    if (error) {
+      return error;
+    }
+  }
+  for (uint8_t i = 0; i < num_rules; i++) {
+    _rules[i] = rules[i];
+    memset(&_states[i], 0, sizeof(_states[i]));
+  }
+  _num_rules = num_rules;
+  return nullptr;
+}
+
+bool RuleEngine::has_rules(const char* chan_id) const {
+  for (uint8_t i = 0; i < _num_rules; i++) {
+    if (strcmp(_rules[i].chan_id, chan_id) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RuleEngine::evaluate(const Rule& rule, RuleState* state, int32_t value,
+                          int32_t* measured) {
+  switch (rule.type) {
+    case RuleType::ABOVE:
+      *measured = value;
+      return value > rule.limit;
+
+    case RuleType::BELOW:
+      *measured = value;
+      return value < rule.limit;
+
+    case RuleType::RATE: {
+      // Compares with the value 'span' samples ago, which is the oldest
+      // in the history once it's full.
+      bool result = false;
+      if (state->history_size == rule.span) {
+        const int32_t delta = value - state->history[state->history_next];
+        *measured = delta;
+        result = delta > rule.limit || delta < -rule.limit;
+      } else {
+        state->history_size++;
+      }
+      state->history[state->history_next] = value;
+      state->history_next = (state->history_next + 1) % rule.span;
+      return result;
+    }
+
+    case RuleType::SPREAD: {
+      // The window includes the current value.
+      state->history[state->history_next] = value;
+      state->history_next = (state->history_next + 1) % rule.span;
+      if (state->history_size < rule.span) {
+        state->history_size++;
+        if (state->history_size < rule.span) {
+          return false;
+        }
+      }
+      int32_t min = value;
+      int32_t max = value;
+      for (uint16_t i = 0; i < rule.span; i++) {
+        const int32_t v = state->history[i];
+        min = v < min ? v : min;
+        max = v > max ? v : max;
+      }
+      *measured = max - min;
+      return max - min > rule.limit;
+    }
+  }
+  return false;
+}
+
+uint32_t RuleEngine::process(const char* chan_id, uint8_t value_index,
+                             const int32_t* values, uint32_t n,
+                             uint32_t first_micros, uint32_t interval_usecs,
+                             Match* matches, uint32_t max_matches) {
+  uint32_t num_matches = 0;
+  for (uint8_t r = 0; r < _num_rules; r++) {
+    const Rule& rule = _rules[r];
+    if (rule.value_index != value_index || strcmp(rule.chan_id, chan_id)) {
+      continue;
+    }
+    RuleState* const state = &_states[r];
+
+    // Restarts the history on a gap of more than half an interval.
+    const int32_t gap = (int32_t)(first_micros - state->next_micros);
+    if (gap > (int32_t)(interval_usecs / 2) ||
+        gap < -(int32_t)(interval_usecs / 2)) {
+      state->history_size = 0;
+      state->history_next = 0;
+    }
+    state->next_micros = first_micros + n * interval_usecs;
+
+    const uint32_t holdoff_usecs = rule.holdoff_millis * 1000;
+    for (uint32_t i = 0; i < n; i++) {
+      int32_t measured = 0;
+      const bool is_over = evaluate(rule, state, values[i], &measured);
+      const bool was_over = state->is_over;
+      state->is_over = is_over;
+      if (!is_over || was_over) {
+        continue;
+      }
+      const uint32_t sample_micros = first_micros + i * interval_usecs;
+      if (state->has_matched &&
+          sample_micros - state->last_match_micros < holdoff_usecs) {
+        continue;
+      }
+      state->has_matched = true;
+      state->last_match_micros = sample_micros;
+      if (num_matches >= max_matches) {
+        _dropped_matches_count++;
+        continue;
+      }
+      matches[num_matches++] = {.rule_index = r,
+                                .value = measured,
+                                .sample_micros = sample_micros};
+    }
+  }
+  return num_matches;
+}
+
+}  // namespace alarm_rules
@@ -0,0 +1,123 @@
+// The rules of the alarms engine and their evaluation on the raw samples
+// of the channels, before they are packetized.
+//
+// A rule applies to the values of a channel, e.g. "lc1", and for
+// channels with more than one value per sample, e.g. the voltage and
+// current of "pw1", to one of the values. Rule types:
+// * ABOVE - a value above the limit.
+// * BELOW - a value below the limit.
+// * RATE - a change of more than the limit within 'span' samples.
+// * SPREAD - max - min of the last 'span' values above the limit.
+//
+// A rule matches on the sample where its condition becomes true, so a
+// match is detected within the sample period, and matches again only
+// after the condition cleared and the hold off time passed. The history
+// of the RATE and SPREAD rules restarts on gaps in the samples.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace alarm_rules {
+
+constexpr uint8_t kMaxRules = 8;
+
+// Max span of the RATE and SPREAD rules, in samples.
+constexpr uint16_t kMaxSpan = 64;
+
+enum class RuleType : uint8_t {
+  ABOVE = 1,
+  BELOW = 2,
+  RATE = 3,
+  SPREAD = 4,
+};
+
+// Actions of a match, besides the event report. A bit mask.
+enum Actions : uint8_t {
+  // Set the alarm output pin, until the alarms are cleared.
+  ACTION_GPIO = 0x01,
+  // Send a message to the printer.
+  ACTION_PRINTER = 0x02,
+};
+
+struct Rule {
+  char chan_id[4];
+  // The value within the sample.
+  uint8_t value_index;
+  RuleType type;
+  int32_t limit;
+  // For RATE and SPREAD, in samples.
+  uint16_t span;
+  // Min time between matches of the rule.
+  uint16_t holdoff_millis;
+  uint8_t actions;
+};
+
+// A match of a rule.
+struct Match {
+  uint8_t rule_index;
+  // The sample value, for ABOVE and BELOW, the change for RATE or the
+  // spread for SPREAD.
+  int32_t value;
+  // The time of the matching sample.
+  uint32_t sample_micros;
+};
+
+// Validates a rule. Returns an error message or null if ok.
+const char* validate(const Rule& rule);
+
+class RuleEngine {
+ public:
+  RuleEngine() {}
+
+  // Prevent copy and assignment.
+  RuleEngine(const RuleEngine& other) = delete;
+  RuleEngine& operator=(const RuleEngine& other) = delete;
+
+  // Replaces the rules and resets their states. Returns an error message
+  // or null if ok, in which case the rules are not changed.
+  const char* set_rules(const Rule* rules, uint8_t num_rules);
+
+  uint8_t num_rules() const { return _num_rules; }
+  const Rule& rule(uint8_t i) const { return _rules[i]; }
+
+  // True if any rule applies to the channel.
+  bool has_rules(const char* chan_id) const;
+
+  // Evaluates n consecutive samples of a value of a channel. first_micros
+  // is the time of the first sample. Returns the number of matches that
+  // were written to 'matches'. Matches beyond max_matches are dropped
+  // and counted.
+  uint32_t process(const char* chan_id, uint8_t value_index,
+                   const int32_t* values, uint32_t n, uint32_t first_micros,
+                   uint32_t interval_usecs, Match* matches,
+                   uint32_t max_matches);
+
+  uint32_t dropped_matches_count() const { return _dropped_matches_count; }
+
+ private:
+  struct RuleState {
+    // True while the condition holds.
+    bool is_over;
+    bool has_matched;
+    uint32_t last_match_micros;
+    // The expected time of the next sample, to detect gaps.
+    uint32_t next_micros;
+    // A ring of the last values, for RATE and SPREAD.
+    uint16_t history_size;
+    uint16_t history_next;
+    int32_t history[kMaxSpan];
+  };
+
+  Rule _rules[kMaxRules];
+  RuleState _states[kMaxRules];
+  uint8_t _num_rules = 0;
+  uint32_t _dropped_matches_count = 0;
+
+  // Returns true if the condition of the rule holds after this value
+  // and sets the measured value.
+  bool evaluate(const Rule& rule, RuleState* state, int32_t value,
+                int32_t* measured);
+};
+
+}  // namespace alarm_rules
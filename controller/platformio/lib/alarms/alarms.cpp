@@ -0,0 +1,219 @@
+#include "alarms.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "data_recorder.h"
+#include "gpio_pins.h"
+#include "host_link.h"
+#include "printer_link_card.h"
+#include "session.h"
+#include "static_mutex.h"
+#include "static_queue.h"
+#include "static_string.h"
+#include "time_util.h"
+
+namespace alarms {
+
+using alarm_rules::Match;
+using alarm_rules::Rule;
+using alarm_rules::RuleType;
+
+// A match that is passed from a producer's task to the alarm task.
+struct AlarmEvent {
+  Match match;
+  char chan_id[4];
+  uint8_t actions;
+  // The time the match was detected, for the latency.
+  uint32_t detect_micros;
+  uint32_t interval_usecs;
+};
+
+// Max matches per process() call. More are dropped and counted.
+static constexpr uint32_t kMaxMatchesPerCall = 4;
+
+// The rules and their states, shared by the producers and the rx task.
+static StaticMutex mutex;
+static alarm_rules::RuleEngine engine;
+
+static StaticQueue<AlarmEvent, 8> events_queue;
+
+// Stats. Protected by the mutex.
+static uint32_t matches_count = 0;
+static uint32_t dropped_events_count = 0;
+// Of the last and slowest matches, from the sample to the detection.
+static uint32_t last_latency_usecs = 0;
+static uint32_t max_latency_usecs = 0;
+static uint32_t max_latency_samples = 0;
+
+bool has_rules(const char* chan_id) {
+  MutexScope scope(mutex);
+  return engine.has_rules(chan_id);
+}
+
+void process(const char* chan_id, uint8_t value_index, const int32_t* values,
+             uint32_t n, uint32_t first_micros, uint32_t interval_usecs) {
+  Match matches[kMaxMatchesPerCall];
+  AlarmEvent event;
+  MutexScope scope(mutex);
+
+  const uint32_t num_matches =
+      engine.process(chan_id, value_index, values, n, first_micros,
+                     interval_usecs, matches, kMaxMatchesPerCall);
+  if (!num_matches) {
+    return;
+  }
+  event.detect_micros = time_util::micros();
+  for (uint32_t i = 0; i < num_matches; i++) {
+    const Rule& rule = engine.rule(matches[i].rule_index);
+    // Set here rather than by the alarm task, for the lowest latency.
+    if (rule.actions & alarm_rules::ACTION_GPIO) {
+      gpio_pins::IFC_OUT1.set_high();
+    }
+    matches_count++;
+    const uint32_t latency_usecs =
+        event.detect_micros - matches[i].sample_micros;
+    last_latency_usecs = latency_usecs;
+    if (latency_usecs > max_latency_usecs) {
+      max_latency_usecs = latency_usecs;
+      max_latency_samples = interval_usecs ? latency_usecs / interval_usecs : 0;
+    }
+    event.match = matches[i];
+    memcpy(event.chan_id, rule.chan_id, sizeof(event.chan_id));
+    event.actions = rule.actions;
+    event.interval_usecs = interval_usecs;
+    if (!events_queue.add_from_task(event, 0)) {
+      dropped_events_count++;
+    }
+  }
+}
+
+// Used by the alarm task only.
+static SerialPacketsData packet_data;
+static StaticString<40> report;
+
+// Sends the alarm as an 'ext' report at the time of the matching sample,
+// directly to the host and the recording.
+static void report_alarm(const AlarmEvent& event) {
+  const uint32_t latency_usecs =
+      event.detect_micros - event.match.sample_micros;
+  char str[41];
+  snprintf(str, sizeof(str), "alarm%hu:%s:%ld:%lu",
+           event.match.rule_index, event.chan_id, event.match.value,
+           latency_usecs);
+  report.set_c_str(str);
+
+  uint32_t base_millis;
+  uint32_t offset_usecs;
+  time_util::split_micros(event.match.sample_micros, time_util::millis(),
+                          &base_millis, &offset_usecs);
+  packet_data.clear();
+  packet_data.write_uint8(2);               // Packet format version
+  packet_data.write_uint32(session::id());  // Device session id.
+  packet_data.write_uint32(base_millis);    // Base time.
+  packet_data.write_str("ext");
+  packet_data.write_uint32(offset_usecs);  // Relative time offset
+  packet_data.write_uint16(1);             // Num data points
+  packet_data.write_str(report.c_str());
+  if (packet_data.had_write_errors()) {
+    error_handler::Panic(180);
+  }
+
+  host_link::client.sendMessage(host_link::HostPorts::LOG_REPORT_MESSAGE,
+                                packet_data);
+  data_recorder::append_log_record_if_recording(packet_data);
+
+  if (event.actions & alarm_rules::ACTION_PRINTER) {
+    printer_link_card::send_report(report.c_str());
+  }
+  logger.warning("Alarm: [%s]", report.c_str());
+}
+
+static void alarms_task_body_impl(void* ignored_argument) {
+  for (;;) {
+    AlarmEvent event;
+    if (!events_queue.consume_from_task(&event, portMAX_DELAY)) {
+      error_handler::Panic(179);
+    }
+    report_alarm(event);
+  }
+}
+
+// The exported task body.
+TaskBodyFunction alarms_task_body(alarms_task_body_impl, nullptr);
+
+static PacketStatus handle_set_rules_command(
+    const SerialPacketsData& command_data) {
+  // Used by the rx task only.
+  static Rule rules[alarm_rules::kMaxRules];
+  static StaticString<3> chan_id;
+
+  const uint8_t num_rules = command_data.read_uint8();
+  if (command_data.had_read_errors() || num_rules > alarm_rules::kMaxRules) {
+    logger.error("Alarm rules: invalid command data.");
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  memset(rules, 0, sizeof(rules));
+  for (uint8_t i = 0; i < num_rules; i++) {
+    Rule& rule = rules[i];
+    command_data.read_str(&chan_id);
+    strncpy(rule.chan_id, chan_id.c_str(), sizeof(rule.chan_id) - 1);
+    rule.value_index = command_data.read_uint8();
+    rule.type = (RuleType)command_data.read_uint8();
+    rule.limit = (int32_t)command_data.read_uint32();
+    rule.span = command_data.read_uint16();
+    rule.holdoff_millis = command_data.read_uint16();
+    rule.actions = command_data.read_uint8();
+  }
+  if (!command_data.all_read_ok()) {
+    logger.error("Alarm rules: invalid command data.");
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  const char* error;
+  {
+    MutexScope scope(mutex);
+    error = engine.set_rules(rules, num_rules);
+  }
+  if (error) {
+    logger.error("Alarm rules: %s.", error);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  logger.info("Alarm rules: %hu rules set.", num_rules);
+  return PacketStatus::OK;
+}
+
+PacketStatus handle_command(uint8_t op_code,
+                            const SerialPacketsData& command_data,
+                            SerialPacketsData& response_data) {
+  if (op_code == SET_ALARM_RULES) {
+    return handle_set_rules_command(command_data);
+  }
+  if (op_code != CLEAR_ALARMS) {
+    logger.error("Unexpected alarms command code %hx", op_code);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  if (!command_data.all_read_ok()) {
+    logger.error("Clear alarms: invalid command data.");
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  gpio_pins::IFC_OUT1.set_low();
+  MutexScope scope(mutex);
+  response_data.write_uint32(matches_count);
+  return PacketStatus::OK;
+}
+
+void dump_state() {
+  MutexScope scope(mutex);
+  if (!engine.num_rules()) {
+    return;
+  }
+  logger.info(
+      "Alarms: %hu rules, matches: %lu, dropped: %lu, latency: %lu us, max "
+      "%lu us (%lu samples)",
+      engine.num_rules(), matches_count,
+      dropped_events_count + engine.dropped_matches_count(),
+      last_latency_usecs, max_latency_usecs, max_latency_samples);
+}
+
+}  // namespace alarms
@@ -0,0 +1,59 @@
+// On device alarms. The producers of the channels, e.g. the adc card and
+// the pw card, pass the raw values to the alarm rules before they are
+// packetized. On a match, the alarm output pin is set (if the rule says
+// so) from the producer's task, and the alarm task, which has a high
+// priority, sends an 'ext' report "alarm<rule>:<chan id>:<value>:<latency
+// usecs>" directly to the host and the recording, ahead of the queued
+// data packets, and optionally to the printer. See alarm_rules.h.
+
+#pragma once
+
+#include "alarm_rules.h"
+#include "serial_packets_consts.h"
+#include "serial_packets_data.h"
+#include "static_task.h"
+
+namespace alarms {
+
+// Control command codes that are handled here.
+enum OpCodes {
+  // Replace the alarm rules. An empty list disables the alarms. The
+  // limits are in raw ADC units.
+  // Command: [uint8 n] n x [str chan id][uint8 value index]
+  //          [uint8 rule type][int32 limit][uint16 span]
+  //          [uint16 hold off millis][uint8 actions]
+  // Response: none
+  SET_ALARM_RULES = 0x0b,
+  // Clear the alarm output pin.
+  // Command: none
+  // Response: [uint32 matches count]
+  CLEAR_ALARMS = 0x0c,
+};
+
+inline bool is_alarms_op_code(uint8_t op_code) {
+  return op_code == SET_ALARM_RULES || op_code == CLEAR_ALARMS;
+}
+
+// Called from the host link rx task with a command whose op code was
+// already read.
+PacketStatus handle_command(uint8_t op_code,
+                            const SerialPacketsData& command_data,
+                            SerialPacketsData& response_data);
+
+// True if any rule applies to the channel. Lets the producers skip the
+// decoding of the values.
+bool has_rules(const char* chan_id);
+
+// Called by the producers with n consecutive raw values of a channel.
+// value_index selects the value for channels with more than one value
+// per sample. first_micros is the time of the first value.
+void process(const char* chan_id, uint8_t value_index, const int32_t* values,
+             uint32_t n, uint32_t first_micros, uint32_t interval_usecs);
+
+void dump_state();
+
+// Caller should provide a task to run this task body. Should have a
+// higher priority than the data queue task.
+extern TaskBodyFunction alarms_task_body;
+
+}  // namespace alarms
@@ -1,27 +1,110 @@
 #include "controller.h"
 
+#include "adc_card.h"
+#include "alarms.h"
+#include "cpu_load.h"
 #include "data_queue.h"
 #include "data_recorder.h"
+#include "downloads.h"
+#include "event_trace.h"
 #include "gpio_pins.h"
 #include "host_link.h"
 #include "serial_packets_client.h"
 #include "session.h"
 #include "static_mutex.h"
+#include "static_queue.h"
+#include "static_task.h"
 
 using host_link::HostPorts;
 
 namespace controller {
 
-// Protects access to the variables below.
+// Serializes external data reports.
 static StaticMutex mutex;
 
-static data_recorder::RecordingName new_recording_name_buffer;
+// Commands that access the SD card or the data recorder may block for
+// a long time (e.g. f_mount() on START) so they are executed by the
+// command task rather than by the host link rx task, and their
+// responses are sent asynchronously.
+struct DeferredCommand {
+  uint32_t cmd_id;
+  uint8_t op_code;
+  // Valid for the START command only.
+  data_recorder::RecordingName recording_name;
+};
+
+// Deferred command slots. Slot indexes are passed between the free and
+// pending queues, similar to data_queue.
+static constexpr uint8_t kNumDeferredCommands = 4;
+static DeferredCommand deferred_commands[kNumDeferredCommands];
+static StaticQueue<uint8_t, kNumDeferredCommands> free_commands_indexes_queue;
+static StaticQueue<uint8_t, kNumDeferredCommands>
+    pending_commands_indexes_queue;
+
+// Accessed by the command task only.
 static data_recorder::RecordingInfo recording_info_buffer;
+static SerialPacketsData deferred_response_data;
 
-// Temp packet data. Used to encode log packets.
-// static SerialPacketsData packet_data;
+void setup() {
+  for (uint8_t i = 0; i < kNumDeferredCommands; i++) {
+    if (!free_commands_indexes_queue.add_from_task(i, 0)) {
+      error_handler::Panic(152);
+    }
+  }
+}
 
-PacketStatus handle_control_command(const SerialPacketsData& command_data,
+// Called from the host link rx task. Grabs a free slot for a deferred
+// command. Returns nullptr if all the slots are in use.
+static DeferredCommand* grab_deferred_command(uint32_t cmd_id,
+                                              uint8_t op_code) {
+  uint8_t i;
+  if (!free_commands_indexes_queue.consume_from_task(&i, 0)) {
+    return nullptr;
+  }
+  DeferredCommand* const command = &deferred_commands[i];
+  command->cmd_id = cmd_id;
+  command->op_code = op_code;
+  command->recording_name.clear();
+  return command;
+}
+
+// Called from the host link rx task. Hands the command to the command
+// task.
+static void queue_deferred_command(DeferredCommand* command) {
+  const uint8_t i = command - deferred_commands;
+  if (i >= kNumDeferredCommands) {
+    error_handler::Panic(153);
+  }
+  if (!pending_commands_indexes_queue.add_from_task(i, 0)) {
+    // Should not happen since the two queues have the capacity of all
+    // the slots.
+    error_handler::Panic(154);
+  }
+}
+
+// Writes the response of the task stacks command.
+// Response: [uint8 n] n x [str name][uint16 stack bytes]
+//           [uint16 unused bytes]
+// The unused bytes are the high water mark, zero if not started.
+static void write_task_stacks(SerialPacketsData& response_data) {
+  uint8_t n = 0;
+  for (StaticTaskBase* task = StaticTaskBase::first(); task;
+       task = task->next()) {
+    n++;
+  }
+  response_data.write_uint8(n);
+  for (StaticTaskBase* task = StaticTaskBase::first(); task;
+       task = task->next()) {
+    response_data.write_str(task->name());
+    response_data.write_uint16(task->stack_size_bytes());
+    response_data.write_uint16(task->unused_stack_bytes());
+  }
+}
+
+// Called from the host link rx task. Returns PENDING if the command
+// will be completed by the command task.
+PacketStatus handle_control_command(uint32_t cmd_id,
+                                    const SerialPacketsData& command_data,
                                     SerialPacketsData& response_data) {
   // Assuming command_data reading is reset and response data is empty.
   const uint8_t op_code = command_data.read_uint8();
@@ -29,31 +112,98 @@ PacketStatus handle_control_command(const SerialPacketsData& command_data,
     logger.error("COMMAND: error reading command code.");
     return PacketStatus::INVALID_ARGUMENT;
   }
-  switch (op_code) {
-    // Command 0x01 - NOP. Command data should be empty.
-    case 0x01:
-      if (!command_data.all_read_ok()) {
-        logger.error("NOP command: Invalid command data.");
-        return PacketStatus::INVALID_ARGUMENT;
-      }
-      return PacketStatus::OK;
-      break;
 
+  // Command 0x01 - NOP. Command data should be empty. Executed inline.
+  if (op_code == 0x01) {
+    if (!command_data.all_read_ok()) {
+      logger.error("NOP command: Invalid command data.");
+      return PacketStatus::INVALID_ARGUMENT;
+    }
+    return PacketStatus::OK;
+  }
+
+  // Commands 0x05 - 0x07 access recording files and are executed by
+  // the downloads task.
+  if (downloads::is_downloads_op_code(op_code)) {
+    return downloads::handle_command(cmd_id, op_code, command_data);
+  }
+
+  // Command 0x08 - reconfigures an adc card and is executed by its task.
+  if (adc_card::is_adc_card_op_code(op_code)) {
+    return adc_card::handle_command(cmd_id, op_code, command_data);
+  }
+
+  // Commands 0x0b - 0x0c - set and clear the alarms. Executed inline.
+  if (alarms::is_alarms_op_code(op_code)) {
+    return alarms::handle_command(op_code, command_data, response_data);
+  }
+
+  // Command 0x0d - the stack usage of the tasks. Executed inline.
+  if (op_code == 0x0d) {
+    if (!command_data.all_read_ok()) {
+      logger.error("Task stacks command: Invalid command data.");
+      return PacketStatus::INVALID_ARGUMENT;
+    }
+    write_task_stacks(response_data);
+    return PacketStatus::OK;
+  }
+
+  // Command 0x0e - the cpu load stats. Executed inline.
+  if (cpu_load::is_cpu_load_op_code(op_code)) {
+    return cpu_load::handle_command(op_code, command_data, response_data);
+  }
+
+  // Commands 0x0f - 0x11 - stop, read and start the event trace.
+  // Executed inline.
+  if (event_trace::is_event_trace_op_code(op_code)) {
+    return event_trace::handle_command(op_code, command_data, response_data);
+  }
+
+  if (op_code < 0x02 || op_code > 0x04) {
+    logger.error("COMMAND: Unknown command code %hx", op_code);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  DeferredCommand* const command = grab_deferred_command(cmd_id, op_code);
+  if (!command) {
+    logger.error("COMMAND: too many pending commands, dropping %hx", op_code);
+    return PacketStatus::TOO_MANY_COMMANDS;
+  }
+
+  // Command 0x02 - START a new recording with given name.
+  if (op_code == 0x02) {
+    // Get recording id string.
+    command_data.read_str(&command->recording_name);
+  }
+
+  // Commands 0x02, 0x03, 0x04 have no other data.
+  if (!command_data.all_read_ok()) {
+    logger.error("COMMAND: Invalid command data for command %hx.", op_code);
+    // Return the slot.
+    if (!free_commands_indexes_queue.add_from_task(command - deferred_commands,
+                                                   0)) {
+      error_handler::Panic(155);
+    }
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  queue_deferred_command(command);
+  return PacketStatus::PENDING;
+}
+
+// Called from the command task. Executes a deferred command and sets
+// its response data.
+static PacketStatus execute_deferred_command(const DeferredCommand& command,
+                                             SerialPacketsData& response_data) {
+  switch (command.op_code) {
     // Command 0x02 - START a new recording with given name.
     case 0x02: {
-      MutexScope scope(mutex);
-      // Get recording id string.
-      command_data.read_str(&new_recording_name_buffer);
-      if (!command_data.all_read_ok()) {
-        logger.error("START command: Invalid command data.");
-        return PacketStatus::INVALID_ARGUMENT;
-      }
       const bool had_old_recording = data_recorder::is_recording_active();
       const bool started_ok =
-          data_recorder::start_recording(new_recording_name_buffer);
+          data_recorder::start_recording(command.recording_name);
       if (!started_ok) {
         logger.error("START command: failed to create recording file for [%s]",
-                     new_recording_name_buffer.c_str());
+                     command.recording_name.c_str());
         return PacketStatus::GENERAL_ERROR;
       }
       response_data.write_uint8(had_old_recording ? 1 : 0);
@@ -62,11 +212,6 @@ PacketStatus handle_control_command(const SerialPacketsData& command_data,
 
     // Command 0x03 - Stop currently running recording. If nay..
     case 0x03: {
-      MutexScope scope(mutex);
-      if (!command_data.all_read_ok()) {
-        logger.error("STOP command: Invalid command data.");
-        return PacketStatus::INVALID_ARGUMENT;
-      }
       const bool had_old_recording = data_recorder::is_recording_active();
       data_recorder::stop_recording();
       response_data.write_uint8(had_old_recording ? 1 : 0);
@@ -75,11 +220,6 @@ PacketStatus handle_control_command(const SerialPacketsData& command_data,
 
     // Command 0x04 - Get status
     case 0x04: {
-      MutexScope scope(mutex);
-      if (!command_data.all_read_ok()) {
-        logger.error("STATUS command: Invalid command data.");
-        return PacketStatus::INVALID_ARGUMENT;
-      }
       // Device info.
       response_data.write_uint8(1);                     // Format version
       response_data.write_uint32(session::id());        // Device session id.
@@ -99,19 +239,42 @@ PacketStatus handle_control_command(const SerialPacketsData& command_data,
     } break;
 
     default:
-      logger.error("COMMAND: Unknown command code %hx", op_code);
-      return PacketStatus::INVALID_ARGUMENT;
+      // Should not happen since we validated the op code.
+      error_handler::Panic(156);
   }
 
   return PacketStatus::UNHANDLED;
 }
 
-PacketStatus host_link_command_handler(uint8_t endpoint,
+static void command_task_body_impl(void* ignored_argument) {
+  for (;;) {
+    uint8_t i;
+    // Blocking.
+    pending_commands_indexes_queue.consume_from_task(&i, portMAX_DELAY);
+    const DeferredCommand& command = deferred_commands[i];
+
+    deferred_response_data.clear();
+    const PacketStatus status =
+        execute_deferred_command(command, deferred_response_data);
+    host_link::client.sendResponse(command.cmd_id, status,
+                                   deferred_response_data);
+
+    // Return the slot.
+    if (!free_commands_indexes_queue.add_from_task(i, 0)) {
+      error_handler::Panic(157);
+    }
+  }
+}
+
+// The exported task body.
+TaskBodyFunction command_task_body(command_task_body_impl, nullptr);
+
+PacketStatus host_link_command_handler(uint8_t endpoint, uint32_t cmd_id,
                                        const SerialPacketsData& command_data,
                                        SerialPacketsData& response_data) {
   if (endpoint == host_link::SelfPorts::CONTROL_COMMAND) {
     logger.info("Recieved a control commannd at endpoint %02hx", endpoint);
-    return handle_control_command(command_data, response_data);
+    return handle_control_command(cmd_id, command_data, response_data);
   }
   logger.error("Ignored command at endpoint %02hx", endpoint);
   return PacketStatus::UNHANDLED;
@@ -120,12 +283,23 @@ PacketStatus host_link_command_handler(uint8_t endpoint,
 // A callback type for incoming messages.
 void host_link_message_handler(uint8_t endpoint,
                                const SerialPacketsData& message_data) {
-  // Currently we don't use nor expect incoming messages.
+  if (endpoint == host_link::SelfPorts::FRAGMENT_ACK_MESSAGE) {
+    host_link::fragment_sender.on_ack_message(message_data);
+    return;
+  }
   logger.warning("Recieved a message at endpoint %02hx", endpoint);
 }
 
+// External reports with this prefix, e.g. "trg:layer_start", also
+// trigger a dump of the adc card captures.
+static constexpr char kCaptureMarkerPrefix[] = "trg";
+
 // Report string is assumed to be validated.
 void report_external_data(const ExternalReportStr& report_str) {
+  if (report_str.starts_with(kCaptureMarkerPrefix)) {
+    adc_card::trigger_capture(time_util::micros());
+  }
+
   MutexScope scope(mutex);
 
   // Encode a log record that contain 'ext' channel with
@@ -138,12 +312,18 @@ void report_external_data(const ExternalReportStr& report_str) {
     data_queue::DataBuffer* data_buffer = data_queue::grab_buffer();
     SerialPacketsData* packet_data = &data_buffer->packet_data();
 
+    // The report time with usecs resolution.
+    uint32_t base_millis;
+    uint32_t offset_usecs;
+    time_util::split_micros(time_util::micros(), time_util::millis(),
+                            &base_millis, &offset_usecs);
+
     packet_data->clear();
-    packet_data->write_uint8(1);                     // packet format version
+    packet_data->write_uint8(2);                     // packet format version
     packet_data->write_uint32(session::id());        // Device session id.
-    packet_data->write_uint32(time_util::millis());  // Base time.
+    packet_data->write_uint32(base_millis);          // Base time.
     packet_data->write_str("ext");                   // External report meta channel id
-    packet_data->write_uint16(0);                    // Relative time offset
+    packet_data->write_uint32(offset_usecs);         // Relative time offset
     packet_data->write_uint16(1);                    // Num data points
     packet_data->write_str(report_str.c_str());
 
@@ -5,15 +5,25 @@
 #include "serial_packets_consts.h"
 #include "serial_packets_data.h"
 #include "static_string.h"
+#include "static_task.h"
 
 namespace controller {
 
 typedef StaticString<40> ExternalReportStr;
 
-PacketStatus host_link_command_handler(uint8_t endpoint,
+// Main calls this once upon initialization.
+void setup();
+
+// A callback handler for incoming host link commands. Slow commands
+// return PENDING and are completed by the command task.
+PacketStatus host_link_command_handler(uint8_t endpoint, uint32_t cmd_id,
                                        const SerialPacketsData& command_data,
                                        SerialPacketsData& response_data);
 
+// Caller should provide a task to run this task body. Executes
+// commands that may block, such as starting a recording.
+extern TaskBodyFunction command_task_body;
+
 // A callback handler for incoming host link messages. Implemented by
 // the controller.
 void host_link_message_handler(uint8_t endpoint,
@@ -0,0 +1,260 @@
+#include "downloads.h"
+
+#include <algorithm>
+
+#include "data_recorder.h"
+#include "host_link.h"
+#include "serial_packets_crc.h"
+#include "static_queue.h"
+
+using data_recorder::RecordingName;
+
+namespace downloads {
+
+// A command that is executed by the downloads task. Trivially copyable
+// since it's passed by value in the queue.
+struct Request {
+  uint32_t cmd_id;
+  uint8_t op_code;
+  char recording_name[RecordingName::kMaxLen + 1];
+  // Start index for LIST_RECORDINGS, file offset for the others.
+  uint32_t offset;
+  // RECORDING_CRC only.
+  uint32_t length;
+  // DOWNLOAD_RECORDING only.
+  uint32_t transfer_id;
+};
+
+static StaticQueue<Request, 2> requests_queue;
+
+// Accessed by the downloads task only.
+static Request request;
+static RecordingName recording_name;
+static SerialPacketsData response_data;
+
+// True while a download is in progress. Set by the downloads task, read
+// by the rx task which rejects the commands that can't be served during
+// a download.
+static volatile bool download_in_progress = false;
+// For a request that is consumed during a download. Accessed by the
+// downloads task only.
+static Request download_time_request;
+static SerialPacketsData download_time_response_data;
+
+// Number of recordings per LIST_RECORDINGS response. Each one takes
+// up to 1 + RecordingName::kMaxLen + 4 bytes.
+static constexpr uint16_t kMaxListedRecordings = 20;
+static_assert(2 + kMaxListedRecordings * (1 + RecordingName::kMaxLen + 4) <=
+              MAX_PACKET_DATA_LEN);
+static data_recorder::RecordingFileInfo listed_recordings[kMaxListedRecordings];
+
+// For computing CRCs.
+static uint8_t crc_buffer[512];
+
+PacketStatus handle_command(uint32_t cmd_id, uint8_t op_code,
+                            const SerialPacketsData& command_data) {
+  // Used by the rx task only.
+  static Request new_request;
+  static RecordingName new_recording_name;
+
+  memset(&new_request, 0, sizeof(new_request));
+  new_request.cmd_id = cmd_id;
+  new_request.op_code = op_code;
+
+  switch (op_code) {
+    case LIST_RECORDINGS:
+      new_request.offset = command_data.read_uint16();
+      break;
+    case DOWNLOAD_RECORDING:
+      command_data.read_str(&new_recording_name);
+      new_request.offset = command_data.read_uint32();
+      new_request.transfer_id = command_data.read_uint32();
+      break;
+    case RECORDING_CRC:
+      command_data.read_str(&new_recording_name);
+      new_request.offset = command_data.read_uint32();
+      new_request.length = command_data.read_uint32();
+      break;
+    default:
+      logger.error("Unexpected downloads command code %hx", op_code);
+      return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  if (!command_data.all_read_ok()) {
+    logger.error("Invalid command data for command %hx.", op_code);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  if (op_code != LIST_RECORDINGS) {
+    static_assert(sizeof(new_request.recording_name) ==
+                  RecordingName::kMaxLen + 1);
+    strcpy(new_request.recording_name, new_recording_name.c_str());
+  }
+
+  // Only LIST_RECORDINGS is served during a download. The others would
+  // wait for the end of the transfer and time out on the host.
+  if (download_in_progress && op_code != LIST_RECORDINGS) {
+    logger.error("Download in progress, rejecting command %hx.", op_code);
+    return PacketStatus::TOO_MANY_COMMANDS;
+  }
+
+  if (!requests_queue.add_from_task(new_request, 0)) {
+    logger.error("Downloads busy, dropping command %hx.", op_code);
+    return PacketStatus::TOO_MANY_COMMANDS;
+  }
+  if (download_in_progress) {
+    // Serve it while the sender waits for acks.
+    host_link::fragment_sender.wake();
+  }
+  return PacketStatus::PENDING;
+}
+
+static PacketStatus execute_list_recordings(const Request& req,
+                                            SerialPacketsData& response) {
+  bool has_more;
+  const int n = data_recorder::list_recordings(
+      req.offset, listed_recordings, kMaxListedRecordings, &has_more);
+  if (n < 0) {
+    return PacketStatus::GENERAL_ERROR;
+  }
+  response.write_uint8(has_more ? 1 : 0);
+  response.write_uint8(n);
+  for (int i = 0; i < n; i++) {
+    response.write_str(listed_recordings[i].name.c_str());
+    response.write_uint32(listed_recordings[i].size);
+  }
+  if (response.had_write_errors()) {
+    // Should not happen since we checked the max size.
+    error_handler::Panic(161);
+  }
+  return PacketStatus::OK;
+}
+
+static PacketStatus execute_recording_crc() {
+  uint32_t file_size;
+  if (!data_recorder::open_read_file(recording_name, &file_size)) {
+    return PacketStatus::GENERAL_ERROR;
+  }
+  if (request.offset > file_size ||
+      request.length > file_size - request.offset) {
+    data_recorder::close_read_file();
+    return PacketStatus::OUT_OF_RANGE;
+  }
+
+  uint16_t crc = 0xffff;
+  uint32_t offset = request.offset;
+  const uint32_t end = request.offset + request.length;
+  while (offset < end) {
+    const uint16_t n = std::min(end - offset, (uint32_t)sizeof(crc_buffer));
+    if (!data_recorder::read_file_bytes(offset, crc_buffer, n)) {
+      data_recorder::close_read_file();
+      return PacketStatus::GENERAL_ERROR;
+    }
+    crc = serial_packets_gen_crc16(crc_buffer, n, crc);
+    offset += n;
+  }
+  data_recorder::close_read_file();
+
+  response_data.write_uint16(crc);
+  return PacketStatus::OK;
+}
+
+// Called during a download, between the file reads and while the
+// sender waits for acks. Serves the pending LIST_RECORDINGS requests so
+// the host can list while downloading. Other requests that were queued
+// before the download started are rejected.
+static void serve_requests_during_download(void* ignored_context) {
+  while (requests_queue.consume_from_task(&download_time_request, 0)) {
+    if (download_time_request.op_code != LIST_RECORDINGS) {
+      logger.error("Download in progress, rejecting command %hx.",
+                   download_time_request.op_code);
+      download_time_response_data.clear();
+      host_link::client.sendResponse(download_time_request.cmd_id,
+                                     PacketStatus::TOO_MANY_COMMANDS,
+                                     download_time_response_data);
+      continue;
+    }
+    download_time_response_data.clear();
+    const PacketStatus status = execute_list_recordings(
+        download_time_request, download_time_response_data);
+    host_link::client.sendResponse(download_time_request.cmd_id, status,
+                                   download_time_response_data);
+  }
+}
+
+// A fragments data source. context points to the file offset of the
+// transfer start.
+static bool read_file_source(void* context, uint32_t offset, uint8_t* buffer,
+                             uint16_t size) {
+  serve_requests_during_download(nullptr);
+  const uint32_t base_offset = *(const uint32_t*)context;
+  return data_recorder::read_file_bytes(base_offset + offset, buffer, size);
+}
+
+// Sends its own response, before the transfer.
+static void execute_download_recording() {
+  uint32_t file_size;
+  if (!data_recorder::open_read_file(recording_name, &file_size)) {
+    host_link::client.sendResponse(request.cmd_id, PacketStatus::GENERAL_ERROR,
+                                   response_data);
+    return;
+  }
+  if (request.offset > file_size) {
+    data_recorder::close_read_file();
+    host_link::client.sendResponse(request.cmd_id, PacketStatus::OUT_OF_RANGE,
+                                   response_data);
+    return;
+  }
+
+  // Set before the response so the next commands of the host see it.
+  download_in_progress = true;
+  response_data.write_uint32(file_size);
+  host_link::client.sendResponse(request.cmd_id, PacketStatus::OK,
+                                 response_data);
+
+  logger.info("Downloading [%s] from %lu, %lu bytes", recording_name.c_str(),
+              request.offset, file_size - request.offset);
+  Elappsed timer;
+  host_link::fragment_sender.set_wait_handler(serve_requests_during_download,
+                                              nullptr);
+  const PacketStatus status = host_link::fragment_sender.send(
+      host_link::HostPorts::FRAGMENT_DATA_MESSAGE, request.transfer_id,
+      file_size - request.offset, read_file_source, &request.offset);
+  host_link::fragment_sender.set_wait_handler(nullptr, nullptr);
+  download_in_progress = false;
+  data_recorder::close_read_file();
+  logger.info("Download of [%s] ended with status %d in %lu ms",
+              recording_name.c_str(), status, timer.elapsed_millis());
+}
+
+static void downloads_task_body_impl(void* ignored_argument) {
+  for (;;) {
+    // Blocking.
+    requests_queue.consume_from_task(&request, portMAX_DELAY);
+    recording_name.set_c_str(request.recording_name);
+    response_data.clear();
+
+    PacketStatus status;
+    switch (request.op_code) {
+      case LIST_RECORDINGS:
+        status = execute_list_recordings(request, response_data);
+        break;
+      case RECORDING_CRC:
+        status = execute_recording_crc();
+        break;
+      case DOWNLOAD_RECORDING:
+        execute_download_recording();
+        continue;
+      default:
+        // Should not happen since we validated the op code.
+        error_handler::Panic(162);
+    }
+
+    host_link::client.sendResponse(request.cmd_id, status, response_data);
+  }
+}
+
+// The exported task body.
+TaskBodyFunction downloads_task_body(downloads_task_body_impl, nullptr);
+
+}  // namespace downloads
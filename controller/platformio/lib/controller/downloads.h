@@ -0,0 +1,46 @@
+// Access to the recording files on the SD card over the host link.
+
+#pragma once
+
+#include "serial_packets_consts.h"
+#include "serial_packets_data.h"
+#include "static_task.h"
+
+namespace downloads {
+
+// Control command codes that are handled here.
+enum OpCodes {
+  // List the recordings on the SD card.
+  // Command: [uint16 start index]
+  // Response: [uint8 has more][uint8 n] n x [str name][uint32 size]
+  LIST_RECORDINGS = 0x05,
+  // Start a fragmented transfer of a recording file, from a given offset,
+  // to the host's FRAGMENT_DATA_MESSAGE endpoint. The response is sent
+  // before the transfer starts. Each fragment carries the CRC of its
+  // data. LIST_RECORDINGS commands are served during the transfer, other
+  // commands are rejected with TOO_MANY_COMMANDS until it ends.
+  // Command: [str name][uint32 offset][uint32 transfer id]
+  // Response: [uint32 file size]
+  DOWNLOAD_RECORDING = 0x06,
+  // Compute the CRC16 of a range of a recording file. Allows the host to
+  // verify downloaded and partially downloaded files.
+  // Command: [str name][uint32 offset][uint32 length]
+  // Response: [uint16 crc]
+  RECORDING_CRC = 0x07,
+};
+
+inline bool is_downloads_op_code(uint8_t op_code) {
+  return op_code >= LIST_RECORDINGS && op_code <= RECORDING_CRC;
+}
+
+// Called from the host link rx task with a command whose op code was
+// already read. Returns PENDING if the command was queued for the
+// downloads task.
+PacketStatus handle_command(uint32_t cmd_id, uint8_t op_code,
+                            const SerialPacketsData& command_data);
+
+// Caller should provide a task to run this task body. Should have
+// a lower priority than the tasks that write the recording.
+extern TaskBodyFunction downloads_task_body;
+
+}  // namespace downloads
@@ -0,0 +1,249 @@
+#include "cpu_load.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "common.h"
+#include "static_mutex.h"
+#include "tcm.h"
+
+DTCM_BSS volatile uint32_t cpu_load_isr_cycles[CPU_LOAD_NUM_ISR_GROUPS] = {0};
+DTCM_BSS volatile uint32_t cpu_load_isr_counts[CPU_LOAD_NUM_ISR_GROUPS] = {0};
+
+// Called by vTaskStartScheduler(). TIM2 is started later by
+// time_util::setup(), and the first sample ignores the times before it.
+void cpu_load_configure_timers(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+// Called by the FreeRTOS context switch.
+ITCM_CODE uint32_t cpu_load_run_time_counter(void) { return TIM2->CNT; }
+
+namespace cpu_load {
+
+static const char* const kIsrGroupNames[CPU_LOAD_NUM_ISR_GROUPS] = {
+    "spi1", "i2c1", "uart", "sdmmc"};
+
+// Max tasks that are tracked, including the idle and timer tasks.
+static constexpr uint32_t kMaxTasks = 16;
+
+// The state of the samples. Accessed by the main task only.
+struct TaskSamples {
+  TaskHandle_t handle;
+  uint32_t last_run_time;
+  // The run time of the task in each of the last windows, a ring.
+  uint32_t window_run_times[kNumWindows];
+};
+static TaskSamples task_samples[kMaxTasks];
+static uint32_t num_task_samples = 0;
+static TaskStatus_t task_statuses[kMaxTasks];
+static uint32_t last_total_run_time = 0;
+static uint32_t window_usecs[kNumWindows] = {0};
+static uint32_t last_isr_cycles[CPU_LOAD_NUM_ISR_GROUPS] = {0};
+static uint32_t last_isr_counts[CPU_LOAD_NUM_ISR_GROUPS] = {0};
+// Total sample() calls.
+static uint32_t samples_count = 0;
+
+// The results of the last sample. Protected by the mutex.
+struct TaskLoad {
+  const char* name;
+  uint16_t load_permille;
+  uint16_t long_load_permille;
+};
+struct IsrLoad {
+  uint16_t load_permille;
+  uint32_t count;
+};
+struct Stats {
+  uint32_t window_usecs;
+  uint32_t long_window_usecs;
+  uint16_t cpu_load_permille;
+  uint16_t long_cpu_load_permille;
+  uint8_t num_tasks;
+  TaskLoad tasks[kMaxTasks];
+  IsrLoad isrs[CPU_LOAD_NUM_ISR_GROUPS];
+};
+static StaticMutex mutex;
+static Stats stats;
+// A copy for dump_state(), to log without holding the mutex.
+static Stats dump_stats;
+
+static uint16_t permille(uint64_t part, uint64_t total) {
+  if (!total) {
+    return 0;
+  }
+  const uint64_t result = (part * 1000 + total / 2) / total;
+  return (result > 1000) ? 1000 : result;
+}
+
+// Sets is_new if the task is seen for the first time.
+static TaskSamples* find_or_add_task(TaskHandle_t handle, bool* is_new) {
+  *is_new = false;
+  for (uint32_t i = 0; i < num_task_samples; i++) {
+    if (task_samples[i].handle == handle) {
+      return &task_samples[i];
+    }
+  }
+  if (num_task_samples >= kMaxTasks) {
+    return nullptr;
+  }
+  *is_new = true;
+  TaskSamples* const samples = &task_samples[num_task_samples++];
+  memset(samples, 0, sizeof(*samples));
+  samples->handle = handle;
+  return samples;
+}
+
+void sample() {
+  uint32_t total_run_time;
+  const uint32_t num_tasks =
+      uxTaskGetSystemState(task_statuses, kMaxTasks, &total_run_time);
+  if (!num_tasks) {
+    // More tasks than kMaxTasks.
+    error_handler::Panic(187);
+  }
+  uint32_t isr_cycles[CPU_LOAD_NUM_ISR_GROUPS];
+  uint32_t isr_counts[CPU_LOAD_NUM_ISR_GROUPS];
+  for (int g = 0; g < CPU_LOAD_NUM_ISR_GROUPS; g++) {
+    isr_cycles[g] = cpu_load_isr_cycles[g];
+    isr_counts[g] = cpu_load_isr_counts[g];
+  }
+
+  const bool is_first_sample = (samples_count++ == 0);
+  const uint32_t window_index = samples_count % kNumWindows;
+  const uint32_t usecs = total_run_time - last_total_run_time;
+  last_total_run_time = total_run_time;
+  window_usecs[window_index] = is_first_sample ? 0 : usecs;
+  uint32_t long_window_usecs = 0;
+  for (uint32_t w = 0; w < kNumWindows; w++) {
+    long_window_usecs += window_usecs[w];
+  }
+
+  Stats new_stats = {};
+  new_stats.window_usecs = window_usecs[window_index];
+  new_stats.long_window_usecs = long_window_usecs;
+  uint16_t idle_permille = 1000;
+  uint16_t long_idle_permille = 1000;
+  for (uint32_t i = 0; i < num_tasks; i++) {
+    const TaskStatus_t& status = task_statuses[i];
+    bool is_new;
+    TaskSamples* const samples = find_or_add_task(status.xHandle, &is_new);
+    if (!samples) {
+      continue;
+    }
+    const uint32_t run_time = status.ulRunTimeCounter - samples->last_run_time;
+    samples->last_run_time = status.ulRunTimeCounter;
+    // The run time of a new task is not limited to this window.
+    samples->window_run_times[window_index] =
+        (is_first_sample || is_new) ? 0 : run_time;
+    uint64_t long_run_time = 0;
+    for (uint32_t w = 0; w < kNumWindows; w++) {
+      long_run_time += samples->window_run_times[w];
+    }
+    TaskLoad& load = new_stats.tasks[new_stats.num_tasks++];
+    load.name = status.pcTaskName;
+    load.load_permille =
+        permille(samples->window_run_times[window_index], new_stats.window_usecs);
+    load.long_load_permille = permille(long_run_time, long_window_usecs);
+    if (status.uxCurrentPriority == tskIDLE_PRIORITY &&
+        strcmp(status.pcTaskName, "IDLE") == 0) {
+      idle_permille = load.load_permille;
+      long_idle_permille = load.long_load_permille;
+    }
+  }
+  new_stats.cpu_load_permille = 1000 - idle_permille;
+  new_stats.long_cpu_load_permille = 1000 - long_idle_permille;
+
+  const uint32_t cycles_per_usec = SystemCoreClock / 1000000;
+  for (int g = 0; g < CPU_LOAD_NUM_ISR_GROUPS; g++) {
+    const uint32_t cycles = isr_cycles[g] - last_isr_cycles[g];
+    last_isr_cycles[g] = isr_cycles[g];
+    new_stats.isrs[g].load_permille =
+        permille(cycles / cycles_per_usec, new_stats.window_usecs);
+    new_stats.isrs[g].count = isr_counts[g] - last_isr_counts[g];
+    last_isr_counts[g] = isr_counts[g];
+  }
+
+  MutexScope scope(mutex);
+  stats = new_stats;
+}
+
+PacketStatus handle_command(uint8_t op_code,
+                            const SerialPacketsData& command_data,
+                            SerialPacketsData& response_data) {
+  if (op_code != GET_CPU_LOAD) {
+    logger.error("Unexpected cpu load command code %hx", op_code);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  if (!command_data.all_read_ok()) {
+    logger.error("CPU load: invalid command data.");
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+  MutexScope scope(mutex);
+  response_data.write_uint32(stats.window_usecs);
+  response_data.write_uint32(stats.long_window_usecs);
+  response_data.write_uint16(stats.cpu_load_permille);
+  response_data.write_uint16(stats.long_cpu_load_permille);
+  response_data.write_uint8(stats.num_tasks);
+  for (uint8_t i = 0; i < stats.num_tasks; i++) {
+    response_data.write_str(stats.tasks[i].name);
+    response_data.write_uint16(stats.tasks[i].load_permille);
+    response_data.write_uint16(stats.tasks[i].long_load_permille);
+  }
+  response_data.write_uint8(CPU_LOAD_NUM_ISR_GROUPS);
+  for (int g = 0; g < CPU_LOAD_NUM_ISR_GROUPS; g++) {
+    response_data.write_str(kIsrGroupNames[g]);
+    response_data.write_uint16(stats.isrs[g].load_permille);
+    response_data.write_uint32(stats.isrs[g].count);
+  }
+  if (response_data.had_write_errors()) {
+    return PacketStatus::GENERAL_ERROR;
+  }
+  return PacketStatus::OK;
+}
+
+void dump_state() {
+  {
+    MutexScope scope(mutex);
+    dump_stats = stats;
+  }
+  const Stats& s = dump_stats;
+  logger.info("CPU: %u.%u%% (%lus: %u.%u%%), ISRs: %s %u.%u%%, %s %u.%u%%, "
+              "%s %u.%u%%, %s %u.%u%%",
+              s.cpu_load_permille / 10, s.cpu_load_permille % 10,
+              s.long_window_usecs / 1000000, s.long_cpu_load_permille / 10,
+              s.long_cpu_load_permille % 10, kIsrGroupNames[0],
+              s.isrs[0].load_permille / 10, s.isrs[0].load_permille % 10,
+              kIsrGroupNames[1], s.isrs[1].load_permille / 10,
+              s.isrs[1].load_permille % 10, kIsrGroupNames[2],
+              s.isrs[2].load_permille / 10, s.isrs[2].load_permille % 10,
+              kIsrGroupNames[3], s.isrs[3].load_permille / 10,
+              s.isrs[3].load_permille % 10);
+
+  // The busy tasks, in a single line.
+  char line[150];
+  int len = 0;
+  for (uint8_t i = 0; i < s.num_tasks; i++) {
+    const TaskLoad& task = s.tasks[i];
+    if (!task.load_permille || strcmp(task.name, "IDLE") == 0) {
+      continue;
+    }
+    const int n = snprintf(&line[len], sizeof(line) - len, " %s %u.%u%%",
+                           task.name, task.load_permille / 10,
+                           task.load_permille % 10);
+    if (n < 0 || len + n >= (int)sizeof(line)) {
+      break;
+    }
+    len += n;
+  }
+  line[len] = 0;
+  logger.info("CPU tasks:%s", line);
+}
+
+}  // namespace cpu_load
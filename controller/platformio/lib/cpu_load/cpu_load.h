@@ -0,0 +1,50 @@
+// CPU load stats. The task times are from the FreeRTOS run time stats,
+// in usecs of the free running TIM2, and the interrupt times are
+// measured by the handlers in DWT cycles (see cpu_load_isr.h). The main
+// loop takes a sample every few seconds, and the loads are computed
+// over the last sample window and over a sliding window of the last
+// kNumWindows windows.
+//
+// The time of an interrupt is also charged to the task it interrupted,
+// so the ISR loads are included in the task loads.
+
+#pragma once
+
+#include "cpu_load_isr.h"
+#include "serial_packets_consts.h"
+#include "serial_packets_data.h"
+
+namespace cpu_load {
+
+// The number of sample windows in the long window.
+static constexpr uint32_t kNumWindows = 12;
+
+// Control command codes that are handled here.
+enum OpCodes {
+  // Returns the loads, in permille, of the last window and of the
+  // long window.
+  // Command: none
+  // Response: [uint32 window usecs][uint32 long window usecs]
+  //           [uint16 cpu load][uint16 long cpu load]
+  //           [uint8 n] n x [str task name][uint16 load][uint16 long load]
+  //           [uint8 m] m x [str isr group][uint16 load][uint32 count]
+  GET_CPU_LOAD = 0x0e,
+};
+
+inline bool is_cpu_load_op_code(uint8_t op_code) {
+  return op_code == GET_CPU_LOAD;
+}
+
+// Called periodically by the main loop. Closes the current window.
+void sample();
+
+// Called from the host link rx task with a command whose op code was
+// already read.
+PacketStatus handle_command(uint8_t op_code,
+                            const SerialPacketsData& command_data,
+                            SerialPacketsData& response_data);
+
+// Logs the loads of the last sample.
+void dump_state();
+
+}  // namespace cpu_load
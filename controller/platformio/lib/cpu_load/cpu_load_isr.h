@@ -0,0 +1,56 @@
+// The ISR side of the CPU load stats. Included by the cube ide generated
+// interrupt handlers (stm32h7xx_it.c), so it's C compatible. The time
+// of the handlers is measured with the DWT cycle counter and is
+// accumulated per group of related interrupts. See cpu_load.h. The
+// handlers are also added to the event trace (see event_trace_hooks.h).
+
+#pragma once
+
+#include <stdint.h>
+
+#include "event_trace_hooks.h"
+#include "main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The groups of the measured interrupts.
+typedef enum {
+  // SPI1 and its DMA streams (the adc card).
+  CPU_LOAD_ISR_SPI1 = 0,
+  // I2C1 and its DMA streams (the I2C devices).
+  CPU_LOAD_ISR_I2C1,
+  // USART1, USART2 and their DMA streams (host and printer links).
+  CPU_LOAD_ISR_UART,
+  // SDMMC1 (the recordings).
+  CPU_LOAD_ISR_SDMMC,
+  CPU_LOAD_NUM_ISR_GROUPS
+} CpuLoadIsrGroup;
+
+// Free running totals per group. Written by the ISRs only.
+extern volatile uint32_t cpu_load_isr_cycles[CPU_LOAD_NUM_ISR_GROUPS];
+extern volatile uint32_t cpu_load_isr_counts[CPU_LOAD_NUM_ISR_GROUPS];
+
+// Call at the beginning of the handler and pass the returned value to
+// cpu_load_isr_exit() at its end. A handler that is preempted by a
+// higher priority one is also charged with its time.
+static inline uint32_t cpu_load_isr_enter(void) { return DWT->CYCCNT; }
+
+static inline void cpu_load_isr_exit(CpuLoadIsrGroup group,
+                                     uint32_t start_cycles) {
+  const uint32_t end_cycles = DWT->CYCCNT;
+  cpu_load_isr_cycles[group] += end_cycles - start_cycles;
+  cpu_load_isr_counts[group]++;
+  event_trace_add_isr(group, start_cycles, end_cycles);
+}
+
+// The FreeRTOS run time stats hooks (see FreeRTOSConfig.h). The run
+// time counter is the free running 1Mhz TIM2, so the task times are in
+// usecs.
+void cpu_load_configure_timers(void);
+uint32_t cpu_load_run_time_counter(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -166,6 +166,7 @@ static int8_t CDC_Init_FS(void)
 static int8_t CDC_DeInit_FS(void)
 {
   /* USER CODE BEGIN 4 */
+  CDC_DeInitCallback_FS();
   return (USBD_OK);
   /* USER CODE END 4 */
 }
@@ -311,11 +312,19 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
   UNUSED(Buf);
   UNUSED(Len);
   UNUSED(epnum);
+  CDC_TransmitCpltCallback_FS();
   /* USER CODE END 13 */
   return result;
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+__weak void CDC_TransmitCpltCallback_FS(void)
+{
+}
+
+__weak void CDC_DeInitCallback_FS(void)
+{
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
@@ -2,20 +2,24 @@
 
 #include "data_recorder.h"
 #include "error_handler.h"
+#include "event_trace.h"
 #include "gpio_pins.h"
 #include "host_link.h"
 #include "static_mutex.h"
 #include "static_queue.h"
+#include "tcm.h"
 
 // #pragma GCC push_options
 // #pragma GCC optimize("O0")
 
 namespace data_queue {
 
-static constexpr int kNumBuffers = 10;
+// Uses the RAM that was reclaimed from the task stacks.
+static constexpr int kNumBuffers = 12;
 static DataBuffer data_buffers[kNumBuffers];
-static StaticQueue<uint8_t, kNumBuffers> free_buffers_indexes_queue;
-static StaticQueue<uint8_t, kNumBuffers> pending_buffers_indexes_queue;
+// The buffer queues are in the DTCM.
+DTCM_BSS static StaticQueue<uint8_t, kNumBuffers> free_buffers_indexes_queue;
+DTCM_BSS static StaticQueue<uint8_t, kNumBuffers> pending_buffers_indexes_queue;
 static bool setup_completed = false;
 
 // Static variables and a mutex to protect them.
@@ -74,10 +78,12 @@ void data_queue_task_body_impl(void* ignored_argument) {
 
     // Send data to monitor.
     gpio_pins::TEST1.set_high();
+    event_trace::add(EVENT_TRACE_BUFFER_SEND_START, buffer_index);
     host_link::client.sendMessage(host_link::HostPorts::LOG_REPORT_MESSAGE,
                                   buffer.packet_data());
     // Send data to SD.
     data_recorder::append_log_record_if_recording(buffer.packet_data());
+    event_trace::add(EVENT_TRACE_BUFFER_SEND_END, buffer_index);
     gpio_pins::TEST1.set_low();
 
     // Free the buffer.
@@ -119,6 +125,7 @@ DataBuffer* grab_buffer() {
     error_handler::Panic(23);
   }
   buffer->_state = DataBuffer::GRABBED;
+  event_trace::add(EVENT_TRACE_BUFFER_GRAB, buffer_index);
   return buffer;
 }
 
@@ -135,6 +142,7 @@ void queue_buffer(DataBuffer* buffer) {
     error_handler::Panic(25);
   }
   buffer->_state = DataBuffer::PENDING;
+  event_trace::add(EVENT_TRACE_BUFFER_QUEUE, buffer_index);
 
   // Queue the buffer index and track max number of pending items.
   {
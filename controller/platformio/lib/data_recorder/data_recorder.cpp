@@ -1,7 +1,10 @@
 #include "data_recorder.h"
 
+#include <algorithm>
 #include <cstring>
 
+#include "dma_buffers.h"
+#include "event_trace.h"
 #include "fatfs.h"
 // #include "gpio_pins.h"
 #include "logger.h"
@@ -14,6 +17,12 @@
 // #pragma GCC push_options
 // #pragma GCC optimize("O0")
 
+// The file system and the recording file. Used instead of SDFatFS and
+// SDFile of the generated fatfs.c since the SD DMA reads and writes
+// their sector buffers, so they should be in the DMA memory.
+DMA_BUFFER static FATFS sd_fatfs;
+DMA_BUFFER static FIL sd_file;
+
 // Workarounds for CubeIDE FATFS issues.
 // https://github.com/artlukm/STM32_FATFS_SDcard_remount
 // https://community.st.com/t5/stm32cubeide-mcu/wrong-returned-value-in-the-library-function-sd-initialize/m-p/580229#M19834
@@ -23,7 +32,7 @@ extern FATFS* FatFs[_VOLUMES];
 static void force_sd_reset() {
   FatFs[0] = 0;
   disk.is_initialized[0] = 0;
-  memset(&SDFatFS, 0, sizeof(SDFatFS));
+  memset(&sd_fatfs, 0, sizeof(sd_fatfs));
   const HAL_StatusTypeDef status = HAL_SD_DeInit(&hsd1);
   if (status != HAL_OK) {
     logger.error("HAL_SD_DeInit returned %d (HAL_StatusTypeDef)", status);
@@ -53,8 +62,9 @@ static State state = STATE_IDLE;
 // [July 2023] - Writing packets of arbitrary size resulted in
 // occaionaly corrupted file with a few bytes added or missings
 // throuout the file. As a workaround, we write to the SD only
-// in chunks that are multiple of _MAX_SS (512).
-static uint8_t
+// in chunks that are multiple of _MAX_SS (512). FatFs passes whole
+// sectors of the buffer to the SD DMA so it's in the DMA memory.
+DMA_BUFFER static uint8_t
     write_buffer[serial_packets_consts::MAX_STUFFED_PACKET_LEN + _MAX_SS];
 // Number of active pending bytes at the begining of write_buffer.
 static uint32_t pending_bytes = 0;
@@ -74,6 +84,52 @@ static inline void increment_write_failures() {
   write_failures++;
 }
 
+// State of reading a recording file for downloading. Reading is allowed
+// also while recording, of another file. If not recording, the SD is
+// mounted for reading only and read_mounted is true. An open read file
+// keeps the SD mounted when a recording starts or stops, so a download
+// is not affected by them. The file and the
+// read buffer are in the DMA memory since the SD DMA writes to their
+// sector buffers. The callers' buffers are not, so the reads are copied
+// through read_buffer.
+DMA_BUFFER static FIL read_file;
+DMA_BUFFER static uint8_t read_buffer[_MAX_SS];
+static bool read_file_opened = false;
+static bool read_mounted = false;
+// Valid if read_file_opened.
+static RecordingName read_recording_name;
+
+// UTF16 file name of a recording. Extra char for terminator.
+typedef TCHAR RecordingFileWName[kMaxFileNameLen + 1];
+
+// Sets wname to the file name of the given recording.
+static void build_recording_file_wname(const RecordingName& recording_name,
+                                       RecordingFileWName& wname) {
+  static_assert(sizeof(wname[0]) == 2U);
+  static_assert(sizeof(wname[0]) == sizeof(TCHAR));
+  static_assert((sizeof(wname) / sizeof(wname[0])) >=
+                (RecordingName::kMaxLen + 5));
+
+  const size_t n = recording_name.len();
+  const char* c_str = recording_name.c_str();
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    // Casting utf8 to utf16.
+    wname[i] = c_str[i];
+  }
+  wname[i++] = '.';
+  wname[i++] = 'l';
+  wname[i++] = 'o';
+  wname[i++] = 'g';
+  wname[i++] = 0;
+
+  // Not expecting buffer here overflow since we checked the sizes
+  // above, but just in case.
+  if (i > (sizeof(wname) / sizeof(wname[0]))) {
+    error_handler::Panic(72);
+  }
+}
+
 
 // Assumes level == STATE_OPENED and mutex is grabbed.
 // Tries to write pending bytes to SD. Always clears pending_bytes upon return.
@@ -90,20 +146,24 @@ static void internal_write_all_pending_bytes() {
 
   // This number should be a multipe of _MAX_SS.
   unsigned int bytes_written;
-  FRESULT status = f_write(&SDFile, write_buffer, n, &bytes_written);
+  event_trace::add(EVENT_TRACE_SD_WRITE_START, 0, n);
+  FRESULT status = f_write(&sd_file, write_buffer, n, &bytes_written);
   if (status != FRESULT::FR_OK) {
+    event_trace::add(EVENT_TRACE_SD_WRITE_END, 0, status);
     increment_write_failures();
     logger.error("Error writing to SD recording file, status=%d", status);
     return;
   }
   if (bytes_written != n) {
+    event_trace::add(EVENT_TRACE_SD_WRITE_END, 0, status);
     increment_write_failures();
     logger.error("Requested to write to SD %lu bytes, %lu written", n,
                  (uint32_t)bytes_written);
     return;
   }
 
-  status = f_sync(&SDFile);
+  status = f_sync(&sd_file);
+  event_trace::add(EVENT_TRACE_SD_WRITE_END, 0, status);
   if (status != FRESULT::FR_OK) {
     increment_write_failures();
     logger.warning("Failed to flush SD file, status=%d", status);
@@ -112,20 +172,60 @@ static void internal_write_all_pending_bytes() {
   writes_ok++;
 }
 
+// Grab mutex before calling this. Mounts the SD for reading if not
+// already mounted.
+static bool internal_mount_for_read() {
+  if (state >= STATE_MOUNTED || read_mounted) {
+    return true;
+  }
+  force_sd_reset();
+  const FRESULT status = f_mount(&sd_fatfs, (TCHAR const*)SDPath, 1);
+  if (status != FRESULT::FR_OK) {
+    logger.error("SD f_mount for read failed. (FRESULT=%d)", status);
+    force_sd_reset();
+    return false;
+  }
+  read_mounted = true;
+  return true;
+}
+
+// Grab mutex before calling this. Unmounts the SD if it was mounted
+// for reading only and no file is open for reading.
+static void internal_unmount_for_read() {
+  if (!read_mounted || read_file_opened) {
+    return;
+  }
+  f_mount(&sd_fatfs, (TCHAR const*)NULL, 1);
+  force_sd_reset();
+  read_mounted = false;
+}
+
+// Grab mutex before calling this.
+static void internal_close_read_file() {
+  if (read_file_opened) {
+    f_close(&read_file);
+    read_file_opened = false;
+  }
+  internal_unmount_for_read();
+}
+
 // Grab mutex before calling this
 // TODO: Change mutexs to be recursive.
 static void internal_stop_recording() {
   if (state >= STATE_OPENED) {
     internal_write_all_pending_bytes();
-    f_close(&SDFile);
+    f_close(&sd_file);
   }
 
-  if (state >= STATE_MOUNTED) {
+  // An open read file keeps the SD mounted, now for reading only.
+  if (state >= STATE_MOUNTED && read_file_opened) {
+    read_mounted = true;
+  } else if (state >= STATE_MOUNTED) {
     // Workaround per https://github.com/artlukm/STM32_FATFS_SDcard_remount
-    // disk.is_initialized[SDFatFS.drv] = 0;
+    // disk.is_initialized[sd_fatfs.drv] = 0;
 
     // The 'NULL' cause to unmount.
-    f_mount(&SDFatFS, (TCHAR const*)NULL, 1);
+    f_mount(&sd_fatfs, (TCHAR const*)NULL, 1);
   }
 
   if (state == STATE_OPENED) {
@@ -139,7 +239,9 @@ static void internal_stop_recording() {
   recording_start_time_millis = 0;
   current_recording_name.clear();
 
-  force_sd_reset();
+  if (!read_mounted) {
+    force_sd_reset();
+  }
 }
 
 void stop_recording() {
@@ -161,56 +263,46 @@ bool start_recording(const RecordingName& new_session_name) {
 
   internal_stop_recording();
 
+  // The new recording overwrites the file, so it can't be read.
+  if (read_file_opened &&
+      read_recording_name.equals(new_session_name.c_str())) {
+    logger.warning("Recording [%s] overwrites the file that is read.",
+                   new_session_name.c_str());
+    internal_close_read_file();
+  }
+
   if (!current_recording_name.set_c_str(new_session_name.c_str())) {
     // Should not happen since we have identical buffer sizes.
     error_handler::Panic(71);
   }
 
-  force_sd_reset();
+  FRESULT status;
+  if (read_mounted) {
+    // Already mounted by the open read file. The recording takes over
+    // the mount.
+    read_mounted = false;
+  } else {
+    force_sd_reset();
 
-  // Special case FR_NOT_READY
-  logger.info("Calling f_mount");
-  FRESULT status = f_mount(&SDFatFS, (TCHAR const*)SDPath, 1);
-  logger.info("f_mount status = (FRESULT) %d", status);
+    // Special case FR_NOT_READY
+    logger.info("Calling f_mount");
+    status = f_mount(&sd_fatfs, (TCHAR const*)SDPath, 1);
+    logger.info("f_mount status = (FRESULT) %d", status);
 
-  if (status != FRESULT::FR_OK) {
-    logger.error("SD f_mount failed. (FRESULT=%d)", status);
-    internal_stop_recording();
-    return false;
+    if (status != FRESULT::FR_OK) {
+      logger.error("SD f_mount failed. (FRESULT=%d)", status);
+      internal_stop_recording();
+      return false;
+    }
   }
 
   state = STATE_MOUNTED;
 
-  // UTF16. Extra char for terminator. Temporary buffer for
-  // opening the session recording file.
-  static TCHAR recording_file_wname[kMaxFileNameLen + 1];
+  // Temporary buffer for opening the session recording file.
+  static RecordingFileWName recording_file_wname;
+  build_recording_file_wname(new_session_name, recording_file_wname);
 
-  static_assert(sizeof(recording_file_wname[0]) == 2U);
-  static_assert(sizeof(recording_file_wname[0]) == sizeof(TCHAR));
-  static_assert(
-      (sizeof(recording_file_wname) / sizeof(recording_file_wname[0])) >=
-      (RecordingName::kMaxLen + 5));
-
-  const size_t n = new_session_name.len();
-  const char* c_str = new_session_name.c_str();
-  unsigned int i;
-  for (i = 0; i < n; i++) {
-    // Casting utf8 to utf16.
-    recording_file_wname[i] = c_str[i];
-  }
-  recording_file_wname[i++] = '.';
-  recording_file_wname[i++] = 'l';
-  recording_file_wname[i++] = 'o';
-  recording_file_wname[i++] = 'g';
-  recording_file_wname[i++] = 0;
-
-  // Not expecting buffer here overflow since we checked the sizes
-  // above, but just in case.
-  if (i > (sizeof(recording_file_wname) / sizeof(recording_file_wname[0]))) {
-    error_handler::Panic(72);
-  }
-
-  status = f_open(&SDFile, recording_file_wname, FA_CREATE_ALWAYS | FA_WRITE);
+  status = f_open(&sd_file, recording_file_wname, FA_CREATE_ALWAYS | FA_WRITE);
   if (status != FRESULT::FR_OK) {
     logger.error("SD f_open failed. (FRESULT=%d)", status);
     internal_stop_recording();
@@ -320,6 +412,160 @@ bool is_recording_active() {
 //   name->set_c_str(current_recording_name.c_str());
 // }
 
+// Converts a listed file name to a recording name. Returns false
+// if it's not a recording file.
+static bool file_name_to_recording_name(const TCHAR* fname,
+                                        RecordingName* recording_name) {
+  size_t n = 0;
+  while (fname[n]) {
+    n++;
+  }
+  if (n <= 4 || n > kMaxFileNameLen) {
+    return false;
+  }
+  // Match the ".log" suffix, case insensitive since FAT may change case.
+  const TCHAR* suffix = &fname[n - 4];
+  if (suffix[0] != '.' || (suffix[1] | 0x20) != 'l' ||
+      (suffix[2] | 0x20) != 'o' || (suffix[3] | 0x20) != 'g') {
+    return false;
+  }
+  recording_name->clear();
+  for (size_t i = 0; i < n - 4; i++) {
+    // Recording names are ascii.
+    if (fname[i] > 0x7f || !recording_name->append((char)fname[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int list_recordings(uint16_t start_index, RecordingFileInfo* infos,
+                    uint16_t max_infos, bool* has_more) {
+  MutexScope scope(mutex);
+
+  *has_more = false;
+  if (!internal_mount_for_read()) {
+    return -1;
+  }
+
+  static const TCHAR kRootDir[] = {'/', 0};
+  static DIR dir;
+  static FILINFO file_info;
+  FRESULT status = f_opendir(&dir, kRootDir);
+  if (status != FRESULT::FR_OK) {
+    logger.error("SD f_opendir failed. (FRESULT=%d)", status);
+    internal_unmount_for_read();
+    return -1;
+  }
+
+  int count = 0;
+  uint16_t index = 0;
+  for (;;) {
+    status = f_readdir(&dir, &file_info);
+    if (status != FRESULT::FR_OK) {
+      logger.error("SD f_readdir failed. (FRESULT=%d)", status);
+      count = -1;
+      break;
+    }
+    // End of directory.
+    if (!file_info.fname[0]) {
+      break;
+    }
+    if (file_info.fattrib & (AM_DIR | AM_HID | AM_SYS)) {
+      continue;
+    }
+    static RecordingName recording_name;
+    if (!file_name_to_recording_name(file_info.fname, &recording_name)) {
+      continue;
+    }
+    if (index++ < start_index) {
+      continue;
+    }
+    if (count >= max_infos) {
+      *has_more = true;
+      break;
+    }
+    infos[count].name.set_c_str(recording_name.c_str());
+    infos[count].size = file_info.fsize;
+    count++;
+  }
+
+  f_closedir(&dir);
+  internal_unmount_for_read();
+  return count;
+}
+
+bool open_read_file(const RecordingName& recording_name, uint32_t* file_size) {
+  MutexScope scope(mutex);
+
+  internal_close_read_file();
+
+  // FatFs doesn't allow to open for reading a file that is open
+  // for writing.
+  if (state == STATE_OPENED &&
+      current_recording_name.equals(recording_name.c_str())) {
+    logger.error("Can't read the active recording [%s]",
+                 recording_name.c_str());
+    return false;
+  }
+
+  if (!internal_mount_for_read()) {
+    return false;
+  }
+
+  static RecordingFileWName read_file_wname;
+  build_recording_file_wname(recording_name, read_file_wname);
+  const FRESULT status = f_open(&read_file, read_file_wname, FA_READ);
+  if (status != FRESULT::FR_OK) {
+    logger.error("SD f_open for read failed. (FRESULT=%d)", status);
+    internal_unmount_for_read();
+    return false;
+  }
+
+  read_file_opened = true;
+  read_recording_name.set_c_str(recording_name.c_str());
+  *file_size = f_size(&read_file);
+  return true;
+}
+
+bool read_file_bytes(uint32_t offset, uint8_t* buffer, uint16_t size) {
+  MutexScope scope(mutex);
+
+  if (!read_file_opened) {
+    logger.error("No recording file is open for reading.");
+    return false;
+  }
+
+  // Sequential reads don't require seeking.
+  if (f_tell(&read_file) != offset) {
+    const FRESULT status = f_lseek(&read_file, offset);
+    if (status != FRESULT::FR_OK) {
+      logger.error("SD f_lseek failed. (FRESULT=%d)", status);
+      return false;
+    }
+  }
+
+  while (size > 0) {
+    const uint16_t n = std::min(size, (uint16_t)sizeof(read_buffer));
+    unsigned int bytes_read;
+    const FRESULT status = f_read(&read_file, read_buffer, n, &bytes_read);
+    if (status != FRESULT::FR_OK || bytes_read != n) {
+      logger.error("SD f_read failed. (FRESULT=%d, %u/%hu bytes)", status,
+                   bytes_read, n);
+      return false;
+    }
+    memcpy(buffer, read_buffer, n);
+    buffer += n;
+    size -= n;
+  }
+  return true;
+}
+
+void close_read_file() {
+  MutexScope scope(mutex);
+  internal_close_read_file();
+}
+
 void get_recoding_info(RecordingInfo* info) {
   MutexScope scope(mutex);
 
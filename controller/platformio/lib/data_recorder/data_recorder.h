@@ -22,6 +22,33 @@ bool start_recording(const RecordingName& new_recording_name);
 // Stop existing recording, if any.
 void stop_recording();
 
+// Information of a recording file on the SD card.
+struct RecordingFileInfo {
+  RecordingName name;
+  uint32_t size = 0;
+};
+
+// Lists the recording files on the SD card, skipping the first
+// start_index ones. Returns the number of infos set, or -1 on error.
+// Sets has_more if there are more than max_infos recordings left. Can
+// be called also while recording.
+int list_recordings(uint16_t start_index, RecordingFileInfo* infos,
+                    uint16_t max_infos, bool* has_more);
+
+// Opens a recording file for reading, closing the previous one, if
+// any. A single file can be open for reading at a time. Can be called
+// also while recording, though not for the active recording. The file
+// stays open when a recording starts or stops, unless the new
+// recording is of the same file.
+bool open_read_file(const RecordingName& recording_name, uint32_t* file_size);
+
+// Reads bytes from the file opened with open_read_file(). Returns false
+// on error or if the range is beyond the end of the file.
+bool read_file_bytes(uint32_t offset, uint8_t* buffer, uint16_t size);
+
+// Closes the file opened with open_read_file(), if any.
+void close_read_file();
+
 // Ignored silently if recording is off.
 // Packet should be a serialized LOG packet with no write errors.
 void append_log_record_if_recording(const SerialPacketsData& packet_data);
@@ -0,0 +1,135 @@
+#include "event_trace.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "common.h"
+#include "tcm.h"
+
+DTCM_BSS EventTraceEvent event_trace_events[CONFIG_EVENT_TRACE_EVENTS];
+DTCM_BSS volatile uint32_t event_trace_count = 0;
+DTCM_DATA volatile uint8_t event_trace_enabled = 1;
+
+// Called by the FreeRTOS context switch, with the interrupts masked.
+ITCM_CODE void event_trace_task_switched_in(uint32_t task_number) {
+  event_trace_add(EVENT_TRACE_TASK_IN, task_number, 0);
+}
+
+namespace event_trace {
+
+// Per READ_TRACE response, leaving room for its header.
+static constexpr uint16_t kEventSize = 8;
+static constexpr uint16_t kMaxEventsPerChunk =
+    ((MAX_PACKET_DATA_LEN - 10) / kEventSize > 255)
+        ? 255
+        : (MAX_PACKET_DATA_LEN - 10) / kEventSize;
+static_assert(kMaxEventsPerChunk > 0);
+static_assert(sizeof(EventTraceEvent) == kEventSize);
+static_assert(CONFIG_EVENT_TRACE_EVENTS <= 0x8000);
+
+// Max tasks that are listed in the STOP_TRACE response.
+static constexpr uint32_t kMaxTasks = 16;
+
+// Used by the host link rx task only.
+static TaskStatus_t task_statuses[kMaxTasks];
+
+// The events of the stopped trace. Set by STOP_TRACE.
+static uint32_t first_event = 0;
+static uint16_t num_events = 0;
+
+static PacketStatus stop_trace(SerialPacketsData& response_data) {
+  {
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    event_trace_enabled = 0;
+    const uint32_t count = event_trace_count;
+    num_events = (count < CONFIG_EVENT_TRACE_EVENTS) ? count
+                                                     : CONFIG_EVENT_TRACE_EVENTS;
+    first_event = count - num_events;
+    __set_PRIMASK(primask);
+  }
+
+  const uint32_t num_tasks =
+      uxTaskGetSystemState(task_statuses, kMaxTasks, nullptr);
+  response_data.write_uint32(SystemCoreClock / 1000000);
+  response_data.write_uint16(num_events);
+  response_data.write_uint8(num_tasks);
+  for (uint32_t i = 0; i < num_tasks; i++) {
+    response_data.write_uint8(task_statuses[i].xTaskNumber);
+    response_data.write_str(task_statuses[i].pcTaskName);
+  }
+  if (response_data.had_write_errors()) {
+    return PacketStatus::GENERAL_ERROR;
+  }
+  return PacketStatus::OK;
+}
+
+static PacketStatus read_trace(uint16_t start_index,
+                               SerialPacketsData& response_data) {
+  if (event_trace_enabled) {
+    logger.error("Event trace: read while not stopped.");
+    return PacketStatus::GENERAL_ERROR;
+  }
+  const uint16_t n = (start_index >= num_events) ? 0
+                     : (num_events - start_index > kMaxEventsPerChunk)
+                         ? kMaxEventsPerChunk
+                         : num_events - start_index;
+  response_data.write_uint8(start_index + n < num_events);
+  response_data.write_uint8(n);
+  for (uint16_t i = 0; i < n; i++) {
+    const EventTraceEvent& event =
+        event_trace_events[(first_event + start_index + i) & EVENT_TRACE_MASK];
+    response_data.write_uint32(event.cycles);
+    response_data.write_uint8(event.type);
+    response_data.write_uint8(event.id);
+    response_data.write_uint16(event.arg);
+  }
+  if (response_data.had_write_errors()) {
+    return PacketStatus::GENERAL_ERROR;
+  }
+  return PacketStatus::OK;
+}
+
+static void start_trace() {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  event_trace_count = 0;
+  event_trace_enabled = 1;
+  __set_PRIMASK(primask);
+}
+
+PacketStatus handle_command(uint8_t op_code,
+                            const SerialPacketsData& command_data,
+                            SerialPacketsData& response_data) {
+  switch (op_code) {
+    case STOP_TRACE:
+      if (!command_data.all_read_ok()) {
+        logger.error("Stop trace: invalid command data.");
+        return PacketStatus::INVALID_ARGUMENT;
+      }
+      return stop_trace(response_data);
+
+    case READ_TRACE: {
+      const uint16_t start_index = command_data.read_uint16();
+      if (!command_data.all_read_ok()) {
+        logger.error("Read trace: invalid command data.");
+        return PacketStatus::INVALID_ARGUMENT;
+      }
+      return read_trace(start_index, response_data);
+    }
+
+    case START_TRACE:
+      if (!command_data.all_read_ok()) {
+        logger.error("Start trace: invalid command data.");
+        return PacketStatus::INVALID_ARGUMENT;
+      }
+      start_trace();
+      return PacketStatus::OK;
+
+    default:
+      logger.error("Unexpected event trace command code %hx", op_code);
+      return PacketStatus::INVALID_ARGUMENT;
+  }
+}
+
+}  // namespace event_trace
@@ -0,0 +1,48 @@
+// Reading of the event trace over the host link. The events are added
+// by the hooks of event_trace_hooks.h and the trace records all the time,
+// keeping the last CONFIG_EVENT_TRACE_EVENTS events. To read it, the
+// host stops the trace, reads its events in chunks, and starts it again.
+// host/src/event_trace.py converts it to a Chrome/Perfetto trace.
+
+#pragma once
+
+#include "event_trace_hooks.h"
+#include "serial_packets_consts.h"
+#include "serial_packets_data.h"
+
+namespace event_trace {
+
+// Control command codes that are handled here.
+enum OpCodes {
+  // Stops the trace, so it can be read, and returns its header.
+  // Command: none
+  // Response: [uint32 cpu cycles per usec][uint16 num events]
+  //           [uint8 n] n x [uint8 task number][str task name]
+  STOP_TRACE = 0x0f,
+  // Reads the events of the stopped trace, oldest first.
+  // Command: [uint16 start index]
+  // Response: [uint8 has more][uint8 n]
+  //           n x [uint32 cycles][uint8 type][uint8 id][uint16 arg]
+  READ_TRACE = 0x10,
+  // Clears the trace and starts recording again.
+  // Command: none
+  // Response: none
+  START_TRACE = 0x11,
+};
+
+inline bool is_event_trace_op_code(uint8_t op_code) {
+  return op_code >= STOP_TRACE && op_code <= START_TRACE;
+}
+
+// Called from the host link rx task with a command whose op code was
+// already read.
+PacketStatus handle_command(uint8_t op_code,
+                            const SerialPacketsData& command_data,
+                            SerialPacketsData& response_data);
+
+// Adds an event from a task. Ignored while the trace is stopped.
+inline void add(EventTraceType type, uint8_t id, uint16_t arg = 0) {
+  event_trace_add(type, id, arg);
+}
+
+}  // namespace event_trace
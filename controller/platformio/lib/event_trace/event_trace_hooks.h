@@ -0,0 +1,102 @@
+// The recording side of the event trace, a ring of timestamped events
+// in RAM for the timelines of perf investigations. Included by the cube
+// ide generated interrupt handlers (via cpu_load_isr.h), so it's C
+// compatible. The events are timestamped with the DWT cycle counter
+// and adding one takes a few cycles with the interrupts disabled. See
+// event_trace.h for reading the trace over the host link.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "main.h"
+
+// The number of events in the ring, a power of 2. 8 bytes per event.
+#ifndef CONFIG_EVENT_TRACE_EVENTS
+#define CONFIG_EVENT_TRACE_EVENTS 2048
+#endif
+
+#define EVENT_TRACE_MASK (CONFIG_EVENT_TRACE_EVENTS - 1)
+
+#ifdef __cplusplus
+static_assert((CONFIG_EVENT_TRACE_EVENTS & EVENT_TRACE_MASK) == 0,
+              "CONFIG_EVENT_TRACE_EVENTS should be a power of 2");
+extern "C" {
+#endif
+
+// The event types. Also used by host/src/event_trace.py.
+typedef enum {
+  // A task was switched in. id: the FreeRTOS task number.
+  EVENT_TRACE_TASK_IN = 1,
+  // An interrupt handler. id: the CpuLoadIsrGroup of the handler.
+  EVENT_TRACE_ISR_ENTER = 2,
+  EVENT_TRACE_ISR_EXIT = 3,
+  // Data queue buffers. id: the buffer index.
+  EVENT_TRACE_BUFFER_GRAB = 4,
+  EVENT_TRACE_BUFFER_QUEUE = 5,
+  EVENT_TRACE_BUFFER_SEND_START = 6,
+  EVENT_TRACE_BUFFER_SEND_END = 7,
+  // SD writes of the recorder, including the sync. arg: at start, the
+  // number of bytes, at end, the FRESULT.
+  EVENT_TRACE_SD_WRITE_START = 8,
+  EVENT_TRACE_SD_WRITE_END = 9,
+} EventTraceType;
+
+typedef struct {
+  uint32_t cycles;
+  uint8_t type;
+  uint8_t id;
+  uint16_t arg;
+} EventTraceEvent;
+
+// The ring. event_trace_count is the total number of events that were
+// added since the trace was started, and it wraps around the ring.
+extern EventTraceEvent event_trace_events[CONFIG_EVENT_TRACE_EVENTS];
+extern volatile uint32_t event_trace_count;
+extern volatile uint8_t event_trace_enabled;
+
+// Can be called from tasks and ISRs. Ignored while the trace is stopped.
+static inline void event_trace_add(EventTraceType type, uint8_t id,
+                                   uint16_t arg) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (event_trace_enabled) {
+    EventTraceEvent* const event =
+        &event_trace_events[event_trace_count++ & EVENT_TRACE_MASK];
+    event->cycles = DWT->CYCCNT;
+    event->type = type;
+    event->id = id;
+    event->arg = arg;
+  }
+  __set_PRIMASK(primask);
+}
+
+// Adds the enter and exit events of a handler that already returned,
+// so the handlers need a single hook. The enter event is not in time
+// order with the events of nested handlers, the host sorts them.
+static inline void event_trace_add_isr(uint8_t group, uint32_t start_cycles,
+                                       uint32_t end_cycles) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (event_trace_enabled) {
+    EventTraceEvent* event =
+        &event_trace_events[event_trace_count++ & EVENT_TRACE_MASK];
+    event->cycles = start_cycles;
+    event->type = EVENT_TRACE_ISR_ENTER;
+    event->id = group;
+    event->arg = 0;
+    event = &event_trace_events[event_trace_count++ & EVENT_TRACE_MASK];
+    event->cycles = end_cycles;
+    event->type = EVENT_TRACE_ISR_EXIT;
+    event->id = group;
+    event->arg = 0;
+  }
+  __set_PRIMASK(primask);
+}
+
+// The FreeRTOS traceTASK_SWITCHED_IN hook (see FreeRTOSConfig.h).
+void event_trace_task_switched_in(uint32_t task_number);
+
+#ifdef __cplusplus
+}
+#endif
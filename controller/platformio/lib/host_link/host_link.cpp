@@ -2,10 +2,15 @@
 
 #include "serial_packets_client.h"
 #include "controller.h"
+#include "tcm.h"
 
 namespace host_link {
 
-SerialPacketsClient client;
+// In the DTCM, for the per byte encoding and decoding. Doesn't contain
+// DMA buffers.
+DTCM_BSS SerialPacketsClient client;
+
+SerialPacketsFragmentSender fragment_sender(client);
 
 void setup(Serial& serial) {
   // The command and message handler are implemented by the controller.
@@ -2,6 +2,7 @@
 
 #include "serial.h"
 #include "serial_packets_client.h"
+#include "serial_packets_fragments.h"
 #include "static_task.h"
 
 // A callback handler for incoming host link commands. Implemented by 
@@ -17,16 +18,23 @@
 namespace host_link {
 
 enum HostPorts {
-  LOG_REPORT_MESSAGE = 10
+  LOG_REPORT_MESSAGE = 10,
+  // Fragments of transfers from the device to the host.
+  FRAGMENT_DATA_MESSAGE = 11
 };
 
 enum SelfPorts {
-  CONTROL_COMMAND = 1
+  CONTROL_COMMAND = 1,
+  // Acks of fragments sent to the host.
+  FRAGMENT_ACK_MESSAGE = 2
 };
 
 // Messages and commands can be sent to the host via this client.
 extern SerialPacketsClient client;
 
+// Fragmented transfers to the host. Used by one task at a time.
+extern SerialPacketsFragmentSender fragment_sender;
+
 // Main calls this once aupon initialization.
 void setup(Serial& serial);
 
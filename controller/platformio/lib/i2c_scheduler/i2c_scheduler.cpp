@@ -2,6 +2,8 @@
 #include "i2c_scheduler.h"
 
 #include "common.h"
+#include "cpu_load_isr.h"
+#include "logger.h"
 #include "time_util.h"
 
 #pragma GCC push_options
@@ -9,12 +11,35 @@
 
 namespace i2c_scheduler {
 // Exported schedulers. One per I2C channel used.
-I2cScheduler i2c1_scheduler(&hi2c1, "I2C1");
+I2cScheduler i2c1_scheduler(&hi2c1, "I2C1", 1);
 }  // namespace i2c_scheduler
 
+// The started schedulers, for mapping the hi2c of the isrs.
+static I2cScheduler* schedulers[i2c_scheduler::kMaxSchedulers] = {};
+static I2C_HandleTypeDef* schedulers_hi2c[i2c_scheduler::kMaxSchedulers] = {};
+
+// The schedulers of the TIM2 compare channels 1 to 4.
+static I2cScheduler* tim2_schedulers[4] = {};
+
+// The min time from setting a TIM2 compare value to its match. Slots
+// that would start sooner are considered late and are skipped.
+static constexpr int32_t kMinCompareLeadUsecs = 20;
+
+// Sets the compare value of a TIM2 channel to a micros() time.
+static inline void set_tim2_compare(uint8_t channel, uint32_t t_micros) {
+  // CCR1 to CCR4 are consecutive.
+  (&TIM2->CCR1)[channel - 1] = t_micros - time_util::internal::micros_offset;
+}
+
+extern "C" void TIM2_IRQHandler(void) {
+  const uint32_t isr_start_cycles = cpu_load_isr_enter();
+  I2cScheduler::tim2_shared_isr();
+  cpu_load_isr_exit(CPU_LOAD_ISR_I2C1, isr_start_cycles);
+}
+
 bool I2cSchedule::is_valid() {
-  // ms_per_slot should be non zero
-  if (ms_per_slot == 0) {
+  // usecs_per_slot should be non zero
+  if (usecs_per_slot == 0) {
     return false;
   }
 
@@ -24,13 +49,15 @@ bool I2cSchedule::is_valid() {
   }
 
   for (uint8_t i = 0; i < kMaxSlotsperSycle; i++) {
-    const I2cScheduleSlot& slot = slots[i];
-    if (!slot.is_valid()) {
-      return false;
-    }
-    // Left over slots that are beyond the cycle should not have a device.
-    if (i >= slots_per_cycle && slot.device) {
-      return false;
+    for (const I2cScheduleEntry& entry : slots[i].devices) {
+      if (!entry.is_valid()) {
+        return false;
+      }
+      // Left over slots that are beyond the cycle should not have a
+      // device.
+      if (i >= slots_per_cycle && entry.device) {
+        return false;
+      }
     }
   }
 
@@ -43,8 +70,29 @@ bool I2cScheduler::start(I2cSchedule* schedule) {
   if (!schedule->is_valid()) {
     return false;
   }
+  // The software timer has a millis resolution.
+  if (!_tim2_channel && schedule->usecs_per_slot % 1000) {
+    return false;
+  }
+
+  // Register for the isrs dispatch.
+  uint8_t scheduler_index = 0;
+  while (scheduler_index < i2c_scheduler::kMaxSchedulers &&
+         schedulers[scheduler_index]) {
+    if (schedulers[scheduler_index] == this ||
+        schedulers_hi2c[scheduler_index] == _hi2c) {
+      return false;
+    }
+    scheduler_index++;
+  }
+  if (scheduler_index >= i2c_scheduler::kMaxSchedulers) {
+    return false;
+  }
+  schedulers_hi2c[scheduler_index] = _hi2c;
+  schedulers[scheduler_index] = this;
 
   _schedule = schedule;
+  _usecs_per_slot = _schedule->usecs_per_slot;
 
   // The preincrement will cause the first tick to process slot zero.
   _slot_index_in_cycle = schedule->slots_per_cycle - 1;
@@ -62,6 +110,12 @@ bool I2cScheduler::start(I2cSchedule* schedule) {
                                          i2c_shared_completion_isr)) {
     error_handler::Panic(112);
   }
+  // For devices that read registers with a single transaction.
+  if (HAL_OK != HAL_I2C_RegisterCallback(_hi2c,
+                                         HAL_I2C_MEM_RX_COMPLETE_CB_ID,
+                                         i2c_shared_completion_isr)) {
+    error_handler::Panic(185);
+  }
   if (HAL_OK != HAL_I2C_RegisterCallback(_hi2c, HAL_I2C_ERROR_CB_ID,
                                          i2c_shared_error_isr)) {
     error_handler::Panic(113);
@@ -73,80 +127,258 @@ bool I2cScheduler::start(I2cSchedule* schedule) {
 
   // Call the on_start() method of each of the devices.
   const uint8_t slots_per_cycle = _schedule->slots_per_cycle;
-  const uint8_t cycle_time_ms = _schedule->ms_per_slot * slots_per_cycle;
+  const uint32_t cycle_time_usecs = _usecs_per_slot * slots_per_cycle;
   for (uint16_t i = 0; i < slots_per_cycle; i++) {
-    _cycle_div_counters[i] = 0;
-    const I2cScheduleSlot& schedule_slot = _schedule->slots[i];
-    // I2cDevice* const device = schedule_slot.device;
-    if (schedule_slot.device) {
-      schedule_slot.device->on_scheduler_init(
-          _hi2c, _schedule->ms_per_slot,
-          cycle_time_ms * schedule_slot.rate_divider);
-      if (schedule_slot.device->is_i2c_bus_in_use()) {
-        error_handler::Panic(151);
+    for (uint8_t j = 0; j < I2cScheduleSlot::kMaxDevicesPerSlot; j++) {
+      _cycle_div_counters[i][j] = 0;
+      const I2cScheduleEntry& entry = _schedule->slots[i].devices[j];
+      if (entry.device) {
+        entry.device->on_scheduler_init(
+            _hi2c, _usecs_per_slot, cycle_time_usecs * entry.rate_divider);
+        if (entry.device->is_i2c_bus_in_use()) {
+          error_handler::Panic(151);
+        }
       }
     }
   }
 
+  if (!validate_bus_time()) {
+    return false;
+  }
+
   // Start the timer. This starts to send ticks to the devices.
-  if (!_timer.start(_schedule->ms_per_slot)) {
+  if (_tim2_channel) {
+    return start_tim2_channel();
+  }
+  if (!_timer.start(_usecs_per_slot / 1000)) {
     return false;
   }
 
   return true;
 }
 
+// Verifies that the devices of each slot fit in the slot, per their
+// worst case traffic and the bus clock.
+bool I2cScheduler::validate_bus_time() {
+  // I2C1-3 are clocked by D2PCLK1 and I2C4 by D3PCLK1 (see i2c.c).
+  const uint32_t i2c_clock_hz =
+#ifdef I2C4
+      (_hi2c->Instance == I2C4) ? HAL_RCCEx_GetD3PCLK1Freq() :
+#endif
+                                HAL_RCC_GetPCLK1Freq();
+  const uint32_t scl_nanos =
+      i2c_transactions::scl_period_nanos(_hi2c->Init.Timing, i2c_clock_hz);
+  const uint32_t max_slot_bus_usecs =
+      _usecs_per_slot * kMaxSlotBusPercent / 100;
+
+  // The average bus time per cycle, with the rate dividers.
+  uint32_t cycle_bus_usecs = 0;
+  for (uint8_t i = 0; i < _schedule->slots_per_cycle; i++) {
+    uint32_t slot_bus_usecs = 0;
+    for (const I2cScheduleEntry& entry : _schedule->slots[i].devices) {
+      if (entry.device) {
+        const uint32_t device_bus_usecs = i2c_transactions::bus_usecs(
+            entry.device->max_slot_bus_load(), scl_nanos);
+        slot_bus_usecs += device_bus_usecs;
+        cycle_bus_usecs += device_bus_usecs / entry.rate_divider;
+      }
+    }
+    if (slot_bus_usecs > max_slot_bus_usecs) {
+      logger.error("%s: slot %hu needs %lu us of bus time, max is %lu us.",
+                   _name, i, slot_bus_usecs, max_slot_bus_usecs);
+      return false;
+    }
+  }
+  logger.info("%s: SCL %lu ns, bus time %lu us per %lu us cycle.", _name,
+              scl_nanos, cycle_bus_usecs,
+              _usecs_per_slot * _schedule->slots_per_cycle);
+  return true;
+}
+
+// Starts the TIM2 compare interrupts of this scheduler. TIM2 runs
+// freely as the usecs time base so the channels just match at the slot
+// times.
+bool I2cScheduler::start_tim2_channel() {
+  if (_tim2_channel < 1 || _tim2_channel > 4 ||
+      tim2_schedulers[_tim2_channel - 1]) {
+    return false;
+  }
+  tim2_schedulers[_tim2_channel - 1] = this;
+
+  const uint32_t flag = TIM_SR_CC1IF << (_tim2_channel - 1);
+  taskENTER_CRITICAL();
+  {
+    _next_slot_micros = time_util::micros() + _usecs_per_slot;
+    set_tim2_compare(_tim2_channel, _next_slot_micros);
+    TIM2->SR = ~flag;
+    TIM2->DIER |= TIM_DIER_CC1IE << (_tim2_channel - 1);
+  }
+  taskEXIT_CRITICAL();
+
+  // Same priority as the I2C and DMA interrupts, so they don't preempt
+  // each other.
+  HAL_NVIC_SetPriority(TIM2_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(TIM2_IRQn);
+  return true;
+}
+
+void I2cScheduler::tim2_shared_isr() {
+  const uint32_t pending = TIM2->SR & TIM2->DIER;
+  for (uint8_t i = 0; i < 4; i++) {
+    const uint32_t flag = TIM_SR_CC1IF << i;
+    if (!(pending & flag)) {
+      continue;
+    }
+    // The flags are cleared by writing zeros.
+    TIM2->SR = ~flag;
+    I2cScheduler* const scheduler = tim2_schedulers[i];
+    if (!scheduler) {
+      error_handler::Panic(186);
+    }
+    scheduler->on_tim2_compare_isr();
+  }
+}
+
+void I2cScheduler::on_tim2_compare_isr() {
+  const uint32_t now_micros = time_util::micros();
+  const uint32_t slot_micros = _next_slot_micros;
+
+  // Schedule the next slot, skipping the ones that are already too
+  // close or missed.
+  _next_slot_micros += _usecs_per_slot;
+  while ((int32_t)(_next_slot_micros - now_micros) < kMinCompareLeadUsecs) {
+    _next_slot_micros += _usecs_per_slot;
+    _stats.late_slots_count++;
+  }
+  set_tim2_compare(_tim2_channel, _next_slot_micros);
+
+  start_slot(slot_micros, time_util::millis_from_isr(), now_micros);
+}
+
 // This implements the method of the TimerCallback parent class.
 void I2cScheduler::timer_callback() {
   // Take a time snapshot as close as possible to the
-  // begining of the tick to have deterministic intervals.
-  uint32_t slot_sys_time_millis = time_util::millis();
+  // begining of the tick.
+  const uint32_t now_micros = time_util::micros();
+  const uint32_t now_millis = time_util::millis();
+
+  // The ideal slot times are anchored at the first tick. If a tick is
+  // more than a slot late, we re-anchor.
+  uint32_t slot_micros = _next_slot_micros;
+  if (!_stats.slots_count ||
+      now_micros - slot_micros >= _usecs_per_slot) {
+    if (_stats.slots_count) {
+      _stats.late_slots_count++;
+    }
+    slot_micros = now_micros;
+  }
+  _next_slot_micros = slot_micros + _usecs_per_slot;
 
-  // Verify that the device from the preious slot doesn't use the I2C bus.
-  // NOTE: We could verify all the device each time but verifying just the last
-  // one seems to be sufficient.
-  I2cDevice* const prev_device = _schedule->slots[_slot_index_in_cycle].device;
-  if (prev_device && prev_device->is_i2c_bus_in_use()) {
-    error_handler::Panic(149);
+  // The i2c isrs, which continue the slot, should not preempt it.
+  taskENTER_CRITICAL();
+  start_slot(slot_micros, now_millis, now_micros);
+  taskEXIT_CRITICAL();
+}
+
+void I2cScheduler::start_slot(uint32_t slot_micros, uint32_t slot_millis,
+                              uint32_t now_micros) {
+  const uint32_t jitter_usecs = now_micros - slot_micros;
+  _stats.slots_count++;
+  _stats.last_jitter_usecs = jitter_usecs;
+  if (jitter_usecs > _stats.window_max_jitter_usecs) {
+    _stats.window_max_jitter_usecs = jitter_usecs;
   }
+  _stats.window_jitter_sum_usecs += jitter_usecs;
+  _stats.window_slots_count++;
 
   // Increment the slot index.
-  // We keep the slot index stable throughout the slot
-  // since it's used also by isrs. Since the timer handler
-  // and the ISRs operate at different times, we don't
-  // need a mutex.
+  // We keep the slot index stable throughout the slot.
   _slot_index_in_cycle++;
   if (_slot_index_in_cycle >= _schedule->slots_per_cycle) {
     _slot_index_in_cycle = 0;
   }
+  _slot_millis = slot_millis;
+  _slot_micros = slot_micros;
 
-  // Do nothing if the slot is not active.
-  const I2cScheduleSlot& scheduler_slot =
-      _schedule->slots[_slot_index_in_cycle];
-  // I2cDevice* const next_device =
-  // _schedule->slots[_slot_index_in_cycle].device;
-  if (!scheduler_slot.device) {
+  // If a device of a previous slot still uses the bus, this slot is
+  // skipped. The isrs still go to that device.
+  if (_active_device && _active_device->is_i2c_bus_in_use()) {
+    _stats.overruns_count++;
+    _device_index_in_slot = I2cScheduleSlot::kMaxDevicesPerSlot;
     return;
   }
 
-  // This slot has a device. Check its cycle rate divider.
-  uint16_t& device_cycle_rate_counter =
-      _cycle_div_counters[_slot_index_in_cycle];
-  device_cycle_rate_counter++;
-  if (device_cycle_rate_counter >= scheduler_slot.rate_divider) {
+  _device_index_in_slot = 0;
+  start_next_devices();
+}
+
+void I2cScheduler::start_next_devices() {
+  const I2cScheduleSlot& scheduler_slot =
+      _schedule->slots[_slot_index_in_cycle];
+  while (_device_index_in_slot < I2cScheduleSlot::kMaxDevicesPerSlot) {
+    const uint8_t i = _device_index_in_slot++;
+    const I2cScheduleEntry& entry = scheduler_slot.devices[i];
+    if (!entry.device) {
+      continue;
+    }
+
+    // Check the device's cycle rate divider.
+    uint16_t& device_cycle_rate_counter =
+        _cycle_div_counters[_slot_index_in_cycle][i];
+    device_cycle_rate_counter++;
+    if (device_cycle_rate_counter < entry.rate_divider) {
+      continue;
+    }
     device_cycle_rate_counter = 0;
+
     // Call the start method of the device. This typically triggers
-    // one or more I2C DMA/IT transfers that should complete before the
-    // end of the slot, freeing the bus to the next device.
-    scheduler_slot.device->on_i2c_slot_begin(slot_sys_time_millis);
+    // one or more I2C DMA/IT transfers. The next device is started when
+    // they complete, and all should complete before the end of the
+    // slot, freeing the bus to the next slot.
+    _active_device = entry.device;
+    entry.device->on_i2c_slot_begin(_slot_millis, _slot_micros);
+    if (entry.device->is_i2c_bus_in_use()) {
+      return;
+    }
   }
 }
 
+void I2cScheduler::get_stats(I2cSchedulerStats* stats) const {
+  taskENTER_CRITICAL();
+  { *stats = _stats; }
+  taskEXIT_CRITICAL();
+}
+
+void I2cScheduler::dump_state() {
+  I2cSchedulerStats stats;
+  taskENTER_CRITICAL();
+  {
+    stats = _stats;
+    _stats.window_max_jitter_usecs = 0;
+    _stats.window_jitter_sum_usecs = 0;
+    _stats.window_slots_count = 0;
+  }
+  taskEXIT_CRITICAL();
+
+  const uint32_t avg_jitter_usecs =
+      stats.window_slots_count
+          ? stats.window_jitter_sum_usecs / stats.window_slots_count
+          : 0;
+  logger.info(
+      "%s: slots %lu, jitter %lu us (avg %lu, max %lu), overruns %lu, late "
+      "%lu",
+      _name, stats.slots_count, stats.last_jitter_usecs, avg_jitter_usecs,
+      stats.window_max_jitter_usecs, stats.overruns_count,
+      stats.late_slots_count);
+}
+
 // Called from ISR to map the hi2c to a scheduler.
 inline I2cScheduler* I2cScheduler::isr_hi2c_to_scheduler(
     const I2C_HandleTypeDef* hi2c) {
-  if (hi2c == &hi2c1) {
-    return &i2c_scheduler::i2c1_scheduler;
+  for (uint8_t i = 0; i < i2c_scheduler::kMaxSchedulers; i++) {
+    if (schedulers_hi2c[i] == hi2c) {
+      return schedulers[i];
+    }
   }
   error_handler::Panic(132);
 }
@@ -164,18 +396,25 @@ void I2cScheduler::i2c_shared_error_isr(I2C_HandleTypeDef* hi2c) {
 
 // Scheduler specifoc completion isr.
 void I2cScheduler::on_i2c_completion_isr() {
-  I2cDevice* const dev = _schedule->slots[_slot_index_in_cycle].device;
+  I2cDevice* const dev = _active_device;
   if (!dev) {
     error_handler::Panic(133);
   }
   dev->on_i2c_complete_isr();
+  // Continue with the next devices of the slot.
+  if (!dev->is_i2c_bus_in_use()) {
+    start_next_devices();
+  }
 }
 
 // Scheduler specifoc error and abort isr.
 void I2cScheduler::on_i2c_error_isr() {
-  I2cDevice* const dev = _schedule->slots[_slot_index_in_cycle].device;
+  I2cDevice* const dev = _active_device;
   if (!dev) {
     error_handler::Panic(134);
   }
   dev->on_i2c_error_isr();
+  if (!dev->is_i2c_bus_in_use()) {
+    start_next_devices();
+  }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "i2c.h"
+#include "i2c_transactions.h"
 #include "main.h"
 #include "static_timer.h"
 
@@ -8,16 +9,86 @@ class I2cDevice {
  public:
   I2cDevice() {}
 
+  // slot_interval_usecs is the time between the slots of the device,
+  // including its rate divider.
   virtual void on_scheduler_init(I2C_HandleTypeDef* scheduler_hi2c,
-                                  uint16_t slot_length_ms,
-                                  uint16_t slot_internval_ms) = 0;
-  virtual void on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms) = 0;
+                                 uint32_t slot_length_usecs,
+                                 uint32_t slot_interval_usecs) = 0;
+  // The slot start time is given in millis() and micros() time bases.
+  // May be called from an ISR (see I2cScheduler) so it should only
+  // start the I2C transfers.
+  virtual void on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms,
+                                 uint32_t slot_sys_timestamp_us) = 0;
   virtual void on_i2c_complete_isr() = 0;
   virtual void on_i2c_error_isr() = 0;
   virtual bool is_i2c_bus_in_use() = 0;
+  // The worst case I2C traffic of the device in a slot. Used to validate
+  // the schedule.
+  virtual i2c_transactions::BusLoad max_slot_bus_load() = 0;
 };
 
-struct I2cScheduleSlot {
+// An I2c bus for the transaction lists, with the HAL DMA transfers. The
+// completion and error callbacks come through the scheduler. The data
+// of the transfers should be in the DMA memory, see dma_buffers.h.
+class HalI2cBus : public i2c_transactions::I2cBus {
+ public:
+  explicit HalI2cBus(I2C_HandleTypeDef* hi2c) : _hi2c(hi2c) {}
+
+  virtual bool start_write(uint8_t device_address, uint8_t* data,
+                           uint16_t size) {
+    return HAL_OK ==
+           HAL_I2C_Master_Transmit_DMA(_hi2c, device_address, data, size);
+  }
+  virtual bool start_read(uint8_t device_address, uint8_t* data,
+                          uint16_t size) {
+    return HAL_OK ==
+           HAL_I2C_Master_Receive_DMA(_hi2c, device_address, data, size);
+  }
+  virtual bool start_write_read(uint8_t device_address, uint8_t reg,
+                                uint8_t* data, uint16_t size) {
+    return HAL_OK == HAL_I2C_Mem_Read_DMA(_hi2c, device_address, reg,
+                                          I2C_MEMADD_SIZE_8BIT, data, size);
+  }
+
+ private:
+  I2C_HandleTypeDef* const _hi2c;
+};
+
+// Base class of devices that describe their I2C transactions as
+// transaction lists (see i2c_transactions.h) rather than handling the
+// completion ISR of each transfer. A subclass calls start_list() from
+// on_i2c_slot_begin() and gets a single on_list_done_isr() call when
+// the list completed or failed. It still implements on_scheduler_init()
+// and on_i2c_slot_begin().
+class I2cListDevice : public I2cDevice,
+                      public i2c_transactions::ListListener {
+ public:
+  explicit I2cListDevice(I2C_HandleTypeDef* hi2c)
+      : _bus(hi2c), _executor(&_bus, this) {}
+
+  // Prevent copy and assignment.
+  I2cListDevice(const I2cListDevice& other) = delete;
+  I2cListDevice& operator=(const I2cListDevice& other) = delete;
+
+  // Methods of I2cDevice. The next step of the list is started from
+  // the completion ISR of the previous one.
+  virtual void on_i2c_complete_isr() final { _executor.on_complete_isr(); }
+  virtual void on_i2c_error_isr() final { _executor.on_error_isr(); }
+  virtual bool is_i2c_bus_in_use() final { return _executor.is_busy(); }
+
+ protected:
+  // Returns false if the list was not started. In that case
+  // on_list_done_isr() is not called.
+  bool start_list(const i2c_transactions::TransactionList& list) {
+    return _executor.start(list);
+  }
+
+ private:
+  HalI2cBus _bus;
+  i2c_transactions::Executor _executor;
+};
+
+struct I2cScheduleEntry {
   I2cDevice* const device;
   // The device is called only every N'th cycles. Used to recude the
   // slot rate of a specific device. Should be >= 1.
@@ -30,13 +101,22 @@ struct I2cScheduleSlot {
   }
 };
 
+struct I2cScheduleSlot {
+  static constexpr uint8_t kMaxDevicesPerSlot = 4;
+  // The devices of the slot. They are started one after the other, each
+  // when the previous one released the bus.
+  const I2cScheduleEntry devices[kMaxDevicesPerSlot];
+};
+
 // Describes the schedule of a single I2C bugs (e.g. i2c1).
-// Each devices called every ms_per_slot * slotes_per_cycle ms.
+// Each devices called every usecs_per_slot * slotes_per_cycle usecs
+// times its rate divider.
 struct I2cSchedule {
-  static constexpr uint8_t kMaxSlotsperSycle = 10;
+  static constexpr uint8_t kMaxSlotsperSycle = 16;
   // This controls the timer tick. Should be long enough such hat
-  // all devices can complete their I2C transactions within that time.
-  const uint16_t ms_per_slot;
+  // all the devices of a slot can complete their I2C transactions within
+  // that time. Should be a multiple of 1000 with a software timer.
+  const uint32_t usecs_per_slot;
   // The number of slots in each cycle. Not all slots have to be
   // active with actual devices.
   const uint8_t slots_per_cycle;
@@ -45,25 +125,84 @@ struct I2cSchedule {
   bool is_valid() MUST_USE_VALUE;
 };
 
+// The max fraction of a slot that its devices may use the bus, per the
+// estimate of the validation. The rest is a margin for the slot jitter
+// and clock stretching.
+static constexpr uint32_t kMaxSlotBusPercent = 75;
+
+// Slot timing statistics of a scheduler. The jitter is the delay of
+// the slot start from its ideal time on the usecs grid.
+struct I2cSchedulerStats {
+  uint32_t slots_count = 0;
+  // Slots that were skipped since the device of a previous slot still
+  // used the bus.
+  uint32_t overruns_count = 0;
+  // Slots that started more than a slot late and were skipped.
+  uint32_t late_slots_count = 0;
+  uint32_t last_jitter_usecs = 0;
+  // Since the last reset_window_stats().
+  uint32_t window_max_jitter_usecs = 0;
+  uint32_t window_jitter_sum_usecs = 0;
+  uint32_t window_slots_count = 0;
+};
+
 // Device scheduler for a single i2c channel (e.g. i2c1);
+//
+// The slots are started either by a compare channel of TIM2, the usecs
+// time base, in which case on_i2c_slot_begin() is called from the
+// timer ISR, or by a FreeRTOS software timer, in which case it's
+// called from the timer task and has the tick jitter of that task.
+// The slot timestamps are of the ideal slot times on the usecs grid.
 class I2cScheduler : public TimerCallback {
  public:
-  I2cScheduler(I2C_HandleTypeDef* hi2c, const char* name)
-      : _hi2c(hi2c), _name(name), _timer(*this, name) {}
+  // tim2_channel is the TIM2 compare channel (1 to 4) that drives the
+  // slots, or 0 to use a software timer.
+  I2cScheduler(I2C_HandleTypeDef* hi2c, const char* name,
+               uint8_t tim2_channel)
+      : _hi2c(hi2c),
+        _name(name),
+        _tim2_channel(tim2_channel),
+        _timer(*this, name) {}
 
   // Prevent copy and assignment.
   I2cScheduler(const I2cScheduler& other) = delete;
   I2cScheduler& operator=(const I2cScheduler& other) = delete;
 
+  // Validates the schedule, including the bus time of each slot, and
+  // starts it. Schedulers of different buses run concurrently.
   bool start(I2cSchedule* schedule) MUST_USE_VALUE;
 
+  // Returns a consistent snapshot of the stats. Call from tasks.
+  void get_stats(I2cSchedulerStats* stats) const;
+
+  // Logs the stats and starts a new window of the max and average
+  // jitter.
+  void dump_state();
+
+  // Dispatches the TIM2 compare interrupts to the schedulers.
+  static void tim2_shared_isr();
+
  private:
   I2C_HandleTypeDef* const _hi2c;
   const char* _name;
+  const uint8_t _tim2_channel;
   StaticTimer _timer;
   I2cSchedule* _schedule = nullptr;
   uint8_t _slot_index_in_cycle = 0;
-  uint16_t _cycle_div_counters[I2cSchedule::kMaxSlotsperSycle];
+  // The next device to start in the current slot.
+  uint8_t _device_index_in_slot = 0;
+  uint16_t _cycle_div_counters[I2cSchedule::kMaxSlotsperSycle]
+                              [I2cScheduleSlot::kMaxDevicesPerSlot];
+  // The timestamps of the current slot.
+  uint32_t _slot_millis = 0;
+  uint32_t _slot_micros = 0;
+  // The device whose transactions are in progress, or were last.
+  // Receives the i2c isrs.
+  I2cDevice* _active_device = nullptr;
+  uint32_t _usecs_per_slot = 0;
+  // The ideal start time of the next slot.
+  uint32_t _next_slot_micros = 0;
+  I2cSchedulerStats _stats;
 
   // ISR handlers that are shared by all schedulers.
   static void i2c_shared_completion_isr(I2C_HandleTypeDef* hi2c);
@@ -73,15 +212,32 @@ class I2cScheduler : public TimerCallback {
   static inline I2cScheduler* isr_hi2c_to_scheduler(
       const I2C_HandleTypeDef* hi2c);
 
+  bool validate_bus_time();
+  bool start_tim2_channel();
+
   // Called on each timer tick.
   void timer_callback();
 
+  // Called from the TIM2 isr when the compare channel matches.
+  void on_tim2_compare_isr();
+
+  // Starts the slot whose ideal time is slot_micros, from either timer.
+  void start_slot(uint32_t slot_micros, uint32_t slot_millis,
+                  uint32_t now_micros);
+
+  // Starts the next devices of the current slot, until one of them uses
+  // the bus. Called from the slot start and from the i2c isrs.
+  void start_next_devices();
+
   // Called from i2c isrs.
   void on_i2c_completion_isr();
   void on_i2c_error_isr();
 };
 
 namespace i2c_scheduler {
+// The max number of concurrently running schedulers, one per bus.
+constexpr uint8_t kMaxSchedulers = 4;
+
 // Scheduler for I2C1 channel.
 extern I2cScheduler i2c1_scheduler;
 }  // namespace i2c_scheduler
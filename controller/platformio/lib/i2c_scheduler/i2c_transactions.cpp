@@ -0,0 +1,100 @@
+#include "i2c_transactions.h"
+
+namespace i2c_transactions {
+
+bool Executor::start(const TransactionList& list) {
+  if (_list || list.num_steps < 1 || list.num_steps > kMaxSteps ||
+      !list.steps) {
+    return false;
+  }
+  _list_copy = list;
+  _list = &_list_copy;
+  _step_index = 0;
+  if (!start_step(_list->steps[0])) {
+    _list = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool Executor::start_step(const Step& step) {
+  const uint8_t address = _list->device_address;
+  switch (step.type) {
+    case StepType::WRITE:
+      return _bus->start_write(address, step.data, step.size);
+    case StepType::READ:
+      return _bus->start_read(address, step.data, step.size);
+    case StepType::WRITE_READ:
+      return _bus->start_write_read(address, step.reg, step.data, step.size);
+  }
+  return false;
+}
+
+void Executor::on_complete_isr() {
+  // A stray completion is ignored.
+  if (!_list) {
+    return;
+  }
+  _step_index++;
+  if (_step_index >= _list->num_steps) {
+    finish(true);
+    return;
+  }
+  if (!start_step(_list->steps[_step_index])) {
+    finish(false);
+  }
+}
+
+void Executor::on_error_isr() {
+  if (!_list) {
+    return;
+  }
+  finish(false);
+}
+
+void Executor::finish(bool ok) {
+  const ListResult result = {.ok = ok, .steps_completed = _step_index};
+  _list = nullptr;
+  _lists_count++;
+  if (!ok) {
+    _errors_count++;
+  }
+  // Last, since the listener may start the next list.
+  _listener->on_list_done_isr(result);
+}
+
+// Bits of a byte with its ack.
+static constexpr uint32_t kBitsPerByte = 9;
+
+BusLoad list_bus_load(const TransactionList& list) {
+  BusLoad load;
+  for (uint8_t i = 0; i < list.num_steps; i++) {
+    const Step& step = list.steps[i];
+    // Start, the address byte, the data bytes and stop.
+    uint32_t bits = 1 + kBitsPerByte * (1 + step.size) + 1;
+    if (step.type == StepType::WRITE_READ) {
+      // The address and register bytes and a repeated start.
+      bits += kBitsPerByte * 2 + 1;
+    }
+    load.bits += bits;
+    load.transfers++;
+  }
+  return load;
+}
+
+uint32_t scl_period_nanos(uint32_t timing, uint32_t i2c_clock_hz) {
+  const uint32_t presc = (timing >> 28) & 0xf;
+  const uint32_t sclh = (timing >> 8) & 0xff;
+  const uint32_t scll = timing & 0xff;
+  // The low and high periods plus about 3 clocks of synchronization of
+  // each of the edges.
+  const uint64_t clocks = (uint64_t)(scll + 1 + sclh + 1) * (presc + 1) + 6;
+  return (uint32_t)((clocks * 1000000000 + i2c_clock_hz - 1) / i2c_clock_hz);
+}
+
+uint32_t bus_usecs(const BusLoad& load, uint32_t scl_period_nanos) {
+  return ((uint64_t)load.bits * scl_period_nanos + 999) / 1000 +
+         load.transfers * kTransferOverheadUsecs;
+}
+
+}  // namespace i2c_transactions
@@ -0,0 +1,143 @@
+// Declarative I2C transactions. A device describes the transactions of a
+// slot as a list of steps, and the executor runs them back to back from
+// the I2C completion ISRs, calling the device once when the whole list
+// completed or failed. This replaces the hand written per step state
+// machines of the devices.
+//
+// The executor accesses the bus only through the I2cBus interface, so
+// the tests drive it with a mock bus.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace i2c_transactions {
+
+enum class StepType : uint8_t {
+  // Writes 'size' bytes from 'data'.
+  WRITE,
+  // Reads 'size' bytes into 'data'.
+  READ,
+  // Writes the register address 'reg' and reads 'size' bytes into 'data',
+  // with a repeated start, as a single transaction.
+  WRITE_READ,
+};
+
+struct Step {
+  StepType type;
+  // For WRITE_READ only.
+  uint8_t reg;
+  // The bytes to write, or the buffer for the bytes read. Should stay
+  // valid until the list completes.
+  uint8_t* data;
+  uint16_t size;
+};
+
+static constexpr uint8_t kMaxSteps = 8;
+
+// A list of steps to a single device. The steps should stay valid until
+// the list completes.
+struct TransactionList {
+  // As in the HAL, e.g. 0x48 << 1.
+  uint8_t device_address;
+  uint8_t num_steps;
+  const Step* steps;
+};
+
+// The outcome of a list.
+struct ListResult {
+  bool ok;
+  // The number of steps that completed. If not ok, this is also the
+  // index of the step that failed.
+  uint8_t steps_completed;
+};
+
+// Starts the DMA/IT transfers of the steps. A false return means the
+// transfer was not started, e.g. because the bus is busy. When started,
+// the owner of the bus calls the executor's on_complete_isr() or
+// on_error_isr() when the transfer ends.
+class I2cBus {
+ public:
+  virtual bool start_write(uint8_t device_address, uint8_t* data,
+                           uint16_t size) = 0;
+  virtual bool start_read(uint8_t device_address, uint8_t* data,
+                          uint16_t size) = 0;
+  virtual bool start_write_read(uint8_t device_address, uint8_t reg,
+                                uint8_t* data, uint16_t size) = 0;
+};
+
+// Notified once per list, from the ISR of the last transfer.
+class ListListener {
+ public:
+  virtual void on_list_done_isr(const ListResult& result) = 0;
+};
+
+// The I2C traffic of transfers, for the validation of schedules.
+struct BusLoad {
+  // SCL periods, including the start, stop and ack bits.
+  uint32_t bits = 0;
+  uint16_t transfers = 0;
+
+  BusLoad& operator+=(const BusLoad& other) {
+    bits += other.bits;
+    transfers += other.transfers;
+    return *this;
+  }
+};
+
+// The traffic of a list. Each step is a transfer.
+BusLoad list_bus_load(const TransactionList& list);
+
+// The SCL period of an I2C TIMINGR value (e.g. 0x20B0155E) with the
+// given I2C kernel clock, rounded up. Includes an estimate of the SCL
+// synchronization delays.
+uint32_t scl_period_nanos(uint32_t timing, uint32_t i2c_clock_hz);
+
+// The CPU time of starting a transfer and of its completion ISR, which
+// are not overlapped by the transfer.
+static constexpr uint32_t kTransferOverheadUsecs = 10;
+
+// The estimated bus time of the traffic, rounded up.
+uint32_t bus_usecs(const BusLoad& load, uint32_t scl_period_nanos);
+
+// Runs one list at a time on a bus.
+class Executor {
+ public:
+  Executor(I2cBus* bus, ListListener* listener)
+      : _bus(bus), _listener(listener) {}
+
+  // Prevent copy and assignment.
+  Executor(const Executor& other) = delete;
+  Executor& operator=(const Executor& other) = delete;
+
+  // Starts the first step of the list. Returns false if a list is in
+  // progress, the list is invalid, or the first transfer could not be
+  // started. In these cases the listener is not called.
+  bool start(const TransactionList& list);
+
+  // Called from the I2C ISRs of the bus.
+  void on_complete_isr();
+  void on_error_isr();
+
+  // True from start() until the listener was called.
+  bool is_busy() const { return _list != nullptr; }
+
+  uint32_t lists_count() const { return _lists_count; }
+  uint32_t errors_count() const { return _errors_count; }
+
+ private:
+  I2cBus* const _bus;
+  ListListener* const _listener;
+  // The list in progress, or null.
+  const TransactionList* _list = nullptr;
+  // A copy of the list, so the caller's one can be a temporary.
+  TransactionList _list_copy = {};
+  uint8_t _step_index = 0;
+  uint32_t _lists_count = 0;
+  uint32_t _errors_count = 0;
+
+  bool start_step(const Step& step);
+  void finish(bool ok);
+};
+
+}  // namespace i2c_transactions
@@ -11,6 +11,7 @@
 #include "static_task.h"
 #include "task.h"
 #include "usb_device.h"
+#include "usbd_cdc.h"
 #include "usbd_cdc_if.h"
 #include "time_util.h"
 
@@ -22,6 +23,9 @@ int _write(int file, uint8_t* ptr, int len) {
   cdc_serial::write(ptr, len);
   return len;
 }
+
+// Defined in usb_device.c.
+extern USBD_HandleTypeDef hUsbDeviceFS;
 }
 
 namespace cdc_serial {
@@ -31,37 +35,142 @@ namespace cdc_serial {
 // static uint8_t buffer[kBufferSize];
 static CircularBuffer<uint8_t, 5000> circular_buffer;
 
-// Semaphore to protect access to the buffer.
+// Semaphore to protect access to the buffer and the stats.
 // static SemaphoreHandle_t semaphore_handle = nullptr;
 static StaticMutex mutex;
 
-// Temp buffer for sending data.
-static uint8_t tx_buffer[100];
+// Stats for diagnostics. Protected by the mutex.
+static uint32_t dropped_bytes = 0;
+static uint32_t dropped_writes = 0;
+static uint32_t lost_tx_completions = 0;
+
+// Double buffering of USB packets. While one packet buffer is
+// transmitted by the USB stack, the task fills the other one.
+// Multiple of the 64 bytes USB FS packet size.
+static constexpr uint16_t kPacketBufferSize = 512;
+static uint8_t packet_buffers[2][kPacketBufferSize];
+
+// Index of the packet buffer the task is filling.
+static uint8_t fill_index = 0;
+// Number of bytes pending in packet_buffers[fill_index].
+static uint16_t fill_size = 0;
+
+// Set by the task when it starts a transfer and cleared by the
+// transmit complete ISR, or by the task if the transfer is gone (see
+// recover_lost_tx()).
+static volatile bool tx_in_progress = false;
+
+// Set when the logger task starts. Used to notify it of new data and
+// of transmit completion.
+static TaskHandle_t volatile logger_task_handle = nullptr;
+
+// The max time the task blocks without a notification. A safety net
+// in case a transmit complete event was lost, e.g. on USB disconnect.
+// Also the max latency of deferred log records.
+static constexpr uint32_t kMaxIdleMillis = 50;
+
+// Called from the USB ISR when a transfer completed. Overrides the weak
+// function of usbd_cdc_if.c.
+extern "C" void CDC_TransmitCpltCallback_FS(void) {
+  tx_in_progress = false;
+  TaskHandle_t const task_handle = logger_task_handle;
+  if (task_handle) {
+    BaseType_t task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task_handle, &task_woken);
+    portYIELD_FROM_ISR(task_woken);
+  }
+}
+
+// Called from the USB ISR on a USB reset or disconnect. A transfer in
+// progress is aborted without a completion. Overrides the weak function
+// of usbd_cdc_if.c.
+extern "C" void CDC_DeInitCallback_FS(void) {
+  if (tx_in_progress) {
+    CDC_TransmitCpltCallback_FS();
+  }
+}
+
+// Clears tx_in_progress if no transfer is really pending. A safety net
+// in case a transfer completion was lost in a way that
+// CDC_DeInitCallback_FS() didn't catch. Without it the output would
+// stall forever. Called only from the logger task.
+static void recover_lost_tx() {
+  if (!tx_in_progress) {
+    return;
+  }
+  const USBD_CDC_HandleTypeDef* const hcdc =
+      (const USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  // Not configured or reset (re)initialized the class state.
+  const bool pending = hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED &&
+                       hcdc != nullptr && hcdc->TxState != 0;
+  if (!pending) {
+    tx_in_progress = false;
+    MutexScope mutex_scope(mutex);
+    lost_tx_completions++;
+  }
+}
+
+// Tries to transmit the filled packet buffer. Called only from the
+// logger task.
+static void transmit_fill_buffer() {
+  tx_in_progress = true;
+  const uint8_t rc = CDC_Transmit_FS(packet_buffers[fill_index], fill_size);
+  if (rc == USBD_OK) {
+    // The transfer owns this buffer until the transmit complete ISR.
+    fill_index ^= 1;
+    fill_size = 0;
+    return;
+  }
+
+  tx_in_progress = false;
+  if (rc == USBD_BUSY) {
+    // Keep the data and try again on next notification.
+    return;
+  }
+
+  // NOTE: We drop the packet on USBD_EMEM and USBD_FAIL.
+  {
+    MutexScope mutex_scope(mutex);
+    dropped_bytes += fill_size;
+  }
+  fill_size = 0;
+}
 
 static void logger_task_body_impl(void* ignored_argument) {
+  logger_task_handle = xTaskGetCurrentTaskHandle();
+
   for (;;) {
-    // Transfer a chunk of data to tx_buffer, if avaiable.
-    uint16_t bytes_to_send = 0;
-    // xSemaphoreTake(semaphore_handle, portMAX_DELAY);
-    {
-      MutexScope mutex_scope(mutex);
-      bytes_to_send = circular_buffer.read(tx_buffer, sizeof(tx_buffer));
-    }
-    // xSemaphoreGive(semaphore_handle);
-
-    if (bytes_to_send) {
-      for (;;) {
-        const uint8_t rc = CDC_Transmit_FS(tx_buffer, bytes_to_send);
-        // Exit on error or ok. 
-        // NOTE: We ignored silentcy the errors USBD_EMEM and USBD_FAIL.
-        if (rc != USBD_BUSY) {
-          break;
-        }
-        time_util::delay_millis(1);
+    // Wait for new data or a transmit completion. We clear the
+    // notification count since we process all the pending work
+    // below.
+    ulTaskNotifyTake(pdTRUE, kMaxIdleMillis);
+    recover_lost_tx();
+
+    // Deferred log records do not notify us, to keep the recording
+    // cheap, so we pick them up here, at least every kMaxIdleMillis.
+    Logger::format_deferred_records();
+
+    // Loop until there is nothing we can do without waiting.
+    for (;;) {
+      // Top off the fill buffer with pending bytes.
+      if (fill_size < kPacketBufferSize) {
+        MutexScope mutex_scope(mutex);
+        fill_size +=
+            circular_buffer.read(&packet_buffers[fill_index][fill_size],
+                                 kPacketBufferSize - fill_size);
+      }
+
+      // Nothing to send or the other buffer is still in transit.
+      if (!fill_size || tx_in_progress) {
+        break;
+      }
+
+      transmit_fill_buffer();
+
+      // If the USB stack is busy or failed, wait for next event.
+      if (fill_size) {
+        break;
       }
-    } else {
-      // Nothing to transmit. Wait and try again.
-      time_util::delay_millis(50);
     }
   }
 }
@@ -74,7 +183,37 @@ void write_str(const char* str) {
 void write(const uint8_t* bfr, uint16_t len) {
   {
     MutexScope mutex_scope(mutex);
-    circular_buffer.write(bfr, len, true);
+    // We drop the new data rather than overwriting older data
+    // since partial log lines are harder to interpret.
+    if (!circular_buffer.write(bfr, len)) {
+      dropped_bytes += len;
+      dropped_writes++;
+    }
+  }
+
+  TaskHandle_t const task_handle = logger_task_handle;
+  if (task_handle) {
+    xTaskNotifyGive(task_handle);
+  }
+}
+
+void get_stats(Stats* stats) {
+  MutexScope mutex_scope(mutex);
+  stats->dropped_bytes = dropped_bytes;
+  stats->dropped_writes = dropped_writes;
+  stats->lost_tx_completions = lost_tx_completions;
+}
+
+void dump_state() {
+  Stats stats;
+  get_stats(&stats);
+  if (stats.dropped_bytes) {
+    logger.warning("CDC serial: dropped %lu bytes in %lu writes",
+                   stats.dropped_bytes, stats.dropped_writes);
+  }
+  if (stats.lost_tx_completions) {
+    logger.warning("CDC serial: %lu lost transmit completions",
+                   stats.lost_tx_completions);
   }
 }
 
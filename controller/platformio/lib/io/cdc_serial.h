@@ -5,10 +5,29 @@
 
 namespace cdc_serial {
 
+// Counters for diagnostics.
+struct Stats {
+  // Bytes that were dropped because the buffer was full or
+  // the USB transfer failed.
+  uint32_t dropped_bytes = 0;
+  // Write calls whose data was dropped because the buffer was full.
+  uint32_t dropped_writes = 0;
+  // Transfers whose transmit complete callback never came, e.g.
+  // because of a USB reset or disconnect.
+  uint32_t lost_tx_completions = 0;
+};
+
 void setup();
 void write_str(const char* str);
+// Non blocking. If there is no room for the entire data, it is
+// dropped and counted in the stats.
 void write(const uint8_t* bfr, uint16_t len);
 
+void get_stats(Stats* stats);
+
+// Logs a warning if data was dropped or transfers were lost.
+void dump_state();
+
 // Caller should provide a task to run this task body.
 extern TaskBodyFunction logger_task_body;
 
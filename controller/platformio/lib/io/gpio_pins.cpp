@@ -5,6 +5,7 @@ namespace gpio_pins {
 // Outputs
 OutputPin LED(LED_GPIO_Port, LED_Pin, 0);
 OutputPin TEST1(TEST1_GPIO_Port, TEST1_Pin, 0);
+OutputPin IFC_OUT1(IFC_OUT1_GPIO_Port, IFC_OUT1_Pin, 0);
 
 // Inputs
 InputPin USER_SWITCH(USER_SWITCH_GPIO_Port, USER_SWITCH_Pin);
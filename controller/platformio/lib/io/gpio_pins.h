@@ -61,6 +61,9 @@ extern OutputPin LED;
 // Port D1 = PCIE B13.
 extern OutputPin TEST1;
 
+// The interface output to the printer. Set by the alarms.
+extern OutputPin IFC_OUT1;
+
 // High when pressed.
 extern InputPin USER_SWITCH;
 
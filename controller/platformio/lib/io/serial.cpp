@@ -1,13 +1,17 @@
 #include "serial.h"
 
 #include "common.h"
+#include "tcm.h"
 
 // #pragma GCC push_options
 // #pragma GCC optimize("Og")
 
 namespace serial {
-Serial serial1(&huart1);
-Serial serial2(&huart2);
+DMA_BUFFER static SerialDmaBuffers serial1_dma_buffers;
+DMA_BUFFER static SerialDmaBuffers serial2_dma_buffers;
+
+Serial serial1(&huart1, &serial1_dma_buffers);
+Serial serial2(&huart2, &serial2_dma_buffers);
 
 // Finds the serial by huart. Fatal error if not found.
 Serial *get_serial_by_huart(UART_HandleTypeDef *huart) {
@@ -25,7 +29,7 @@ Serial *get_serial_by_huart(UART_HandleTypeDef *huart) {
 
 }  // namespace serial.
 
-void Serial::tx_next_chunk() {
+ITCM_CODE void Serial::tx_next_chunk() {
   // At most sizeof(_tx_dma_buffer)
   const uint16_t len = _tx_buffer.read(_tx_dma_buffer, sizeof(_tx_dma_buffer));
   if (len > 0) {
@@ -34,8 +38,9 @@ void Serial::tx_next_chunk() {
 }
 
 // Called from isr to accept new incoming data from the RX DMA buffer.
-void Serial::rx_data_arrived_isr(const uint8_t *buffer, uint16_t len,
-                                 BaseType_t *task_woken) {
+ITCM_CODE void Serial::rx_data_arrived_isr(const uint8_t *buffer,
+                                           uint16_t len,
+                                           BaseType_t *task_woken) {
   if (len) {
     const bool ok = _rx_buffer.write(buffer, len, true);
     if (!ok) {
@@ -168,7 +173,7 @@ void Serial::start_rx_dma() {
 
 
 
-void Serial::uart_TxCpltCallback(UART_HandleTypeDef *huart) {
+ITCM_CODE void Serial::uart_TxCpltCallback(UART_HandleTypeDef *huart) {
   Serial *serial = serial::get_serial_by_huart(huart);
   serial->tx_next_chunk();
 }
@@ -182,7 +187,8 @@ void Serial::uart_ErrorCallback(UART_HandleTypeDef *huart) {
 // Called in case of reciever timeout, with partial buffer size.
 // Based on an example at
 // https://community.st.com/t5/wireless-mcu/hal-uartex-receivetoidle-dma-idle-event-what-is-that-whatever-it/m-p/141617/highlight/true#M5301
-void Serial::uart_RxEventCallback(UART_HandleTypeDef *huart, uint16_t size) {
+ITCM_CODE void Serial::uart_RxEventCallback(UART_HandleTypeDef *huart,
+                                            uint16_t size) {
   // Map the HAL's hurart to our Serial wrapper class.
   Serial *serial = serial::get_serial_by_huart(huart);
 
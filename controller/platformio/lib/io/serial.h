@@ -4,6 +4,7 @@
 #include "FreeRTOS.h"
 #include "circular_buffer.h"
 #include "common.h"
+#include "dma_buffers.h"
 #include "semphr.h"
 #include "static_binary_semaphore.h"
 #include "static_mutex.h"
@@ -13,9 +14,21 @@
 // #pragma GCC push_options
 // #pragma GCC optimize("Og")
 
+// The buffers that the UART DMA of a Serial reads and writes. Should be
+// in the non cacheable DMA memory, see dma_buffers.h.
+struct SerialDmaBuffers {
+  // Non circular TX buffer.
+  uint8_t tx[64];
+  // Circular RX buffer.
+  uint8_t rx[256];
+};
+
 class Serial {
  public:
-  Serial(UART_HandleTypeDef* huart) : _huart(huart) {}
+  Serial(UART_HandleTypeDef* huart, SerialDmaBuffers* dma_buffers)
+      : _huart(huart),
+        _tx_dma_buffer(dma_buffers->tx),
+        _rx_dma_buffer(dma_buffers->rx) {}
 
   void write_str(const char* str) { write((uint8_t*)str, strlen(str)); }
 
@@ -68,7 +81,7 @@ class Serial {
   CircularBuffer<uint8_t, 5000> _tx_buffer;
   StaticMutex _tx_mutex;
   // This DMA buffer is non circual.
-  uint8_t _tx_dma_buffer[64];
+  uint8_t (&_tx_dma_buffer)[sizeof(SerialDmaBuffers::tx)];
 
   // ---RX. Circular DMA.
   CircularBuffer<uint8_t, 5000> _rx_buffer;
@@ -78,7 +91,7 @@ class Serial {
   StaticBinarySemaphore _rx_data_avail_sem;
   // This DMA buffer is circular bytes are added by the DMA
   // in a contingious circular fashion with wrap around.
-  uint8_t _rx_dma_buffer[256];
+  uint8_t (&_rx_dma_buffer)[sizeof(SerialDmaBuffers::rx)];
   // One past the last position in _rx_dma_buffer where we
   // consumed data. Modulu the buffer size.
   uint16_t _rx_last_pos = 0;
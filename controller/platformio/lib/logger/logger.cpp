@@ -15,6 +15,20 @@ Logger logger;
 static char line_buffer[200];
 static StaticMutex mutex;
 
+// Returns the single letter prefix of a log level.
+static const char* level_str(LoggerLevel level) {
+  switch (level) {
+    case LOG_VERBOSE:
+      return "V";
+    case LOG_INFO:
+      return "I";
+    case LOG_WARNING:
+      return "W";
+    default:
+      return "E";
+  }
+}
+
 void Logger::_vlog(const char* level_str, const char* format,
                    va_list args) const {
 
@@ -31,4 +45,119 @@ void Logger::_vlog(const char* level_str, const char* format,
     strcpy(&line_buffer[prefix_len + msg_len], "\n");
     cdc_serial::write_str(line_buffer);
   }
-}
\ No newline at end of file
+}
+
+// ----- Deferred logging.
+
+// A deferred log message, as recorded by the caller.
+struct DeferredRecord {
+  const char* format;
+  LoggerLevel level;
+  uint8_t num_args;
+  uintptr_t args[Logger::kMaxDeferredArgs];
+};
+
+// A ring of deferred records. Producers and the consumer access
+// it with interrupts masked for a few instructions, so it never
+// blocks and it's safe to use from ISRs.
+static constexpr uint16_t kNumDeferredRecords = 64;
+static DeferredRecord deferred_records[kNumDeferredRecords];
+static uint16_t deferred_start = 0;
+static uint16_t deferred_size = 0;
+// Total records dropped because the ring was full.
+static uint32_t deferred_dropped = 0;
+
+// Accessed by the logger task only.
+static char deferred_line_buffer[200];
+static uint32_t deferred_dropped_reported = 0;
+
+void Logger::record_deferred(LoggerLevel level, const char* format,
+                             uint8_t num_args, const uintptr_t* args) const {
+  if (num_args > kMaxDeferredArgs) {
+    num_args = kMaxDeferredArgs;
+  }
+
+  // Preserve the interrupt mask state so this can be called
+  // with interrupts already disabled.
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  {
+    if (deferred_size >= kNumDeferredRecords) {
+      deferred_dropped++;
+    } else {
+      uint16_t i = deferred_start + deferred_size;
+      if (i >= kNumDeferredRecords) {
+        i -= kNumDeferredRecords;
+      }
+      DeferredRecord& record = deferred_records[i];
+      record.format = format;
+      record.level = level;
+      record.num_args = num_args;
+      for (uint8_t j = 0; j < num_args; j++) {
+        record.args[j] = args[j];
+      }
+      deferred_size++;
+    }
+  }
+  __set_PRIMASK(primask);
+}
+
+// Pops the oldest record. Returns false if none.
+static bool pop_deferred_record(DeferredRecord* record,
+                                uint32_t* dropped_count) {
+  bool result = false;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  {
+    *dropped_count = deferred_dropped;
+    if (deferred_size) {
+      *record = deferred_records[deferred_start];
+      deferred_start++;
+      if (deferred_start >= kNumDeferredRecords) {
+        deferred_start = 0;
+      }
+      deferred_size--;
+      result = true;
+    }
+  }
+  __set_PRIMASK(primask);
+  return result;
+}
+
+uint16_t Logger::format_deferred_records() {
+  uint16_t count = 0;
+  DeferredRecord record;
+  uint32_t dropped_count;
+  while (pop_deferred_record(&record, &dropped_count)) {
+    count++;
+    strcpy(deferred_line_buffer, level_str(record.level));
+    strcat(deferred_line_buffer, ": ");
+    const int prefix_len = strlen(deferred_line_buffer);
+    // Unused args are passed as zeros and are ignored by the format.
+    static_assert(kMaxDeferredArgs == 6);
+    const uintptr_t* a = record.args;
+    for (uint8_t j = record.num_args; j < kMaxDeferredArgs; j++) {
+      record.args[j] = 0;
+    }
+    const int n = snprintf(
+        deferred_line_buffer + prefix_len,
+        sizeof(deferred_line_buffer) - prefix_len - 2, record.format, a[0],
+        a[1], a[2], a[3], a[4], a[5]);
+    // snprintf returns the untruncated length.
+    const int msg_len = std::min(
+        n, (int)(sizeof(deferred_line_buffer) - prefix_len - 3));
+    strcpy(&deferred_line_buffer[prefix_len + std::max(0, msg_len)], "\n");
+    cdc_serial::write_str(deferred_line_buffer);
+  }
+
+  // Report drops since last time.
+  if (dropped_count != deferred_dropped_reported) {
+    snprintf(deferred_line_buffer, sizeof(deferred_line_buffer),
+             "W: Dropped %lu deferred log records\n",
+             dropped_count - deferred_dropped_reported);
+    deferred_dropped_reported = dropped_count;
+    cdc_serial::write_str(deferred_line_buffer);
+  }
+
+  return count;
+}
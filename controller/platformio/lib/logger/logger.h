@@ -1,8 +1,10 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <stdio.h>
 #include <algorithm>
+#include <type_traits>
 #include "main.h"
 #include "stdarg.h"
 
@@ -14,6 +16,26 @@ enum LoggerLevel {
   LOG_NONE = 5
 };
 
+// Compile time min log level of the deferred loggers. Deferred log calls
+// below the level of their module are removed by the compiler. Can be
+// overridden per module with build flags such as
+// -D CONFIG_LOG_LEVEL_ADC_CARD=LOG_VERBOSE
+#ifndef CONFIG_LOG_MIN_LEVEL
+#define CONFIG_LOG_MIN_LEVEL LOG_INFO
+#endif
+
+#ifndef CONFIG_LOG_LEVEL_ADC_CARD
+#define CONFIG_LOG_LEVEL_ADC_CARD CONFIG_LOG_MIN_LEVEL
+#endif
+
+#ifndef CONFIG_LOG_LEVEL_PW_CARD
+#define CONFIG_LOG_LEVEL_PW_CARD CONFIG_LOG_MIN_LEVEL
+#endif
+
+#ifndef CONFIG_LOG_LEVEL_PRINTER_LINK
+#define CONFIG_LOG_LEVEL_PRINTER_LINK CONFIG_LOG_MIN_LEVEL
+#endif
+
 class Logger {
  public:
   Logger() {}
@@ -84,10 +106,20 @@ class Logger {
     }
   }
 
- private:
- 
+  // Max number of arguments of a deferred log record.
+  static constexpr uint8_t kMaxDeferredArgs = 6;
+
+  // Records a deferred log message. Does not format and does not block,
+  // can be called also from ISRs. Args are integers or pointers to
+  // strings that are never modified (e.g. literals).
+  void record_deferred(LoggerLevel level, const char* format,
+                       uint8_t num_args, const uintptr_t* args) const;
 
+  // Called by the logger task. Formats and outputs the pending deferred
+  // log records. Returns the number of records processed.
+  static uint16_t format_deferred_records();
 
+ private:
   LoggerLevel _level;
 
   // Primitive method to output the log message.
@@ -95,3 +127,63 @@ class Logger {
 };
 
 extern Logger logger;
+
+// A logger with a compile time min level, for log calls in performance
+// critical code. Instead of formatting the message, the calls record
+// the format string pointer and the raw arguments in a ring buffer and
+// the logger task formats them later. Arguments should be integers
+// of up to 32 bits or pointers to constant strings. Messages are
+// dropped if the ring is full.
+template <LoggerLevel kMinLevel>
+class DeferredLogger {
+ public:
+  template <typename... Args>
+  inline void verbose(const char* format, Args... args) const {
+    log<LOG_VERBOSE>(format, args...);
+  }
+
+  template <typename... Args>
+  inline void info(const char* format, Args... args) const {
+    log<LOG_INFO>(format, args...);
+  }
+
+  template <typename... Args>
+  inline void warning(const char* format, Args... args) const {
+    log<LOG_WARNING>(format, args...);
+  }
+
+  template <typename... Args>
+  inline void error(const char* format, Args... args) const {
+    log<LOG_ERROR>(format, args...);
+  }
+
+ private:
+  template <LoggerLevel kLevel, typename... Args>
+  inline void log(const char* format, Args... args) const {
+    static_assert(sizeof...(Args) <= Logger::kMaxDeferredArgs);
+    // A compile time constant, the code is dropped for lower levels.
+    if (kLevel >= kMinLevel) {
+      if (logger.is_level(kLevel)) {
+        const uintptr_t raw_args[sizeof...(Args) + 1] = {to_raw_arg(args)...};
+        logger.record_deferred(kLevel, format, sizeof...(Args), raw_args);
+      }
+    }
+  }
+
+  // The formatting is done with snprintf() and all the raw args
+  // as uintptr_t. This works for types that are promoted to a single
+  // 32 bits word.
+  template <typename T>
+  static inline uintptr_t to_raw_arg(T* v) {
+    return reinterpret_cast<uintptr_t>(v);
+  }
+
+  template <typename T>
+  static inline uintptr_t to_raw_arg(T v) {
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                  "Unsupported deferred log argument type");
+    static_assert(sizeof(T) <= sizeof(uintptr_t));
+    // Sign extension is ok since the format reads 32 bits.
+    return static_cast<uintptr_t>(v);
+  }
+};
@@ -0,0 +1,43 @@
+// Placement of the DMA buffers in the non cacheable .dma_buffers section
+// of STM32H750VBTX_FLASH.ld. The CPU runs with the data cache enabled, so
+// a DMA that reads or writes a buffer in cacheable memory can miss data
+// that is still in the cache, or have its data hidden by stale cache
+// lines. The startup code maps the section with the MPU as non cacheable
+// memory and zeroes it before the static constructors.
+//
+// A buffer that is passed to a HAL DMA function, or an object that
+// contains one, should be declared with DMA_BUFFER, or be copied through
+// such a buffer. Not for the DTCM which the DMA controllers can't access.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A variable or an object in the non cacheable DMA memory. Zero
+// initialized. Aligned to the 32 bytes cache line size.
+#define DMA_BUFFER __attribute__((section(".dma_buffers"), aligned(32)))
+
+// The boundaries of the section and the size of its MPU region, defined
+// in STM32H750VBTX_FLASH.ld. The size is the address of its symbol.
+extern "C" {
+extern uint8_t _sdma_buffers[];
+extern uint8_t _edma_buffers[];
+extern uint8_t _dma_buffers_mpu_size[];
+}
+
+namespace dma_buffers {
+
+// The size of the MPU region of the section. A power of 2.
+inline uint32_t mpu_region_size() {
+  return (uint32_t)_dma_buffers_mpu_size;
+}
+
+// True if the n bytes at p are in the non cacheable DMA memory.
+inline bool contains(const void* p, size_t n) {
+  const uint8_t* const bytes = static_cast<const uint8_t*>(p);
+  return bytes >= _sdma_buffers && bytes <= _edma_buffers &&
+         n <= (size_t)(_edma_buffers - bytes);
+}
+
+}  // namespace dma_buffers
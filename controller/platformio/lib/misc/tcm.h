@@ -0,0 +1,21 @@
+// Placement of hot code and data in the tightly coupled memories of the
+// Cortex-M7, which are accessed with no wait states, rather than in the
+// flash and the AXI SRAM. See the .itcm_text and .dtcm_* sections of
+// STM32H750VBTX_FLASH.ld, which also place the interrupt handlers in the
+// ITCM. The startup code initializes them before the static constructors.
+//
+// The DMA controllers can't access the DTCM, so the DTCM_* macros should
+// not be used for DMA buffers or for objects that contain them.
+
+#pragma once
+
+// A function that runs from the ITCM. Not inlined, so it doesn't end up
+// in the flash code of its callers.
+#define ITCM_CODE __attribute__((section(".itcm_text"), noinline))
+
+// Initialized variables and constants in the DTCM.
+#define DTCM_DATA __attribute__((section(".dtcm_data")))
+#define DTCM_CONST __attribute__((section(".dtcm_rodata")))
+
+// Zero initialized variables and objects in the DTCM.
+#define DTCM_BSS __attribute__((section(".dtcm_bss")))
@@ -8,6 +8,9 @@
 
 namespace printer_link_card {
 
+// For logging from the rx path.
+static const DeferredLogger<CONFIG_LOG_LEVEL_PRINTER_LINK> deferred_logger;
+
 // Initialized in setup() to point to the serial port.
 static Serial* printer_link_serial = nullptr;
 
@@ -56,6 +59,15 @@ void setup(Serial* serial) {
   printer_link_serial = serial;
 }
 
+void send_report(const char* report) {
+  if (!printer_link_serial) {
+    error_handler::Panic(181);
+  }
+  printer_link_serial->write_str("[");
+  printer_link_serial->write_str(report);
+  printer_link_serial->write_str("]\n");
+}
+
 // report_str doesn't include the bounding '[', ']'.
 static void handle_incoming_report(
     const controller::ExternalReportStr& report_str) {
@@ -152,7 +164,7 @@ static void printer_link_task_body_impl(void* ignored_argument) {
   for (;;) {
     // Wait for rx chars.
     const int n = printer_link_serial->read(temp_buffer, sizeof(temp_buffer));
-    logger.info("Printer link: Recieved %d chars", n);
+    deferred_logger.info("Printer link: Recieved %d chars", n);
     // If current COLLECT session is too old, clear it.
     if (state == COLLECT) {
       const uint32_t millis_in_collect =
@@ -9,6 +9,10 @@ namespace printer_link_card {
 // serial port to use.
 void setup(Serial* serial);
 
+// Sends a report to the printer, in the same "[...]" framing as the
+// reports it sends to us. Can be called from any task after setup().
+void send_report(const char* report);
+
 // Caller should provide a task to run this task body.
 // Should be started after setup().
 extern TaskBodyFunction printer_link_task_body;
@@ -3,32 +3,65 @@
 #include <FreeRtos.h>
 #include <i2c.h>
 
+#include "alarms.h"
 #include "common.h"
 #include "data_queue.h"
+#include "dma_buffers.h"
 #include "error_handler.h"
 #include "session.h"
-#include "static_queue.h"
+#include "static_notify_channel.h"
 #include "time_util.h"
 
 #pragma GCC push_options
 #pragma GCC optimize("O0")
 
 // The number of data points we send in a log packet. Each
-// data point contains a pair of voltage and current readings.
-static constexpr uint16_t kDataPointsPerPacket = 8;
+// data point contains a pair of voltage and current readings. About
+// 300ms of data with either mode.
+static constexpr uint16_t kDataPointsPerPacket =
+    pw_card::kContinuousMode ? 40 : 8;
 
 // Sampling time 1/128 sec. 4.096V full scale.
 //static constexpr uint16_t kAds1115BaseConfig = 0b0000001110000000;
 
+static_assert(CONFIG_PW_DATA_RATE >= 0 && CONFIG_PW_DATA_RATE <= 7);
+
 // ADS115B configuration.
+#if CONFIG_PW_CONTINUOUS_MODE
+// CONFIG_PW_DATA_RATE. 1.024V full scale. Continuous mode. The comparator
+// is disabled.
+static constexpr uint16_t kAds1115BaseConfig =
+    0b0000011000000011 | CONFIG_PW_DATA_RATE << 5;
+// CHAN0: P->AIN0, N->AIN3.
+static constexpr uint16_t kAds1115ConfigCh0 = kAds1115BaseConfig | 0b001 << 12;
+// CHAN1: P->AIN1, N->AIN3
+static constexpr uint16_t kAds1115ConfigCh1 = kAds1115BaseConfig | 0b010 << 12;
+#else
 // Sampling time 1/128 sec. 1.024V full scale. Single mode.
 static constexpr uint16_t kAds1115BaseConfig = 0b0000011110000000;
 // CHAN0: start a new conversion, P->AIN0, N->AIN3.
-static constexpr uint16_t kAds1115ConfigStartCh0 =
+static constexpr uint16_t kAds1115ConfigCh0 =
     kAds1115BaseConfig | 0b1 << 15 | 0b001 << 12;
 // CHAN1: start a new conversion, P->AIN1, N->AIN3
-static constexpr uint16_t kAds1115ConfigStartCh1 =
+static constexpr uint16_t kAds1115ConfigCh1 =
     kAds1115BaseConfig | 0b1 << 15 | 0b010 << 12;
+#endif
+
+// Conversion time per data rate code, rounded up.
+static constexpr uint32_t kAds1115ConversionUsecs[] = {
+    125000, 62500, 31250, 15625, 8000, 4000, 2106, 1163};
+static constexpr uint32_t kConversionUsecs =
+    kAds1115ConversionUsecs[CONFIG_PW_DATA_RATE];
+
+// In the continuous mode, the conversion in progress when the channel is
+// switched completes with the old channel, so a value of the new channel
+// is available only after two conversions. Plus a margin for the
+// internal oscillator tolerance and the I2C transactions.
+static constexpr uint32_t kMinContinuousSlotIntervalUsecs =
+    2 * kConversionUsecs + kConversionUsecs / 4 + 500;
+
+// For logging from the sampling path.
+static const DeferredLogger<CONFIG_LOG_LEVEL_PW_CARD> deferred_logger;
 
 enum AdcChan {
   // RMS voltage reading.
@@ -46,6 +79,7 @@ enum EventType {
 
 struct AdcReading {
   uint32_t timestamp_millis;
+  uint32_t timestamp_micros;
   AdcChan chan;
   int16_t value;
 };
@@ -61,14 +95,29 @@ struct IsrEvent {
   };
 };
 
-// I2c device implementation for the ADS1115B ADC.
-class I2cPwDevice : public I2cDevice, public TaskBody {
+// The buffers that the I2C DMA reads and writes for a device. In the
+// non cacheable DMA memory, see dma_buffers.h.
+struct PwDmaBuffers {
+  // The conversion value read.
+  uint8_t value[2];
+  // Config register address and value.
+  uint8_t config[3];
+};
+
+// I2c device implementation for the ADS1115B ADC. Each slot runs a
+// single transaction list that reads the conversion value and then
+// writes the config of the next conversion.
+class I2cPwDevice : public I2cListDevice, public TaskBody {
  public:
+  // dma_buffers should be in the DMA memory.
   I2cPwDevice(I2C_HandleTypeDef* hi2c, uint8_t device_address,
-              const char* pw_chan_id)
-      : _hi2c(hi2c),
+              const char* pw_chan_id, PwDmaBuffers* dma_buffers)
+      : I2cListDevice(hi2c),
+        _hi2c(hi2c),
         _i2c_device_address(device_address),
-        _pw_chan_id(pw_chan_id) {}
+        _pw_chan_id(pw_chan_id),
+        _value_buffer(dma_buffers->value),
+        _config_buffer(dma_buffers->config) {}
 
   // Prevent copy and assignment.
   I2cPwDevice(const I2cPwDevice& other) = delete;
@@ -76,25 +125,22 @@ class I2cPwDevice : public I2cDevice, public TaskBody {
 
   // Methods of I2cDevice
   virtual void on_scheduler_init(I2C_HandleTypeDef* scheduler_hi2c,
-                                 uint16_t slot_length_ms,
-                                 uint16_t slot_internval_ms);
-  virtual void on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms);
-  virtual void on_i2c_complete_isr();
-  virtual void on_i2c_error_isr();
-  virtual bool is_i2c_bus_in_use() {
-    switch (_state) {
-      // The states in which DMA transactions may be active.
-      case State::STATE_HARDWARE_TESTING:
-      case State::STATE_ADC_STEP1:
-      case State::STATE_ADC_STEP2:
-      case State::STATE_ADC_STEP3:
-        return true;
-
-      default:
-        return false;
-    }
+                                 uint32_t slot_length_usecs,
+                                 uint32_t slot_interval_usecs);
+  virtual void on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms,
+                                 uint32_t slot_sys_timestamp_us);
+
+  // The reading list is the larger one.
+  virtual i2c_transactions::BusLoad max_slot_bus_load() {
+    return i2c_transactions::list_bus_load(
+        {.device_address = _i2c_device_address,
+         .num_steps = 2,
+         .steps = _adc_steps});
   }
 
+  // Method of ListListener.
+  virtual void on_list_done_isr(const i2c_transactions::ListResult& result);
+
  private:
   // Module states.
   enum State {
@@ -102,36 +148,22 @@ class I2cPwDevice : public I2cDevice, public TaskBody {
     // STATE_SCHEDULER_STARTED.
     STATE_UNDEFINED,
     // The first on_i2c_slot_start() sets the state to STATE_HARDWARE_TESTING
-    // and starts the hardware test DMA transaction.
+    // and starts the hardware test transaction.
     STATE_SCHEDULER_STARTED,
-    // When the hardware test DMA transaction is completed,
-    // on_i2c_complete_isr()
-    // or on_i2c_error_isr() are called. They set the state to
-    // STATE_HARDWARE_TESTING_COMPLETED
-    // and send an IsrEvent to the task with the the hardware status.
+    // When the hardware test transaction is done, on_list_done_isr()
+    // sets the state to STATE_HARDWARE_TESTING_COMPLETED and sends an
+    // IsrEvent to the task with the the hardware status.
     STATE_HARDWARE_TESTING,
     // The task recieves the hardware status event. If the hardware doesn't
     // exists, it stays in this state forever.Otherwise it chagnes state to
     // STATE_ADC_READY.
     STATE_HARDWARE_TESTING_COMPLETED,
     // When on_i2c_slot_begin() is called, it sets the state to
-    // STATE_ADC_STEP1 and starts the
-    // first ADC DMA transaction (setting the register to read).
+    // STATE_ADC_READING and starts the ADC transaction list.
     STATE_ADC_READY,
-    // When on_i2c_complete_isr() is called, it sets the state to
-    // STATE_ADC_STEP2 and starts
-    // the second ADC DMA transaction (reading the conversion value of
-    // previous slot).
-    STATE_ADC_STEP1,
-    // When on_i2c_complete_isr() is called, it sends the conversion value to
-    // the task via
-    // and event, sets the state to STATE_ADC_STEP3, and starts the third ADC
-    // DMA transaction
-    // (starting the next conversion).
-    STATE_ADC_STEP2,
-    // When on_i2c_complete_isr() is called, it sets the state back to
-    // STATE_ADC_READY.
-    STATE_ADC_STEP3
+    // When the list is done, on_list_done_isr() sends the conversion
+    // value to the task and sets the state back to STATE_ADC_READY.
+    STATE_ADC_READING,
   };
 
   // The I2C channel.
@@ -141,25 +173,49 @@ class I2cPwDevice : public I2cDevice, public TaskBody {
   const char* _pw_chan_id;
   // The current ADC channel we process. Either 0 or 1.
   AdcChan _current_adc_channel = ADC_CHAN0;
-  uint8_t _dma_data_buffer[4] = {0};
+  // The DMA buffers of the device, in its PwDmaBuffers.
+  uint8_t (&_value_buffer)[2];
+  uint8_t (&_config_buffer)[3];
   uint32_t _prev_slot_timestamp_millis = 0;
   uint32_t _current_slot_timestamp_millis = 0;
-  StaticQueue<IsrEvent, 5> _event_queue;
+  uint32_t _prev_slot_timestamp_micros = 0;
+  uint32_t _current_slot_timestamp_micros = 0;
+  // From the I2C completion ISR to the task.
+  StaticNotifyChannel<IsrEvent, 8> _event_queue;
   State _state = STATE_UNDEFINED;
   // Set by on_scheduler_start()
-  uint16_t _data_point_internval_ms = 0;
+  uint32_t _data_point_interval_usecs = 0;
+
+  // Writes the config register. If the card does not exist, the list
+  // fails.
+  const i2c_transactions::Step _hardware_test_steps[1] = {
+      {.type = i2c_transactions::StepType::WRITE,
+       .reg = 0,
+       .data = _config_buffer,
+       .size = 3}};
+
+  // Reads the conversion register, then starts the conversion of the
+  // next channel (single shot mode) or switches the channel (continuous
+  // mode).
+  const i2c_transactions::Step _adc_steps[2] = {
+      {.type = i2c_transactions::StepType::WRITE_READ,
+       .reg = 0x00,
+       .data = _value_buffer,
+       .size = 2},
+      {.type = i2c_transactions::StepType::WRITE,
+       .reg = 0,
+       .data = _config_buffer,
+       .size = 3}};
+
+  void set_config_buffer(uint16_t config_value);
 
   // Handlers for hardware testing steps.
   void hardware_testing_start_from_timer();
   void hardware_testing_completion_from_isr(bool ok, BaseType_t* task_woken);
 
   // Handler for ADC reading.
-  void adc_step1_start_from_timer();
-  // void adc_step1_on_completion_from_isr();
-  void adc_step2_start_from_isr();
-  void adc_step2_on_completion_from_isr(BaseType_t* task_woken);
-  void adc_step3_start_from_isr();
-  // void adc_step3_on_completion_from_isr();
+  void adc_reading_start_from_timer();
+  void adc_reading_completion_from_isr(BaseType_t* task_woken);
 
   // Implemenation of TaskBody parent
   void task_body();
@@ -234,6 +290,23 @@ void I2cPwDevice::task_body() {
       continue;
     }
 
+    // Evaluate the alarm rules of the voltage (value 0) and current
+    // (value 1) before the data point is packetized.
+    if (alarms::has_rules(_pw_chan_id)) {
+      const uint32_t point_micros =
+          event0.adc_reading.timestamp_micros +
+          (event1.adc_reading.timestamp_micros -
+           event0.adc_reading.timestamp_micros) /
+              2;
+      const uint32_t interval_usecs = _data_point_interval_usecs;
+      const int32_t voltage = event0.adc_reading.value;
+      const int32_t current = event1.adc_reading.value;
+      alarms::process(_pw_chan_id, 0, &voltage, 1, point_micros,
+                      interval_usecs);
+      alarms::process(_pw_chan_id, 1, &current, 1, point_micros,
+                      interval_usecs);
+    }
+
     // If no bufer, allocate and fill in the headers. We can do it here
     // since we know the timestamp of the first data point.
     if (data_buffer == nullptr) {
@@ -244,21 +317,30 @@ void I2cPwDevice::task_body() {
 
       // Fill packet header.
       packet_data->clear();
-      packet_data->write_uint8(1);               // packet version
+      packet_data->write_uint8(2);               // packet version
       packet_data->write_uint32(session::id());  // Device session id.
-      // We use the average of the two timestamps.
-      const uint32_t start_time = (event0.adc_reading.timestamp_millis +
-                                   event1.adc_reading.timestamp_millis) /
-                                  2;
-      packet_data->write_uint32(start_time);  // Device session id.
+      // We use the average of the two timestamps. The packet has the
+      // millis and the channel time offset has the sub millis part.
+      const uint32_t start_time_micros =
+          event0.adc_reading.timestamp_micros +
+          (event1.adc_reading.timestamp_micros -
+           event0.adc_reading.timestamp_micros) /
+              2;
+      uint32_t start_time_millis;
+      uint32_t start_time_usecs;
+      time_util::split_micros(start_time_micros,
+                              event0.adc_reading.timestamp_millis,
+                              &start_time_millis, &start_time_usecs);
+      packet_data->write_uint32(start_time_millis);  // Packet base time.
 
       // Fill in the channgel header
       packet_data->write_str(_pw_chan_id);
-      packet_data->write_uint16(0);  // Time offset from packet start time.
+      packet_data->write_uint32(
+          start_time_usecs);  // Usecs offset from packet start time.
       packet_data->write_uint16(
           kDataPointsPerPacket);  // Num of data points we plan to add
-      packet_data->write_uint16(
-          _data_point_internval_ms);  // Interval between points.
+      packet_data->write_uint32(
+          _data_point_interval_usecs);  // Usecs between points.
     }
 
     // Add next data point.
@@ -275,16 +357,16 @@ void I2cPwDevice::task_body() {
       items_in_buffer = 0;
 
       // Dump the last data point, for sanity check.
-      logger.info("%s %hd, %hd", _pw_chan_id, event0.adc_reading.value,
-                  event1.adc_reading.value);
+      deferred_logger.info("%s %hd, %hd", _pw_chan_id,
+                           event0.adc_reading.value, event1.adc_reading.value);
     }
   }
 }
 
 // This is called before the first tick.
 void I2cPwDevice::on_scheduler_init(I2C_HandleTypeDef* _scheduler_hi2c,
-                                    uint16_t slot_length_ms,
-                                    uint16_t slot_internval_ms) {
+                                    uint32_t slot_length_usecs,
+                                    uint32_t slot_interval_usecs) {
   if (_scheduler_hi2c != _hi2c) {
     error_handler::Panic(141);
   }
@@ -295,11 +377,21 @@ void I2cPwDevice::on_scheduler_init(I2C_HandleTypeDef* _scheduler_hi2c,
   // Since each data point takes a slot for reading the voltage
   // and a slot to read the current, the data point rate is half
   // of that slot rate.
-  _data_point_internval_ms = 2 * slot_internval_ms;
-  logger.info("%s data point interval = %hu ms", _pw_chan_id, _data_point_internval_ms);
+  _data_point_interval_usecs = 2 * slot_interval_usecs;
+  logger.info("%s data point interval = %lu us (%s mode)", _pw_chan_id,
+              _data_point_interval_usecs,
+              pw_card::kContinuousMode ? "continuous" : "single shot");
+
+  // In the continuous mode, each channel switch should be settled by the
+  // next slot.
+  if (pw_card::kContinuousMode &&
+      slot_interval_usecs < kMinContinuousSlotIntervalUsecs) {
+    error_handler::Panic(183);
+  }
 
-  // We expect at least 2ms reserved time per slot and data rate of 10Hz.
-  if (slot_length_ms < 2 || _data_point_internval_ms > 100) {
+  // We expect data rate of at least 10Hz. The slot length is verified
+  // by the scheduler.
+  if (_data_point_interval_usecs > 100000) {
     error_handler::Panic(135);
   }
 
@@ -313,7 +405,8 @@ void I2cPwDevice::on_scheduler_init(I2C_HandleTypeDef* _scheduler_hi2c,
   _state = STATE_SCHEDULER_STARTED;
 }
 
-void I2cPwDevice::on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms) {
+void I2cPwDevice::on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms,
+                                    uint32_t slot_sys_timestamp_us) {
   // Do nothing if still initializing.
   // if (_state == STATE_UNDEFINED) {
   //   return;
@@ -323,6 +416,8 @@ void I2cPwDevice::on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms) {
   // TODO: Add a sanity check that the slot intervals are as expected.
   _prev_slot_timestamp_millis = _current_slot_timestamp_millis;
   _current_slot_timestamp_millis = slot_sys_timestamp_ms;
+  _prev_slot_timestamp_micros = _current_slot_timestamp_micros;
+  _current_slot_timestamp_micros = slot_sys_timestamp_us;
 
   switch (_state) {
     // TODO: Impelement the hardware testing sequence.
@@ -335,7 +430,7 @@ void I2cPwDevice::on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms) {
       break;
 
     case State::STATE_ADC_READY:
-      adc_step1_start_from_timer();
+      adc_reading_start_from_timer();
       break;
 
     default:
@@ -343,56 +438,34 @@ void I2cPwDevice::on_i2c_slot_begin(uint32_t slot_sys_timestamp_ms) {
   }
 }
 
-void I2cPwDevice::on_i2c_complete_isr() {
+void I2cPwDevice::on_list_done_isr(
+    const i2c_transactions::ListResult& result) {
+  BaseType_t task_woken = pdFALSE;
   switch (_state) {
-    case STATE_HARDWARE_TESTING: {
-      BaseType_t task_woken = pdFALSE;
-      // Completion ok.
-      hardware_testing_completion_from_isr(true, &task_woken);
-      // In case the queue push above requires a task switch.
-      portYIELD_FROM_ISR(task_woken)
-    } break;
-
-    case STATE_ADC_STEP1:
-      // adc_step1_on_completion_from_isr();
-      adc_step2_start_from_isr();
+    // A failure means that there is no hardware.
+    case STATE_HARDWARE_TESTING:
+      hardware_testing_completion_from_isr(result.ok, &task_woken);
       break;
 
-    case STATE_ADC_STEP2: {
-      BaseType_t task_woken = pdFALSE;
-      adc_step2_on_completion_from_isr(&task_woken);
-      // Select next channel
-      _current_adc_channel =
-          (_current_adc_channel == ADC_CHAN0) ? ADC_CHAN1 : ADC_CHAN0;
-      adc_step3_start_from_isr();
-      // In case the queue push above requires a task switch.
-      portYIELD_FROM_ISR(task_woken)
-
-    } break;
-
-    case STATE_ADC_STEP3:
-      // Cycle completed OK.
-      // adc_step3_on_completion_from_isr();
-      _state = STATE_ADC_READY;
+    case STATE_ADC_READING:
+      // Every other error is fatal.
+      if (!result.ok) {
+        error_handler::Panic(117);
+      }
+      adc_reading_completion_from_isr(&task_woken);
       break;
 
     default:
       error_handler::Panic(211);
   }
+  // In case the queue push above requires a task switch.
+  portYIELD_FROM_ISR(task_woken)
 }
 
-inline void I2cPwDevice::on_i2c_error_isr() {
-  // The hardware testing DMA transaction failed. No hardware.
-  if (_state == STATE_HARDWARE_TESTING) {
-    BaseType_t task_woken = pdFALSE;
-    // Completion with error.
-    hardware_testing_completion_from_isr(false, &task_woken);
-    // In case the queue push above requires a task switch.
-    portYIELD_FROM_ISR(task_woken) return;
-  }
-
-  // Every other error is fatal.
-  error_handler::Panic(117);
+inline void I2cPwDevice::set_config_buffer(uint16_t config_value) {
+  _config_buffer[0] = 0x01;  // config reg address
+  _config_buffer[1] = (uint8_t)(config_value >> 8);
+  _config_buffer[2] = (uint8_t)config_value;
 }
 
 // ----- HARDWARE TESTING state handlers
@@ -402,21 +475,15 @@ inline void I2cPwDevice::hardware_testing_start_from_timer() {
     error_handler::Panic(145);
   }
 
-  // We write the default value of the config register.
-  // If the card does not exist, the I2C error ISR will be
-  // triggered.
-  static_assert(sizeof(_dma_data_buffer[0]) == 1);
-  static_assert(sizeof(_dma_data_buffer) / sizeof(_dma_data_buffer[0]) >= 3);
   // Writing the default configuration value. Just to see if the device exists
   // and responds.
-  const uint16_t config_value = 0b0000010110000000;
-  _dma_data_buffer[0] = 0x01;  // config reg address
-  _dma_data_buffer[1] = (uint8_t)(config_value >> 8);
-  _dma_data_buffer[2] = (uint8_t)config_value;
+  set_config_buffer(0b0000010110000000);
   _state = State::STATE_HARDWARE_TESTING;
-  const HAL_StatusTypeDef status = HAL_I2C_Master_Transmit_DMA(
-      _hi2c, _i2c_device_address, _dma_data_buffer, 3);
-  if (status != HAL_OK) {
+  const i2c_transactions::TransactionList list = {
+      .device_address = _i2c_device_address,
+      .num_steps = 1,
+      .steps = _hardware_test_steps};
+  if (!start_list(list)) {
     // This should not fail even if the card doesn't exist since
     // nothing was sent to it yet.
     error_handler::Panic(146);
@@ -438,93 +505,66 @@ inline void I2cPwDevice::hardware_testing_completion_from_isr(
 
 // ----- ADC READING state handlers
 
-inline void I2cPwDevice::adc_step1_start_from_timer() {
+inline void I2cPwDevice::adc_reading_start_from_timer() {
   if (_state != STATE_ADC_READY) {
     error_handler::Panic(216);
   }
-  static_assert(sizeof(_dma_data_buffer[0]) == 1);
-  static_assert(sizeof(_dma_data_buffer) / sizeof(_dma_data_buffer[0]) >= 1);
-  _dma_data_buffer[0] = 0;
-  _state = STATE_ADC_STEP1;
-  HAL_StatusTypeDef status = HAL_I2C_Master_Transmit_DMA(
-      _hi2c, _i2c_device_address, _dma_data_buffer, 1);
-  if (status != HAL_OK) {
+  // The config of the next channel.
+  set_config_buffer((_current_adc_channel == ADC_CHAN0) ? kAds1115ConfigCh1
+                                                        : kAds1115ConfigCh0);
+  _value_buffer[0] = 0;
+  _value_buffer[1] = 0;
+  _state = STATE_ADC_READING;
+  const i2c_transactions::TransactionList list = {
+      .device_address = _i2c_device_address,
+      .num_steps = 2,
+      .steps = _adc_steps};
+  if (!start_list(list)) {
     error_handler::Panic(213);
   }
 }
 
-// inline void I2cPwDevice::adc_step1_on_completion_from_isr() {
-//   // Nothing to do here since it's a write.
-// }
-
-void I2cPwDevice::adc_step2_start_from_isr() {
-  if (_state != STATE_ADC_STEP1) {
-    error_handler::Panic(217);
-  }
-  // Start reading the conversion value from the selected register 0.
-  static_assert(sizeof(_dma_data_buffer[0]) == 1);
-  static_assert(sizeof(_dma_data_buffer) / sizeof(_dma_data_buffer[0]) >= 2);
-  _dma_data_buffer[0] = 0;
-  _dma_data_buffer[1] = 0;
-  _state = STATE_ADC_STEP2;
-  const HAL_StatusTypeDef status = HAL_I2C_Master_Receive_DMA(
-      _hi2c, _i2c_device_address, _dma_data_buffer, 2);
-  if (status != HAL_OK) {
-    error_handler::Panic(212);
-  }
-}
-
-inline void I2cPwDevice::adc_step2_on_completion_from_isr(
+inline void I2cPwDevice::adc_reading_completion_from_isr(
     BaseType_t* task_woken) {
-  if (_state != STATE_ADC_STEP2) {
+  if (_state != STATE_ADC_READING) {
     error_handler::Panic(218);
   }
   // Here when completed to read the conversion value from reg 0.
-  // Use the value conversion value.
   const uint16_t ads_reg_value =
-      ((uint16_t)_dma_data_buffer[0] << 8) | _dma_data_buffer[1];
-  // We use the timestamp of previous slot since this is when we
-  // started the conversion.
+      ((uint16_t)_value_buffer[0] << 8) | _value_buffer[1];
+  // In the single shot mode we use the timestamp of previous slot since
+  // this is when we started the conversion. In the continuous mode, the
+  // value is of the last conversion that completed before this slot,
+  // which on average is centered a conversion time ago.
   const IsrEvent event = {
       .type = ADC_READING,
-      {.adc_reading = {.timestamp_millis = _prev_slot_timestamp_millis,
+      {.adc_reading = {.timestamp_millis =
+                           pw_card::kContinuousMode
+                               ? _current_slot_timestamp_millis
+                               : _prev_slot_timestamp_millis,
+                       .timestamp_micros =
+                           pw_card::kContinuousMode
+                               ? _current_slot_timestamp_micros -
+                                     kConversionUsecs
+                               : _prev_slot_timestamp_micros,
                        .chan = _current_adc_channel,
                        .value = (int16_t)ads_reg_value}}};
   if (!_event_queue.add_from_isr(event, task_woken)) {
     // Comment this out for debugging with breakpoints
     error_handler::Panic(214);
   }
+  // The list already selected the next channel.
+  _current_adc_channel =
+      (_current_adc_channel == ADC_CHAN0) ? ADC_CHAN1 : ADC_CHAN0;
+  _state = STATE_ADC_READY;
 }
 
-// Start conversion of the channel whose index is in 'channel'.
-inline void I2cPwDevice::adc_step3_start_from_isr() {
-  if (_state != STATE_ADC_STEP2) {
-    error_handler::Panic(219);
-  }
-  const uint16_t config_value = (_current_adc_channel == ADC_CHAN0)
-                                    ? kAds1115ConfigStartCh0
-                                    : kAds1115ConfigStartCh1;
-  static_assert(sizeof(_dma_data_buffer[0]) == 1);
-  static_assert(sizeof(_dma_data_buffer) / sizeof(_dma_data_buffer[0]) >= 3);
-  _dma_data_buffer[0] = 0x01;  // config reg address
-  _dma_data_buffer[1] = (uint8_t)(config_value >> 8);
-  _dma_data_buffer[2] = (uint8_t)config_value;
-  _state = STATE_ADC_STEP3;
-  const HAL_StatusTypeDef status = HAL_I2C_Master_Transmit_DMA(
-      _hi2c, _i2c_device_address, _dma_data_buffer, 3);
-  if (status != HAL_OK) {
-    error_handler::Panic(215);
-  }
-}
-
-// inline void I2cPwDevice::adc_step3_on_completion_from_isr() {
-//   // Nothing to do here since it's a write.
-// }
-
 namespace pw_card {
 
 // The the device and task body as references to the base classes.
-static I2cPwDevice _i2c1_pw1_device(&hi2c1, 0x48 << 1, "pw1");
+DMA_BUFFER static PwDmaBuffers pw1_dma_buffers;
+static I2cPwDevice _i2c1_pw1_device(&hi2c1, 0x48 << 1, "pw1",
+                                    &pw1_dma_buffers);
 I2cDevice& i2c1_pw1_device = _i2c1_pw1_device;
 TaskBody& i2c1_pw1_device_task_body = _i2c1_pw1_device;
 
@@ -5,8 +5,24 @@
 #include "i2c_scheduler.h"
 #include "static_task.h"
 
+// The ADS1115 acquisition mode. In the single shot mode each slot reads
+// the conversion that was started in the previous slot and starts the
+// next one. In the continuous mode the ADC converts continuously at
+// CONFIG_PW_DATA_RATE and each slot reads the latest conversion and
+// switches the channel.
+#ifndef CONFIG_PW_CONTINUOUS_MODE
+#define CONFIG_PW_CONTINUOUS_MODE 1
+#endif
+
+// ADS1115 data rate code of the continuous mode, 0 (8 SPS) to 7 (860 SPS).
+#ifndef CONFIG_PW_DATA_RATE
+#define CONFIG_PW_DATA_RATE 7
+#endif
+
 namespace pw_card {
 
+constexpr bool kContinuousMode = CONFIG_PW_CONTINUOUS_MODE;
+
 // Power devcie "pw1".
 extern I2cDevice& i2c1_pw1_device;
 extern TaskBody& i2c1_pw1_device_task_body;
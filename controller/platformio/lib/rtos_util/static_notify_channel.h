@@ -0,0 +1,145 @@
+#pragma once
+
+#include <FreeRTOS.h>
+
+#include "common.h"
+#include "task.h"
+
+// #pragma GCC push_options
+// #pragma GCC optimize("O0")
+
+// A lightweight alternative to StaticQueue for events from an ISR to a
+// single task. The items are passed in a lock free ring with a single
+// producer (the ISR) and a single consumer (the task), and the task is
+// woken with a direct to task notification. Unlike a queue, no critical
+// section is entered on either side, and the ISR copies the item
+// directly into the ring.
+//
+// The consumer is the task that last waited on the channel, so the
+// channel should be consumed by one task at a time. The notification
+// value is treated as a hint only since other users of the task
+// notification (e.g. stream buffers) may consume or add to it. The ring
+// is always checked before blocking, so no item is missed.
+//
+// The capacity is N rounded up to a power of 2, so the free running
+// counts can wrap around.
+template <typename T, uint16_t N>
+class StaticNotifyChannel {
+ private:
+  static constexpr uint16_t round_up_to_power_of_2(uint16_t n) {
+    uint16_t result = 1;
+    while (result < n) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+ public:
+  static_assert(N > 0 && N <= 0x8000);
+
+  StaticNotifyChannel() {}
+
+  // Prevent copy and assignment.
+  StaticNotifyChannel(const StaticNotifyChannel& other) = delete;
+  StaticNotifyChannel& operator=(const StaticNotifyChannel& other) = delete;
+
+  // The capacity of this channel.
+  static constexpr uint16_t capacity = round_up_to_power_of_2(N);
+
+  // Drops the pending items. Call from the consumer task only, while the
+  // producer is known to be idle.
+  inline void reset() { _read_count = _write_count; }
+
+  // The current number of items in the channel.
+  inline uint32_t size() const { return _write_count - _read_count; }
+
+  // Caller must call portYIELD_FROM_ISR(task_woken) at the very end of
+  // the ISR. Returns false if the channel is full.
+  inline bool add_from_isr(const T& item, BaseType_t* task_woken) {
+    const uint32_t write_count = _write_count;
+    if (write_count - _read_count >= capacity) {
+      return false;
+    }
+    _items[write_count & (capacity - 1)] = item;
+    // The item should be visible before its count.
+    __DMB();
+    _write_count = write_count + 1;
+    TaskHandle_t const task_handle = _consumer_handle;
+    if (task_handle) {
+      vTaskNotifyGiveFromISR(task_handle, task_woken);
+    }
+    return true;
+  }
+
+  // Wakes up the consumer task without an item, e.g. to tell it about a
+  // request in another queue. Can be called from any task.
+  inline void wake_up_from_task() {
+    TaskHandle_t const task_handle = _consumer_handle;
+    if (task_handle) {
+      xTaskNotifyGive(task_handle);
+    }
+  }
+
+  // Non blocking. Returns false if there are no pending items. Call from
+  // the consumer task only.
+  inline bool try_consume(T* item_buffer) {
+    const uint32_t read_count = _read_count;
+    if (_write_count == read_count) {
+      return false;
+    }
+    // The count should be read before the item.
+    __DMB();
+    *item_buffer = _items[read_count & (capacity - 1)];
+    // We are done with the item before the ISR can reuse it.
+    __DMB();
+    _read_count = read_count + 1;
+    return true;
+  }
+
+  // Waits until the channel is notified, by an item or by
+  // wake_up_from_task(). Returns false on timeout. Use portMAX_DELAY to
+  // indicate waiting forever. May return true spuriously, so callers
+  // should check their conditions again.
+  inline bool wait_from_task(uint32_t timeout_millis) {
+    static_assert(configTICK_RATE_HZ == 1000);
+    _consumer_handle = xTaskGetCurrentTaskHandle();
+    return ulTaskNotifyTake(pdTRUE, timeout_millis) != 0;
+  }
+
+  // Use portMAX_DELAY to indicate waiting forever. Use 0 to indicate no
+  // blocking and immediate failure if no item.
+  inline bool consume_from_task(T* item_buffer, uint32_t timeout_millis) {
+    static_assert(configTICK_RATE_HZ == 1000);
+    // Set before checking the ring, so an item that is added after the
+    // check notifies us.
+    _consumer_handle = xTaskGetCurrentTaskHandle();
+    if (try_consume(item_buffer)) {
+      return true;
+    }
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    TickType_t ticks_to_wait = timeout_millis;
+    for (;;) {
+      if (xTaskCheckForTimeOut(&timeout, &ticks_to_wait) != pdFALSE) {
+        // Timeout, one last check.
+        return try_consume(item_buffer);
+      }
+      // Notifications of items that we already consumed may wake us
+      // up with an empty ring, in which case we wait again.
+      ulTaskNotifyTake(pdTRUE, ticks_to_wait);
+      if (try_consume(item_buffer)) {
+        return true;
+      }
+    }
+  }
+
+ private:
+  T _items[capacity];
+  // Free running counts. Written by the producer and by the consumer,
+  // respectively.
+  volatile uint32_t _write_count = 0;
+  volatile uint32_t _read_count = 0;
+  TaskHandle_t volatile _consumer_handle = nullptr;
+};
+
+// #pragma GCC pop_options
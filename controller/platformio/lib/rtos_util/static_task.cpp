@@ -0,0 +1,43 @@
+#include "static_task.h"
+
+StaticTaskBase* StaticTaskBase::_first = nullptr;
+
+bool StaticTaskBase::start() {
+  if (_handle != nullptr) {
+    return false;
+  }
+
+  // Passing this StaticTask object as the private parameter to allow
+  // dispatching to the runable.
+  _handle =
+      xTaskCreateStatic(task_body_dispatcher, _name, _stack_size_in_stack_type,
+                        this, _priority, _stack, &_tcb);
+  if (_handle == nullptr) {
+    return false;
+  }
+  logger.info("Task %s started successfully", _name);
+  return true;
+}
+
+void StaticTaskBase::dump_stacks() {
+  for (StaticTaskBase* task = _first; task; task = task->_next) {
+    if (!task->_handle) {
+      continue;
+    }
+    const uint32_t size = task->stack_size_bytes();
+    const uint32_t unused = task->unused_stack_bytes();
+    if (unused < kMinUnusedStackBytes) {
+      logger.warning("Stack %-12s: %4lu of %4lu bytes used, low margin.",
+                     task->_name, size - unused, size);
+    } else {
+      logger.info("Stack %-12s: %4lu of %4lu bytes used.", task->_name,
+                  size - unused, size);
+    }
+  }
+}
+
+void StaticTaskBase::task_body_dispatcher(void* pvParameters) {
+  StaticTaskBase* const static_task = (StaticTaskBase*)pvParameters;
+  // Not expected to return.
+  (static_task->_task_body).task_body();
+}
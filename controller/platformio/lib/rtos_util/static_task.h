@@ -29,68 +29,93 @@ class TaskBodyFunction : public TaskBody {
   void* const _pvParameters;
 };
 
-// Static tasks with given stack size is bytes.
-class StaticTask {
+// The part of StaticTask that doesn't depend on the stack size. All the
+// static tasks are linked in a list, for the stack reports.
+class StaticTaskBase {
  public:
-
-  StaticTask(TaskBody& task_body, const char* const name, UBaseType_t priority)
-      : _task_body(task_body), _name(name), _priority(priority) {}
-
-  ~StaticTask() {
+  ~StaticTaskBase() {
     // Static tasks should not be finalized.
     error_handler::Panic(85);
   }
 
   // Prevent copy and assignment.
-  StaticTask(const StaticTask& other) = delete;
-  StaticTask& operator=(const StaticTask& other) = delete;
+  StaticTaskBase(const StaticTaskBase& other) = delete;
+  StaticTaskBase& operator=(const StaticTaskBase& other) = delete;
 
-bool start() {
-  if (_handle != nullptr) {
-    return false;
-  }
-
-  // Passing this StaticTask object as the private parameter to allow
-  // dispatching to the runable.
-  _handle = xTaskCreateStatic(task_body_dispatcher, _name,
-                              sizeof(_stack) / sizeof(_stack[0]), this,
-                              _priority, _stack, &_tcb);
-  if (_handle == nullptr) {
-    return false;
-  }
-  logger.info("Task %s started successfully", _name);
-  return true;
-}
+  bool start();
 
   inline TaskHandle_t handle() { return _handle; }
+  inline const char* name() const { return _name; }
+  inline uint32_t stack_size_bytes() const {
+    return sizeof(StackType_t) * _stack_size_in_stack_type;
+  }
 
+  // The high water mark of the stack. Zero if not started.
   uint32_t unused_stack_bytes() {
     return (_handle == nullptr)
                ? 0
                : sizeof(StackType_t) * uxTaskGetStackHighWaterMark(_handle);
   }
 
+  // For iterating the static tasks, in reverse order of construction.
+  static inline StaticTaskBase* first() { return _first; }
+  inline StaticTaskBase* next() const { return _next; }
+
+  // Logs the stack usage of the started tasks.
+  static void dump_stacks();
+
+ protected:
+  StaticTaskBase(TaskBody& task_body, const char* const name,
+                 UBaseType_t priority, StackType_t* stack,
+                 uint32_t stack_size_in_stack_type)
+      : _task_body(task_body),
+        _name(name),
+        _priority(priority),
+        _stack(stack),
+        _stack_size_in_stack_type(stack_size_in_stack_type),
+        _next(_first) {
+    // The static tasks are constructed before the scheduler starts.
+    _first = this;
+  }
 
  private:
-  // We use the same stack size for all tasks.
-  static constexpr uint32_t kStackSizeInBytes = 2000;
-  static constexpr uint32_t kStackSizeInStackType = kStackSizeInBytes / sizeof(StackType_t);
+  // Static tasks with less unused stack than this are reported as
+  // warnings.
+  static constexpr uint32_t kMinUnusedStackBytes = 200;
 
+  static StaticTaskBase* _first;
 
-  TaskBody&  _task_body;
+  TaskBody& _task_body;
   const char* const _name;
   const UBaseType_t _priority;
+  StackType_t* const _stack;
+  const uint32_t _stack_size_in_stack_type;
+  StaticTaskBase* const _next;
 
   TaskHandle_t _handle = nullptr;
   StaticTask_t _tcb;
-  StackType_t _stack[kStackSizeInStackType];
 
   // A shared FreeRTOS task body that dispatches to the TaskBody.
-  static void task_body_dispatcher(void* pvParameters) {
-    StaticTask* const static_task = (StaticTask*)pvParameters;
-    // Not expected to return.
-    (static_task->_task_body).task_body();
-  }
+  static void task_body_dispatcher(void* pvParameters);
+};
+
+// Static tasks with given stack size is bytes. The sizes are set per
+// task from the high water marks of dump_stacks() and the estimates of
+// tools/stack_usage.py.
+template <uint32_t kStackSizeInBytes>
+class StaticTask : public StaticTaskBase {
+ public:
+  StaticTask(TaskBody& task_body, const char* const name, UBaseType_t priority)
+      : StaticTaskBase(task_body, name, priority, _stack,
+                       kStackSizeInStackType) {}
+
+ private:
+  static constexpr uint32_t kStackSizeInStackType =
+      kStackSizeInBytes / sizeof(StackType_t);
+  // Room for the context, a few frames and a logger call.
+  static_assert(kStackSizeInBytes >= 800);
+
+  StackType_t _stack[kStackSizeInStackType];
 };
 
 // #pragma GCC pop_options
@@ -0,0 +1,46 @@
+#include "time_util.h"
+
+#include "error_handler.h"
+
+namespace time_util {
+
+namespace internal {
+uint32_t micros_offset = 0;
+}  // namespace internal
+
+// TIM2 is clocked by the 120Mhz APB1 timers clock.
+static constexpr uint32_t kTim2ClockHz = 120000000;
+
+void setup() {
+  // Start TIM2 as a free running 1Mhz up counter.
+  __HAL_RCC_TIM2_CLK_ENABLE();
+  TIM2->CR1 = 0;
+  TIM2->PSC = (kTim2ClockHz / 1000000) - 1;
+  TIM2->ARR = 0xffffffff;
+  TIM2->CNT = 0;
+  // Load the prescaler.
+  TIM2->EGR = TIM_EGR_UG;
+  TIM2->CR1 = TIM_CR1_CEN;
+
+  // Align with the FreeRTOS ticks. The SysTick counts down the core
+  // clock cycles of the current tick. We retry if the tick was pending
+  // since its count may not match the SysTick.
+  const uint32_t cycles_per_usec = SystemCoreClock / 1000000;
+  for (int i = 0; i < 10; i++) {
+    __disable_irq();
+    const uint32_t tick = xTaskGetTickCount();
+    const uint32_t systick_val = SysTick->VAL;
+    const uint32_t tim2_count = TIM2->CNT;
+    const bool tick_pending = SCB->ICSR & SCB_ICSR_PENDSTSET_Msk;
+    __enable_irq();
+    if (!tick_pending) {
+      const uint32_t usecs_in_tick =
+          (SysTick->LOAD - systick_val) / cycles_per_usec;
+      internal::micros_offset = tick * 1000 + usecs_in_tick - tim2_count;
+      return;
+    }
+  }
+  error_handler::Panic(167);
+}
+
+}  // namespace time_util
@@ -25,6 +25,37 @@ inline void delay_millis(uint32_t millis) {
   vTaskDelay(millis);
 }
 
+namespace internal {
+// Maps TIM2 counts to micros(). Set by setup().
+extern uint32_t micros_offset;
+}  // namespace internal
+
+// Starts the usecs time base. TIM2 is a 32 bits timer that runs
+// freely at 1Mhz. Should be called once from a task, before using
+// micros().
+void setup();
+
+// A free running usecs counter. Wraps around every ~71 minutes. It's
+// aligned with the millis() ticks such that, mod 2^32,
+// micros() = millis() * 1000 + usecs since the tick. Call from tasks
+// and ISRs.
+inline uint32_t micros() { return TIM2->CNT + internal::micros_offset; }
+
+// Splits a micros() timestamp to the millis() value at that time and
+// the usecs since that millis tick. ref_millis is a millis() value
+// within ~35 minutes of the timestamp that resolves the wrap around of
+// the usecs counter.
+inline void split_micros(uint32_t t_micros, uint32_t ref_millis,
+                         uint32_t* millis, uint32_t* usecs_in_millis) {
+  const int32_t delta_usecs = (int32_t)(t_micros - ref_millis * 1000);
+  // Floor division, for timestamps before the ref millis.
+  const int32_t delta_millis = (delta_usecs >= 0)
+                                   ? delta_usecs / 1000
+                                   : -((999 - delta_usecs) / 1000);
+  *millis = ref_millis + delta_millis;
+  *usecs_in_millis = delta_usecs - delta_millis * 1000;
+}
+
 }  // namespace time_util
 
 class Elappsed {
@@ -79,7 +79,13 @@ void SerialPacketsClient::rx_process_decoded_command_packet(
     const DecodedCommandMetadata& metadata, const SerialPacketsData& data) {
   // This accesses rx task only vars so no need to use _prot_mutex.
   _rx_task_data.tmp_data.clear();
-  const uint8_t status = _command_handler(metadata.endpoint, data, _rx_task_data.tmp_data);
+  const PacketStatus status = _command_handler(
+      metadata.endpoint, metadata.cmd_id, data, _rx_task_data.tmp_data);
+
+  // The handler will send the response later using sendResponse().
+  if (status == PacketStatus::PENDING) {
+    return;
+  }
 
   // Send response
   {
@@ -228,6 +234,40 @@ PacketStatus SerialPacketsClient::sendCommand(uint8_t endpoint,
   }
 }
 
+PacketStatus SerialPacketsClient::sendResponse(uint32_t cmd_id,
+                                               PacketStatus status,
+                                               const SerialPacketsData& data) {
+  if (!begun()) {
+    logger.error("Client's begin() was not called");
+    return PacketStatus::INVALID_STATE;
+  }
+
+  if (!cmd_id || status == PacketStatus::PENDING) {
+    logger.error("Invalid deferred response, cmd_id=%08lx, status=%d", cmd_id,
+                 status);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  {
+    MutexScope mutex_scope(_prot_mutex);
+
+    // Encode the packet in wire format.
+    if (!_prot.packet_encoder.encode_response_packet(
+            cmd_id, status, data, &_prot.tmp_stuffed_packet)) {
+      logger.error("Failed to encode response packet, data_size=%hu",
+                   data.size());
+      return PacketStatus::GENERAL_ERROR;
+    }
+
+    // Blocking.
+    _serial->write(_prot.tmp_stuffed_packet._buffer,
+                   _prot.tmp_stuffed_packet.size());
+  }
+
+  logger.verbose("Sent deferred response, cmd_id = %08lx", cmd_id);
+  return PacketStatus::OK;
+}
+
 PacketStatus SerialPacketsClient::sendMessage(uint8_t endpoint,
                                               const SerialPacketsData& data) {
   if (!begun()) {
@@ -24,9 +24,12 @@ constexpr uint16_t DEFAULT_CMD_TIMEOUT_MILLIS = 1000;
 
 // A callback type for all incoming commands. Handler should
 // set response_status and response_data with the response
-// info.
+// info. Alternatively, slow handlers can return PENDING and
+// later send the response using sendResponse() with the given
+// cmd_id, allowing the rx task to continue processing incoming
+// packets in the meantime.
 typedef PacketStatus (*SerialPacketsIncomingCommandHandler)(
-    uint8_t endpoint, const SerialPacketsData& command_data,
+    uint8_t endpoint, uint32_t cmd_id, const SerialPacketsData& command_data,
     SerialPacketsData& response_data);
 
 // A callback type for incoming messages.
@@ -62,6 +65,12 @@ class SerialPacketsClient {
   // this, use a command instead.
   PacketStatus sendMessage(uint8_t endpoint, const SerialPacketsData& data);
 
+  // Send the response of an incoming command whose handler returned
+  // PENDING. Can be called from any task. cmd_id is the value that
+  // was passed to the command handler.
+  PacketStatus sendResponse(uint32_t cmd_id, PacketStatus status,
+                            const SerialPacketsData& data);
+
   // Returns the number of in progress commands that wait for a
   // response or to timeout. The max number of allowed pending
   // messages is configurable.
@@ -35,6 +35,10 @@ enum PacketStatus {
   INVALID_STATE = 8,
   TOO_MANY_COMMANDS = 9,
 
+  // Returned by a command handler to indicate that the response will
+  // be sent later using sendResponse(). Never sent over the wire.
+  PENDING = 10,
+
   // Reserved for application codes from here to 255.
   USER_ERRORS_BASE = 100,
 };
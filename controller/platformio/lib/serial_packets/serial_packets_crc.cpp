@@ -1,4 +1,6 @@
 #include "serial_packets_crc.h"
+
+#include "tcm.h"
 // #include "gpio_pins.h"
 
 // From
@@ -11,7 +13,8 @@
 
 // namespace serial_packets {
 
-static const uint16_t CRC_CCITT_TABLE[256] = {
+// In the DTCM, for the per byte lookups.
+DTCM_CONST static const uint16_t CRC_CCITT_TABLE[256] = {
     0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7, 0x8108,
     0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF, 0x1231, 0x0210,
     0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6, 0x9339, 0x8318, 0xB37B,
@@ -42,8 +45,8 @@ static const uint16_t CRC_CCITT_TABLE[256] = {
     0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8, 0x6E17, 0x7E36, 0x4E55, 0x5E74,
     0x2E93, 0x3EB2, 0x0ED1, 0x1EF0};
 
-uint16_t serial_packets_gen_crc16(const uint8_t* buffer, int size,
-                                  uint16_t initial_crc) {
+ITCM_CODE uint16_t serial_packets_gen_crc16(const uint8_t* buffer, int size,
+                                            uint16_t initial_crc) {
   uint16_t tmp;
   uint16_t crc = initial_crc;
   for (int i = 0; i < size; i++) {
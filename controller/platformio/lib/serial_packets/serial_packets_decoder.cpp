@@ -4,6 +4,7 @@
 #include "logger.h"
 #include "serial_packets_consts.h"
 #include "serial_packets_crc.h"
+#include "tcm.h"
 
 using serial_packets_consts::MAX_PACKET_LEN;
 using serial_packets_consts::MIN_PACKET_LEN;
@@ -16,7 +17,7 @@ using serial_packets_consts::TYPE_MESSAGE;
 using serial_packets_consts::TYPE_LOG;
 
 
-bool SerialPacketsDecoder::decode_next_byte(uint8_t b) {
+ITCM_CODE bool SerialPacketsDecoder::decode_next_byte(uint8_t b) {
   // When not in packet, wait for next  flag byte.
   if (!_in_packet) {
     if (b == PACKET_START_FLAG) {
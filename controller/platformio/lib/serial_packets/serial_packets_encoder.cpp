@@ -1,6 +1,7 @@
 #include "serial_packets_encoder.h"
 
 #include "serial_packets_consts.h"
+#include "tcm.h"
 
 using serial_packets_consts::PACKET_END_FLAG;
 using serial_packets_consts::PACKET_ESC;
@@ -10,8 +11,8 @@ using serial_packets_consts::TYPE_LOG;
 using serial_packets_consts::TYPE_MESSAGE;
 using serial_packets_consts::TYPE_RESPONSE;
 
-bool SerialPacketsEncoder::byte_stuffing(const EncodedPacketBuffer& in,
-                                         StuffedPacketBuffer* out) {
+ITCM_CODE bool SerialPacketsEncoder::byte_stuffing(
+    const EncodedPacketBuffer& in, StuffedPacketBuffer* out) {
   out->clear();
   const uint16_t capacity = out->capacity();
   uint16_t j = 0;
@@ -0,0 +1,328 @@
+#include "serial_packets_fragments.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "serial_packets_crc.h"
+#include "time_util.h"
+
+using serial_packets_fragments::kFastRetransmitDupAcks;
+using serial_packets_fragments::kFormatVersion;
+using serial_packets_fragments::kMaxFragmentDataLen;
+using serial_packets_fragments::kMaxWindowSize;
+
+PacketStatus SerialPacketsFragmentSender::send(
+    uint8_t endpoint, uint32_t transfer_id, uint32_t total_len,
+    DataSource source, void* context, uint8_t window_size,
+    uint16_t ack_timeout_millis, uint8_t max_retries) {
+  if (!transfer_id || !source || !window_size ||
+      window_size > kMaxWindowSize) {
+    logger.error("Invalid fragmented transfer args, id=%08lx, window=%hu",
+                 transfer_id, window_size);
+    return PacketStatus::INVALID_ARGUMENT;
+  }
+
+  {
+    MutexScope mutex_scope(_mutex);
+    _transfer_id = transfer_id;
+    _acked_offset = 0;
+    _num_acks = 0;
+    _dup_acks = 0;
+    _aborted = false;
+  }
+  // Clear a left over signal from a previous transfer.
+  _ack_semaphore.take(0);
+
+  // The offset of the next fragment to send.
+  uint32_t next_offset = 0;
+  // An empty transfer still has a single, empty, fragment.
+  bool sent_empty_fragment = false;
+  uint32_t last_acked_offset = 0;
+  uint32_t last_num_acks = 0;
+  uint8_t retries = 0;
+  // The offset of the last fast retransmit. A loss is fast retransmitted
+  // once, if the resent fragment is lost too it's resent on timeout.
+  bool has_fast_retransmit = false;
+  uint32_t fast_retransmit_offset = 0;
+  Elappsed ack_timer;
+
+  PacketStatus result = PacketStatus::OK;
+  for (;;) {
+    uint32_t acked_offset;
+    uint32_t num_acks;
+    uint32_t dup_acks;
+    bool aborted;
+    {
+      MutexScope mutex_scope(_mutex);
+      acked_offset = _acked_offset;
+      num_acks = _num_acks;
+      dup_acks = _dup_acks;
+      aborted = _aborted;
+    }
+
+    if (aborted) {
+      logger.warning("Fragmented transfer %08lx aborted by receiver.",
+                     transfer_id);
+      result = PacketStatus::GENERAL_ERROR;
+      break;
+    }
+
+    if (num_acks && acked_offset >= total_len) {
+      break;
+    }
+
+    // Progress resets the timeout.
+    if (num_acks != last_num_acks) {
+      if (acked_offset != last_acked_offset) {
+        retries = 0;
+      }
+      last_num_acks = num_acks;
+      last_acked_offset = acked_offset;
+      ack_timer.reset();
+    }
+
+    // Fast retransmit. Duplicate acks while fragments are in flight mean
+    // that the fragment at the acked offset was lost and the receiver
+    // drops the ones after it. Go back to it without waiting for the
+    // timeout.
+    if (dup_acks >= kFastRetransmitDupAcks && next_offset > acked_offset &&
+        (!has_fast_retransmit || fast_retransmit_offset != acked_offset)) {
+      logger.warning("Fragmented transfer %08lx, fast resend from %lu.",
+                     transfer_id, acked_offset);
+      has_fast_retransmit = true;
+      fast_retransmit_offset = acked_offset;
+      next_offset = acked_offset;
+      sent_empty_fragment = false;
+      ack_timer.reset();
+    }
+
+    // Timeout. Go back to the last acked offset.
+    if (ack_timer.elapsed_millis() >= ack_timeout_millis) {
+      if (++retries > max_retries) {
+        logger.error("Fragmented transfer %08lx timeout at offset %lu.",
+                     transfer_id, acked_offset);
+        result = PacketStatus::TIMEOUT;
+        break;
+      }
+      logger.warning("Fragmented transfer %08lx, resending from %lu.",
+                     transfer_id, acked_offset);
+      next_offset = acked_offset;
+      sent_empty_fragment = false;
+      ack_timer.reset();
+    }
+
+    // Send the next fragment if the window allows.
+    const uint32_t window_end =
+        acked_offset + (uint32_t)window_size * kMaxFragmentDataLen;
+    const bool has_more =
+        next_offset < total_len || (total_len == 0 && !sent_empty_fragment);
+    if (has_more && next_offset < window_end) {
+      const uint16_t n =
+          std::min((uint32_t)kMaxFragmentDataLen, total_len - next_offset);
+      if (n && !source(context, next_offset, _fragment_bytes, n)) {
+        logger.error("Fragmented transfer %08lx, source failed at %lu.",
+                     transfer_id, next_offset);
+        result = PacketStatus::GENERAL_ERROR;
+        break;
+      }
+      _packet_data.clear();
+      _packet_data.write_uint8(kFormatVersion);
+      _packet_data.write_uint32(transfer_id);
+      _packet_data.write_uint32(total_len);
+      _packet_data.write_uint32(next_offset);
+      _packet_data.write_uint16(
+          serial_packets_gen_crc16(_fragment_bytes, n));
+      _packet_data.write_bytes(_fragment_bytes, n);
+      if (_packet_data.had_write_errors()) {
+        // Should not happen since we limit the fragment size.
+        error_handler::Panic(159);
+      }
+      const PacketStatus status = _client.sendMessage(endpoint, _packet_data);
+      if (status != PacketStatus::OK) {
+        result = status;
+        break;
+      }
+      next_offset += n;
+      sent_empty_fragment = true;
+      continue;
+    }
+
+    // Window is full or all sent. Wait for an ack, timeout or wake().
+    if (_wait_handler) {
+      _wait_handler(_wait_handler_context);
+    }
+    const uint32_t elapsed = ack_timer.elapsed_millis();
+    _ack_semaphore.take(elapsed < ack_timeout_millis
+                            ? ack_timeout_millis - elapsed
+                            : 0);
+  }
+
+  {
+    MutexScope mutex_scope(_mutex);
+    _transfer_id = 0;
+  }
+  return result;
+}
+
+void SerialPacketsFragmentSender::on_ack_message(
+    const SerialPacketsData& data) {
+  data.reset_reading();
+  const uint8_t version = data.read_uint8();
+  const uint32_t transfer_id = data.read_uint32();
+  const uint32_t next_offset = data.read_uint32();
+  const uint8_t status = data.read_uint8();
+  if (!data.all_read_ok() || version != kFormatVersion) {
+    logger.error("Invalid fragment ack message (version %hu).", version);
+    return;
+  }
+
+  {
+    MutexScope mutex_scope(_mutex);
+    if (!_transfer_id || transfer_id != _transfer_id) {
+      // A late ack of a previous transfer.
+      return;
+    }
+    _num_acks++;
+    // Acks are cumulative, ignore stale ones.
+    if (next_offset > _acked_offset) {
+      _acked_offset = next_offset;
+      _dup_acks = 0;
+    } else if (next_offset == _acked_offset) {
+      _dup_acks++;
+    }
+    if (status) {
+      _aborted = true;
+    }
+  }
+  _ack_semaphore.give();
+}
+
+void SerialPacketsFragmentReceiver::begin(uint32_t transfer_id,
+                                          uint8_t ack_endpoint,
+                                          uint8_t* buffer,
+                                          uint32_t buffer_size) {
+  MutexScope mutex_scope(_mutex);
+  _transfer_id = transfer_id;
+  _ack_endpoint = ack_endpoint;
+  _buffer = buffer;
+  _buffer_size = buffer_size;
+  _sink = nullptr;
+  _context = nullptr;
+  _has_total_len = false;
+  _total_len = 0;
+  _next_offset = 0;
+  _aborted = false;
+}
+
+void SerialPacketsFragmentReceiver::begin(uint32_t transfer_id,
+                                          uint8_t ack_endpoint, DataSink sink,
+                                          void* context) {
+  MutexScope mutex_scope(_mutex);
+  _transfer_id = transfer_id;
+  _ack_endpoint = ack_endpoint;
+  _buffer = nullptr;
+  _buffer_size = 0;
+  _sink = sink;
+  _context = context;
+  _has_total_len = false;
+  _total_len = 0;
+  _next_offset = 0;
+  _aborted = false;
+}
+
+void SerialPacketsFragmentReceiver::on_fragment_message(
+    const SerialPacketsData& data) {
+  data.reset_reading();
+  const uint8_t version = data.read_uint8();
+  const uint32_t transfer_id = data.read_uint32();
+  const uint32_t total_len = data.read_uint32();
+  const uint32_t offset = data.read_uint32();
+  const uint16_t crc = data.read_uint16();
+  const uint16_t n = data.unread_bytes();
+  if (data.had_read_errors() || version != kFormatVersion) {
+    logger.error("Invalid fragment message (version %hu).", version);
+    return;
+  }
+
+  MutexScope mutex_scope(_mutex);
+
+  if (!_transfer_id || transfer_id != _transfer_id) {
+    logger.warning("Ignoring fragment of unexpected transfer %08lx.",
+                   transfer_id);
+    return;
+  }
+
+  // Already aborted. Remind the sender.
+  if (_aborted) {
+    send_ack();
+    return;
+  }
+
+  if (!_has_total_len) {
+    _has_total_len = true;
+    _total_len = total_len;
+    if (_buffer && total_len > _buffer_size) {
+      logger.error("Fragmented transfer too long (%lu > %lu).", total_len,
+                   _buffer_size);
+      _aborted = true;
+      send_ack();
+      return;
+    }
+  }
+
+  // Not the one we expect. A duplicate or a fragment after a lost one.
+  // In both cases, the ack tells the sender where we are.
+  if (total_len != _total_len || offset != _next_offset ||
+      offset + n > _total_len) {
+    send_ack();
+    return;
+  }
+
+  // Check the data before it's accepted. The reassembly buffer is
+  // written only with verified data.
+  data.read_bytes(_fragment_bytes, n);
+  if (serial_packets_gen_crc16(_fragment_bytes, n) != crc) {
+    logger.warning("Fragmented transfer %08lx, bad CRC at %lu.", transfer_id,
+                   offset);
+    send_ack();
+    return;
+  }
+
+  if (_buffer) {
+    memcpy(&_buffer[offset], _fragment_bytes, n);
+  } else if (!_sink(_context, offset, _fragment_bytes, n)) {
+    logger.error("Fragmented transfer %08lx, sink failed at %lu.",
+                 transfer_id, offset);
+    _aborted = true;
+    send_ack();
+    return;
+  }
+  _next_offset += n;
+  send_ack();
+}
+
+// Called with the mutex held.
+void SerialPacketsFragmentReceiver::send_ack() {
+  _ack_data.clear();
+  _ack_data.write_uint8(kFormatVersion);
+  _ack_data.write_uint32(_transfer_id);
+  _ack_data.write_uint32(_next_offset);
+  _ack_data.write_uint8(_aborted ? 1 : 0);
+  _client.sendMessage(_ack_endpoint, _ack_data);
+}
+
+bool SerialPacketsFragmentReceiver::is_done() {
+  MutexScope mutex_scope(_mutex);
+  return _transfer_id && _has_total_len && !_aborted &&
+         _next_offset >= _total_len;
+}
+
+bool SerialPacketsFragmentReceiver::is_aborted() {
+  MutexScope mutex_scope(_mutex);
+  return _aborted;
+}
+
+uint32_t SerialPacketsFragmentReceiver::received_bytes() {
+  MutexScope mutex_scope(_mutex);
+  return _next_offset;
+}
@@ -0,0 +1,194 @@
+// Fragmented transfers of payloads that are larger than a single
+// packet, on top of SerialPacketsClient messages.
+//
+// A transfer is a sequence of fragment messages from the sender to
+// the data endpoint of the receiver. The receiver acknowledges with
+// ack messages to the ack endpoint of the sender. Up to a window of
+// fragments may be in flight without an ack. Acks are cumulative and
+// the receiver acks each fragment it gets. The sender resends from the
+// last acked offset (go back N) when it gets kFastRetransmitDupAcks
+// duplicate acks, or, as a fallback, on ack timeout.
+//
+// Fragment message:
+//   uint8   format version (2)
+//   uint32  transfer id
+//   uint32  total transfer length in bytes
+//   uint32  fragment offset
+//   uint16  CRC16 of the fragment data
+//   bytes   fragment data (rest of the message)
+//
+// The receiver drops a fragment whose data doesn't match its CRC, same
+// as a lost fragment.
+//
+// Ack message:
+//   uint8   format version (2)
+//   uint32  transfer id
+//   uint32  next expected offset (all the bytes before it were received)
+//   uint8   status. Zero = OK, else the receiver aborted the transfer.
+
+#pragma once
+
+#include <inttypes.h>
+
+#include "serial_packets_client.h"
+#include "static_binary_semaphore.h"
+#include "static_mutex.h"
+
+namespace serial_packets_fragments {
+
+constexpr uint8_t kFormatVersion = 2;
+
+// Size of the fragment message fields before the fragment data.
+constexpr uint16_t kFragmentHeaderLen = 1 + 4 + 4 + 4 + 2;
+
+// Max number of data bytes in a single fragment.
+constexpr uint16_t kMaxFragmentDataLen =
+    MAX_PACKET_DATA_LEN - kFragmentHeaderLen;
+
+// Max number of fragments in flight, waiting for acks.
+constexpr uint8_t kMaxWindowSize = 8;
+
+// Number of duplicate acks that trigger a fast retransmit. The link
+// doesn't reorder packets, so a duplicate ack means that a fragment was
+// lost or dropped by the receiver.
+constexpr uint8_t kFastRetransmitDupAcks = 2;
+
+}  // namespace serial_packets_fragments
+
+// Sends a transfer and waits for its acks. Can be used by a single
+// task at a time.
+class SerialPacketsFragmentSender {
+ public:
+  // A callback that provides the transfer data. Should fill buffer with
+  // size bytes starting at offset. May be called more than once for the
+  // same offset if fragments are resent. Returns true iff ok.
+  typedef bool (*DataSource)(void* context, uint32_t offset, uint8_t* buffer,
+                             uint16_t size);
+
+  // A callback that is called by the sending task while it waits for
+  // acks. Allows the task to serve other requests during a long
+  // transfer.
+  typedef void (*WaitHandler)(void* context);
+
+  SerialPacketsFragmentSender(SerialPacketsClient& client) : _client(client) {}
+
+  // Prevent copy and assignment.
+  SerialPacketsFragmentSender(const SerialPacketsFragmentSender& other) =
+      delete;
+  SerialPacketsFragmentSender& operator=(
+      const SerialPacketsFragmentSender& other) = delete;
+
+  // Blocking. Sends total_len bytes from source to the given endpoint
+  // and returns when all were acked, the receiver aborted, or the
+  // max number of consecutive ack timeouts was reached.
+  PacketStatus send(uint8_t endpoint, uint32_t transfer_id, uint32_t total_len,
+                    DataSource source, void* context,
+                    uint8_t window_size = serial_packets_fragments::kMaxWindowSize,
+                    uint16_t ack_timeout_millis = 500, uint8_t max_retries = 5);
+
+  // Should be called by the message handler of the client with
+  // the messages that arrive to the ack endpoint.
+  void on_ack_message(const SerialPacketsData& data);
+
+  // Sets the wait handler of the next transfers. Null to clear. Should
+  // be called by the sending task, not during a transfer.
+  void set_wait_handler(WaitHandler handler, void* context) {
+    _wait_handler = handler;
+    _wait_handler_context = context;
+  }
+
+  // Wakes up the sending task, if it waits for acks, so it calls the
+  // wait handler. Can be called by any task.
+  void wake() { _ack_semaphore.give(); }
+
+ private:
+  SerialPacketsClient& _client;
+
+  // Accessed by the sending task only.
+  WaitHandler _wait_handler = nullptr;
+  void* _wait_handler_context = nullptr;
+
+  // Protects the ack state below which is updated by the rx task.
+  StaticMutex _mutex;
+  // Zero if no transfer in progress.
+  uint32_t _transfer_id = 0;
+  uint32_t _acked_offset = 0;
+  uint32_t _num_acks = 0;
+  // Number of consecutive acks of _acked_offset that didn't advance it.
+  uint32_t _dup_acks = 0;
+  bool _aborted = false;
+
+  // Signaled on each ack and by wake(), to wake up the sending task.
+  StaticBinarySemaphore _ack_semaphore;
+
+  // Accessed by the sending task only.
+  uint8_t _fragment_bytes[serial_packets_fragments::kMaxFragmentDataLen];
+  SerialPacketsData _packet_data;
+};
+
+// Reassembles a transfer into a caller provided buffer or a streaming
+// sink. Fragments are accepted in order only, out of order fragments
+// are dropped and resent by the sender.
+class SerialPacketsFragmentReceiver {
+ public:
+  // A callback that consumes the transfer data, in order. Returns
+  // false to abort the transfer.
+  typedef bool (*DataSink)(void* context, uint32_t offset, const uint8_t* data,
+                           uint16_t size);
+
+  SerialPacketsFragmentReceiver(SerialPacketsClient& client)
+      : _client(client) {}
+
+  // Prevent copy and assignment.
+  SerialPacketsFragmentReceiver(const SerialPacketsFragmentReceiver& other) =
+      delete;
+  SerialPacketsFragmentReceiver& operator=(
+      const SerialPacketsFragmentReceiver& other) = delete;
+
+  // Start receiving a transfer into a buffer. The transfer is aborted if
+  // it's longer than buffer_size.
+  void begin(uint32_t transfer_id, uint8_t ack_endpoint, uint8_t* buffer,
+             uint32_t buffer_size);
+
+  // Start receiving a transfer into a streaming sink.
+  void begin(uint32_t transfer_id, uint8_t ack_endpoint, DataSink sink,
+             void* context);
+
+  // Should be called by the message handler of the client with
+  // the messages that arrive to the data endpoint.
+  void on_fragment_message(const SerialPacketsData& data);
+
+  // Returns true if all the transfer bytes were received.
+  bool is_done();
+
+  // Returns true if the transfer was aborted.
+  bool is_aborted();
+
+  // Number of bytes received so far, in order.
+  uint32_t received_bytes();
+
+ private:
+  SerialPacketsClient& _client;
+
+  // Protects the fields below.
+  StaticMutex _mutex;
+  // Zero if not started.
+  uint32_t _transfer_id = 0;
+  uint8_t _ack_endpoint = 0;
+  // Either buffer or sink is non null.
+  uint8_t* _buffer = nullptr;
+  uint32_t _buffer_size = 0;
+  DataSink _sink = nullptr;
+  void* _context = nullptr;
+  // Known after the first fragment.
+  bool _has_total_len = false;
+  uint32_t _total_len = 0;
+  uint32_t _next_offset = 0;
+  bool _aborted = false;
+
+  // Accessed by the rx task only.
+  uint8_t _fragment_bytes[serial_packets_fragments::kMaxFragmentDataLen];
+  SerialPacketsData _ack_data;
+
+  void send_ack();
+};
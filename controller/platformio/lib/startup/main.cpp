@@ -5,9 +5,12 @@
 
 #include <unistd.h>
 
+#include <cstring>
+
 #include "FreeRTOS.h"
 #include "cdc_serial.h"
 #include "dma.h"
+#include "dma_buffers.h"
 #include "fatfs.h"
 #include "gpio.h"
 #include "logger.h"
@@ -42,11 +45,74 @@ __attribute__((section(".rodata"))) const int uxTopUsedPriority =
     configMAX_PRIORITIES - 1;
 }
 
+// The TCM sections, defined in STM32H750VBTX_FLASH.ld. See tcm.h.
+extern "C" {
+extern uint32_t _siitcm, _sitcm, _eitcm;
+extern uint32_t _sidtcm_data, _sdtcm_data, _edtcm_data;
+extern uint32_t _sdtcm_bss, _edtcm_bss;
+}
+
+// Initializes the ITCM code and the DTCM data, similar to the
+// initialization of .data and .bss by the startup code. Runs before
+// the other static constructors since some of them construct objects
+// in the DTCM.
+__attribute__((constructor(101))) static void tcm_setup() {
+  const uint32_t* src = &_siitcm;
+  for (uint32_t* dst = &_sitcm; dst < &_eitcm;) {
+    *dst++ = *src++;
+  }
+  src = &_sidtcm_data;
+  for (uint32_t* dst = &_sdtcm_data; dst < &_edtcm_data;) {
+    *dst++ = *src++;
+  }
+  for (uint32_t* dst = &_sdtcm_bss; dst < &_edtcm_bss;) {
+    *dst++ = 0;
+  }
+  // Make sure the code is fetched after it was written.
+  __DSB();
+  __ISB();
+}
+
+// Zeroes the DMA buffers. See dma_buffers.h. Runs before the caches are
+// enabled and before the static constructors of the objects there.
+__attribute__((constructor(101))) static void dma_buffers_setup() {
+  memset(_sdma_buffers, 0, _edma_buffers - _sdma_buffers);
+}
+
+// Maps the DMA buffers as non cacheable memory and enables the
+// instruction and data caches. The rest of the memory keeps the default
+// memory map, with the AXI and D2 SRAM cacheable (write back) and the
+// TCMs uncached. The region size is set in STM32H750VBTX_FLASH.ld.
+static void mpu_and_caches_setup() {
+  HAL_MPU_Disable();
+  MPU_Region_InitTypeDef region = {};
+  region.Enable = MPU_REGION_ENABLE;
+  region.Number = MPU_REGION_NUMBER0;
+  region.BaseAddress = (uint32_t)_sdma_buffers;
+  // The size field is log2(size) - 1, e.g. MPU_REGION_SIZE_64KB = 15.
+  region.Size = 30 - __CLZ(dma_buffers::mpu_region_size());
+  region.SubRegionDisable = 0x00;
+  region.TypeExtField = MPU_TEX_LEVEL1;
+  region.AccessPermission = MPU_REGION_FULL_ACCESS;
+  region.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+  region.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+  region.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+  region.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+  HAL_MPU_ConfigRegion(&region);
+  HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+
+  SCB_EnableICache();
+  SCB_EnableDCache();
+}
+
 static void main_task_body_impl(void* argument);
 static TaskBodyFunction main_task_body(main_task_body_impl, nullptr);
-static StaticTask main_task(main_task_body, "Main", 2);
+static StaticTask<2000> main_task(main_task_body, "Main", 2);
 
-static StaticTask cdc_logger_task(cdc_serial::logger_task_body, "Logger", 3);
+// Formats the deferred log records with vsnprintf. Keep the full size
+// until the stack high water reports show the actual headroom.
+static StaticTask<2000> cdc_logger_task(cdc_serial::logger_task_body,
+                                        "Logger", 3);
 
 static void main_task_body_impl(void* argument) {
   // NOTE: We delay to give the CDC chance to connect so we don't
@@ -74,6 +140,7 @@ int main(void) {
   // relyes on systick. This was observed also with Cube IDE when
   // FreeRTOS is eanbled.
 
+  mpu_and_caches_setup();
   HAL_Init();
   SystemClock_Config();
   PeriphCommonClock_Config();
@@ -3,9 +3,13 @@
 #include <unistd.h>
 
 #include "adc_card.h"
+#include "alarms.h"
 #include "cdc_serial.h"
+#include "controller.h"
+#include "cpu_load.h"
 #include "data_queue.h"
 #include "data_recorder.h"
+#include "downloads.h"
 #include "dma.h"
 #include "gpio.h"
 #include "gpio_pins.h"
@@ -25,41 +29,60 @@
 #pragma GCC push_options
 #pragma GCC optimize("O0")
 
-// Tasks with static stack allocations.
-static StaticTask host_link_task(host_link::host_link_task_body, "Host", 6);
-static StaticTask printer_link_task(printer_link_card::printer_link_task_body,
-                                    "Printer Link", 3);
-static StaticTask adc_card_task(adc_card::adc_card_task_body, "ADC", 5);
-static StaticTask pw_card_task(pw_card::i2c1_pw1_device_task_body, "PW1", 7);
-static StaticTask data_queue_task(data_queue::data_queue_task_body, "DQUE", 4);
+// Tasks with static stack allocations. The stack sizes are in bytes. The
+// tasks that access the SD card need the most.
+static StaticTask<2000> host_link_task(host_link::host_link_task_body, "Host",
+                                       6);
+static StaticTask<1200> printer_link_task(
+    printer_link_card::printer_link_task_body, "Printer Link", 3);
+static StaticTask<2000> adc_card_task(adc_card::adc_card1_task_body, "ADC", 5);
+static StaticTask<1200> alarms_task(alarms::alarms_task_body, "Alarms", 6);
+static StaticTask<1200> pw_card_task(pw_card::i2c1_pw1_device_task_body, "PW1",
+                                     7);
+static StaticTask<2000> data_queue_task(data_queue::data_queue_task_body,
+                                        "DQUE", 4);
+static StaticTask<2500> command_task(controller::command_task_body, "Command",
+                                     3);
+static StaticTask<2500> downloads_task(downloads::downloads_task_body, "DNLD",
+                                       2);
 
 // I2c schedule
 static I2cSchedule i2c1_schedule = {
-    // 10ms per cycle (100hz cycles)
-    .ms_per_slot = 2,
-    .slots_per_cycle = 5,
+    // 10ms per cycle (100hz cycles), or 4ms (250hz cycles) with the
+    // continuous mode of the power device.
+    .usecs_per_slot = 2000,
+    .slots_per_cycle = pw_card::kContinuousMode ? 2 : 5,
     .slots = {
         // For power device, two slots form a data points.
-        // With a divider of 2, the data point interval is 40ms (25 Hz)
-        [0] = {.device = &pw_card::i2c1_pw1_device, .rate_divider = 2},
+        // With a divider of 2, the data point interval is 40ms (25 Hz).
+        // In the continuous mode it's 8ms (125 Hz).
+        [0] = {.devices = {{.device = &pw_card::i2c1_pw1_device,
+                            .rate_divider =
+                                pw_card::kContinuousMode ? 1 : 2}}},
     }};
 
 // Called from from the main FreeRTOS task.
 void app_main() {
+  // The usecs time base, for the timestamps of the ISR events.
+  time_util::setup();
+
   session::setup();
 
   serial::serial1.init();
   serial::serial2.init();
 
+  // TIM12 PWM acts as CS for the ADC SPI. The adc card sets its
+  // period and duty cycle per its acquisition mode.
   HAL_TIM_PWM_Start(&htim12, TIM_CHANNEL_1);
-  // Set TIM12 PWM 200 ticks high, 300 ticks down. Acts
-  // as CS for the ADC SPI.
-  __HAL_TIM_SET_COMPARE(&htim12, TIM_CHANNEL_1, 200);
   HAL_TIM_Base_Start_IT(&htim12);
 
   // Init data queue.
   data_queue::setup();
 
+  // Init controller. Must be done before the host link starts
+  // processing commands.
+  controller::setup();
+
   // Init host link.
   host_link::setup(serial::serial1);
 
@@ -70,12 +93,21 @@ void app_main() {
   if (!data_queue_task.start()) {
     error_handler::Panic(69);
   }
+  if (!command_task.start()) {
+    error_handler::Panic(158);
+  }
+  if (!downloads_task.start()) {
+    error_handler::Panic(163);
+  }
   if (!host_link_task.start()) {
     error_handler::Panic(86);
   }
   if (!printer_link_task.start()) {
     error_handler::Panic(87);
   }
+  if (!alarms_task.start()) {
+    error_handler::Panic(182);
+  }
   if (!adc_card_task.start()) {
     error_handler::Panic(88);
   }
@@ -91,6 +123,7 @@ void app_main() {
 
   // Start the main loop. It's used to provide visual feedback to the user.
   Elappsed report_timer;
+  uint32_t reports_count = 0;
 
   for (uint32_t i = 0;; i++) {
     const bool is_logging = data_recorder::is_recording_active();
@@ -109,6 +142,16 @@ void app_main() {
       }
       logger.info("Session id: [%08lx]", session::id());
       data_queue::dump_state();
+      cdc_serial::dump_state();
+      alarms::dump_state();
+      i2c_scheduler::i2c1_scheduler.dump_state();
+      cpu_load::sample();
+      cpu_load::dump_state();
+      // The stack high water marks change rarely so we report them
+      // every minute.
+      if (reports_count++ % 12 == 0) {
+        StaticTaskBase::dump_stacks();
+      }
       adc_card::verify_static_registers_values();
     }
 
@@ -0,0 +1,226 @@
+// Unit test of the adc card pre trigger capture.
+
+#include <unity.h>
+
+#include <cstring>
+
+#include "../../unity_util.h"
+#include "adc_capture.h"
+
+using adc_capture::Capture;
+using adc_capture::DumpChunk;
+using adc_capture::TriggerSource;
+using adc_capture::Triggers;
+
+static constexpr uint32_t kIntervalUsecs = 100;
+static constexpr uint32_t kCapacity = 1000;
+// Same layout as the adc card DMA points of the main channel.
+static constexpr uint32_t kStride = 16;
+static constexpr uint32_t kMaxAppend = 200;
+
+static uint8_t buffer[kCapacity * adc_capture::kBytesPerSample];
+static uint8_t points[kMaxAppend * kStride];
+static uint8_t dump[kCapacity * adc_capture::kBytesPerSample];
+
+static int32_t decode(const uint8_t* p) {
+  int32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (v & 0x800000) ? v - 0x1000000 : v;
+}
+
+// Appends n samples whose values are their indexes plus 'value_offset'.
+static void append(Capture& capture, uint32_t n, uint32_t first_micros,
+                   int32_t value_offset = 0) {
+  const uint32_t first_index = capture.next_index();
+  for (uint32_t i = 0; i < n; i++) {
+    const int32_t v = (int32_t)(first_index + i) + value_offset;
+    points[i * kStride + 0] = v >> 16;
+    points[i * kStride + 1] = v >> 8;
+    points[i * kStride + 2] = v;
+  }
+  capture.append(points, kStride, n, first_micros);
+}
+
+// Appends contiguous samples from time 0.
+static void append_contiguous(Capture& capture, uint32_t n) {
+  append(capture, n, capture.next_index() * kIntervalUsecs);
+}
+
+// Collects the dump, verifies the values and returns the total samples.
+static uint32_t collect_dump(Capture& capture, uint32_t max_chunk,
+                             DumpChunk* first_chunk) {
+  uint32_t total = 0;
+  DumpChunk chunk;
+  while (capture.next_dump_chunk(max_chunk, &chunk, dump)) {
+    TEST_ASSERT_TRUE(chunk.num_samples <= max_chunk);
+    TEST_ASSERT_EQUAL(total == 0, chunk.is_first);
+    if (total == 0) {
+      *first_chunk = chunk;
+    }
+    for (uint32_t i = 0; i < chunk.num_samples; i++) {
+      TEST_ASSERT_EQUAL((int32_t)(chunk.first_index + i),
+                        decode(&dump[i * adc_capture::kBytesPerSample]));
+    }
+    total += chunk.num_samples;
+  }
+  return total;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_host_trigger() {
+  Capture capture(buffer, sizeof(buffer), kIntervalUsecs);
+  TEST_ASSERT_TRUE(capture.set_window(100, 50));
+  append_contiguous(capture, 150);
+  TEST_ASSERT_TRUE(capture.trigger(140, TriggerSource::HOST));
+  TEST_ASSERT_TRUE(capture.is_triggered());
+  // Waits for the post trigger samples.
+  DumpChunk chunk;
+  TEST_ASSERT_FALSE(capture.next_dump_chunk(30, &chunk, dump));
+  append_contiguous(capture, 40);
+  TEST_ASSERT_FALSE(capture.next_dump_chunk(30, &chunk, dump));
+  append_contiguous(capture, 1);
+  DumpChunk first;
+  TEST_ASSERT_EQUAL(151, collect_dump(capture, 30, &first));
+  TEST_ASSERT_EQUAL(40, first.first_index);
+  TEST_ASSERT_EQUAL(40 * kIntervalUsecs, first.first_micros);
+  TEST_ASSERT_EQUAL(140, first.trigger_index);
+  TEST_ASSERT_TRUE(first.source == TriggerSource::HOST);
+  TEST_ASSERT_FALSE(capture.is_triggered());
+  TEST_ASSERT_EQUAL(1, capture.dumps_count());
+}
+
+// The pre trigger window is clamped to the captured samples.
+void test_short_pre_trigger() {
+  Capture capture(buffer, sizeof(buffer), kIntervalUsecs);
+  TEST_ASSERT_TRUE(capture.set_window(100, 10));
+  append_contiguous(capture, 31);
+  TEST_ASSERT_TRUE(capture.trigger(20, TriggerSource::MARKER));
+  DumpChunk first;
+  TEST_ASSERT_EQUAL(31, collect_dump(capture, 100, &first));
+  TEST_ASSERT_EQUAL(0, first.first_index);
+}
+
+void test_level_and_slope_triggers() {
+  Capture capture(buffer, sizeof(buffer), kIntervalUsecs);
+  TEST_ASSERT_TRUE(capture.set_window(5, 5));
+  Triggers triggers;
+  triggers.level_low = -1000;
+  triggers.level_high = 50;
+  capture.set_triggers(triggers);
+  append_contiguous(capture, 40);
+  TEST_ASSERT_FALSE(capture.is_triggered());
+  append_contiguous(capture, 20);
+  TEST_ASSERT_TRUE(capture.is_triggered());
+  DumpChunk first;
+  TEST_ASSERT_EQUAL(11, collect_dump(capture, 100, &first));
+  TEST_ASSERT_EQUAL(51, first.trigger_index);
+  TEST_ASSERT_TRUE(first.source == TriggerSource::LEVEL);
+  // Still outside the range, doesn't trigger again.
+  append_contiguous(capture, 20);
+  TEST_ASSERT_FALSE(capture.is_triggered());
+
+  // A step of the values triggers the slope.
+  capture.reset();
+  triggers = Triggers();
+  triggers.slope_delta = 100;
+  triggers.slope_span = 4;
+  capture.set_triggers(triggers);
+  append_contiguous(capture, 100);
+  TEST_ASSERT_FALSE(capture.is_triggered());
+  append(capture, 20, capture.next_index() * kIntervalUsecs, 1000);
+  TEST_ASSERT_TRUE(capture.is_triggered());
+  TEST_ASSERT_TRUE(capture.next_dump_chunk(100, &first, dump));
+  TEST_ASSERT_EQUAL(95, first.first_index);
+  TEST_ASSERT_EQUAL(11, first.num_samples);
+  TEST_ASSERT_EQUAL(100, first.trigger_index);
+  TEST_ASSERT_TRUE(first.source == TriggerSource::SLOPE);
+  TEST_ASSERT_EQUAL(2, capture.triggers_count());
+}
+
+// Triggers while a dump is pending are ignored.
+void test_ignored_triggers() {
+  Capture capture(buffer, sizeof(buffer), kIntervalUsecs);
+  TEST_ASSERT_TRUE(capture.set_window(10, 10));
+  append_contiguous(capture, 50);
+  TEST_ASSERT_TRUE(capture.trigger(45, TriggerSource::HOST));
+  TEST_ASSERT_FALSE(capture.trigger(48, TriggerSource::HOST));
+  TEST_ASSERT_EQUAL(1, capture.ignored_triggers_count());
+}
+
+// Gaps in the sample times split the dump chunks.
+void test_runs() {
+  Capture capture(buffer, sizeof(buffer), kIntervalUsecs);
+  TEST_ASSERT_TRUE(capture.set_window(100, 100));
+  append(capture, 50, 0);
+  // Within half an interval, same run.
+  append(capture, 50, 50 * kIntervalUsecs + 40);
+  // A gap of 10 intervals.
+  append(capture, 100, 110 * kIntervalUsecs);
+  TEST_ASSERT_EQUAL(75, capture.index_at_micros(75 * kIntervalUsecs));
+  TEST_ASSERT_EQUAL(120, capture.index_at_micros(130 * kIntervalUsecs));
+  TEST_ASSERT_TRUE(capture.trigger(120, TriggerSource::MARKER));
+  append(capture, 100, 210 * kIntervalUsecs);
+
+  DumpChunk chunk;
+  TEST_ASSERT_TRUE(capture.next_dump_chunk(1000, &chunk, dump));
+  TEST_ASSERT_EQUAL(20, chunk.first_index);
+  TEST_ASSERT_EQUAL(80, chunk.num_samples);
+  TEST_ASSERT_EQUAL(20 * kIntervalUsecs, chunk.first_micros);
+  TEST_ASSERT_TRUE(capture.next_dump_chunk(1000, &chunk, dump));
+  TEST_ASSERT_EQUAL(100, chunk.first_index);
+  TEST_ASSERT_EQUAL(121, chunk.num_samples);
+  TEST_ASSERT_EQUAL(110 * kIntervalUsecs, chunk.first_micros);
+  TEST_ASSERT_FALSE(capture.next_dump_chunk(1000, &chunk, dump));
+}
+
+// Samples that are overwritten before they are dumped are skipped.
+void test_ring_wrap_around() {
+  Capture capture(buffer, sizeof(buffer), kIntervalUsecs);
+  TEST_ASSERT_TRUE(capture.set_window(400, 400));
+  for (int i = 0; i < 12; i++) {
+    append_contiguous(capture, kMaxAppend);
+  }
+  TEST_ASSERT_TRUE(capture.trigger(2000, TriggerSource::HOST));
+  append_contiguous(capture, kMaxAppend);
+  // Dumps a part and then lets the ring overwrite the rest.
+  DumpChunk chunk;
+  TEST_ASSERT_TRUE(capture.next_dump_chunk(100, &chunk, dump));
+  TEST_ASSERT_EQUAL(1600, chunk.first_index);
+  TEST_ASSERT_EQUAL(1600, decode(dump));
+  for (int i = 0; i < 2; i++) {
+    append_contiguous(capture, kMaxAppend);
+  }
+  TEST_ASSERT_TRUE(capture.next_dump_chunk(1000, &chunk, dump));
+  TEST_ASSERT_EQUAL(2000, chunk.first_index);
+  TEST_ASSERT_EQUAL(401, chunk.num_samples);
+  for (uint32_t i = 0; i < chunk.num_samples; i++) {
+    TEST_ASSERT_EQUAL((int32_t)(chunk.first_index + i),
+                      decode(&dump[i * adc_capture::kBytesPerSample]));
+  }
+  TEST_ASSERT_EQUAL(300, capture.lost_samples_count());
+  TEST_ASSERT_FALSE(capture.is_triggered());
+}
+
+void test_invalid_window() {
+  Capture capture(buffer, sizeof(buffer), kIntervalUsecs);
+  TEST_ASSERT_FALSE(capture.set_window(kCapacity / 2, 10));
+  TEST_ASSERT_FALSE(capture.set_window(10, kCapacity));
+  TEST_ASSERT_TRUE(capture.set_window(kCapacity / 2 - 1, kCapacity / 2 - 1));
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_host_trigger);
+  RUN_TEST(test_short_pre_trigger);
+  RUN_TEST(test_level_and_slope_triggers);
+  RUN_TEST(test_ignored_triggers);
+  RUN_TEST(test_runs);
+  RUN_TEST(test_ring_wrap_around);
+  RUN_TEST(test_invalid_window);
+  UNITY_END();
+
+  unity_util::common_end();
+}
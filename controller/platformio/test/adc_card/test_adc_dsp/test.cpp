@@ -0,0 +1,248 @@
+// Unit test and benchmark of the adc card DSP kernels. Compares them
+// with the reference implementation and reports their cycles per
+// sample.
+
+#include <unity.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "../../unity_util.h"
+#include "adc_dsp.h"
+#include "adc_dsp_reference.h"
+#include "main.h"
+
+using adc_dsp::FilterSpec;
+using adc_dsp::FilterState;
+using adc_dsp::Reduce;
+
+// Same layout as the adc card DMA points.
+static constexpr uint32_t kPointSize = 16;
+static constexpr uint32_t kConversions = 4;
+static constexpr uint32_t kNumSamples = 480;
+static constexpr uint32_t kSampleStride = kConversions * kPointSize;
+
+static uint8_t points[kNumSamples * kSampleStride];
+static int32_t actual[kNumSamples];
+static int32_t expected[kNumSamples];
+static int32_t reduced[kNumSamples];
+static double expected_iir[kNumSamples];
+
+// A deterministic pseudo random generator.
+static uint32_t rand_state;
+static uint32_t next_rand() {
+  rand_state = rand_state * 1664525 + 1013904223;
+  return rand_state;
+}
+
+// Fills the points with a slow ramp, noise and occasional spikes,
+// around the given value.
+static void fill_points(int32_t center) {
+  rand_state = 12345;
+  memset(points, 0, sizeof(points));
+  for (uint32_t i = 0; i < kNumSamples * kConversions; i++) {
+    int32_t v = center + (int32_t)(i * 37) - 50000 +
+                (int32_t)(next_rand() % 2001) - 1000;
+    if (next_rand() % 50 == 0) {
+      v += (next_rand() & 1) ? 3000000 : -3000000;
+    }
+    v = adc_dsp_reference::clamp24(v);
+    adc_dsp::encode_int24(v, &points[i * kPointSize]);
+  }
+}
+
+// The data of the last conversion of the first sample.
+static const uint8_t* first_sample() {
+  return &points[(kConversions - 1) * kPointSize];
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_decode_encode() {
+  const int32_t values[] = {0, 1, -1, 0x123456, -0x123456, adc_dsp::kMaxValue,
+                            adc_dsp::kMinValue};
+  for (const int32_t v : values) {
+    uint8_t bfr[4] = {0, 0, 0, 0xff};
+    adc_dsp::encode_int24(v, bfr);
+    TEST_ASSERT_EQUAL(v, adc_dsp::decode_int24(bfr));
+    TEST_ASSERT_EQUAL(v, adc_dsp_reference::decode_int24(bfr));
+  }
+}
+
+static void check_reduce(const FilterSpec& spec, int32_t center) {
+  fill_points(center);
+  adc_dsp::reduce(spec, first_sample(), kSampleStride, kPointSize,
+                  kNumSamples, actual);
+  adc_dsp_reference::reduce(spec, first_sample(), kSampleStride, kPointSize,
+                            kNumSamples, expected);
+  TEST_ASSERT_EQUAL_INT32_ARRAY(expected, actual, kNumSamples);
+}
+
+void test_reduce() {
+  static const int32_t centers[] = {0, 5000000, -5000000};
+  for (const int32_t center : centers) {
+    check_reduce({.reduce = Reduce::LAST}, center);
+    for (uint8_t n = 1; n <= kConversions; n++) {
+      check_reduce({.reduce = Reduce::MEAN, .reduce_count = n}, center);
+      check_reduce({.reduce = Reduce::MEDIAN, .reduce_count = n}, center);
+    }
+  }
+}
+
+// The median rejects single spikes.
+void test_median_rejects_spikes() {
+  fill_points(0);
+  adc_dsp::encode_int24(adc_dsp::kMaxValue, &points[kPointSize]);
+  const FilterSpec spec = {.reduce = Reduce::MEDIAN, .reduce_count = 3};
+  adc_dsp::reduce(spec, first_sample(), kSampleStride, kPointSize, 1, actual);
+  TEST_ASSERT_LESS_THAN(100000, actual[0]);
+}
+
+// Decimates in chunks, to verify the state is carried between calls.
+static void check_decimate(uint8_t decimation, uint8_t order,
+                           uint32_t chunk_size) {
+  const FilterSpec spec = {.reduce = Reduce::LAST,
+                           .reduce_count = 1,
+                           .decimation = decimation,
+                           .cic_order = order};
+  TEST_ASSERT_NULL(adc_dsp::validate(spec, 1));
+  fill_points(1000000);
+  adc_dsp::reduce(spec, first_sample(), kSampleStride, kPointSize,
+                  kNumSamples, reduced);
+  const uint32_t expected_count =
+      adc_dsp_reference::decimate(spec, reduced, kNumSamples, expected);
+
+  FilterState state;
+  state.reset();
+  uint32_t actual_count = 0;
+  for (uint32_t i = 0; i < kNumSamples; i += chunk_size) {
+    memcpy(actual, &reduced[i], chunk_size * sizeof(int32_t));
+    const uint32_t n = adc_dsp::decimate(spec, &state, actual, chunk_size);
+    TEST_ASSERT_EQUAL_INT32_ARRAY(&expected[actual_count], actual, n);
+    actual_count += n;
+  }
+  TEST_ASSERT_EQUAL(expected_count, actual_count);
+}
+
+void test_decimate() {
+  check_decimate(1, 1, 120);
+  check_decimate(4, 1, 120);
+  check_decimate(4, 3, 120);
+  check_decimate(3, 2, 120);
+  check_decimate(5, 3, 40);
+  check_decimate(2, 4, 30);
+}
+
+void test_invalid_cic_gain() {
+  TEST_ASSERT_NOT_NULL(adc_dsp::validate({.reduce = Reduce::LAST,
+                                          .reduce_count = 1,
+                                          .decimation = 16,
+                                          .cic_order = 2},
+                                         1));
+  TEST_ASSERT_NOT_NULL(adc_dsp::validate({.reduce = Reduce::LAST,
+                                          .reduce_count = 1,
+                                          .decimation = 1,
+                                          .cic_order = 5},
+                                         1));
+  TEST_ASSERT_NOT_NULL(
+      adc_dsp::validate({.reduce = Reduce::MEAN, .reduce_count = 3}, 2));
+}
+
+// The fixed point IIR tracks the floating point one within one LSB.
+void test_iir() {
+  for (uint8_t shift = 1; shift <= 6; shift++) {
+    const FilterSpec spec = {.reduce = Reduce::LAST,
+                             .reduce_count = 1,
+                             .decimation = 1,
+                             .cic_order = 1,
+                             .iir_shift = shift};
+    fill_points(-2000000);
+    adc_dsp::reduce(spec, first_sample(), kSampleStride, kPointSize,
+                    kNumSamples, reduced);
+    adc_dsp_reference::iir_lowpass(spec, reduced, kNumSamples, expected_iir);
+
+    FilterState state;
+    state.reset();
+    memcpy(actual, reduced, sizeof(actual));
+    adc_dsp::iir_lowpass(spec, &state, actual, kNumSamples / 2);
+    adc_dsp::iir_lowpass(spec, &state, &actual[kNumSamples / 2],
+                         kNumSamples / 2);
+    for (uint32_t i = 0; i < kNumSamples; i++) {
+      TEST_ASSERT_DOUBLE_WITHIN(1.0, expected_iir[i], actual[i]);
+    }
+  }
+}
+
+// Reports the cycles per sample of the kernels. Uses the DWT cycle
+// counter.
+static uint32_t cycles_per_sample(const FilterSpec& spec) {
+  FilterState state;
+  state.reset();
+  const uint32_t start = DWT->CYCCNT;
+  adc_dsp::reduce(spec, first_sample(), kSampleStride, kPointSize,
+                  kNumSamples, actual);
+  const uint32_t n = adc_dsp::decimate(spec, &state, actual, kNumSamples);
+  adc_dsp::iir_lowpass(spec, &state, actual, n);
+  return (DWT->CYCCNT - start) / kNumSamples;
+}
+
+void test_benchmark() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  struct Case {
+    const char* name;
+    FilterSpec spec;
+  };
+  static const Case cases[] = {
+      {"last", {}},
+      {"mean/3", {.reduce = Reduce::MEAN, .reduce_count = 3}},
+      {"median/3", {.reduce = Reduce::MEDIAN, .reduce_count = 3}},
+      {"median/4", {.reduce = Reduce::MEDIAN, .reduce_count = 4}},
+      {"boxcar/4",
+       {.reduce = Reduce::LAST, .reduce_count = 1, .decimation = 4}},
+      {"cic3/4",
+       {.reduce = Reduce::LAST,
+        .reduce_count = 1,
+        .decimation = 4,
+        .cic_order = 3}},
+      {"iir/4",
+       {.reduce = Reduce::LAST,
+        .reduce_count = 1,
+        .decimation = 1,
+        .cic_order = 1,
+        .iir_shift = 4}},
+      {"median/3+cic3/4+iir/2",
+       {.reduce = Reduce::MEDIAN,
+        .reduce_count = 3,
+        .decimation = 4,
+        .cic_order = 3,
+        .iir_shift = 2}},
+  };
+  fill_points(0);
+  for (const Case& c : cases) {
+    char msg[60];
+    snprintf(msg, sizeof(msg), "%s: %lu cycles/sample", c.name,
+             cycles_per_sample(c.spec));
+    TEST_MESSAGE(msg);
+  }
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_decode_encode);
+  RUN_TEST(test_reduce);
+  RUN_TEST(test_median_rejects_spikes);
+  RUN_TEST(test_decimate);
+  RUN_TEST(test_invalid_cic_gain);
+  RUN_TEST(test_iir);
+  RUN_TEST(test_benchmark);
+  UNITY_END();
+
+  unity_util::common_end();
+}
@@ -0,0 +1,253 @@
+// Unit test of the ADC sequence compiler. Verifies that the compiled
+// default sequence matches the original hand coded DMA layout.
+
+#include <unity.h>
+
+#include <cstring>
+
+#include "../../unity_util.h"
+#include "adc_card_config.h"
+#include "adc_sequence.h"
+
+using adc_sequence::ChannelSpec;
+using adc_sequence::Plan;
+
+// The number of static registers that adc_card reads for diagnostics.
+static constexpr uint8_t kNumDiagRegs = 19;
+
+static constexpr uint32_t kCyclesPerHalf = 40;
+static constexpr uint32_t kBytesPerHalf =
+    kCyclesPerHalf * 12 * adc_sequence::kBytesPerPoint;
+
+static uint8_t expected_tx[kBytesPerHalf];
+static uint8_t actual_tx[kBytesPerHalf];
+
+void setUp() {}
+void tearDown() {}
+
+// The original hand coded layout of the first half of the TX buffer.
+static void build_legacy_tx_half(uint8_t* p) {
+  for (uint32_t cycle = 0; cycle < kCyclesPerHalf; cycle++) {
+    for (uint32_t slot = 0; slot < 3; slot++) {
+      for (uint32_t pt = 0; pt < 4; pt++) {
+        const uint32_t pt_global_index = (cycle * 12) + (slot * 4) + pt;
+        const uint8_t reg_index = pt_global_index % kNumDiagRegs;
+        const bool next_point_is_loadcell = pt != 2;
+        const uint8_t reg_0x06_val = next_point_is_loadcell ? 0x0a : 0x05;
+        const uint8_t reg_0x10_val = next_point_is_loadcell ? 0x07 : 0x00;
+        const uint8_t reg_0x11_val = next_point_is_loadcell ? 0x34
+                                     : (slot == 0)          ? 0x56
+                                     : (slot == 1)          ? 0x78
+                                                            : 0x9a;
+        const uint8_t point[] = {0x12, 0x00, 0x00, 0x00,
+                                 0x00, (uint8_t)(0x20 | reg_index),
+                                 0x00, 0x00,
+                                 0x46, reg_0x06_val,
+                                 0x50, reg_0x10_val,
+                                 0x51, reg_0x11_val,
+                                 0x08, 0x00};
+        static_assert(sizeof(point) == adc_sequence::kBytesPerPoint);
+        memcpy(p, point, sizeof(point));
+        p += sizeof(point);
+      }
+    }
+  }
+}
+
+void test_default_tx_image() {
+  constexpr Plan plan = adc_sequence::compile(adc_card_config::standard_mode::kChannels);
+  static_assert(plan.is_valid());
+
+  build_legacy_tx_half(expected_tx);
+  memset(actual_tx, 0, sizeof(actual_tx));
+  const uint32_t n = adc_sequence::build_tx_half(
+      plan, adc_card_config::standard_mode::kChannels, kCyclesPerHalf, kNumDiagRegs,
+      actual_tx);
+  TEST_ASSERT_EQUAL(kBytesPerHalf, n);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected_tx, actual_tx, kBytesPerHalf);
+}
+
+void test_default_rx_plan() {
+  constexpr Plan plan = adc_sequence::compile(adc_card_config::standard_mode::kChannels);
+  static_assert(plan.is_valid());
+
+  TEST_ASSERT_EQUAL(4, plan.num_channels);
+  TEST_ASSERT_EQUAL(3, plan.slots_per_cycle);
+  TEST_ASSERT_EQUAL(12, plan.points_per_cycle);
+
+  // lc1: the last of three LC points in each slot.
+  TEST_ASSERT_EQUAL(2, plan.channels[0].first_point);
+  TEST_ASSERT_EQUAL(4, plan.channels[0].points_stride);
+  TEST_ASSERT_EQUAL(3, plan.channels[0].samples_per_cycle);
+  TEST_ASSERT_EQUAL(1000,
+                    adc_sequence::first_sample_offset_usecs(plan, 0, 2000));
+  TEST_ASSERT_EQUAL(2000, adc_sequence::sample_interval_usecs(plan, 0, 2000));
+
+  // tm1, tm2, tm3: the last point of slots 0, 1, 2.
+  for (uint8_t c = 1; c <= 3; c++) {
+    const uint16_t first_point = 3 + (c - 1) * 4;
+    TEST_ASSERT_EQUAL(first_point, plan.channels[c].first_point);
+    TEST_ASSERT_EQUAL(12, plan.channels[c].points_stride);
+    TEST_ASSERT_EQUAL(1, plan.channels[c].samples_per_cycle);
+    TEST_ASSERT_EQUAL(first_point * 500,
+                      adc_sequence::first_sample_offset_usecs(plan, c, 2000));
+    TEST_ASSERT_EQUAL(6000, adc_sequence::sample_interval_usecs(plan, c, 2000));
+  }
+}
+
+// A load cell only sequence.
+void test_single_channel() {
+  static constexpr ChannelSpec specs[] = {
+      {.chan_id = "lc1", .ref = 0x0a, .pga = 0x07, .inpmux = 0x34,
+       .conversions = 2, .rate_divider = 1},
+  };
+  constexpr Plan plan = adc_sequence::compile(specs);
+  static_assert(plan.is_valid());
+  TEST_ASSERT_EQUAL(2, plan.points_per_cycle);
+  TEST_ASSERT_EQUAL(1, plan.channels[0].first_point);
+  TEST_ASSERT_EQUAL(2, plan.channels[0].points_stride);
+  TEST_ASSERT_EQUAL(1, plan.channels[0].samples_per_cycle);
+}
+
+// Dividers that don't divide the cycle are rejected.
+void test_invalid_dividers() {
+  static constexpr ChannelSpec specs[] = {
+      {.chan_id = "lc1", .ref = 0x0a, .pga = 0x07, .inpmux = 0x34,
+       .conversions = 1, .rate_divider = 2},
+      {.chan_id = "tm1", .ref = 0x05, .pga = 0x00, .inpmux = 0x56,
+       .conversions = 1, .rate_divider = 3},
+  };
+  constexpr Plan plan = adc_sequence::compile(specs);
+  TEST_ASSERT_FALSE(plan.is_valid());
+}
+
+// Returns true if the point at the given index sends NOPs rather than
+// configuring and starting a conversion.
+static bool is_nop_point(const uint8_t* buffer, uint32_t point_index) {
+  const uint8_t* p = &buffer[point_index * adc_sequence::kBytesPerPoint];
+  for (uint32_t i = 8; i < adc_sequence::kBytesPerPoint; i++) {
+    if (p[i] != 0x00) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// In continuous mode, only the points that switch channels restart
+// the conversion.
+void test_high_rate_tx_images() {
+  using namespace adc_card_config::high_rate_mode;
+  constexpr Plan plan = adc_sequence::compile(kChannels);
+  constexpr Plan burst_plan = adc_sequence::compile(kBurstChannels);
+  static_assert(adc_sequence::is_valid_burst(plan, burst_plan,
+                                             kMode.cycles_per_half));
+  constexpr uint32_t kPoints = kMode.cycles_per_half;
+  constexpr uint32_t kBytes = kPoints * adc_sequence::kBytesPerPoint;
+  static_assert(kBytes <= sizeof(actual_tx));
+
+  // The main sequence never switches channels.
+  uint32_t n = adc_sequence::build_tx_half(
+      plan, kChannels, kMode.cycles_per_half, kNumDiagRegs, actual_tx,
+      kMode.conversion_mode);
+  TEST_ASSERT_EQUAL(kBytes, n);
+  for (uint32_t i = 0; i < kPoints; i++) {
+    TEST_ASSERT_TRUE(is_nop_point(actual_tx, i));
+  }
+
+  // The burst half switches to tm1 on the last main point, to tm2 and
+  // tm3 after 4 conversions each, and back to the load cell.
+  TEST_ASSERT_EQUAL(16, burst_plan.points_per_cycle);
+  n = adc_sequence::build_tx_burst_half(
+      plan, kChannels, burst_plan, kBurstChannels, kMode.cycles_per_half,
+      kNumDiagRegs, actual_tx, kMode.conversion_mode);
+  TEST_ASSERT_EQUAL(kBytes, n);
+  const uint32_t burst_start = kPoints - 16;
+  TEST_ASSERT_EQUAL(burst_start, adc_sequence::cycles_before_burst(
+                                     plan, burst_plan, kMode.cycles_per_half));
+  for (uint32_t i = 0; i < kPoints; i++) {
+    const bool is_switch = i == burst_start - 1 || i == burst_start + 3 ||
+                           i == burst_start + 7 || i == burst_start + 11;
+    TEST_ASSERT_EQUAL(!is_switch, is_nop_point(actual_tx, i));
+  }
+  // The inpmux values of the switches.
+  const uint32_t kInpmuxOffset = 13;
+  TEST_ASSERT_EQUAL_HEX8(
+      0x56, actual_tx[(burst_start - 1) * adc_sequence::kBytesPerPoint +
+                      kInpmuxOffset]);
+  TEST_ASSERT_EQUAL_HEX8(
+      0x34, actual_tx[(burst_start + 11) * adc_sequence::kBytesPerPoint +
+                      kInpmuxOffset]);
+
+  // The used temperature samples are the last of their 4 points.
+  for (uint8_t c = 0; c < 3; c++) {
+    TEST_ASSERT_EQUAL(3 + 4 * c, burst_plan.channels[c].first_point);
+    TEST_ASSERT_EQUAL(1, burst_plan.channels[c].samples_per_cycle);
+  }
+}
+
+// The data rates of both modes settle in time, and slower ones are
+// rejected.
+void test_data_rate_validation() {
+  using adc_sequence::PointTiming;
+  using adc_sequence::reg_mode0;
+  using adc_sequence::validate_data_rate;
+
+  // 14400 SPS, sinc5.
+  TEST_ASSERT_EQUAL_HEX8(0x6c, reg_mode0(13, adc_sequence::kFilterFir));
+  TEST_ASSERT_EQUAL(139, adc_sequence::conversion_latency_usecs(0x6c));
+  // 1200 SPS, sinc3.
+  TEST_ASSERT_EQUAL(2500, adc_sequence::conversion_latency_usecs(
+                              reg_mode0(9, 2)));
+  // FIR above 20 SPS, invalid filter and data rate codes.
+  TEST_ASSERT_EQUAL(0, adc_sequence::conversion_latency_usecs(
+                           reg_mode0(5, adc_sequence::kFilterFir)));
+  TEST_ASSERT_EQUAL(0, adc_sequence::conversion_latency_usecs(
+                           reg_mode0(8, 5)));
+  TEST_ASSERT_EQUAL(0, adc_sequence::conversion_latency_usecs(
+                           reg_mode0(17, 0)));
+
+  // Standard mode, one shot at 2000 points/sec and 2Mhz SCLK.
+  constexpr PointTiming one_shot = {
+      .conversion_mode = adc_sequence::ConversionMode::ONE_SHOT,
+      .usecs_per_point = 500,
+      .transfer_usecs = 64,
+      .start_delay_usecs = 50,
+      .min_switch_conversions = 1};
+  TEST_ASSERT_NULL(validate_data_rate(0x6c, one_shot));
+  TEST_ASSERT_NULL(validate_data_rate(reg_mode0(12, 0), one_shot));
+  TEST_ASSERT_NULL(validate_data_rate(reg_mode0(11, 0), one_shot));
+  TEST_ASSERT_NOT_NULL(validate_data_rate(reg_mode0(11, 1), one_shot));
+  TEST_ASSERT_NOT_NULL(validate_data_rate(reg_mode0(10, 0), one_shot));
+
+  // High rate mode, continuous at 8000 points/sec, 4 conversions after
+  // each switch.
+  constexpr PointTiming continuous = {
+      .conversion_mode = adc_sequence::ConversionMode::CONTINUOUS,
+      .usecs_per_point = 125,
+      .transfer_usecs = 16,
+      .start_delay_usecs = 50,
+      .min_switch_conversions = 4};
+  TEST_ASSERT_NULL(validate_data_rate(0x6c, continuous));
+  TEST_ASSERT_NULL(validate_data_rate(reg_mode0(16, 0), continuous));
+  // Slower than the points.
+  TEST_ASSERT_NOT_NULL(validate_data_rate(reg_mode0(12, 0), continuous));
+  // Doesn't settle in a single conversion.
+  PointTiming short_switch = continuous;
+  short_switch.min_switch_conversions = 1;
+  TEST_ASSERT_NOT_NULL(validate_data_rate(0x6c, short_switch));
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_default_tx_image);
+  RUN_TEST(test_default_rx_plan);
+  RUN_TEST(test_single_channel);
+  RUN_TEST(test_invalid_dividers);
+  RUN_TEST(test_high_rate_tx_images);
+  RUN_TEST(test_data_rate_validation);
+  UNITY_END();
+
+  unity_util::common_end();
+}
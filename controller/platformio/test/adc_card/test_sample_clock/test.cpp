@@ -0,0 +1,110 @@
+// Unit test of the sample clock model of the adc card.
+
+#include <unity.h>
+
+#include "../../unity_util.h"
+#include "sample_clock.h"
+
+static constexpr uint32_t kPeriod = 20000;
+static constexpr uint16_t kWindow = 32;
+
+// A deterministic pseudo random generator.
+static uint32_t rand_state;
+static uint32_t next_rand() {
+  rand_state = rand_state * 1664525 + 1013904223;
+  return rand_state >> 8;
+}
+
+// An interrupt latency of 5 to 40 usecs with occasional long ones.
+static uint32_t next_latency() {
+  if (next_rand() % 100 == 0) {
+    return 500;
+  }
+  return 5 + next_rand() % 36;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Without latency the model follows the events exactly.
+void test_exact_events() {
+  SampleClock clock(kPeriod, kWindow);
+  for (uint32_t i = 0; i < 1000; i++) {
+    const uint32_t t = 12345 + i * kPeriod;
+    TEST_ASSERT_EQUAL_UINT32(t, clock.update(i, t));
+  }
+  TEST_ASSERT_EQUAL(0, clock.rate_error_ppb());
+  TEST_ASSERT_EQUAL(0, clock.resets_count());
+}
+
+// Tracks events with latency and a drift of 'ppm', starting at time
+// 'start'. Verifies that the model times are periodic and that they
+// follow the events with about the min latency. The model wanders a
+// few usecs with the min latency of the windows.
+static void check_tracking(int32_t ppm, uint32_t start) {
+  rand_state = 777;
+  SampleClock clock(kPeriod, kWindow);
+  const double true_period = kPeriod * (1.0 + ppm * 1e-6);
+  uint32_t prev_model_time = 0;
+  for (uint32_t i = 0; i < 5000; i++) {
+    const uint32_t true_time = start + (uint32_t)(i * true_period);
+    const uint32_t model_time = clock.update(i, true_time + next_latency());
+    // Let the model settle.
+    if (i > 2000) {
+      const int32_t error = (int32_t)(model_time - true_time);
+      TEST_ASSERT_INT32_WITHIN(12, 5, error);
+      const int32_t interval = (int32_t)(model_time - prev_model_time);
+      TEST_ASSERT_INT32_WITHIN(2, (int32_t)true_period, interval);
+    }
+    prev_model_time = model_time;
+  }
+  TEST_ASSERT_INT32_WITHIN(3000, ppm * 1000, clock.rate_error_ppb());
+  TEST_ASSERT_EQUAL(0, clock.resets_count());
+}
+
+void test_tracking() {
+  check_tracking(0, 1000);
+  check_tracking(100, 1000);
+  check_tracking(-50, 1000);
+  // Wraps around the 32 bits usecs.
+  check_tracking(20, 0xffffffff - 3 * kPeriod * kWindow);
+}
+
+// Missing events don't break the model.
+void test_missing_events() {
+  SampleClock clock(kPeriod, kWindow);
+  for (uint32_t i = 0; i < 200; i++) {
+    if (i % 10 == 3) {
+      continue;
+    }
+    const uint32_t t = i * kPeriod;
+    TEST_ASSERT_EQUAL_UINT32(t, clock.update(i, t));
+  }
+  TEST_ASSERT_EQUAL_UINT32(250 * kPeriod, clock.model_time(250));
+  TEST_ASSERT_EQUAL(0, clock.resets_count());
+}
+
+// A jump in the events time restarts the model.
+void test_reset_on_jump() {
+  SampleClock clock(kPeriod, kWindow);
+  for (uint32_t i = 0; i < 100; i++) {
+    clock.update(i, i * kPeriod);
+  }
+  const uint32_t t = 100 * kPeriod + 50000;
+  TEST_ASSERT_EQUAL_UINT32(t, clock.update(100, t));
+  TEST_ASSERT_EQUAL(1, clock.resets_count());
+  TEST_ASSERT_EQUAL_UINT32(t + kPeriod, clock.update(101, t + kPeriod));
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_exact_events);
+  RUN_TEST(test_tracking);
+  RUN_TEST(test_missing_events);
+  RUN_TEST(test_reset_on_jump);
+  UNITY_END();
+
+  unity_util::common_end();
+}
@@ -0,0 +1,181 @@
+// Unit test of the alarm rules evaluation.
+
+#include <unity.h>
+
+#include "../../unity_util.h"
+#include "alarm_rules.h"
+
+using alarm_rules::Match;
+using alarm_rules::Rule;
+using alarm_rules::RuleEngine;
+using alarm_rules::RuleType;
+
+static constexpr uint32_t kIntervalUsecs = 125;
+static constexpr uint32_t kMaxMatches = 10;
+
+static Match matches[kMaxMatches];
+
+void setUp() {}
+void tearDown() {}
+
+void test_validate() {
+  TEST_ASSERT_NULL(alarm_rules::validate({.chan_id = "lc1",
+                                          .value_index = 0,
+                                          .type = RuleType::ABOVE,
+                                          .limit = -5}));
+  TEST_ASSERT_NOT_NULL(alarm_rules::validate({.chan_id = "lc",
+                                              .value_index = 0,
+                                              .type = RuleType::ABOVE,
+                                              .limit = 5}));
+  TEST_ASSERT_NOT_NULL(alarm_rules::validate(
+      {.chan_id = "lc1", .value_index = 0, .type = (RuleType)7}));
+  TEST_ASSERT_NOT_NULL(alarm_rules::validate({.chan_id = "lc1",
+                                              .value_index = 0,
+                                              .type = RuleType::RATE,
+                                              .limit = 5,
+                                              .span = 0}));
+  TEST_ASSERT_NOT_NULL(alarm_rules::validate({.chan_id = "lc1",
+                                              .value_index = 0,
+                                              .type = RuleType::SPREAD,
+                                              .limit = 5,
+                                              .span = 65}));
+
+  RuleEngine engine;
+  Rule rules[alarm_rules::kMaxRules + 1] = {};
+  TEST_ASSERT_NOT_NULL(engine.set_rules(rules, alarm_rules::kMaxRules + 1));
+  TEST_ASSERT_EQUAL(0, engine.num_rules());
+}
+
+// Matches on the sample that crosses the threshold, once.
+void test_threshold() {
+  RuleEngine engine;
+  const Rule rules[] = {
+      {.chan_id = "tm1",
+       .value_index = 0,
+       .type = RuleType::ABOVE,
+       .limit = 100},
+      {.chan_id = "pw1", .value_index = 1, .type = RuleType::BELOW,
+       .limit = -10},
+  };
+  TEST_ASSERT_NULL(engine.set_rules(rules, 2));
+  TEST_ASSERT_TRUE(engine.has_rules("tm1"));
+  TEST_ASSERT_FALSE(engine.has_rules("tm2"));
+
+  const int32_t values[] = {90, 99, 101, 150, 100, 120};
+  uint32_t n = engine.process("tm1", 0, values, 6, 1000, kIntervalUsecs,
+                              matches, kMaxMatches);
+  TEST_ASSERT_EQUAL(2, n);
+  TEST_ASSERT_EQUAL(0, matches[0].rule_index);
+  TEST_ASSERT_EQUAL(101, matches[0].value);
+  TEST_ASSERT_EQUAL(1000 + 2 * kIntervalUsecs, matches[0].sample_micros);
+  TEST_ASSERT_EQUAL(120, matches[1].value);
+
+  // Other channels and values don't match.
+  n = engine.process("tm2", 0, values, 6, 1000, kIntervalUsecs, matches,
+                     kMaxMatches);
+  TEST_ASSERT_EQUAL(0, n);
+  const int32_t current[] = {-11};
+  n = engine.process("pw1", 0, current, 1, 0, kIntervalUsecs, matches,
+                     kMaxMatches);
+  TEST_ASSERT_EQUAL(0, n);
+  n = engine.process("pw1", 1, current, 1, 0, kIntervalUsecs, matches,
+                     kMaxMatches);
+  TEST_ASSERT_EQUAL(1, n);
+  TEST_ASSERT_EQUAL(1, matches[0].rule_index);
+}
+
+void test_holdoff() {
+  RuleEngine engine;
+  const Rule rules[] = {{.chan_id = "lc1",
+                         .value_index = 0,
+                         .type = RuleType::ABOVE,
+                         .limit = 0,
+                         .span = 0,
+                         .holdoff_millis = 1}};
+  TEST_ASSERT_NULL(engine.set_rules(rules, 1));
+  // A match every 4 samples (500us) but the hold off is 1ms.
+  int32_t values[16];
+  for (int i = 0; i < 16; i++) {
+    values[i] = (i % 4 == 0) ? 1 : 0;
+  }
+  const uint32_t n = engine.process("lc1", 0, values, 16, 0, kIntervalUsecs,
+                                    matches, kMaxMatches);
+  TEST_ASSERT_EQUAL(2, n);
+  TEST_ASSERT_EQUAL(0, matches[0].sample_micros);
+  TEST_ASSERT_EQUAL(8 * kIntervalUsecs, matches[1].sample_micros);
+}
+
+void test_rate() {
+  RuleEngine engine;
+  const Rule rules[] = {{.chan_id = "lc1",
+                         .value_index = 0,
+                         .type = RuleType::RATE,
+                         .limit = 50,
+                         .span = 3}};
+  TEST_ASSERT_NULL(engine.set_rules(rules, 1));
+  // A ramp of 20 per sample, matches once, and then slows down.
+  const int32_t values1[] = {0, 20, 40, 60, 80};
+  const int32_t values2[] = {100, 90, 80};
+  uint32_t n = engine.process("lc1", 0, values1, 5, 0, kIntervalUsecs, matches,
+                              kMaxMatches);
+  TEST_ASSERT_EQUAL(1, n);
+  TEST_ASSERT_EQUAL(60, matches[0].value);
+  TEST_ASSERT_EQUAL(3 * kIntervalUsecs, matches[0].sample_micros);
+  n = engine.process("lc1", 0, values2, 3, 5 * kIntervalUsecs, kIntervalUsecs,
+                     matches, kMaxMatches);
+  TEST_ASSERT_EQUAL(0, n);
+
+  // After a gap the history restarts so the step is not seen.
+  const int32_t values3[] = {1000, 1000, 1000};
+  n = engine.process("lc1", 0, values3, 3, 100 * kIntervalUsecs,
+                     kIntervalUsecs, matches, kMaxMatches);
+  TEST_ASSERT_EQUAL(0, n);
+}
+
+void test_spread() {
+  RuleEngine engine;
+  const Rule rules[] = {{.chan_id = "lc1",
+                         .value_index = 0,
+                         .type = RuleType::SPREAD,
+                         .limit = 10,
+                         .span = 4}};
+  TEST_ASSERT_NULL(engine.set_rules(rules, 1));
+  const int32_t values[] = {0, 5, -5, 5, 0, 0, 0, 0, 0, 10};
+  const uint32_t n = engine.process("lc1", 0, values, 10, 0, kIntervalUsecs,
+                                    matches, kMaxMatches);
+  TEST_ASSERT_EQUAL(0, n);
+  const int32_t values2[] = {-2};
+  TEST_ASSERT_EQUAL(1, engine.process("lc1", 0, values2, 1,
+                                      10 * kIntervalUsecs, kIntervalUsecs,
+                                      matches, kMaxMatches));
+  TEST_ASSERT_EQUAL(12, matches[0].value);
+}
+
+void test_dropped_matches() {
+  RuleEngine engine;
+  const Rule rules[] = {
+      {.chan_id = "lc1", .value_index = 0, .type = RuleType::ABOVE, .limit = 0},
+      {.chan_id = "lc1", .value_index = 0, .type = RuleType::BELOW, .limit = 0},
+  };
+  TEST_ASSERT_NULL(engine.set_rules(rules, 2));
+  const int32_t values[] = {1, -1, 1, -1};
+  const uint32_t n = engine.process("lc1", 0, values, 4, 0, kIntervalUsecs,
+                                    matches, 3);
+  TEST_ASSERT_EQUAL(3, n);
+  TEST_ASSERT_EQUAL(1, engine.dropped_matches_count());
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_validate);
+  RUN_TEST(test_threshold);
+  RUN_TEST(test_holdoff);
+  RUN_TEST(test_rate);
+  RUN_TEST(test_spread);
+  RUN_TEST(test_dropped_matches);
+  UNITY_END();
+
+  unity_util::common_end();
+}
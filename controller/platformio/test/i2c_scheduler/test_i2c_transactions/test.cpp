@@ -0,0 +1,252 @@
+// Unit test of the I2C transaction lists with a mock bus.
+
+#include <unity.h>
+
+#include <cstring>
+
+#include "../../unity_util.h"
+#include "i2c_transactions.h"
+
+using i2c_transactions::Executor;
+using i2c_transactions::ListResult;
+using i2c_transactions::Step;
+using i2c_transactions::StepType;
+using i2c_transactions::TransactionList;
+
+// A bus that records the transfers. The test completes them by calling
+// the executor's ISR methods, as the HAL would.
+class MockBus : public i2c_transactions::I2cBus {
+ public:
+  struct Transfer {
+    char type;
+    uint8_t address;
+    uint8_t reg;
+    uint8_t* data;
+    uint16_t size;
+  };
+
+  Transfer transfers[10];
+  int num_transfers = 0;
+  // If >= 0, the transfer with this index fails to start.
+  int fail_start_index = -1;
+  // The bytes that the reads return.
+  uint8_t read_value = 0;
+
+  virtual bool start_write(uint8_t address, uint8_t* data, uint16_t size) {
+    return record('W', address, 0, data, size);
+  }
+  virtual bool start_read(uint8_t address, uint8_t* data, uint16_t size) {
+    memset(data, read_value, size);
+    return record('R', address, 0, data, size);
+  }
+  virtual bool start_write_read(uint8_t address, uint8_t reg, uint8_t* data,
+                                uint16_t size) {
+    memset(data, read_value, size);
+    return record('M', address, reg, data, size);
+  }
+
+ private:
+  bool record(char type, uint8_t address, uint8_t reg, uint8_t* data,
+              uint16_t size) {
+    if (num_transfers == fail_start_index) {
+      return false;
+    }
+    transfers[num_transfers++] = {type, address, reg, data, size};
+    return true;
+  }
+};
+
+class MockListener : public i2c_transactions::ListListener {
+ public:
+  int num_calls = 0;
+  ListResult last_result = {};
+  // If set, starts this list from the callback.
+  Executor* executor = nullptr;
+  const TransactionList* next_list = nullptr;
+
+  virtual void on_list_done_isr(const ListResult& result) {
+    num_calls++;
+    last_result = result;
+    if (executor && next_list) {
+      TEST_ASSERT_TRUE(executor->start(*next_list));
+      next_list = nullptr;
+    }
+  }
+};
+
+// A fresh bus, listener and executor per test.
+struct Fixture {
+  MockBus bus;
+  MockListener listener;
+  Executor executor{&bus, &listener};
+};
+
+static uint8_t config[3] = {0x01, 0x85, 0x83};
+static uint8_t value[2];
+static uint8_t raw[4];
+
+static const Step kSteps[] = {
+    {.type = StepType::WRITE_READ, .reg = 0x00, .data = value, .size = 2},
+    {.type = StepType::WRITE, .reg = 0, .data = config, .size = 3},
+    {.type = StepType::READ, .reg = 0, .data = raw, .size = 4},
+};
+
+static const TransactionList kList = {
+    .device_address = 0x90, .num_steps = 3, .steps = kSteps};
+
+void setUp() {
+  memset(value, 0, sizeof(value));
+  memset(raw, 0, sizeof(raw));
+}
+
+void tearDown() {}
+
+// The steps are chained from the completion ISRs with a single
+// notification at the end.
+void test_chained_steps() {
+  Fixture f;
+  f.bus.read_value = 0x5a;
+  TEST_ASSERT_TRUE(f.executor.start(kList));
+  TEST_ASSERT_TRUE(f.executor.is_busy());
+  TEST_ASSERT_EQUAL(1, f.bus.num_transfers);
+  TEST_ASSERT_EQUAL('M', f.bus.transfers[0].type);
+  TEST_ASSERT_EQUAL_HEX8(0x90, f.bus.transfers[0].address);
+  TEST_ASSERT_EQUAL_HEX8(0x00, f.bus.transfers[0].reg);
+  TEST_ASSERT_EQUAL(2, f.bus.transfers[0].size);
+
+  f.executor.on_complete_isr();
+  TEST_ASSERT_EQUAL(2, f.bus.num_transfers);
+  TEST_ASSERT_EQUAL('W', f.bus.transfers[1].type);
+  TEST_ASSERT_EQUAL_PTR(config, f.bus.transfers[1].data);
+  TEST_ASSERT_EQUAL(3, f.bus.transfers[1].size);
+  TEST_ASSERT_EQUAL(0, f.listener.num_calls);
+
+  f.executor.on_complete_isr();
+  TEST_ASSERT_EQUAL(3, f.bus.num_transfers);
+  TEST_ASSERT_EQUAL('R', f.bus.transfers[2].type);
+  TEST_ASSERT_EQUAL(0, f.listener.num_calls);
+
+  f.executor.on_complete_isr();
+  TEST_ASSERT_FALSE(f.executor.is_busy());
+  TEST_ASSERT_EQUAL(1, f.listener.num_calls);
+  TEST_ASSERT_TRUE(f.listener.last_result.ok);
+  TEST_ASSERT_EQUAL(3, f.listener.last_result.steps_completed);
+  TEST_ASSERT_EQUAL_HEX8(0x5a, value[1]);
+  TEST_ASSERT_EQUAL_HEX8(0x5a, raw[3]);
+  TEST_ASSERT_EQUAL(1, f.executor.lists_count());
+  TEST_ASSERT_EQUAL(0, f.executor.errors_count());
+
+  // Stray completions are ignored.
+  f.executor.on_complete_isr();
+  TEST_ASSERT_EQUAL(1, f.listener.num_calls);
+}
+
+// An error ISR ends the list at the failed step.
+void test_error() {
+  Fixture f;
+  TEST_ASSERT_TRUE(f.executor.start(kList));
+  f.executor.on_complete_isr();
+  f.executor.on_error_isr();
+  TEST_ASSERT_FALSE(f.executor.is_busy());
+  TEST_ASSERT_EQUAL(2, f.bus.num_transfers);
+  TEST_ASSERT_EQUAL(1, f.listener.num_calls);
+  TEST_ASSERT_FALSE(f.listener.last_result.ok);
+  TEST_ASSERT_EQUAL(1, f.listener.last_result.steps_completed);
+  TEST_ASSERT_EQUAL(1, f.executor.errors_count());
+}
+
+// A step that can't be started fails the list.
+void test_start_failure() {
+  Fixture f;
+  // The first step. Reported by start().
+  f.bus.fail_start_index = 0;
+  TEST_ASSERT_FALSE(f.executor.start(kList));
+  TEST_ASSERT_FALSE(f.executor.is_busy());
+  TEST_ASSERT_EQUAL(0, f.listener.num_calls);
+
+  // A later step. Reported to the listener.
+  f.bus.fail_start_index = 2;
+  TEST_ASSERT_TRUE(f.executor.start(kList));
+  f.executor.on_complete_isr();
+  f.executor.on_complete_isr();
+  TEST_ASSERT_FALSE(f.executor.is_busy());
+  TEST_ASSERT_EQUAL(1, f.listener.num_calls);
+  TEST_ASSERT_FALSE(f.listener.last_result.ok);
+  TEST_ASSERT_EQUAL(2, f.listener.last_result.steps_completed);
+}
+
+void test_invalid_and_busy() {
+  Fixture f;
+  const TransactionList empty = {.device_address = 0x90, .num_steps = 0,
+                                 .steps = kSteps};
+  TEST_ASSERT_FALSE(f.executor.start(empty));
+  const TransactionList too_long = {
+      .device_address = 0x90,
+      .num_steps = i2c_transactions::kMaxSteps + 1,
+      .steps = kSteps};
+  TEST_ASSERT_FALSE(f.executor.start(too_long));
+  TEST_ASSERT_EQUAL(0, f.bus.num_transfers);
+
+  TEST_ASSERT_TRUE(f.executor.start(kList));
+  TEST_ASSERT_FALSE(f.executor.start(kList));
+  TEST_ASSERT_EQUAL(1, f.bus.num_transfers);
+}
+
+// The listener can start the next list from the completion callback.
+void test_restart_from_listener() {
+  Fixture f;
+  const Step step = {
+      .type = StepType::WRITE, .reg = 0, .data = config, .size = 3};
+  const TransactionList single = {
+      .device_address = 0x92, .num_steps = 1, .steps = &step};
+  f.listener.executor = &f.executor;
+  f.listener.next_list = &kList;
+  TEST_ASSERT_TRUE(f.executor.start(single));
+  f.executor.on_complete_isr();
+  TEST_ASSERT_EQUAL(1, f.listener.num_calls);
+  TEST_ASSERT_TRUE(f.executor.is_busy());
+  TEST_ASSERT_EQUAL(2, f.bus.num_transfers);
+  TEST_ASSERT_EQUAL_HEX8(0x90, f.bus.transfers[1].address);
+  TEST_ASSERT_EQUAL('M', f.bus.transfers[1].type);
+}
+
+// The bus time estimates of the schedule validation.
+void test_bus_time() {
+  // The cube timing of i2c1 with the 120Mhz D2PCLK1. (94 + 1 + 21 + 1) * 3
+  // + 6 clocks.
+  const uint32_t scl_nanos =
+      i2c_transactions::scl_period_nanos(0x20B0155E, 120000000);
+  TEST_ASSERT_EQUAL(2975, scl_nanos);
+
+  // 48 bits for the register read and 38 for the write.
+  const Step steps[] = {
+      {.type = StepType::WRITE_READ, .reg = 0x00, .data = value, .size = 2},
+      {.type = StepType::WRITE, .reg = 0, .data = config, .size = 3},
+  };
+  const TransactionList list = {
+      .device_address = 0x90, .num_steps = 2, .steps = steps};
+  i2c_transactions::BusLoad load = i2c_transactions::list_bus_load(list);
+  TEST_ASSERT_EQUAL(86, load.bits);
+  TEST_ASSERT_EQUAL(2, load.transfers);
+  TEST_ASSERT_EQUAL(256 + 2 * i2c_transactions::kTransferOverheadUsecs,
+                    i2c_transactions::bus_usecs(load, scl_nanos));
+
+  load += i2c_transactions::list_bus_load(list);
+  TEST_ASSERT_EQUAL(172, load.bits);
+  TEST_ASSERT_EQUAL(4, load.transfers);
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_chained_steps);
+  RUN_TEST(test_error);
+  RUN_TEST(test_start_failure);
+  RUN_TEST(test_invalid_and_busy);
+  RUN_TEST(test_restart_from_listener);
+  RUN_TEST(test_bus_time);
+  UNITY_END();
+
+  unity_util::common_end();
+}
@@ -0,0 +1,158 @@
+// Tests the caches and the non cacheable DMA memory: the cache and MPU
+// setup, the placement of the DMA buffers and the integrity of data that
+// the DMA reads and writes while the CPU accesses it through the data
+// cache. Also benchmarks reads from cacheable and non cacheable memory.
+
+#include <unity.h>
+
+#include <cstdio>
+
+#include "../../unity_util.h"
+#include "dma_buffers.h"
+#include "main.h"
+
+static constexpr uint32_t kBufferSize = 2048;
+
+DMA_BUFFER static uint8_t src_buffer[kBufferSize];
+DMA_BUFFER static uint8_t dst_buffer[kBufferSize];
+
+// A cacheable buffer in the AXI SRAM.
+static uint8_t cached_buffer[kBufferSize];
+
+// A memory to memory DMA. DMA2 is not used by the app.
+static DMA_HandleTypeDef hdma;
+
+static void init_dma() {
+  __HAL_RCC_DMA2_CLK_ENABLE();
+  hdma.Instance = DMA2_Stream0;
+  hdma.Init.Request = DMA_REQUEST_MEM2MEM;
+  hdma.Init.Direction = DMA_MEMORY_TO_MEMORY;
+  hdma.Init.PeriphInc = DMA_PINC_ENABLE;
+  hdma.Init.MemInc = DMA_MINC_ENABLE;
+  hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  hdma.Init.Mode = DMA_NORMAL;
+  hdma.Init.Priority = DMA_PRIORITY_LOW;
+  hdma.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+  hdma.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+  hdma.Init.MemBurst = DMA_MBURST_SINGLE;
+  hdma.Init.PeriphBurst = DMA_PBURST_SINGLE;
+  TEST_ASSERT_EQUAL(HAL_OK, HAL_DMA_Init(&hdma));
+}
+
+static void dma_copy(const uint8_t* src, uint8_t* dst, uint32_t n) {
+  TEST_ASSERT_EQUAL(HAL_OK, HAL_DMA_Start(&hdma, (uint32_t)src,
+                                          (uint32_t)dst, n));
+  TEST_ASSERT_EQUAL(HAL_OK, HAL_DMA_PollForTransfer(
+                                &hdma, HAL_DMA_FULL_TRANSFER, 100));
+}
+
+// Reads the n bytes at p. The sum is volatile so the reads are not
+// optimized out.
+static volatile uint32_t bytes_sum;
+static void read_bytes(const uint8_t* p, uint32_t n) {
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    sum += p[i];
+  }
+  bytes_sum = sum;
+}
+
+static uint8_t pattern(uint32_t pass, uint32_t i) {
+  return (uint8_t)(i * 7 + pass * 13 + 1);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_caches_enabled() {
+  TEST_ASSERT_TRUE(SCB->CCR & SCB_CCR_IC_Msk);
+  TEST_ASSERT_TRUE(SCB->CCR & SCB_CCR_DC_Msk);
+}
+
+// Region 0 maps the DMA buffers as normal non cacheable memory.
+void test_mpu_region() {
+  TEST_ASSERT_TRUE(MPU->CTRL & MPU_CTRL_ENABLE_Msk);
+  TEST_ASSERT_TRUE(MPU->CTRL & MPU_CTRL_PRIVDEFENA_Msk);
+
+  MPU->RNR = 0;
+  const uint32_t rbar = MPU->RBAR;
+  const uint32_t rasr = MPU->RASR;
+  TEST_ASSERT_EQUAL_HEX32((uint32_t)_sdma_buffers, rbar & MPU_RBAR_ADDR_Msk);
+  TEST_ASSERT_TRUE(rasr & MPU_RASR_ENABLE_Msk);
+  const uint32_t size_field =
+      (rasr & MPU_RASR_SIZE_Msk) >> MPU_RASR_SIZE_Pos;
+  TEST_ASSERT_EQUAL(dma_buffers::mpu_region_size(), 1UL << (size_field + 1));
+  TEST_ASSERT_EQUAL(dma_buffers::mpu_region_size(),
+                    _edma_buffers - _sdma_buffers);
+  TEST_ASSERT_EQUAL(1, (rasr & MPU_RASR_TEX_Msk) >> MPU_RASR_TEX_Pos);
+  TEST_ASSERT_FALSE(rasr & MPU_RASR_C_Msk);
+  TEST_ASSERT_FALSE(rasr & MPU_RASR_B_Msk);
+}
+
+void test_placement() {
+  TEST_ASSERT_TRUE(dma_buffers::contains(src_buffer, sizeof(src_buffer)));
+  TEST_ASSERT_TRUE(dma_buffers::contains(dst_buffer, sizeof(dst_buffer)));
+  TEST_ASSERT_FALSE(
+      dma_buffers::contains(cached_buffer, sizeof(cached_buffer)));
+  TEST_ASSERT_EQUAL(0, (uint32_t)src_buffer % 32);
+  TEST_ASSERT_EQUAL(0, (uint32_t)dst_buffer % 32);
+}
+
+// The DMA sees the last CPU writes and the CPU sees the DMA writes, with
+// no cache maintenance. Each pass first reads the destination so a
+// cacheable destination would have stale lines in the cache.
+void test_dma_integrity() {
+  init_dma();
+  for (uint32_t pass = 0; pass < 20; pass++) {
+    read_bytes(dst_buffer, kBufferSize);
+    for (uint32_t i = 0; i < kBufferSize; i++) {
+      src_buffer[i] = pattern(pass, i);
+    }
+    dma_copy(src_buffer, dst_buffer, kBufferSize);
+    for (uint32_t i = 0; i < kBufferSize; i++) {
+      TEST_ASSERT_EQUAL_HEX8(pattern(pass, i), dst_buffer[i]);
+    }
+  }
+}
+
+// Reports the cycles of reading a buffer in cacheable and in non
+// cacheable memory.
+void test_benchmark() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  // Load the cacheable buffer into the cache.
+  read_bytes(cached_buffer, kBufferSize);
+
+  uint32_t start = DWT->CYCCNT;
+  read_bytes(cached_buffer, kBufferSize);
+  const uint32_t cached_cycles = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  read_bytes(dst_buffer, kBufferSize);
+  const uint32_t uncached_cycles = DWT->CYCCNT - start;
+
+  char msg[80];
+  snprintf(msg, sizeof(msg),
+           "read %lu bytes: cached %lu cycles, non cacheable %lu cycles",
+           kBufferSize, cached_cycles, uncached_cycles);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_THAN(uncached_cycles, cached_cycles);
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_caches_enabled);
+  RUN_TEST(test_mpu_region);
+  RUN_TEST(test_placement);
+  RUN_TEST(test_dma_integrity);
+  RUN_TEST(test_benchmark);
+  UNITY_END();
+
+  unity_util::common_end();
+}
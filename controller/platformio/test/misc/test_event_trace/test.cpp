@@ -0,0 +1,150 @@
+// Unit test of the event trace ring and of its host link commands, and
+// a benchmark of the cycles per added event.
+
+#include <unity.h>
+
+#include <cstdio>
+
+#include "../../unity_util.h"
+#include "event_trace.h"
+#include "main.h"
+
+static SerialPacketsData command_data;
+static SerialPacketsData response_data;
+
+// Other tasks and interrupts may add events during the tests, so the
+// tests look only at the events of this type.
+static constexpr EventTraceType kTestType = EVENT_TRACE_BUFFER_GRAB;
+
+static PacketStatus send_command(uint8_t op_code) {
+  command_data.clear();
+  command_data.write_uint8(op_code);
+  command_data.read_uint8();
+  response_data.clear();
+  return event_trace::handle_command(op_code, command_data, response_data);
+}
+
+// Stops the trace and returns its number of events.
+static uint16_t stop_trace() {
+  TEST_ASSERT_EQUAL(PacketStatus::OK, send_command(event_trace::STOP_TRACE));
+  TEST_ASSERT_EQUAL(SystemCoreClock / 1000000, response_data.read_uint32());
+  const uint16_t num_events = response_data.read_uint16();
+  const uint8_t num_tasks = response_data.read_uint8();
+  TEST_ASSERT_GREATER_THAN(0, num_tasks);
+  TEST_ASSERT_FALSE(response_data.had_read_errors());
+  return num_events;
+}
+
+// Reads all the events of the stopped trace and returns the args of the
+// test events, in order.
+static uint16_t read_test_args(uint16_t* args, uint16_t max_args) {
+  uint16_t num_args = 0;
+  uint16_t start_index = 0;
+  bool has_more = true;
+  while (has_more) {
+    command_data.clear();
+    command_data.write_uint8(event_trace::READ_TRACE);
+    command_data.write_uint16(start_index);
+    command_data.read_uint8();
+    response_data.clear();
+    TEST_ASSERT_EQUAL(PacketStatus::OK,
+                      event_trace::handle_command(event_trace::READ_TRACE,
+                                                  command_data, response_data));
+    has_more = response_data.read_uint8();
+    const uint8_t n = response_data.read_uint8();
+    for (uint8_t i = 0; i < n; i++) {
+      response_data.read_uint32();
+      const uint8_t type = response_data.read_uint8();
+      response_data.read_uint8();
+      const uint16_t arg = response_data.read_uint16();
+      if (type == kTestType && num_args < max_args) {
+        args[num_args++] = arg;
+      }
+    }
+    TEST_ASSERT_TRUE(response_data.all_read_ok());
+    start_index += n;
+  }
+  return num_args;
+}
+
+void setUp() {
+  TEST_ASSERT_EQUAL(PacketStatus::OK, send_command(event_trace::START_TRACE));
+}
+
+void tearDown() {}
+
+void test_stop_and_read() {
+  for (uint16_t i = 0; i < 3; i++) {
+    event_trace::add(kTestType, 0, 100 + i);
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(3, stop_trace());
+
+  // Events are ignored while stopped.
+  event_trace::add(kTestType, 0, 200);
+
+  uint16_t args[10];
+  TEST_ASSERT_EQUAL(3, read_test_args(args, 10));
+  TEST_ASSERT_EQUAL(100, args[0]);
+  TEST_ASSERT_EQUAL(101, args[1]);
+  TEST_ASSERT_EQUAL(102, args[2]);
+}
+
+void test_read_while_recording() {
+  response_data.clear();
+  command_data.clear();
+  command_data.write_uint8(event_trace::READ_TRACE);
+  command_data.write_uint16(0);
+  command_data.read_uint8();
+  TEST_ASSERT_EQUAL(PacketStatus::GENERAL_ERROR,
+                    event_trace::handle_command(event_trace::READ_TRACE,
+                                                command_data, response_data));
+}
+
+// The ring keeps the last events.
+void test_wrap_around() {
+  constexpr uint16_t kNumAdded = CONFIG_EVENT_TRACE_EVENTS + 5;
+  for (uint16_t i = 0; i < kNumAdded; i++) {
+    event_trace::add(kTestType, 0, i);
+  }
+  TEST_ASSERT_EQUAL(CONFIG_EVENT_TRACE_EVENTS, stop_trace());
+
+  static uint16_t args[CONFIG_EVENT_TRACE_EVENTS];
+  const uint16_t n = read_test_args(args, CONFIG_EVENT_TRACE_EVENTS);
+  TEST_ASSERT_GREATER_THAN(0, n);
+  TEST_ASSERT_EQUAL(kNumAdded - 1, args[n - 1]);
+  for (uint16_t i = 1; i < n; i++) {
+    TEST_ASSERT_EQUAL(args[i - 1] + 1, args[i]);
+  }
+}
+
+// Reports the cycles per added event.
+void test_benchmark() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  constexpr uint32_t kNumEvents = 1000;
+  const uint32_t start = DWT->CYCCNT;
+  for (uint32_t i = 0; i < kNumEvents; i++) {
+    event_trace::add(kTestType, 0, i);
+  }
+  const uint32_t cycles = (DWT->CYCCNT - start) / kNumEvents;
+
+  char msg[60];
+  snprintf(msg, sizeof(msg), "event trace: %lu cycles/event", cycles);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_THAN(50, cycles);
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_stop_and_read);
+  RUN_TEST(test_read_while_recording);
+  RUN_TEST(test_wrap_around);
+  RUN_TEST(test_benchmark);
+  UNITY_END();
+
+  unity_util::common_end();
+}
@@ -0,0 +1,202 @@
+// Unit test and benchmark of the ISR to task notify channel. Compares
+// its cycles per event with the StaticQueue it replaced.
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <unity.h>
+
+#include <cstdio>
+
+#include "../../unity_util.h"
+#include "main.h"
+#include "static_notify_channel.h"
+#include "static_queue.h"
+#include "static_task.h"
+#include "time_util.h"
+
+// Similar in size to the events of the adc card.
+struct Event {
+  uint32_t id;
+  uint32_t seq;
+};
+
+// The FromISR calls below are made from a task, which FreeRTOS allows
+// on the Cortex-M ports.
+static StaticNotifyChannel<Event, 5> channel;
+static StaticQueue<Event, 8> queue;
+
+// Adds events to the channel, from another task, one every 2ms, while
+// items_to_send is positive.
+static volatile uint32_t items_to_send = 0;
+static uint32_t next_seq = 0;
+
+static void producer_task_body_impl(void* ignored_argument) {
+  for (;;) {
+    time_util::delay_millis(2);
+    if (!items_to_send) {
+      continue;
+    }
+    BaseType_t task_woken = pdFALSE;
+    const Event event = {.id = 7, .seq = next_seq};
+    if (channel.add_from_isr(event, &task_woken)) {
+      next_seq++;
+      items_to_send--;
+    }
+    portYIELD_FROM_ISR(task_woken);
+  }
+}
+
+static TaskBodyFunction producer_task_body(producer_task_body_impl, nullptr);
+static StaticTask<1000> producer_task(producer_task_body, "producer", 4);
+
+static void drain() {
+  Event event;
+  while (channel.try_consume(&event)) {
+  }
+}
+
+void setUp() { drain(); }
+
+void tearDown() {}
+
+void test_order_and_capacity() {
+  BaseType_t task_woken = pdFALSE;
+  // Rounded up to a power of 2.
+  TEST_ASSERT_EQUAL(8, channel.capacity);
+  for (uint32_t i = 0; i < 8; i++) {
+    TEST_ASSERT_TRUE(channel.add_from_isr({.id = 1, .seq = i}, &task_woken));
+  }
+  TEST_ASSERT_FALSE(channel.add_from_isr({.id = 1, .seq = 8}, &task_woken));
+  TEST_ASSERT_EQUAL(8, channel.size());
+
+  for (uint32_t i = 0; i < 8; i++) {
+    Event event;
+    TEST_ASSERT_TRUE(channel.consume_from_task(&event, 0));
+    TEST_ASSERT_EQUAL(i, event.seq);
+  }
+  TEST_ASSERT_EQUAL(0, channel.size());
+
+  // The counts wrap around the ring.
+  for (uint32_t i = 0; i < 20; i++) {
+    Event event;
+    TEST_ASSERT_TRUE(channel.add_from_isr({.id = 2, .seq = i}, &task_woken));
+    TEST_ASSERT_TRUE(channel.try_consume(&event));
+    TEST_ASSERT_EQUAL(i, event.seq);
+  }
+}
+
+void test_reset() {
+  BaseType_t task_woken = pdFALSE;
+  TEST_ASSERT_TRUE(channel.add_from_isr({.id = 1, .seq = 0}, &task_woken));
+  TEST_ASSERT_TRUE(channel.add_from_isr({.id = 1, .seq = 1}, &task_woken));
+  channel.reset();
+  TEST_ASSERT_EQUAL(0, channel.size());
+  Event event;
+  TEST_ASSERT_FALSE(channel.try_consume(&event));
+}
+
+// The pending notifications of the consumed events don't end the wait.
+void test_timeout() {
+  BaseType_t task_woken = pdFALSE;
+  for (uint32_t i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(channel.add_from_isr({.id = 1, .seq = i}, &task_woken));
+  }
+  drain();
+  Event event;
+  TEST_ASSERT_FALSE(channel.consume_from_task(&event, 0));
+  const uint32_t start = time_util::millis();
+  TEST_ASSERT_FALSE(channel.consume_from_task(&event, 20));
+  const uint32_t elapsed = time_util::millis() - start;
+  TEST_ASSERT_GREATER_OR_EQUAL(20, elapsed);
+  TEST_ASSERT_LESS_OR_EQUAL(21, elapsed);
+}
+
+// A wake up without an item ends wait_from_task() but not
+// consume_from_task().
+void test_wake_up() {
+  Event event;
+  // Registers this task as the consumer.
+  TEST_ASSERT_FALSE(channel.consume_from_task(&event, 0));
+  channel.wake_up_from_task();
+  TEST_ASSERT_TRUE(channel.wait_from_task(0));
+  TEST_ASSERT_FALSE(channel.wait_from_task(5));
+  channel.wake_up_from_task();
+  TEST_ASSERT_FALSE(channel.consume_from_task(&event, 5));
+}
+
+// Events from another task wake up the consumer, in order.
+void test_producer_task() {
+  TEST_ASSERT_TRUE(producer_task.start());
+  Event event;
+  TEST_ASSERT_FALSE(channel.consume_from_task(&event, 0));
+  const uint32_t first_seq = next_seq;
+  items_to_send = 20;
+  for (uint32_t i = 0; i < 20; i++) {
+    TEST_ASSERT_TRUE(channel.consume_from_task(&event, 100));
+    TEST_ASSERT_EQUAL(7, event.id);
+    TEST_ASSERT_EQUAL(first_seq + i, event.seq);
+  }
+  TEST_ASSERT_EQUAL(0, items_to_send);
+}
+
+// Reports the cycles of passing an event from an ISR and consuming it by
+// the task, without blocking, with the channel and with the queue. Uses
+// the DWT cycle counter.
+void test_benchmark() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  constexpr uint32_t kNumEvents = 1000;
+  BaseType_t task_woken = pdFALSE;
+  Event event;
+
+  // Registers this task as the consumer, so the channel also pays for
+  // the notification.
+  TEST_ASSERT_FALSE(channel.consume_from_task(&event, 0));
+  uint32_t start = DWT->CYCCNT;
+  for (uint32_t i = 0; i < kNumEvents; i++) {
+    if (!channel.add_from_isr({.id = 1, .seq = i}, &task_woken) ||
+        !channel.consume_from_task(&event, 0)) {
+      TEST_FAIL();
+    }
+  }
+  const uint32_t channel_cycles = (DWT->CYCCNT - start) / kNumEvents;
+
+  queue.reset();
+  start = DWT->CYCCNT;
+  for (uint32_t i = 0; i < kNumEvents; i++) {
+    if (!queue.add_from_isr({.id = 1, .seq = i}, &task_woken) ||
+        !queue.consume_from_task(&event, 0)) {
+      TEST_FAIL();
+    }
+  }
+  const uint32_t queue_cycles = (DWT->CYCCNT - start) / kNumEvents;
+
+  char msg[60];
+  snprintf(msg, sizeof(msg), "notify channel: %lu cycles/event",
+           channel_cycles);
+  TEST_MESSAGE(msg);
+  snprintf(msg, sizeof(msg), "static queue: %lu cycles/event", queue_cycles);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_THAN(queue_cycles, channel_cycles);
+
+  // Drop the pending notifications of the benchmark.
+  channel.wait_from_task(0);
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_order_and_capacity);
+  RUN_TEST(test_reset);
+  RUN_TEST(test_timeout);
+  RUN_TEST(test_wake_up);
+  RUN_TEST(test_producer_task);
+  RUN_TEST(test_benchmark);
+  UNITY_END();
+
+  unity_util::common_end();
+}
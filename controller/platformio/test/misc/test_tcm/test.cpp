@@ -0,0 +1,221 @@
+// Tests the placement of code and data in the ITCM and DTCM, and
+// benchmarks them against the flash and the AXI SRAM: the interrupt
+// entry latency, the CRC and the packet encoding.
+
+#include <unity.h>
+
+#include <cstdio>
+
+#include "../../unity_util.h"
+#include "main.h"
+#include "serial_packets_crc.h"
+#include "serial_packets_encoder.h"
+#include "tcm.h"
+
+static constexpr uintptr_t kItcmStart = 0x00000000;
+static constexpr uintptr_t kItcmEnd = 0x00010000;
+static constexpr uintptr_t kDtcmStart = 0x20000000;
+static constexpr uintptr_t kDtcmEnd = 0x20020000;
+
+static bool in_itcm(const void* p) {
+  const uintptr_t addr = (uintptr_t)p;
+  return addr >= kItcmStart && addr < kItcmEnd;
+}
+
+static bool in_dtcm(const void* p) {
+  const uintptr_t addr = (uintptr_t)p;
+  return addr >= kDtcmStart && addr < kDtcmEnd;
+}
+
+DTCM_DATA static uint32_t dtcm_data_value = 0x12345678;
+DTCM_BSS static uint32_t dtcm_bss_values[4];
+
+// The CRC of serial_packets_crc.cpp, with the table and the code in the
+// flash, as before the TCM placement.
+static const uint16_t kFlashCrcTable[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7, 0x8108,
+    0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF, 0x1231, 0x0210,
+    0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6, 0x9339, 0x8318, 0xB37B,
+    0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE, 0x2462, 0x3443, 0x0420, 0x1401,
+    0x64E6, 0x74C7, 0x44A4, 0x5485, 0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE,
+    0xF5CF, 0xC5AC, 0xD58D, 0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6,
+    0x5695, 0x46B4, 0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D,
+    0xC7BC, 0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B, 0x5AF5,
+    0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12, 0xDBFD, 0xCBDC,
+    0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A, 0x6CA6, 0x7C87, 0x4CE4,
+    0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41, 0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD,
+    0xAD2A, 0xBD0B, 0x8D68, 0x9D49, 0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13,
+    0x2E32, 0x1E51, 0x0E70, 0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A,
+    0x9F59, 0x8F78, 0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E,
+    0xE16F, 0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E, 0x02B1,
+    0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256, 0xB5EA, 0xA5CB,
+    0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D, 0x34E2, 0x24C3, 0x14A0,
+    0x0481, 0x7466, 0x6447, 0x5424, 0x4405, 0xA7DB, 0xB7FA, 0x8799, 0x97B8,
+    0xE75F, 0xF77E, 0xC71D, 0xD73C, 0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657,
+    0x7676, 0x4615, 0x5634, 0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9,
+    0xB98A, 0xA9AB, 0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882,
+    0x28A3, 0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92, 0xFD2E,
+    0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9, 0x7C26, 0x6C07,
+    0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1, 0xEF1F, 0xFF3E, 0xCF5D,
+    0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8, 0x6E17, 0x7E36, 0x4E55, 0x5E74,
+    0x2E93, 0x3EB2, 0x0ED1, 0x1EF0};
+
+__attribute__((noinline)) static uint16_t flash_crc16(const uint8_t* buffer,
+                                                      int size,
+                                                      uint16_t initial_crc) {
+  uint16_t crc = initial_crc;
+  for (int i = 0; i < size; i++) {
+    crc = (crc << 8) ^ kFlashCrcTable[(crc >> 8) ^ buffer[i]];
+  }
+  return crc;
+}
+
+// The same packets, encoded with the encoder and buffers in the DTCM,
+// and in the AXI SRAM.
+DTCM_BSS static SerialPacketsEncoder dtcm_encoder;
+DTCM_BSS static SerialPacketsData dtcm_data;
+DTCM_BSS static StuffedPacketBuffer dtcm_stuffed;
+static SerialPacketsEncoder axi_encoder;
+static SerialPacketsData axi_data;
+static StuffedPacketBuffer axi_stuffed;
+
+// Handlers of two unused interrupts, one in the ITCM (per the
+// *_IRQHandler pattern of the linker script) and one that is kept in
+// the flash. They record the cycle count at their entry.
+static volatile uint32_t isr_entry_cycles = 0;
+
+extern "C" void WWDG_IRQHandler(void) { isr_entry_cycles = DWT->CYCCNT; }
+
+extern "C" __attribute__((section(".text.test_flash_isr"))) void
+PVD_AVD_IRQHandler(void) {
+  isr_entry_cycles = DWT->CYCCNT;
+}
+
+static void enable_cycle_counter() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+// Returns the min cycles from pending the interrupt to its handler entry.
+static uint32_t isr_latency_cycles(IRQn_Type irq) {
+  HAL_NVIC_SetPriority(irq, 5, 0);
+  HAL_NVIC_EnableIRQ(irq);
+  uint32_t min_cycles = UINT32_MAX;
+  for (int i = 0; i < 100; i++) {
+    isr_entry_cycles = 0;
+    const uint32_t start = DWT->CYCCNT;
+    NVIC_SetPendingIRQ(irq);
+    __DSB();
+    __ISB();
+    const uint32_t cycles = isr_entry_cycles - start;
+    if (isr_entry_cycles && cycles < min_cycles) {
+      min_cycles = cycles;
+    }
+  }
+  HAL_NVIC_DisableIRQ(irq);
+  return min_cycles;
+}
+
+static void report(const char* name, uint32_t value, const char* units) {
+  char msg[80];
+  snprintf(msg, sizeof(msg), "%s: %lu %s", name, value, units);
+  TEST_MESSAGE(msg);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_placement() {
+  TEST_ASSERT_TRUE(in_itcm((const void*)&serial_packets_gen_crc16));
+  TEST_ASSERT_TRUE(in_itcm((const void*)&WWDG_IRQHandler));
+  TEST_ASSERT_FALSE(in_itcm((const void*)&PVD_AVD_IRQHandler));
+  TEST_ASSERT_FALSE(in_itcm((const void*)&flash_crc16));
+
+  // Initialized by the startup code.
+  TEST_ASSERT_TRUE(in_dtcm(&dtcm_data_value));
+  TEST_ASSERT_EQUAL_HEX32(0x12345678, dtcm_data_value);
+  TEST_ASSERT_TRUE(in_dtcm(dtcm_bss_values));
+  for (uint32_t v : dtcm_bss_values) {
+    TEST_ASSERT_EQUAL(0, v);
+  }
+  TEST_ASSERT_TRUE(in_dtcm(&dtcm_encoder));
+  TEST_ASSERT_FALSE(in_dtcm(&axi_encoder));
+}
+
+void test_isr_latency() {
+  enable_cycle_counter();
+  const uint32_t itcm_cycles = isr_latency_cycles(WWDG_IRQn);
+  const uint32_t flash_cycles = isr_latency_cycles(PVD_AVD_IRQn);
+  report("isr latency, itcm handler", itcm_cycles, "cycles");
+  report("isr latency, flash handler", flash_cycles, "cycles");
+  TEST_ASSERT_NOT_EQUAL(UINT32_MAX, itcm_cycles);
+  TEST_ASSERT_NOT_EQUAL(UINT32_MAX, flash_cycles);
+  TEST_ASSERT_LESS_OR_EQUAL(flash_cycles, itcm_cycles);
+}
+
+void test_crc_benchmark() {
+  enable_cycle_counter();
+  static uint8_t bytes[1000];
+  for (uint32_t i = 0; i < sizeof(bytes); i++) {
+    bytes[i] = i * 7;
+  }
+  TEST_ASSERT_EQUAL_HEX16(flash_crc16(bytes, sizeof(bytes), 0xffff),
+                          serial_packets_gen_crc16(bytes, sizeof(bytes)));
+
+  uint32_t start = DWT->CYCCNT;
+  serial_packets_gen_crc16(bytes, sizeof(bytes));
+  const uint32_t tcm_cycles = DWT->CYCCNT - start;
+  start = DWT->CYCCNT;
+  flash_crc16(bytes, sizeof(bytes), 0xffff);
+  const uint32_t flash_cycles = DWT->CYCCNT - start;
+
+  report("crc of 1000 bytes, tcm", tcm_cycles, "cycles");
+  report("crc of 1000 bytes, flash", flash_cycles, "cycles");
+  TEST_ASSERT_LESS_OR_EQUAL(flash_cycles, tcm_cycles);
+}
+
+// Returns the cycles of encoding a packet with the given objects.
+static uint32_t encode_cycles(SerialPacketsEncoder& encoder,
+                              SerialPacketsData& data,
+                              StuffedPacketBuffer& stuffed) {
+  data.clear();
+  for (int i = 0; i < 900; i++) {
+    // Some bytes need stuffing.
+    data.write_uint8(0x70 + (i % 16));
+  }
+  const uint32_t start = DWT->CYCCNT;
+  TEST_ASSERT_TRUE(encoder.encode_message_packet(0x01, data, &stuffed));
+  return DWT->CYCCNT - start;
+}
+
+void test_encode_benchmark() {
+  enable_cycle_counter();
+  const uint32_t dtcm_cycles =
+      encode_cycles(dtcm_encoder, dtcm_data, dtcm_stuffed);
+  const uint32_t axi_cycles = encode_cycles(axi_encoder, axi_data, axi_stuffed);
+  TEST_ASSERT_EQUAL(axi_stuffed.size(), dtcm_stuffed.size());
+
+  report("encode 900 bytes, dtcm", dtcm_cycles, "cycles");
+  report("encode 900 bytes, axi sram", axi_cycles, "cycles");
+  report("encode throughput, dtcm",
+         900 * (SystemCoreClock / 1000000) / dtcm_cycles, "bytes/usec");
+  TEST_ASSERT_LESS_OR_EQUAL(axi_cycles, dtcm_cycles);
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_placement);
+  RUN_TEST(test_isr_latency);
+  RUN_TEST(test_crc_benchmark);
+  RUN_TEST(test_encode_benchmark);
+  UNITY_END();
+
+  unity_util::common_end();
+}
@@ -56,8 +56,55 @@ void test_reset_elapsed() {
   TEST_ASSERT_LESS_OR_EQUAL(1, timer.elapsed_millis());
 }
 
+void test_micros_rate() {
+  const uint32_t start = time_util::micros();
+  time_util::delay_millis(100);
+  const uint32_t elapsed = time_util::micros() - start;
+  TEST_ASSERT_GREATER_OR_EQUAL(99000, elapsed);
+  TEST_ASSERT_LESS_OR_EQUAL(101000, elapsed);
+}
+
+// micros() is millis() * 1000 plus the usecs since the tick.
+void test_micros_aligned_with_millis() {
+  for (int i = 0; i < 20; i++) {
+    const uint32_t millis = time_util::millis();
+    const uint32_t micros = time_util::micros();
+    const int32_t usecs_in_millis = (int32_t)(micros - millis * 1000);
+    // We allow a tick between the two reads.
+    TEST_ASSERT_GREATER_OR_EQUAL(0, usecs_in_millis);
+    TEST_ASSERT_LESS_THAN(2000, usecs_in_millis);
+    time_util::delay_millis(7);
+  }
+}
+
+void test_split_micros() {
+  uint32_t millis;
+  uint32_t usecs;
+
+  time_util::split_micros(1234567, 1234, &millis, &usecs);
+  TEST_ASSERT_EQUAL(1234, millis);
+  TEST_ASSERT_EQUAL(567, usecs);
+
+  // Before the ref millis.
+  time_util::split_micros(1234567, 1300, &millis, &usecs);
+  TEST_ASSERT_EQUAL(1234, millis);
+  TEST_ASSERT_EQUAL(567, usecs);
+
+  time_util::split_micros(1233000, 1234, &millis, &usecs);
+  TEST_ASSERT_EQUAL(1233, millis);
+  TEST_ASSERT_EQUAL(0, usecs);
+
+  // The usecs counter wraps around before the millis.
+  const uint32_t ref_millis = 4294968;
+  const uint32_t t_micros = ref_millis * 1000 + 123;
+  time_util::split_micros(t_micros, ref_millis, &millis, &usecs);
+  TEST_ASSERT_EQUAL(ref_millis, millis);
+  TEST_ASSERT_EQUAL(123, usecs);
+}
+
 void app_main() {
   unity_util::common_start();
+  time_util::setup();
 
   UNITY_BEGIN();
   RUN_TEST(test_tick_rate);
@@ -66,6 +113,9 @@ void app_main() {
   RUN_TEST(test_elapsed);
   RUN_TEST(test_set_elapsed);
   RUN_TEST(test_reset_elapsed);
+  RUN_TEST(test_micros_rate);
+  RUN_TEST(test_micros_aligned_with_millis);
+  RUN_TEST(test_split_micros);
   UNITY_END();
 
   unity_util::common_end();
@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "../../unity_util.h"
+#include "dma_buffers.h"
 #include "fatfs.h"
 #include "serial_packets_data.h"
 #include "text_util.h"
@@ -15,7 +16,11 @@
 
 constexpr uint32_t kBytesToTest = 10000000;
 constexpr uint32_t kBytesPerPacket = 720;
-static uint8_t buffer[kBytesPerPacket];
+// The SD DMA reads and writes the buffers, so they are in the non
+// cacheable DMA memory.
+DMA_BUFFER static uint8_t buffer[kBytesPerPacket];
+DMA_BUFFER static FATFS fatfs;
+DMA_BUFFER static FIL file;
 static StuffedPacketBuffer stuffed_packet;
 
 static TCHAR file1_wname[20];
@@ -30,11 +35,11 @@ void setUp() {
 void tearDown() {}
 
 void test_read_write() {
-  volatile FRESULT status = f_mount(&SDFatFS, (TCHAR const*)SDPath, 0);
+  volatile FRESULT status = f_mount(&fatfs, (TCHAR const*)SDPath, 0);
   TEST_ASSERT_EQUAL(status, FRESULT::FR_OK);
 
   // ----- Write file
-  status = f_open(&SDFile, file1_wname, FA_CREATE_ALWAYS | FA_WRITE);
+  status = f_open(&file, file1_wname, FA_CREATE_ALWAYS | FA_WRITE);
   TEST_ASSERT_EQUAL(status, FRESULT::FR_OK);
 
   uint32_t bytes_written = 0;
@@ -52,19 +57,19 @@ void test_read_write() {
     stuffed_packet.read_bytes(buffer, n);
     TEST_ASSERT_FALSE(stuffed_packet.had_read_errors());
     unsigned int bytes_written;
-    status = f_write(&SDFile, buffer, n, &bytes_written);
+    status = f_write(&file, buffer, n, &bytes_written);
     TEST_ASSERT_EQUAL(status, FRESULT::FR_OK);
     TEST_ASSERT_EQUAL(bytes_written, n);
 
-    status = f_sync(&SDFile);
+    status = f_sync(&file);
     TEST_ASSERT_EQUAL(status, FRESULT::FR_OK);
   }
 
-  f_close(&SDFile);
+  f_close(&file);
 
   // ----- Write file
 
-  status = f_open(&SDFile, file1_wname, FA_OPEN_EXISTING | FA_READ);
+  status = f_open(&file, file1_wname, FA_OPEN_EXISTING | FA_READ);
   TEST_ASSERT_EQUAL(status, FRESULT::FR_OK);
 
   uint32_t bytes_verified = 0;
@@ -72,7 +77,7 @@ void test_read_write() {
     static_assert(sizeof(buffer) >= kBytesPerPacket);
     uint32_t n = std::min(kBytesPerPacket, (kBytesToTest - bytes_verified));
     unsigned int bytes_read;
-    status = f_read(&SDFile, buffer, n, &bytes_read);
+    status = f_read(&file, buffer, n, &bytes_read);
     TEST_ASSERT_EQUAL(status, FRESULT::FR_OK);
     TEST_ASSERT_EQUAL(bytes_read, n);
 
@@ -88,9 +93,9 @@ void test_read_write() {
     TEST_ASSERT_TRUE(stuffed_packet.all_read_ok());
   }
 
-  f_close(&SDFile);
+  f_close(&file);
 
-  f_mount(&SDFatFS, (TCHAR const*)NULL, 0);
+  f_mount(&fatfs, (TCHAR const*)NULL, 0);
 }
 
 void app_main() {
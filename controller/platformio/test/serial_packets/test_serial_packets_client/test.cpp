@@ -48,7 +48,12 @@ struct FakeResponse {
 
 static FakeResponse fake_response;
 
-PacketStatus command_handler(uint8_t endpoint, const SerialPacketsData& data,
+// The cmd_id of a command whose handler returned PENDING, or zero
+// if none.
+static volatile uint32_t pending_cmd_id = 0;
+
+PacketStatus command_handler(uint8_t endpoint, uint32_t cmd_id,
+                             const SerialPacketsData& data,
                              SerialPacketsData& response_data) {
   // Record the incoming command.
   Command item;
@@ -56,6 +61,11 @@ PacketStatus command_handler(uint8_t endpoint, const SerialPacketsData& data,
   item.endpoint = endpoint;
   item.data = copy_data(data);
   command_list.push_back(item);
+  // For a deferred response, the responder task sends the response.
+  if (fake_response.status == PacketStatus::PENDING) {
+    pending_cmd_id = cmd_id;
+    return PacketStatus::PENDING;
+  }
   // Return a requested fake response.
   populate_data(response_data, fake_response.data);
   if (fake_response.delay) {
@@ -85,8 +95,28 @@ void rx_task_body(void* argument) {
 
 static StaticTask<2000> rx_task(rx_task_body, "rx_test", 5);
 
+// Sends the response of deferred commands, after the fake response delay.
+void responder_task_body(void* argument) {
+  static SerialPacketsData response_data;
+  for (;;) {
+    const uint32_t cmd_id = pending_cmd_id;
+    if (!cmd_id) {
+      time_util::delay_millis(2);
+      continue;
+    }
+    time_util::delay_millis(fake_response.delay);
+    populate_data(response_data, {0xaa, 0xbb, 0xcc});
+    pending_cmd_id = 0;
+    client->sendResponse(cmd_id, (PacketStatus)0x99, response_data);
+  }
+}
+
+static StaticTask<2000> responder_task(responder_task_body, "responder", 4);
+
 void setUp() {
   rx_task.stop();
+  responder_task.stop();
+  pending_cmd_id = 0;
   packet_data.clear();
   client.reset();
   client = std::make_unique<SerialPacketsClient>();
@@ -185,6 +215,30 @@ void test_command_timeout() {
   assert_data_equal(packet_data, {});
 }
 
+// The command handler returns PENDING and a different task sends
+// the response later.
+void test_deferred_command_response() {
+  rx_task.start();
+  responder_task.start();
+
+  const std::vector<uint8_t> data = {0x11, 0x22, 0x33};
+  populate_data(packet_data, data);
+  fake_response.set(PacketStatus::PENDING, {}, 100);
+
+  Elappsed timer;
+  const PacketStatus status = client->sendCommand(0x20, packet_data, 1000);
+  const uint32_t time_millis = timer.elapsed_millis();
+  // We get back the status the responder task sent.
+  TEST_ASSERT_EQUAL(0x99, status);
+  TEST_ASSERT_GREATER_OR_EQUAL(100, time_millis);
+  TEST_ASSERT_LESS_OR_EQUAL(200, time_millis);
+
+  TEST_ASSERT_EQUAL(1, command_list.size());
+  TEST_ASSERT_EQUAL(0, message_list.size());
+  TEST_ASSERT_EQUAL(0, client->num_pending_commands());
+  assert_data_equal(packet_data, {0xaa, 0xbb, 0xcc});
+}
+
 void app_main() {
   unity_util::common_start();
 
@@ -196,6 +250,7 @@ void app_main() {
   RUN_TEST(test_send_message_loop);
   RUN_TEST(test_send_command_loop);
   RUN_TEST(test_command_timeout);
+  RUN_TEST(test_deferred_command_response);
 
   UNITY_END();
 
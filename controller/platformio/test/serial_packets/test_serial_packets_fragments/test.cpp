@@ -0,0 +1,176 @@
+// Unit test of fragmented transfers. The data serial is looped back so
+// the client receives its own fragments and acks.
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <unity.h>
+
+#include <memory>
+#include <vector>
+
+#include "../../unity_util.h"
+#include "../serial_packets_test_utils.h"
+#include "serial_packets_client.h"
+#include "serial_packets_fragments.h"
+#include "static_task.h"
+#include "time_util.h"
+
+static Serial& DATA_SERIAL = serial::serial1;
+
+static constexpr uint8_t kDataEndpoint = 0x21;
+static constexpr uint8_t kAckEndpoint = 0x22;
+
+static std::unique_ptr<SerialPacketsClient> client;
+static std::unique_ptr<SerialPacketsFragmentSender> sender;
+static std::unique_ptr<SerialPacketsFragmentReceiver> receiver;
+
+// Transfer data and reassembly buffer.
+static uint8_t source_bytes[5000];
+static uint8_t received_bytes[5000];
+
+// Number of fragments to drop at the receiver, after passing
+// fragments_to_pass fragments, to test resending.
+static int fragments_to_pass = 0;
+static int fragments_to_drop = 0;
+
+PacketStatus command_handler(uint8_t endpoint, uint32_t cmd_id,
+                             const SerialPacketsData& data,
+                             SerialPacketsData& response_data) {
+  return PacketStatus::UNHANDLED;
+}
+
+void message_handler(uint8_t endpoint, const SerialPacketsData& data) {
+  if (endpoint == kDataEndpoint) {
+    if (fragments_to_pass > 0) {
+      fragments_to_pass--;
+    } else if (fragments_to_drop > 0) {
+      fragments_to_drop--;
+      return;
+    }
+    receiver->on_fragment_message(data);
+    return;
+  }
+  if (endpoint == kAckEndpoint) {
+    sender->on_ack_message(data);
+  }
+}
+
+bool data_source(void* context, uint32_t offset, uint8_t* buffer,
+                 uint16_t size) {
+  memcpy(buffer, &source_bytes[offset], size);
+  return true;
+}
+
+void rx_task_body(void* argument) {
+  // Should not return.
+  client->rx_task_body();
+  error_handler::Panic(89);
+}
+
+static StaticTask<2000> rx_task(rx_task_body, "rx_test", 5);
+
+void setUp() {
+  rx_task.stop();
+  client.reset();
+  client = std::make_unique<SerialPacketsClient>();
+  sender = std::make_unique<SerialPacketsFragmentSender>(*client);
+  receiver = std::make_unique<SerialPacketsFragmentReceiver>(*client);
+
+  // Clear serial input
+  time_util::delay_millis(100);
+  DATA_SERIAL.clear();
+
+  PacketStatus status =
+      client->begin(DATA_SERIAL, command_handler, message_handler);
+  TEST_ASSERT_EQUAL(PacketStatus::OK, status);
+
+  for (uint32_t i = 0; i < sizeof(source_bytes); i++) {
+    source_bytes[i] = i * 7 + (i >> 8);
+  }
+  memset(received_bytes, 0, sizeof(received_bytes));
+  fragments_to_pass = 0;
+  fragments_to_drop = 0;
+}
+
+void tearDown() {}
+
+void test_transfer_to_buffer() {
+  rx_task.start();
+  receiver->begin(0x1234, kAckEndpoint, received_bytes,
+                  sizeof(received_bytes));
+
+  const PacketStatus status =
+      sender->send(kDataEndpoint, 0x1234, sizeof(source_bytes), data_source,
+                   nullptr, 3, 200);
+  TEST_ASSERT_EQUAL(PacketStatus::OK, status);
+  TEST_ASSERT_TRUE(receiver->is_done());
+  TEST_ASSERT_EQUAL(sizeof(source_bytes), receiver->received_bytes());
+  TEST_ASSERT_EQUAL_MEMORY(source_bytes, received_bytes,
+                           sizeof(source_bytes));
+}
+
+// A lost fragment is resent after the ack timeout.
+void test_transfer_with_lost_fragment() {
+  rx_task.start();
+  receiver->begin(0x1235, kAckEndpoint, received_bytes,
+                  sizeof(received_bytes));
+  fragments_to_drop = 1;
+
+  const PacketStatus status =
+      sender->send(kDataEndpoint, 0x1235, sizeof(source_bytes), data_source,
+                   nullptr, 3, 200);
+  TEST_ASSERT_EQUAL(PacketStatus::OK, status);
+  TEST_ASSERT_TRUE(receiver->is_done());
+  TEST_ASSERT_EQUAL_MEMORY(source_bytes, received_bytes,
+                           sizeof(source_bytes));
+}
+
+// A lost fragment in the middle of the window is resent on the
+// duplicate acks of the fragments after it, well before the ack timeout.
+void test_fast_retransmit() {
+  rx_task.start();
+  receiver->begin(0x1237, kAckEndpoint, received_bytes,
+                  sizeof(received_bytes));
+  fragments_to_pass = 1;
+  fragments_to_drop = 1;
+
+  const uint32_t start_millis = time_util::millis();
+  const PacketStatus status =
+      sender->send(kDataEndpoint, 0x1237, sizeof(source_bytes), data_source,
+                   nullptr, 5, 2000);
+  const uint32_t elapsed_millis = time_util::millis() - start_millis;
+  TEST_ASSERT_EQUAL(PacketStatus::OK, status);
+  TEST_ASSERT_TRUE(receiver->is_done());
+  TEST_ASSERT_EQUAL_MEMORY(source_bytes, received_bytes,
+                           sizeof(source_bytes));
+  TEST_ASSERT_LESS_THAN(2000, elapsed_millis);
+}
+
+// The receiver aborts a transfer that doesn't fit its buffer.
+void test_transfer_too_long() {
+  rx_task.start();
+  receiver->begin(0x1236, kAckEndpoint, received_bytes, 100);
+
+  const PacketStatus status =
+      sender->send(kDataEndpoint, 0x1236, sizeof(source_bytes), data_source,
+                   nullptr, 3, 200);
+  TEST_ASSERT_EQUAL(PacketStatus::GENERAL_ERROR, status);
+  TEST_ASSERT_TRUE(receiver->is_aborted());
+}
+
+void app_main() {
+  unity_util::common_start();
+
+  serial::serial1.init();
+
+  UNITY_BEGIN();
+
+  RUN_TEST(test_transfer_to_buffer);
+  RUN_TEST(test_transfer_with_lost_fragment);
+  RUN_TEST(test_fast_retransmit);
+  RUN_TEST(test_transfer_too_long);
+
+  UNITY_END();
+
+  unity_util::common_end();
+}
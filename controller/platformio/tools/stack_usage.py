@@ -0,0 +1,207 @@
+#!python
+
+# Estimates the worst case stack usage of the firmware tasks. Combines
+# the per function stack usage of the .su files that the compiler emits
+# with -fstack-usage, with the call graph that is extracted from the
+# disassembly of the firmware, and compares the deepest call chain of
+# each task with the stack size of its StaticTask<> declaration.
+#
+# Indirect calls (virtual methods, function pointers) and recursion are
+# not followed, so their estimates are lower bounds, marked with '+'.
+# On the other hand, the deepest chain of the static call graph may not
+# be a feasible one, so tasks above their stack size are flagged rather
+# than failing the build, unless --strict is given. The high water marks
+# of the task stacks reports (or host/src/task_stacks.py) complete the
+# picture at runtime.
+#
+# Runs after the build via extra_script.py, or manually:
+#   python tools/stack_usage.py --build_dir .pio/build/my_env \
+#       --objdump arm-none-eabi-objdump --verbose
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+# The entry function of each task, by the task name of its StaticTask.
+TASK_ENTRIES = {
+    "Main": "main_task_body_impl",
+    "Logger": "cdc_serial::logger_task_body_impl",
+    "Host": "host_link::host_link_task_body_impl",
+    "Printer Link": "printer_link_card::printer_link_task_body_impl",
+    "ADC": "adc_card::AdcCard::task_body",
+    "Alarms": "alarms::alarms_task_body_impl",
+    "PW1": "I2cPwDevice::task_body",
+    "DQUE": "data_queue::data_queue_task_body_impl",
+    "Command": "controller::command_task_body_impl",
+    "DNLD": "downloads::downloads_task_body_impl",
+}
+
+# The sources with the StaticTask declarations, relative to the project.
+TASK_SOURCES = ["src/app_main.cpp", "lib/startup/main.cpp"]
+
+# The worst case context that an interrupt or a context switch pushes on
+# the task stack, with the FPU registers.
+CONTEXT_BYTES = 208
+
+TASK_DECL_RE = re.compile(
+    r"StaticTask<(\d+)>\s+\w+\(\s*[\w:]+\s*,\s*\"([^\"]+)\"", re.MULTILINE
+)
+FUNC_HEADER_RE = re.compile(r"^[0-9a-f]+ <(.+)>:$")
+CALL_RE = re.compile(r"\s(bl|blx|b\.w|b)\s+[0-9a-f]+ <(.+)>$")
+# A branch target within a function, e.g. <foo+0x1a>.
+OFFSET_RE = re.compile(r"\+0x[0-9a-f]+$")
+INDIRECT_CALL_RE = re.compile(r"\sblx\s+r\d+")
+
+
+def base_name(name: str) -> str:
+    """Reduces a function name of the .su files or of the disassembly to
+    its qualified name without the return type, parameters and clone
+    suffixes, e.g. 'void ns::Foo::bar(int)' -> 'ns::Foo::bar'."""
+    name = re.sub(r" \[clone [^\]]*\]", "", name)
+    paren = name.find("(")
+    if paren > 0:
+        name = name[:paren]
+    # Drop the return type, skipping the spaces within template args.
+    depth = 0
+    for i in range(len(name) - 1, -1, -1):
+        c = name[i]
+        if c == ">":
+            depth += 1
+        elif c == "<":
+            depth -= 1
+        elif c == " " and depth == 0:
+            name = name[i + 1 :]
+            break
+    return re.sub(r"\.(constprop|isra|part|cold)\.\d+", "", name).strip("*&")
+
+
+def read_stack_usage(build_dir: str) -> dict:
+    """Returns the max frame size and the 'dynamic' flag per function."""
+    frames = {}
+    for root, _, files in os.walk(build_dir):
+        for file in files:
+            if not file.endswith(".su"):
+                continue
+            with open(os.path.join(root, file)) as f:
+                for line in f:
+                    fields = line.rstrip("\n").split("\t")
+                    if len(fields) != 3:
+                        continue
+                    # path:line:col:name
+                    name = base_name(fields[0].split(":", 3)[-1])
+                    size = int(fields[1])
+                    dynamic = "dynamic" in fields[2]
+                    old_size, old_dynamic = frames.get(name, (0, False))
+                    frames[name] = (max(size, old_size), dynamic or old_dynamic)
+    return frames
+
+
+def read_call_graph(objdump: str, elf: str):
+    """Returns the callees and the indirect call flag per function."""
+    text = subprocess.run(
+        [objdump, "-d", "-C", elf], capture_output=True, text=True, check=True
+    ).stdout
+    callees = {}
+    indirect = set()
+    current = None
+    for line in text.splitlines():
+        m = FUNC_HEADER_RE.match(line)
+        if m:
+            current = base_name(m.group(1))
+            callees.setdefault(current, set())
+            continue
+        if current is None:
+            continue
+        m = CALL_RE.search(line)
+        if m and not OFFSET_RE.search(m.group(2)):
+            callee = base_name(m.group(2))
+            # Branches within the function are not calls.
+            if callee != current:
+                callees[current].add(callee)
+        elif INDIRECT_CALL_RE.search(line):
+            indirect.add(current)
+    return callees, indirect
+
+
+def worst_case(func, frames, callees, indirect, memo, stack):
+    """Returns (bytes, is_lower_bound, call chain) of the deepest chain."""
+    if func in memo:
+        return memo[func]
+    if func in stack:
+        # Recursion. Not followed.
+        return (0, True, [])
+    frame, dynamic = frames.get(func, (0, False))
+    bound = dynamic or func in indirect or func not in frames
+    best = (0, False, [])
+    stack.add(func)
+    for callee in sorted(callees.get(func, ())):
+        result = worst_case(callee, frames, callees, indirect, memo, stack)
+        if result[0] > best[0]:
+            best = result
+        bound = bound or result[1]
+    stack.remove(func)
+    memo[func] = (frame + best[0], bound, [func] + best[2])
+    return memo[func]
+
+
+def read_task_sizes(project_dir: str) -> dict:
+    sizes = {}
+    for source in TASK_SOURCES:
+        with open(os.path.join(project_dir, source)) as f:
+            for size, name in TASK_DECL_RE.findall(f.read()):
+                sizes[name] = int(size)
+    return sizes
+
+
+def check(project_dir: str, build_dir: str, objdump: str, elf: str, verbose) -> bool:
+    """Prints the estimates. Returns false if a task is over its size."""
+    frames = read_stack_usage(build_dir)
+    callees, indirect = read_call_graph(objdump, elf)
+    sizes = read_task_sizes(project_dir)
+    memo = {}
+    ok = True
+    print("Task stacks, worst case estimates ('+' = lower bound):")
+    for task, entry in TASK_ENTRIES.items():
+        if task not in sizes:
+            print(f"  {task:12s}: no StaticTask declaration found")
+            continue
+        if entry not in callees:
+            print(f"  {task:12s}: entry {entry} not found")
+            continue
+        used, bound, chain = worst_case(entry, frames, callees, indirect, memo, set())
+        used += CONTEXT_BYTES
+        size = sizes[task]
+        status = "ok"
+        if used > size:
+            status = "OVER"
+            ok = False
+        mark = "+" if bound else " "
+        print(f"  {task:12s}: {used:5d}{mark} of {size:5d} bytes  {status}")
+        if verbose:
+            print("      " + " -> ".join(chain))
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--project_dir", default=".")
+    parser.add_argument("--build_dir", required=True)
+    parser.add_argument("--elf", help="Default: <build_dir>/firmware.elf")
+    parser.add_argument("--objdump", default="arm-none-eabi-objdump")
+    parser.add_argument(
+        "--verbose", action="store_true", help="Print the deepest call chains."
+    )
+    parser.add_argument(
+        "--strict", action="store_true", help="Fail if a task is over its size."
+    )
+    args = parser.parse_args()
+    elf = args.elf or os.path.join(args.build_dir, "firmware.elf")
+    ok = check(args.project_dir, args.build_dir, args.objdump, elf, args.verbose)
+    if not ok and args.strict:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,96 @@
+# Host side of fragmented transfers. See serial_packets_fragments.h
+# in the controller code for the protocol.
+
+import binascii
+import logging
+from typing import Optional, Callable
+
+from serial_packets.client import SerialPacketsClient
+from serial_packets.packets import PacketData
+
+logger = logging.getLogger("main")
+
+FORMAT_VERSION = 2
+
+
+class FragmentReceiver:
+    """Reassembles a single fragmented transfer from the device.
+
+    The caller should pass to on_fragment_message() the messages that arrive
+    at the data endpoint. Data is accumulated in memory or, if a sink is
+    provided, passed to it in order.
+    """
+
+    def __init__(
+        self,
+        client: SerialPacketsClient,
+        ack_endpoint: int,
+        transfer_id: int,
+        sink: Optional[Callable[[int, bytes], None]] = None,
+    ):
+        self.__client = client
+        self.__ack_endpoint = ack_endpoint
+        self.__transfer_id = transfer_id
+        self.__sink = sink
+        self.__data = bytearray()
+        self.__total_len: Optional[int] = None
+        self.__next_offset = 0
+
+    def transfer_id(self) -> int:
+        return self.__transfer_id
+
+    def total_len(self) -> Optional[int]:
+        return self.__total_len
+
+    def received_bytes(self) -> int:
+        return self.__next_offset
+
+    def is_done(self) -> bool:
+        return self.__total_len is not None and self.__next_offset >= self.__total_len
+
+    def data(self) -> bytearray:
+        """The received data, if no sink was provided."""
+        return self.__data
+
+    def on_fragment_message(self, data: PacketData) -> None:
+        data.reset_read_location()
+        version = data.read_uint8()
+        transfer_id = data.read_uint32()
+        total_len = data.read_uint32()
+        offset = data.read_uint32()
+        crc = data.read_uint16()
+        if data.read_error() or version != FORMAT_VERSION:
+            logger.error(f"Invalid fragment message (version {version})")
+            return
+        if transfer_id != self.__transfer_id:
+            logger.warning(f"Ignoring fragment of transfer {transfer_id:08x}")
+            return
+        if self.__total_len is None:
+            self.__total_len = total_len
+        fragment = data.read_bytes(data.bytes_left_to_read())
+        # Same CRC as the device's serial_packets_gen_crc16().
+        crc_ok = binascii.crc_hqx(fragment, 0xFFFF) == crc
+        if not crc_ok:
+            logger.warning(f"Bad fragment CRC at offset {offset}")
+        # Accept in order fragments only. Else, the ack tells the device
+        # where to resend from.
+        if (
+            crc_ok
+            and total_len == self.__total_len
+            and offset == self.__next_offset
+            and offset + len(fragment) <= total_len
+        ):
+            if self.__sink:
+                self.__sink(offset, fragment)
+            else:
+                self.__data.extend(fragment)
+            self.__next_offset += len(fragment)
+        self.__send_ack()
+
+    def __send_ack(self) -> None:
+        ack = PacketData()
+        ack.add_uint8(FORMAT_VERSION)
+        ack.add_uint32(self.__transfer_id)
+        ack.add_uint32(self.__next_offset)
+        ack.add_uint8(0)  # Status OK
+        self.__client.send_message(self.__ack_endpoint, ack)
@@ -173,6 +173,25 @@ class ParsedLogPacket:
         self.__channels[chan_id].append_values(values)
 
 
+@dataclass(frozen=True)
+class ChannelHeader:
+    """The header of the values of a channel in a log packet."""
+
+    # Time of the first value, relative to the packet start time.
+    first_value_rel_time_usecs: int
+    num_values: int
+    step_interval_usecs: int
+
+    def value_time_millis(self, packet_start_time_millis: int, i: int) -> int | float:
+        """Returns the time of the i'th value. An int if it's a whole millisecond."""
+        t_usecs = (
+            packet_start_time_millis * 1000
+            + self.first_value_rel_time_usecs
+            + i * self.step_interval_usecs
+        )
+        return t_usecs // 1000 if t_usecs % 1000 == 0 else t_usecs / 1000
+
+
 class LogPacketsParser:
     def __init__(self, sys_config: SysConfig):
         """Constructor."""
@@ -189,8 +208,24 @@ class LogPacketsParser:
         """Returns a list of ignored channel ids and their respective row counts."""
         return self.__ignored_channels
 
+    def _read_channel_header(
+        self, packet_version: int, packet_data: PacketData
+    ) -> ChannelHeader:
+        """Reads a channel header. Times are in millis in version 1 and in usecs in version 2."""
+        if packet_version == 1:
+            first_value_rel_time_usecs = packet_data.read_uint16() * 1000
+            num_values = packet_data.read_uint16()
+            step_interval_usecs = packet_data.read_uint16() * 1000
+        else:
+            first_value_rel_time_usecs = packet_data.read_uint32()
+            num_values = packet_data.read_uint16()
+            step_interval_usecs = packet_data.read_uint32()
+        assert not packet_data.read_error()
+        return ChannelHeader(first_value_rel_time_usecs, num_values, step_interval_usecs)
+
     def _parse_lc_ch_values(
         self,
+        packet_version: int,
         chan_id: str,
         packet_start_time_millis: int,
         packet_data: PacketData,
@@ -202,20 +237,17 @@ class LogPacketsParser:
             LoadCellChannelConfig
         ] = self.__sys_config.load_cell_config(chan_id)
         # Read header
-        first_value_rel_time: int = packet_data.read_uint16()
-        num_values = packet_data.read_uint16()
+        header = self._read_channel_header(packet_version, packet_data)
+        num_values = header.num_values
         assert num_values > 1, f"num_values: {num_values}"
-        step_interval_millis = packet_data.read_uint16()
-        assert not packet_data.read_error()
         # Read values
         values = []
-        item_time_millis: int = packet_start_time_millis + first_value_rel_time
         for i in range(num_values):
+            item_time_millis = header.value_time_millis(packet_start_time_millis, i)
             adc_reading: int = packet_data.read_int24()
             if lc_ch_config:
                 grams = lc_ch_config.adc_reading_to_grams(adc_reading)
                 values.append(LcChannelValue(item_time_millis, adc_reading, grams))
-            item_time_millis += step_interval_millis
         assert not packet_data.read_error()
         # If channel is not ignored, add its values.
         if values:
@@ -226,6 +258,7 @@ class LogPacketsParser:
 
     def _parse_pw_ch_values(
         self,
+        packet_version: int,
         chan_id: str,
         packet_start_time_millis: int,
         packet_data: PacketData,
@@ -237,15 +270,13 @@ class LogPacketsParser:
             chan_id
         )
         # Read header
-        first_value_rel_time: int = packet_data.read_uint16()
-        num_values = packet_data.read_uint16()
+        header = self._read_channel_header(packet_version, packet_data)
+        num_values = header.num_values
         assert num_values > 1, f"num_values: {num_values}"
-        step_interval_millis = packet_data.read_uint16()
-        assert not packet_data.read_error()
         # Read values
         values = []
-        item_time_millis: int = packet_start_time_millis + first_value_rel_time
         for i in range(num_values):
+            item_time_millis = header.value_time_millis(packet_start_time_millis, i)
             adc_voltage_reading: int = packet_data.read_int16()
             adc_current_reading: int = packet_data.read_int16()
             if pw_ch_config:
@@ -264,7 +295,6 @@ class LogPacketsParser:
                         value_amps,
                     )
                 )
-            item_time_millis += step_interval_millis
         assert not packet_data.read_error()
         # If channel is not ignored, add its values.
         if values:
@@ -275,6 +305,7 @@ class LogPacketsParser:
 
     def _parse_tm_ch_values(
         self,
+        packet_version: int,
         chan_id: str,
         packet_start_time_millis: int,
         packet_data: PacketData,
@@ -285,16 +316,15 @@ class LogPacketsParser:
         tm_ch_config: Optional[
             TemperatureChannelConfig
         ] = self.__sys_config.temperature_config(chan_id)
-        # Read header
-        first_value_rel_time: int = packet_data.read_uint16()
-        num_values = packet_data.read_uint16()
-        assert num_values > 1, f"num_values: {num_values}"
-        step_interval_millis = packet_data.read_uint16()
-        assert not packet_data.read_error()
+        # Read header. Temperatures that are sampled in bursts may have a
+        # single value.
+        header = self._read_channel_header(packet_version, packet_data)
+        num_values = header.num_values
+        assert num_values > 0, f"num_values: {num_values}"
         # Read values
         values = []
-        item_time_millis: int = packet_start_time_millis + first_value_rel_time
         for i in range(num_values):
+            item_time_millis = header.value_time_millis(packet_start_time_millis, i)
             adc_reading: int = packet_data.read_int24()
             if tm_ch_config:
                 r_ohms = tm_ch_config.adc_reading_to_ohms(adc_reading)
@@ -302,7 +332,6 @@ class LogPacketsParser:
                 values.append(
                     TmChannelValue(item_time_millis, adc_reading, r_ohms, t_celsius)
                 )
-            item_time_millis += step_interval_millis
         assert not packet_data.read_error()
         # If channel is not ignored, add its values.
         if tm_ch_config:
@@ -312,17 +341,24 @@ class LogPacketsParser:
 
     def _parse_external_reports_values(
         self,
+        packet_version: int,
         packet_start_time_millis: int,
         packet_data: PacketData,
         output: ParsedLogPacket,
     ) -> None:
         """Parse external reports."""
-        first_value_rel_time: int = packet_data.read_uint16()
+        # External reports have no step interval.
+        if packet_version == 1:
+            first_value_rel_time_usecs = packet_data.read_uint16() * 1000
+        else:
+            first_value_rel_time_usecs = packet_data.read_uint32()
         num_values = packet_data.read_uint16()
         # As of dec 2023, each external report is sent independently.
         assert num_values == 1, f"num_values: {num_values}"
         assert not packet_data.read_error()
-        item_time_millis: int = packet_start_time_millis + first_value_rel_time
+        item_time_millis = ChannelHeader(
+            first_value_rel_time_usecs, num_values, 0
+        ).value_time_millis(packet_start_time_millis, 0)
         report_str: str = packet_data.read_str()
 
         tokens = report_str.split(":")
@@ -352,8 +388,9 @@ class LogPacketsParser:
 
     def parse_next_packet(self, packet_data: PacketData) -> ParsedLogPacket:
         packet_data.reset_read_location()
+        # In version 2 the channel times are in usecs rather than millis.
         version = packet_data.read_uint8()
-        assert version == 1, f"Unexpected log packet version: {version}"
+        assert version in (1, 2), f"Unexpected log packet version: {version}"
         session_id = packet_data.read_uint32()
         packet_start_time_millis = packet_data.read_uint32()
         result: ParsedLogPacket = ParsedLogPacket(session_id, packet_start_time_millis)
@@ -367,28 +404,28 @@ class LogPacketsParser:
             # Parse a load cell channel.
             if chan_id.startswith("lc"):
                 self._parse_lc_ch_values(
-                    chan_id, packet_start_time_millis, packet_data, result
+                    version, chan_id, packet_start_time_millis, packet_data, result
                 )
                 continue
 
             # Parse a power channel
             if chan_id.startswith("pw"):
                 self._parse_pw_ch_values(
-                    chan_id, packet_start_time_millis, packet_data, result
+                    version, chan_id, packet_start_time_millis, packet_data, result
                 )
                 continue
 
             # Temperature channels.
             if chan_id.startswith("tm"):
                 self._parse_tm_ch_values(
-                    chan_id, packet_start_time_millis, packet_data, result
+                    version, chan_id, packet_start_time_millis, packet_data, result
                 )
                 continue
 
             # Markers.
             if chan_id == "ext":
                 self._parse_external_reports_values(
-                    packet_start_time_millis, packet_data, result
+                    version, packet_start_time_millis, packet_data, result
                 )
                 continue
 
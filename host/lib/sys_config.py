@@ -281,7 +281,7 @@ class SysConfig:
             # Load cell channel config
             if chan_id.startswith("lc"):
                 assert chan_id not in self.__lc_chan_configs, f"Duplicate channel [{chan_id}]"
-                assert re.fullmatch("lc[1-9]", chan_id), f"Invalid lc chan id: [{chan_id}]"
+                assert re.fullmatch("lc[1-9a-z]", chan_id), f"Invalid lc chan id: [{chan_id}]"
                 label = chan_config["label"]            
                 color = chan_config["color"]
                 offset = chan_config["adc_offset"]
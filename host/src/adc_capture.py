@@ -0,0 +1,129 @@
+#!python
+
+# A python program to trigger a dump of the pre trigger capture of the
+# ADS1261 adc card, or to set its level and slope triggers. The dumps are
+# sent at full resolution in the log stream of the card.
+#
+# Examples:
+#   python adc_capture.py --trigger
+#   python adc_capture.py --level_low -500000 --level_high 500000
+
+import argparse
+import asyncio
+import logging
+import signal
+import sys
+from serial_packets.client import SerialPacketsClient
+from serial_packets.packets import PacketStatus, PacketData
+
+# Local imports
+sys.path.insert(0, "..")
+from lib.sys_config import SysConfig
+
+logging.basicConfig(
+    level=logging.INFO,
+    format="%(relativeCreated)07d %(levelname)-7s %(filename)-10s: %(message)s",
+)
+logger = logging.getLogger("main")
+
+# Allows to stop the program by typing ctrl-c.
+signal.signal(signal.SIGINT, lambda number, frame: sys.exit())
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "--sys_config",
+    dest="sys_config",
+    default="sys_config.toml",
+    help="Path to system configuration file.",
+)
+parser.add_argument(
+    "--card",
+    dest="card",
+    type=int,
+    default=0,
+    help="Index of the adc card.",
+)
+parser.add_argument(
+    "--trigger",
+    dest="trigger",
+    action="store_true",
+    help="Trigger a dump now.",
+)
+parser.add_argument(
+    "--level_low",
+    dest="level_low",
+    type=int,
+    default=1,
+    help="A raw value below this triggers. Disabled if above level_high.",
+)
+parser.add_argument(
+    "--level_high",
+    dest="level_high",
+    type=int,
+    default=0,
+    help="A raw value above this triggers. Disabled if below level_low.",
+)
+parser.add_argument(
+    "--slope_delta",
+    dest="slope_delta",
+    type=int,
+    default=0,
+    help="A raw change of more than this triggers. Disabled if 0.",
+)
+parser.add_argument(
+    "--slope_span",
+    dest="slope_span",
+    type=int,
+    default=1,
+    help="The number of samples of the slope trigger.",
+)
+args = parser.parse_args()
+
+# Device endpoints.
+CONTROL_ENDPOINT = 0x01
+
+# Command codes.
+ADC_CAPTURE_TRIGGER = 0x09
+ADC_CAPTURE_TRIGGERS = 0x0A
+
+
+async def async_main():
+    sys_config = SysConfig()
+    sys_config.load_from_file(args.sys_config)
+    serial_port = sys_config.data_link_port()
+    serial_packets_client = SerialPacketsClient(
+        serial_port,
+        command_async_callback=None,
+        message_async_callback=None,
+        event_async_callback=None,
+        baudrate=115200,
+    )
+    connected = await serial_packets_client.connect()
+    assert connected, f"Could not open port {serial_port}"
+
+    cmd = PacketData()
+    if args.trigger:
+        cmd.add_uint8(ADC_CAPTURE_TRIGGER)
+        cmd.add_uint8(args.card)
+    else:
+        cmd.add_uint8(ADC_CAPTURE_TRIGGERS)
+        cmd.add_uint8(args.card)
+        # Signed values, as two's complement.
+        cmd.add_uint32(args.level_low & 0xFFFFFFFF)
+        cmd.add_uint32(args.level_high & 0xFFFFFFFF)
+        cmd.add_uint32(args.slope_delta & 0xFFFFFFFF)
+        cmd.add_uint16(args.slope_span)
+    status, _ = await serial_packets_client.send_command_future(
+        CONTROL_ENDPOINT, cmd
+    )
+    if status != PacketStatus.OK.value:
+        raise RuntimeError(f"Capture command failed with status {status}")
+    logger.info("Triggered" if args.trigger else "Triggers set")
+
+
+def main():
+    asyncio.run(async_main())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+#!python
+
+# A python program to change the data rate, filter, reference and gain
+# of the ADS1261 adc card at run time, without reflashing the device.
+#
+# Example:
+#   python adc_config.py --data_rate 12 --filter 0 --channel lc1:0a:06
+
+import argparse
+import asyncio
+import logging
+import signal
+import sys
+from typing import List, Tuple
+from serial_packets.client import SerialPacketsClient
+from serial_packets.packets import PacketStatus, PacketData
+
+# Local imports
+sys.path.insert(0, "..")
+from lib.sys_config import SysConfig
+
+logging.basicConfig(
+    level=logging.INFO,
+    format="%(relativeCreated)07d %(levelname)-7s %(filename)-10s: %(message)s",
+)
+logger = logging.getLogger("main")
+
+# Allows to stop the program by typing ctrl-c.
+signal.signal(signal.SIGINT, lambda number, frame: sys.exit())
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "--sys_config",
+    dest="sys_config",
+    default="sys_config.toml",
+    help="Path to system configuration file.",
+)
+parser.add_argument(
+    "--card",
+    dest="card",
+    type=int,
+    default=0,
+    help="Index of the adc card.",
+)
+parser.add_argument(
+    "--data_rate",
+    dest="data_rate",
+    type=int,
+    required=True,
+    help="ADS1261 data rate code, e.g. 13 for 14400 SPS.",
+)
+parser.add_argument(
+    "--filter",
+    dest="filter",
+    type=int,
+    default=4,
+    help="ADS1261 filter code, 0-3 for sinc1-sinc4, 4 for FIR.",
+)
+parser.add_argument(
+    "--channel",
+    dest="channels",
+    action="append",
+    default=[],
+    help="A channel setting chan_id:ref:pga with the register values in hex, "
+    "e.g. lc1:0a:07. Can be repeated.",
+)
+args = parser.parse_args()
+
+# Device endpoints.
+CONTROL_ENDPOINT = 0x01
+
+# Command codes.
+ADC_CONFIGURE = 0x08
+
+
+def parse_channels() -> List[Tuple[str, int, int]]:
+    result = []
+    for setting in args.channels:
+        chan_id, ref, pga = setting.split(":")
+        result.append((chan_id, int(ref, 16), int(pga, 16)))
+    return result
+
+
+async def async_main():
+    sys_config = SysConfig()
+    sys_config.load_from_file(args.sys_config)
+    serial_port = sys_config.data_link_port()
+    serial_packets_client = SerialPacketsClient(
+        serial_port,
+        command_async_callback=None,
+        message_async_callback=None,
+        event_async_callback=None,
+        baudrate=115200,
+    )
+    connected = await serial_packets_client.connect()
+    assert connected, f"Could not open port {serial_port}"
+
+    channels = parse_channels()
+    cmd = PacketData()
+    cmd.add_uint8(ADC_CONFIGURE)
+    cmd.add_uint8(args.card)
+    cmd.add_uint8(args.data_rate)
+    cmd.add_uint8(args.filter)
+    cmd.add_uint8(len(channels))
+    for chan_id, ref, pga in channels:
+        cmd.add_uint8(len(chan_id))
+        cmd.add_bytes(chan_id.encode())
+        cmd.add_uint8(ref)
+        cmd.add_uint8(pga)
+    status, response_data = await serial_packets_client.send_command_future(
+        CONTROL_ENDPOINT, cmd
+    )
+    if status != PacketStatus.OK.value:
+        raise RuntimeError(f"Configuration failed with status {status}")
+    gap_usecs = response_data.read_uint32()
+    logger.info(f"Configured, acquisition restarted after {gap_usecs} us")
+
+
+def main():
+    asyncio.run(async_main())
+
+
+if __name__ == "__main__":
+    main()
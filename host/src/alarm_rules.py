@@ -0,0 +1,132 @@
+#!python
+
+# A python program to set the on device alarm rules, or to clear the
+# alarm output. The alarms are reported in the log stream as 'ext'
+# reports "alarm<rule>:<chan id>:<value>:<latency usecs>".
+#
+# A rule is <chan id>:<type>:<limit>[:<span>[:<hold off ms>[:<actions>]]]
+# where type is above, below, rate or spread, the limit is in raw units
+# and actions is a combination of 'g' (output pin) and 'p' (printer).
+# The value index of the pw channels is selected with a suffix of the
+# chan id, e.g. pw1.1 for the current.
+#
+# Examples:
+#   python alarm_rules.py --rule lc1:above:500000 --rule tm1:rate:2000:8
+#   python alarm_rules.py --rule lc1:spread:1000:16:100:gp
+#   python alarm_rules.py --clear
+#   python alarm_rules.py   (no rules, disables the alarms)
+
+import argparse
+import asyncio
+import logging
+import signal
+import sys
+from serial_packets.client import SerialPacketsClient
+from serial_packets.packets import PacketStatus, PacketData
+
+# Local imports
+sys.path.insert(0, "..")
+from lib.sys_config import SysConfig
+
+logging.basicConfig(
+    level=logging.INFO,
+    format="%(relativeCreated)07d %(levelname)-7s %(filename)-10s: %(message)s",
+)
+logger = logging.getLogger("main")
+
+# Allows to stop the program by typing ctrl-c.
+signal.signal(signal.SIGINT, lambda number, frame: sys.exit())
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "--sys_config",
+    dest="sys_config",
+    default="sys_config.toml",
+    help="Path to system configuration file.",
+)
+parser.add_argument(
+    "--rule",
+    dest="rules",
+    action="append",
+    default=[],
+    help="An alarm rule. Can be repeated.",
+)
+parser.add_argument(
+    "--clear",
+    dest="clear",
+    action="store_true",
+    help="Clear the alarm output.",
+)
+args = parser.parse_args()
+
+# Device endpoints.
+CONTROL_ENDPOINT = 0x01
+
+# Command codes.
+SET_ALARM_RULES = 0x0B
+CLEAR_ALARMS = 0x0C
+
+RULE_TYPES = {"above": 1, "below": 2, "rate": 3, "spread": 4}
+ACTIONS = {"g": 1, "p": 2}
+
+
+def add_rule(cmd: PacketData, rule_str: str) -> None:
+    fields = rule_str.split(":")
+    if len(fields) < 3 or len(fields) > 6:
+        raise ValueError(f"Invalid rule: [{rule_str}]")
+    chan_id, _, value_index = fields[0].partition(".")
+    rule_type = RULE_TYPES[fields[1]]
+    limit = int(fields[2])
+    span = int(fields[3]) if len(fields) > 3 else 1
+    holdoff = int(fields[4]) if len(fields) > 4 else 0
+    actions = sum(ACTIONS[c] for c in fields[5]) if len(fields) > 5 else 1
+    cmd.add_uint8(len(chan_id))
+    cmd.add_bytes(chan_id.encode())
+    cmd.add_uint8(int(value_index or 0))
+    cmd.add_uint8(rule_type)
+    # Signed value, as two's complement.
+    cmd.add_uint32(limit & 0xFFFFFFFF)
+    cmd.add_uint16(span)
+    cmd.add_uint16(holdoff)
+    cmd.add_uint8(actions)
+
+
+async def async_main():
+    sys_config = SysConfig()
+    sys_config.load_from_file(args.sys_config)
+    serial_port = sys_config.data_link_port()
+    serial_packets_client = SerialPacketsClient(
+        serial_port,
+        command_async_callback=None,
+        message_async_callback=None,
+        event_async_callback=None,
+        baudrate=115200,
+    )
+    connected = await serial_packets_client.connect()
+    assert connected, f"Could not open port {serial_port}"
+
+    cmd = PacketData()
+    if args.clear:
+        cmd.add_uint8(CLEAR_ALARMS)
+    else:
+        cmd.add_uint8(SET_ALARM_RULES)
+        cmd.add_uint8(len(args.rules))
+        for rule_str in args.rules:
+            add_rule(cmd, rule_str)
+    status, response = await serial_packets_client.send_command_future(
+        CONTROL_ENDPOINT, cmd
+    )
+    if status != PacketStatus.OK.value:
+        raise RuntimeError(f"Alarms command failed with status {status}")
+    if args.clear:
+        logger.info(f"Alarm cleared, {response.read_uint32()} matches so far")
+    else:
+        logger.info(f"{len(args.rules)} alarm rules set")
+
+
+def main():
+    asyncio.run(async_main())
+
+
+if __name__ == "__main__":
+    main()
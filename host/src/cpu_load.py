@@ -0,0 +1,118 @@
+#!python
+
+# A python program that reports the CPU load of the device, per task and
+# per group of interrupts, for capacity planning. The loads are over the
+# last window of the device (5 secs) and over its long window (the last
+# 12 windows). The ISR time is also included in the load of the tasks
+# they interrupted.
+#
+# Examples:
+#   python cpu_load.py
+#   python cpu_load.py --period 5
+
+import argparse
+import asyncio
+import logging
+import signal
+import sys
+from serial_packets.client import SerialPacketsClient
+from serial_packets.packets import PacketStatus, PacketData
+
+# Local imports
+sys.path.insert(0, "..")
+from lib.sys_config import SysConfig
+
+logging.basicConfig(
+    level=logging.INFO,
+    format="%(relativeCreated)07d %(levelname)-7s %(filename)-10s: %(message)s",
+)
+logger = logging.getLogger("main")
+
+# Allows to stop the program by typing ctrl-c.
+signal.signal(signal.SIGINT, lambda number, frame: sys.exit())
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "--sys_config",
+    dest="sys_config",
+    default="sys_config.toml",
+    help="Path to system configuration file.",
+)
+parser.add_argument(
+    "--period",
+    dest="period",
+    type=float,
+    default=0,
+    help="If non zero, repeat every this many seconds.",
+)
+args = parser.parse_args()
+
+# Device endpoints.
+CONTROL_ENDPOINT = 0x01
+
+# Command codes.
+GET_CPU_LOAD = 0x0E
+
+
+def percent(permille: int) -> str:
+    return f"{permille / 10:5.1f}%"
+
+
+async def report_cpu_load(serial_packets_client: SerialPacketsClient):
+    cmd = PacketData()
+    cmd.add_uint8(GET_CPU_LOAD)
+    status, response = await serial_packets_client.send_command_future(
+        CONTROL_ENDPOINT, cmd
+    )
+    if status != PacketStatus.OK.value:
+        raise RuntimeError(f"CPU load command failed with status {status}")
+    window_usecs = response.read_uint32()
+    long_window_usecs = response.read_uint32()
+    cpu_load = response.read_uint16()
+    long_cpu_load = response.read_uint16()
+    logger.info(
+        f"CPU load: {percent(cpu_load)} over {window_usecs / 1e6:.1f}s, "
+        f"{percent(long_cpu_load)} over {long_window_usecs / 1e6:.1f}s"
+    )
+    num_tasks = response.read_uint8()
+    for _ in range(num_tasks):
+        name = response.read_str()
+        load = response.read_uint16()
+        long_load = response.read_uint16()
+        logger.info(f"  task {name:12s}: {percent(load)} {percent(long_load)}")
+    num_isr_groups = response.read_uint8()
+    for _ in range(num_isr_groups):
+        name = response.read_str()
+        load = response.read_uint16()
+        count = response.read_uint32()
+        rate = count * 1e6 / window_usecs if window_usecs else 0
+        logger.info(f"  isr  {name:12s}: {percent(load)} {rate:8.0f}/s")
+
+
+async def async_main():
+    sys_config = SysConfig()
+    sys_config.load_from_file(args.sys_config)
+    serial_port = sys_config.data_link_port()
+    serial_packets_client = SerialPacketsClient(
+        serial_port,
+        command_async_callback=None,
+        message_async_callback=None,
+        event_async_callback=None,
+        baudrate=115200,
+    )
+    connected = await serial_packets_client.connect()
+    assert connected, f"Could not open port {serial_port}"
+
+    while True:
+        await report_cpu_load(serial_packets_client)
+        if not args.period:
+            break
+        await asyncio.sleep(args.period)
+
+
+def main():
+    asyncio.run(async_main())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,241 @@
+#!python
+
+# A python program to list and download recordings from the device's
+# SD card over the data link.
+
+import argparse
+import asyncio
+import binascii
+import logging
+import os
+import random
+import signal
+import sys
+import time
+from typing import Optional, List, Tuple
+from serial_packets.client import SerialPacketsClient
+from serial_packets.packets import PacketStatus, PacketData
+
+# Local imports
+sys.path.insert(0, "..")
+from lib.fragments import FragmentReceiver
+from lib.sys_config import SysConfig
+
+logging.basicConfig(
+    level=logging.INFO,
+    format="%(relativeCreated)07d %(levelname)-7s %(filename)-10s: %(message)s",
+)
+logger = logging.getLogger("main")
+
+# Allows to stop the program by typing ctrl-c.
+signal.signal(signal.SIGINT, lambda number, frame: sys.exit())
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "--sys_config",
+    dest="sys_config",
+    default="sys_config.toml",
+    help="Path to system configuration file.",
+)
+parser.add_argument(
+    "--list",
+    dest="list",
+    default=False,
+    action=argparse.BooleanOptionalAction,
+    help="If on, list the recordings on the device.",
+)
+parser.add_argument(
+    "--recording",
+    dest="recording",
+    default=None,
+    help="Name of a recording to download, without the .log suffix.",
+)
+parser.add_argument(
+    "--output_dir",
+    dest="output_dir",
+    default=".",
+    help="Output directory for downloaded files.",
+)
+parser.add_argument(
+    "--resume",
+    dest="resume",
+    default=True,
+    action=argparse.BooleanOptionalAction,
+    help="If on, resume a partially downloaded file.",
+)
+args = parser.parse_args()
+
+# Device endpoints.
+CONTROL_ENDPOINT = 0x01
+FRAGMENT_ACK_ENDPOINT = 0x02
+
+# Host endpoints.
+FRAGMENT_DATA_ENDPOINT = 11
+
+# Command codes.
+LIST_RECORDINGS = 0x05
+DOWNLOAD_RECORDING = 0x06
+RECORDING_CRC = 0x07
+
+# Max time without download progress.
+DOWNLOAD_IDLE_TIMEOUT_SECS = 10
+
+serial_packets_client: Optional[SerialPacketsClient] = None
+fragment_receiver: Optional[FragmentReceiver] = None
+
+
+def crc16(data: bytes, crc: int = 0xFFFF) -> int:
+    """Same CRC as the device's serial_packets_gen_crc16()."""
+    return binascii.crc_hqx(data, crc)
+
+
+async def message_async_callback(endpoint: int, data: PacketData) -> None:
+    if endpoint == FRAGMENT_DATA_ENDPOINT and fragment_receiver:
+        fragment_receiver.on_fragment_message(data)
+
+
+async def send_command(cmd: PacketData) -> Tuple[int, PacketData]:
+    status, response_data = await serial_packets_client.send_command_future(
+        CONTROL_ENDPOINT, cmd
+    )
+    return status, response_data
+
+
+async def list_recordings() -> List[Tuple[str, int]]:
+    """Returns a list of (name, size) of the recordings on the device."""
+    result = []
+    while True:
+        cmd = PacketData()
+        cmd.add_uint8(LIST_RECORDINGS)
+        cmd.add_uint16(len(result))  # Start index
+        status, response_data = await send_command(cmd)
+        if status != PacketStatus.OK.value:
+            raise RuntimeError(f"LIST command failed with status {status}")
+        has_more = response_data.read_uint8()
+        n = response_data.read_uint8()
+        for i in range(n):
+            name = response_data.read_str()
+            size = response_data.read_uint32()
+            result.append((name, size))
+        assert response_data.all_read_ok()
+        if not has_more:
+            return result
+
+
+async def recording_crc(name: str, offset: int, length: int) -> int:
+    cmd = PacketData()
+    cmd.add_uint8(RECORDING_CRC)
+    cmd.add_uint8(len(name))
+    cmd.add_bytes(name.encode())
+    cmd.add_uint32(offset)
+    cmd.add_uint32(length)
+    status, response_data = await send_command(cmd)
+    if status != PacketStatus.OK.value:
+        raise RuntimeError(f"CRC command failed with status {status}")
+    return response_data.read_uint16()
+
+
+async def download_recording(name: str, output_path: str) -> None:
+    global fragment_receiver
+
+    # Determine where to start from.
+    start_offset = 0
+    if args.resume and os.path.exists(output_path):
+        local_size = os.path.getsize(output_path)
+        with open(output_path, "rb") as f:
+            local_crc = crc16(f.read())
+        device_crc = await recording_crc(name, 0, local_size)
+        if local_crc == device_crc:
+            start_offset = local_size
+            logger.info(f"Resuming download from offset {start_offset}")
+        else:
+            logger.warning("Local file doesn't match, downloading from start.")
+
+    output_file = open(output_path, "r+b" if start_offset else "wb")
+    output_file.seek(start_offset)
+
+    def sink(offset: int, data: bytes) -> None:
+        output_file.write(data)
+
+    transfer_id = random.randint(1, 0xFFFFFFFF)
+    fragment_receiver = FragmentReceiver(
+        serial_packets_client, FRAGMENT_ACK_ENDPOINT, transfer_id, sink
+    )
+
+    cmd = PacketData()
+    cmd.add_uint8(DOWNLOAD_RECORDING)
+    cmd.add_uint8(len(name))
+    cmd.add_bytes(name.encode())
+    cmd.add_uint32(start_offset)
+    cmd.add_uint32(transfer_id)
+    status, response_data = await send_command(cmd)
+    if status != PacketStatus.OK.value:
+        output_file.close()
+        raise RuntimeError(f"DOWNLOAD command failed with status {status}")
+    file_size = response_data.read_uint32()
+    logger.info(f"Downloading {file_size - start_offset} bytes")
+
+    # Wait for the transfer to complete.
+    start_time = time.time()
+    last_progress_time = start_time
+    last_received_bytes = 0
+    while not fragment_receiver.is_done() and file_size > start_offset:
+        await asyncio.sleep(0.1)
+        received_bytes = fragment_receiver.received_bytes()
+        if received_bytes != last_received_bytes:
+            last_received_bytes = received_bytes
+            last_progress_time = time.time()
+        elif time.time() - last_progress_time > DOWNLOAD_IDLE_TIMEOUT_SECS:
+            output_file.close()
+            raise RuntimeError(
+                f"Download stalled at offset {start_offset + received_bytes}"
+            )
+    output_file.close()
+    fragment_receiver = None
+    elapsed_secs = time.time() - start_time
+    logger.info(
+        f"Received {file_size - start_offset} bytes in {elapsed_secs:.1f} secs"
+    )
+
+    # Verify the entire file.
+    with open(output_path, "rb") as f:
+        local_crc = crc16(f.read())
+    device_crc = await recording_crc(name, 0, file_size)
+    if local_crc != device_crc:
+        raise RuntimeError(
+            f"CRC mismatch, local {local_crc:04x}, device {device_crc:04x}"
+        )
+    logger.info(f"Downloaded {output_path}, CRC {local_crc:04x} OK")
+
+
+async def async_main():
+    global serial_packets_client
+
+    sys_config = SysConfig()
+    sys_config.load_from_file(args.sys_config)
+    serial_port = sys_config.data_link_port()
+    serial_packets_client = SerialPacketsClient(
+        serial_port,
+        command_async_callback=None,
+        message_async_callback=message_async_callback,
+        event_async_callback=None,
+        baudrate=115200,
+    )
+    connected = await serial_packets_client.connect()
+    assert connected, f"Could not open port {serial_port}"
+
+    if args.list:
+        for name, size in await list_recordings():
+            logger.info(f"{name:30} {size:10d}")
+
+    if args.recording:
+        output_path = os.path.join(args.output_dir, args.recording + ".log")
+        await download_recording(args.recording, output_path)
+
+
+def main():
+    asyncio.run(async_main())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,280 @@
+#!python
+
+# A python program that reads the event trace of the device and converts
+# it to a Chrome trace JSON file, for viewing the timeline of the tasks,
+# interrupts, data buffers and SD writes in https://ui.perfetto.dev or
+# chrome://tracing. The device records the trace all the time, keeping
+# its last events, so run this right after the event of interest.
+#
+# Examples:
+#   python event_trace.py
+#   python event_trace.py --output spike.json --no_restart
+
+import argparse
+import asyncio
+import json
+import logging
+import signal
+import sys
+from serial_packets.client import SerialPacketsClient
+from serial_packets.packets import PacketStatus, PacketData
+
+# Local imports
+sys.path.insert(0, "..")
+from lib.sys_config import SysConfig
+
+logging.basicConfig(
+    level=logging.INFO,
+    format="%(relativeCreated)07d %(levelname)-7s %(filename)-10s: %(message)s",
+)
+logger = logging.getLogger("main")
+
+# Allows to stop the program by typing ctrl-c.
+signal.signal(signal.SIGINT, lambda number, frame: sys.exit())
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "--sys_config",
+    dest="sys_config",
+    default="sys_config.toml",
+    help="Path to system configuration file.",
+)
+parser.add_argument(
+    "--output",
+    dest="output",
+    default="trace.json",
+    help="Path of the output Chrome trace file.",
+)
+parser.add_argument(
+    "--no_restart",
+    dest="no_restart",
+    action="store_true",
+    help="Leave the trace stopped after reading it.",
+)
+args = parser.parse_args()
+
+# Device endpoints.
+CONTROL_ENDPOINT = 0x01
+
+# Command codes.
+STOP_TRACE = 0x0F
+READ_TRACE = 0x10
+START_TRACE = 0x11
+
+# Event types, per EventTraceType in event_trace_hooks.h.
+TASK_IN = 1
+ISR_ENTER = 2
+ISR_EXIT = 3
+BUFFER_GRAB = 4
+BUFFER_QUEUE = 5
+BUFFER_SEND_START = 6
+BUFFER_SEND_END = 7
+SD_WRITE_START = 8
+SD_WRITE_END = 9
+
+# Per CpuLoadIsrGroup in cpu_load_isr.h.
+ISR_GROUPS = ["spi1", "i2c1", "uart", "sdmmc"]
+
+# Trace process ids.
+TASKS_PID = 1
+ISRS_PID = 2
+DATA_PID = 3
+
+# Thread ids within DATA_PID.
+SEND_TID = 1
+SD_TID = 2
+
+
+async def send_command(client: SerialPacketsClient, cmd: PacketData):
+    status, response = await client.send_command_future(CONTROL_ENDPOINT, cmd)
+    if status != PacketStatus.OK.value:
+        raise RuntimeError(f"Trace command failed with status {status}")
+    return response
+
+
+async def read_trace(client: SerialPacketsClient):
+    """Returns (cycles per usec, task names by number, events)."""
+    cmd = PacketData()
+    cmd.add_uint8(STOP_TRACE)
+    response = await send_command(client, cmd)
+    cycles_per_usec = response.read_uint32()
+    num_events = response.read_uint16()
+    task_names = {}
+    for _ in range(response.read_uint8()):
+        number = response.read_uint8()
+        task_names[number] = response.read_str()
+    logger.info(f"Reading {num_events} events...")
+
+    events = []
+    has_more = True
+    while has_more:
+        cmd = PacketData()
+        cmd.add_uint8(READ_TRACE)
+        cmd.add_uint16(len(events))
+        response = await send_command(client, cmd)
+        has_more = response.read_uint8()
+        for _ in range(response.read_uint8()):
+            cycles = response.read_uint32()
+            event_type = response.read_uint8()
+            event_id = response.read_uint8()
+            arg = response.read_uint16()
+            events.append((cycles, event_type, event_id, arg))
+    return cycles_per_usec, task_names, events
+
+
+def unwrap(events):
+    """Converts the 32 bit cycle counts to a monotonic count, assuming that
+    consecutive events are less than 2^31 cycles apart (4.4 secs at 480Mhz).
+    The deltas are signed since the ISR enter events are added late."""
+    result = []
+    last = None
+    total = 0
+    for cycles, event_type, event_id, arg in events:
+        if last is not None:
+            delta = (cycles - last) & 0xFFFFFFFF
+            if delta >= 0x80000000:
+                delta -= 0x100000000
+            total += delta
+        last = cycles
+        result.append((total, event_type, event_id, arg))
+    # Stable, so equal times keep their order.
+    result.sort(key=lambda e: e[0])
+    return result
+
+
+def to_chrome_trace(cycles_per_usec, task_names, events):
+    trace = []
+
+    def meta(pid, tid, kind, name):
+        trace.append(
+            {"ph": "M", "pid": pid, "tid": tid, "name": kind, "args": {"name": name}}
+        )
+
+    def add_slice(pid, tid, name, start, end, event_args=None):
+        event = {
+            "ph": "X",
+            "pid": pid,
+            "tid": tid,
+            "name": name,
+            "ts": start,
+            "dur": end - start,
+        }
+        if event_args:
+            event["args"] = event_args
+        trace.append(event)
+
+    # The lifetime of a data buffer, from grab to send end.
+    def add_buffer_event(ph, buffer_index, name, ts):
+        trace.append(
+            {
+                "ph": ph,
+                "cat": "buffer",
+                "id": buffer_index,
+                "pid": DATA_PID,
+                "tid": 0,
+                "name": name,
+                "ts": ts,
+            }
+        )
+
+    meta(TASKS_PID, 0, "process_name", "Tasks")
+    meta(ISRS_PID, 0, "process_name", "ISRs")
+    meta(DATA_PID, 0, "process_name", "Data")
+    meta(DATA_PID, SEND_TID, "thread_name", "Buffer sends")
+    meta(DATA_PID, SD_TID, "thread_name", "SD writes")
+    for number, name in task_names.items():
+        meta(TASKS_PID, number, "thread_name", name)
+    for group, name in enumerate(ISR_GROUPS):
+        meta(ISRS_PID, group, "thread_name", name)
+
+    if not events:
+        return {"traceEvents": trace}
+    t0 = events[0][0]
+    running_task = None
+    isr_starts = {}
+    send_starts = {}
+    sd_start = None
+    for cycles, event_type, event_id, arg in events:
+        ts = (cycles - t0) / cycles_per_usec
+        if event_type == TASK_IN:
+            if running_task is not None:
+                number, start = running_task
+                name = task_names.get(number, f"task {number}")
+                add_slice(TASKS_PID, number, name, start, ts)
+            running_task = (event_id, ts)
+        elif event_type == ISR_ENTER:
+            isr_starts[event_id] = ts
+        elif event_type == ISR_EXIT:
+            start = isr_starts.pop(event_id, None)
+            if start is not None:
+                name = (
+                    ISR_GROUPS[event_id]
+                    if event_id < len(ISR_GROUPS)
+                    else f"isr {event_id}"
+                )
+                add_slice(ISRS_PID, event_id, name, start, ts)
+        elif event_type == BUFFER_GRAB:
+            add_buffer_event("b", event_id, f"buffer {event_id}", ts)
+        elif event_type == BUFFER_QUEUE:
+            add_buffer_event("n", event_id, "queued", ts)
+        elif event_type == BUFFER_SEND_START:
+            send_starts[event_id] = ts
+        elif event_type == BUFFER_SEND_END:
+            start = send_starts.pop(event_id, None)
+            if start is not None:
+                add_slice(DATA_PID, SEND_TID, "send", start, ts, {"buffer": event_id})
+            add_buffer_event("e", event_id, f"buffer {event_id}", ts)
+        elif event_type == SD_WRITE_START:
+            sd_start = (ts, arg)
+        elif event_type == SD_WRITE_END:
+            if sd_start is not None:
+                start, num_bytes = sd_start
+                add_slice(
+                    DATA_PID,
+                    SD_TID,
+                    "write",
+                    start,
+                    ts,
+                    {"bytes": num_bytes, "status": arg},
+                )
+            sd_start = None
+        else:
+            logger.warning(f"Unknown event type {event_type}")
+    return {"traceEvents": trace, "displayTimeUnit": "ns"}
+
+
+async def async_main():
+    sys_config = SysConfig()
+    sys_config.load_from_file(args.sys_config)
+    serial_port = sys_config.data_link_port()
+    serial_packets_client = SerialPacketsClient(
+        serial_port,
+        command_async_callback=None,
+        message_async_callback=None,
+        event_async_callback=None,
+        baudrate=115200,
+    )
+    connected = await serial_packets_client.connect()
+    assert connected, f"Could not open port {serial_port}"
+
+    cycles_per_usec, task_names, events = await read_trace(serial_packets_client)
+    if not args.no_restart:
+        cmd = PacketData()
+        cmd.add_uint8(START_TRACE)
+        await send_command(serial_packets_client, cmd)
+
+    events = unwrap(events)
+    if events:
+        span_usecs = (events[-1][0] - events[0][0]) / cycles_per_usec
+        logger.info(f"{len(events)} events over {span_usecs / 1000:.1f} ms")
+    with open(args.output, "w") as f:
+        json.dump(to_chrome_trace(cycles_per_usec, task_names, events), f)
+    logger.info(f"Wrote {args.output}")
+
+
+def main():
+    asyncio.run(async_main())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,98 @@
+#!python
+
+# A python program that reports the stack usage of the device's tasks,
+# from the high water marks of their stacks. Tasks with a low margin
+# should get a larger stack in app_main.cpp, and tasks with a large
+# margin can give RAM back to the data buffers.
+#
+# Example:
+#   python task_stacks.py
+
+import argparse
+import asyncio
+import logging
+import signal
+import sys
+from serial_packets.client import SerialPacketsClient
+from serial_packets.packets import PacketStatus, PacketData
+
+# Local imports
+sys.path.insert(0, "..")
+from lib.sys_config import SysConfig
+
+logging.basicConfig(
+    level=logging.INFO,
+    format="%(relativeCreated)07d %(levelname)-7s %(filename)-10s: %(message)s",
+)
+logger = logging.getLogger("main")
+
+# Allows to stop the program by typing ctrl-c.
+signal.signal(signal.SIGINT, lambda number, frame: sys.exit())
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "--sys_config",
+    dest="sys_config",
+    default="sys_config.toml",
+    help="Path to system configuration file.",
+)
+parser.add_argument(
+    "--min_margin",
+    dest="min_margin",
+    type=int,
+    default=200,
+    help="Unused stack bytes below which a task is flagged.",
+)
+args = parser.parse_args()
+
+# Device endpoints.
+CONTROL_ENDPOINT = 0x01
+
+# Command codes.
+GET_TASK_STACKS = 0x0D
+
+
+async def async_main():
+    sys_config = SysConfig()
+    sys_config.load_from_file(args.sys_config)
+    serial_port = sys_config.data_link_port()
+    serial_packets_client = SerialPacketsClient(
+        serial_port,
+        command_async_callback=None,
+        message_async_callback=None,
+        event_async_callback=None,
+        baudrate=115200,
+    )
+    connected = await serial_packets_client.connect()
+    assert connected, f"Could not open port {serial_port}"
+
+    cmd = PacketData()
+    cmd.add_uint8(GET_TASK_STACKS)
+    status, response = await serial_packets_client.send_command_future(
+        CONTROL_ENDPOINT, cmd
+    )
+    if status != PacketStatus.OK.value:
+        raise RuntimeError(f"Task stacks command failed with status {status}")
+    num_tasks = response.read_uint8()
+    total_size = 0
+    for _ in range(num_tasks):
+        name = response.read_str()
+        size = response.read_uint16()
+        unused = response.read_uint16()
+        total_size += size
+        if not unused:
+            logger.info(f"{name:12s}: {size:5d} bytes, not started")
+            continue
+        flag = "  LOW MARGIN" if unused < args.min_margin else ""
+        logger.info(
+            f"{name:12s}: {size - unused:5d} of {size:5d} bytes used{flag}"
+        )
+    logger.info(f"Total stacks: {total_size} bytes")
+
+
+def main():
+    asyncio.run(async_main())
+
+
+if __name__ == "__main__":
+    main()